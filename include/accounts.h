@@ -0,0 +1,113 @@
+/**
+ * @file accounts.h
+ * ---------------------
+ * @brief Local account table: balances held on the Pi, keyed by card UID (4, 7 or 10
+ * bytes), for closed-loop venues where the Pi rather than the card is authoritative. The
+ * table is a fixed array of slots in static memory, searched by open addressing with
+ * linear probing; it is never allowed to fill beyond half its slots, so a lookup takes a
+ * couple of probes and never allocates.
+ */
+
+#ifndef _ACCOUNTS_H
+#define _ACCOUNTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Slots in the table, a power of two.
+#define ACCOUNTS_SLOTS (65536)
+// Accounts the table takes: half the slots.
+#define ACCOUNTS_MAX (ACCOUNTS_SLOTS / 2)
+#define ACCOUNTS_UID_MAX_LENGTH (10)
+
+/**
+ * An account. A slot with uid_length 0 is empty. balance may be changed through the
+ * pointer accounts_find returns; the UID must not.
+ */
+typedef struct
+{
+    int32_t balance;
+    uint8_t uid_length;
+    uint8_t uid[ACCOUNTS_UID_MAX_LENGTH];
+} account_t;
+
+typedef struct
+{
+    unsigned int lookups;
+    unsigned int probes;
+    // Furthest any account sits from its home slot; no lookup probes further.
+    unsigned int max_displacement;
+} accounts_stats_t;
+
+/**
+ * @fn accounts_find
+ * ---------------------
+ * @returns the account of uid, or NULL if it has none.
+ */
+account_t *accounts_find(const uint8_t *uid, size_t uid_length);
+
+/**
+ * @fn accounts_add
+ * ---------------------
+ * @description: Opens an account for uid with the given balance.
+ * @returns the new account, or NULL if uid already has one, is not 4, 7 or 10 bytes, or
+ * the table holds ACCOUNTS_MAX accounts.
+ */
+account_t *accounts_add(const uint8_t *uid, size_t uid_length, int32_t balance);
+
+/**
+ * @fn accounts_update
+ * ---------------------
+ * @description: Adds delta to the balance of uid's account.
+ * @param balance: if not NULL, receives the new balance.
+ * @returns false if uid has no account.
+ */
+bool accounts_update(const uint8_t *uid, size_t uid_length, int32_t delta, int32_t *balance);
+
+/**
+ * @fn accounts_set
+ * ---------------------
+ * @description: Sets the balance of uid's account.
+ * @param old_balance: if not NULL, receives the balance it replaced.
+ * @returns false if uid has no account.
+ */
+bool accounts_set(const uint8_t *uid, size_t uid_length, int32_t balance, int32_t *old_balance);
+
+/**
+ * @fn accounts_next
+ * ---------------------
+ * @description: Iterates over the accounts in slot order. Start with *position 0.
+ * @returns the next account, or NULL once all have been seen.
+ */
+const account_t *accounts_next(size_t *position);
+
+/**
+ * @fn accounts_count
+ * ---------------------
+ * @returns number of accounts in the table.
+ */
+size_t accounts_count(void);
+
+/**
+ * @fn accounts_get_stats
+ * ---------------------
+ * @returns lookup counts since the last accounts_clear.
+ */
+const accounts_stats_t *accounts_get_stats(void);
+
+/**
+ * @fn accounts_print_stats
+ * ---------------------
+ * @description: Prints the number of accounts, the load and the probes per lookup.
+ */
+void accounts_print_stats(void);
+
+/**
+ * @fn accounts_clear
+ * ---------------------
+ * @description: Removes every account and clears the statistics.
+ */
+void accounts_clear(void);
+
+#endif // _ACCOUNTS_H
@@ -0,0 +1,98 @@
+/**
+ * @file console.h
+ * ---------------------
+ * @brief Buffered console output. Text and bytes go into a TX ring buffer that the mini
+ * UART interrupt drains, so printing returns as soon as the output is queued instead of
+ * waiting on the serial line. Also formats hex tables a line at a time, and parses hex.
+ */
+
+#ifndef _CONSOLE_H
+#define _CONSOLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes the ring buffer holds: more than a whole 1K card printed as a table.
+#define CONSOLE_TX_BUFFER_SIZE (4096)
+// Longest console_printf output; the rest is cut off.
+#define CONSOLE_FORMAT_MAX (256)
+// Time a byte takes on the line at 115200 baud, 8N1.
+#define CONSOLE_BYTE_US (87)
+
+/**
+ * @fn console_init
+ * ---------------------
+ * @description: Starts draining the ring buffer from the mini UART interrupt. Until then
+ * output is written out directly. Call after interrupts are globally enabled.
+ */
+void console_init(void);
+
+/**
+ * @fn console_printf
+ * ---------------------
+ * @description: Queues formatted text, sending "\n" as "\r\n" like uart_putchar. Waits
+ * only if the ring buffer is full. Fits formatted_fn_t, so it can back the shell.
+ * @returns number of characters formatted.
+ */
+int console_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * @fn console_write
+ * ---------------------
+ * @description: Queues raw bytes, sent as they are.
+ */
+void console_write(const uint8_t *bytes, size_t length);
+
+/**
+ * @fn console_print_table
+ * ---------------------
+ * @description: Queues bytes as a table of 16-byte rows under a header of column
+ * numbers, one line at a time. Rows are labelled first_label, first_label + label_step
+ * and so on.
+ */
+void console_print_table(const uint8_t *bytes, size_t length, size_t first_label, size_t label_step);
+
+/**
+ * @fn console_pending
+ * ---------------------
+ * @returns number of bytes queued but not yet handed to the UART.
+ */
+size_t console_pending(void);
+
+/**
+ * @fn console_flush
+ * ---------------------
+ * @description: Waits until everything queued has been handed to the UART.
+ */
+void console_flush(void);
+
+/**
+ * @fn format_hex_bytes
+ * ---------------------
+ * @description: Writes each byte as two hex digits and a space, then a terminating NUL,
+ * to out, which holds 3 * count + 1 characters.
+ * @returns number of characters written before the NUL.
+ */
+size_t format_hex_bytes(char *out, const uint8_t *bytes, size_t count);
+
+/**
+ * @fn parse_hex_bytes
+ * ---------------------
+ * @description: Parses bytes written as hex digits, two to a byte, e.g. "de ad be ef" or
+ * "04:a2:2b"; spaces and colons between digits are skipped.
+ * @returns number of bytes written to bytes, or -1 if text holds anything else, an odd
+ * number of digits or more than max_length bytes.
+ */
+int parse_hex_bytes(const char *text, uint8_t *bytes, size_t max_length);
+
+/**
+ * @fn format_decimal
+ * ---------------------
+ * @description: Writes value in decimal, padded on the left with pad to at least width
+ * characters, then a terminating NUL, to out.
+ * @returns number of characters written before the NUL.
+ */
+size_t format_decimal(char *out, unsigned int value, size_t width, char pad);
+
+#endif // _CONSOLE_H
@@ -0,0 +1,94 @@
+/**
+ * @file denylist.h
+ * ---------------------
+ * @brief Deny list of revoked card UIDs, checked as soon as a card is detected so that a
+ * lost card can no longer be used. A Bloom filter answers "not revoked" for almost every
+ * card after a few bit tests; a UID it lets through is confirmed in an exact set, an
+ * open-addressing table of the revoked UIDs, so a false positive never refuses a card.
+ * Both live in static memory.
+ */
+
+#ifndef _DENYLIST_H
+#define _DENYLIST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// UIDs the list takes, and slots in the exact set: twice as many, a power of two.
+#define DENYLIST_MAX (131072)
+#define DENYLIST_SLOTS (2 * DENYLIST_MAX)
+// Bloom filter bits, a power of two, and bits set per UID: about 1% false positives
+// with 100k UIDs.
+#define DENYLIST_BLOOM_BITS (1 << 20)
+#define DENYLIST_BLOOM_HASHES (7)
+#define DENYLIST_UID_MAX_LENGTH (10)
+
+typedef struct
+{
+    unsigned int checks;
+    // Checks the Bloom filter passed on to the exact set, and those it confirmed.
+    unsigned int filter_passes;
+    unsigned int hits;
+} denylist_stats_t;
+
+/**
+ * @fn denylist_add
+ * ---------------------
+ * @description: Revokes uid. Adding a UID twice is harmless.
+ * @returns false if uid is not 4, 7 or 10 bytes or the list holds DENYLIST_MAX UIDs.
+ */
+bool denylist_add(const uint8_t *uid, size_t uid_length);
+
+/**
+ * @fn denylist_contains
+ * ---------------------
+ * @returns true if uid is revoked.
+ */
+bool denylist_contains(const uint8_t *uid, size_t uid_length);
+
+/**
+ * @fn denylist_parse_uid
+ * ---------------------
+ * @description: Parses a UID written in hex, e.g. "de ad be ef" or "04:a2:2b:6a:3c:5d:80";
+ * spaces and colons between digits are skipped.
+ * @returns false if text is not a 4, 7 or 10-byte UID.
+ */
+bool denylist_parse_uid(const char *text, uint8_t *uid, size_t *uid_length);
+
+/**
+ * @fn denylist_count
+ * ---------------------
+ * @returns number of revoked UIDs.
+ */
+size_t denylist_count(void);
+
+/**
+ * @fn denylist_get_stats
+ * ---------------------
+ * @returns check counts since the last denylist_clear or denylist_reset_stats.
+ */
+const denylist_stats_t *denylist_get_stats(void);
+
+/**
+ * @fn denylist_reset_stats
+ * ---------------------
+ * @description: Zeroes the check counts.
+ */
+void denylist_reset_stats(void);
+
+/**
+ * @fn denylist_print_stats
+ * ---------------------
+ * @description: Prints the number of revoked UIDs and how checks were answered.
+ */
+void denylist_print_stats(void);
+
+/**
+ * @fn denylist_clear
+ * ---------------------
+ * @description: Removes every UID and zeroes the check counts.
+ */
+void denylist_clear(void);
+
+#endif // _DENYLIST_H
@@ -0,0 +1,147 @@
+/**
+ * @file journal.h
+ * ---------------------
+ * @brief Append-only journal of balance updates. Each `pay` or `charge` appends a
+ * fixed-size entry to a ring in RAM, which costs a copy and nothing else; entries are
+ * later committed in groups to a block device, a pluggable backend that the journal
+ * fills as a circular log of records:
+ *
+ *   sequence, ticks, old balance, new balance, amount (4 bytes each, LSB first),
+ *   status, UID length, UID (10 bytes), zero padding, CRC (2 bytes, MSB first)
+ *
+ * The CRC is CRC-16/CCITT-FALSE over everything before it. A record never spans two
+ * device blocks; the rest of a block after its last record is zero.
+ */
+
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Entries the RAM ring holds.
+#define JOURNAL_CAPACITY (256)
+#define JOURNAL_UID_MAX_LENGTH (10)
+#define JOURNAL_RECORD_LENGTH (40)
+// Largest device block the journal can stage.
+#define JOURNAL_BLOCK_MAX (512)
+// Balance of an entry when it was not read from the card.
+#define JOURNAL_BALANCE_UNKNOWN INT32_MIN
+
+typedef struct
+{
+    uint32_t sequence;
+    uint32_t ticks;
+    int32_t old_balance;
+    int32_t new_balance;
+    int32_t amount;
+    uint8_t status;
+    uint8_t uid_length;
+    uint8_t uid[JOURNAL_UID_MAX_LENGTH];
+} journal_entry_t;
+
+/**
+ * Block device the journal commits to: block_count blocks of block_size bytes, at most
+ * JOURNAL_BLOCK_MAX. read and write move one whole block and return 0 on success;
+ * context is passed to both.
+ */
+typedef struct
+{
+    size_t block_size;
+    size_t block_count;
+    int (*read)(void *context, size_t block, uint8_t *buf);
+    int (*write)(void *context, size_t block, const uint8_t *buf);
+    void *context;
+} journal_device_t;
+
+typedef struct
+{
+    unsigned int appended;
+    unsigned int committed;
+    unsigned int commits;
+    unsigned int block_writes;
+    unsigned int dropped;
+    unsigned int write_errors;
+} journal_stats_t;
+
+/**
+ * @fn journal_attach
+ * ---------------------
+ * @description: Commits from now on to device, or to nothing if it is NULL (entries then
+ * stay in RAM, the oldest overwritten once the ring is full). The device is scanned for
+ * its newest record so that sequence numbers and the log continue after it.
+ * @returns 0, or -1 if the device cannot be read or its blocks are too large.
+ */
+int journal_attach(const journal_device_t *device);
+
+/**
+ * @fn journal_append
+ * ---------------------
+ * @description: Adds an entry stamped with the next sequence number and the current
+ * ticks. Never waits: with the ring full, the oldest entry not yet committed is dropped.
+ */
+void journal_append(const uint8_t *uid, size_t uid_length, int32_t old_balance, int32_t new_balance, int32_t amount, uint8_t status);
+
+/**
+ * @fn journal_commit
+ * ---------------------
+ * @description: Group commit: writes every pending entry to the device with one write per
+ * block they fill, rewriting the last, partly filled block on the next commit. Call when
+ * idle, e.g. between shell commands, so the writes never hold up a card.
+ * @returns 0, or -1 if a block write failed; the entries stay pending then.
+ */
+int journal_commit(void);
+
+/**
+ * @fn journal_pending
+ * ---------------------
+ * @returns number of entries appended but not yet committed.
+ */
+size_t journal_pending(void);
+
+/**
+ * @fn journal_get
+ * ---------------------
+ * @description: Copies the index-th newest entry still in the ring (0 is the newest).
+ * @returns true if there is one.
+ */
+bool journal_get(size_t index, journal_entry_t *entry);
+
+/**
+ * @fn journal_encode
+ * ---------------------
+ * @description: Writes entry as a JOURNAL_RECORD_LENGTH-byte record to out.
+ */
+void journal_encode(const journal_entry_t *entry, uint8_t *out);
+
+/**
+ * @fn journal_decode
+ * ---------------------
+ * @description: Decodes the record at record into entry.
+ * @returns false if it is not a valid record, e.g. unused space of a block.
+ */
+bool journal_decode(const uint8_t *record, journal_entry_t *entry);
+
+/**
+ * @fn journal_get_stats
+ * ---------------------
+ * @returns counts since the last journal_reset.
+ */
+const journal_stats_t *journal_get_stats(void);
+
+/**
+ * @fn journal_print
+ * ---------------------
+ * @description: Prints the count newest entries and the journal statistics.
+ */
+void journal_print(size_t count);
+
+/**
+ * @fn journal_reset
+ * ---------------------
+ * @description: Empties the ring, detaches the device and clears the statistics.
+ */
+void journal_reset(void);
+
+#endif // _JOURNAL_H
@@ -0,0 +1,37 @@
+/**
+ * @file journal_file.h
+ * ---------------------
+ * @brief Journal block device backed by a file, for the host: block n is the block_size
+ * bytes at offset n * block_size. Lets the host tests commit a journal and read the log
+ * back, and a copy of a device image be inspected off the Pi.
+ */
+
+#ifndef _JOURNAL_FILE_H
+#define _JOURNAL_FILE_H
+
+#include <stdio.h>
+#include <journal.h>
+
+typedef struct
+{
+    FILE *file;
+    journal_device_t device;
+} journal_file_t;
+
+/**
+ * @fn journal_file_open
+ * ---------------------
+ * @description: Opens the file at path, creating it if needed and extending it with
+ * zeros to block_count blocks, and fills in journal->device to attach.
+ * @returns 0, or -1 if the file cannot be opened or extended.
+ */
+int journal_file_open(journal_file_t *journal, const char *path, size_t block_size, size_t block_count);
+
+/**
+ * @fn journal_file_close
+ * ---------------------
+ * @description: Closes the file; detach the device from the journal first.
+ */
+void journal_file_close(journal_file_t *journal);
+
+#endif // _JOURNAL_FILE_H
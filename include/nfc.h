@@ -27,12 +27,420 @@
 #define MIFARE_KEY_LENGTH (6)
 #define MIFARE_BLOCK_LENGTH (16)
 
+// ISO14443A target selection
+#define PN532_MAX_TARGETS (2)
+#define NFC_CASCADE_TAG (0x88)
+#define NFC_SEL_RES_ISO14443_4 (0x20)
+#define NFC_SEL_RES_MIFARE_ULTRALIGHT (0x00)
+#define NFC_SEL_RES_MIFARE_CLASSIC_1K (0x08)
+
+// FeliCa
+#define FELICA_IDM_LENGTH (8)
+#define FELICA_PMM_LENGTH (8)
+#define FELICA_BLOCK_LENGTH (16)
+#define FELICA_SYSTEM_CODE_ANY (0xFFFF)
+#define FELICA_CMD_POLLING (0x00)
+#define FELICA_CMD_READ_WITHOUT_ENCRYPTION (0x06)
+// Blocks asked for in one Read Without Encryption; the least every FeliCa card accepts.
+#define FELICA_MAX_READ_BLOCKS (4)
+
+// ISO7816 READ BINARY and UPDATE BINARY bytes per APDU: the most a short APDU carries.
+// The exchanges take extended frames (see PN532_FRAME_MAX_LENGTH).
+#define NFC_READ_BINARY_CHUNK (256)
+#define NFC_UPDATE_BINARY_CHUNK (255)
+
+// NTAG21x and MIFARE Ultralight: 4-byte pages, READ returns 4 pages, WRITE takes one
+// (MIFARE_ULTRALIGHT_CMD_WRITE). The rest go through InCommunicateThru.
+#define NTAG_PAGE_LENGTH (4)
+#define NTAG_CMD_GET_VERSION (0x60)
+#define NTAG_CMD_FAST_READ (0x3A)
+#define NTAG_CMD_PWD_AUTH (0x1B)
+#define NTAG_VERSION_LENGTH (8)
+#define NTAG_PWD_LENGTH (4)
+#define NTAG_PACK_LENGTH (2)
+#define NTAG_MAX_PAGES (231) // NTAG216
+// Pages per FAST_READ: 256 bytes, an extended frame (see PN532_FRAME_MAX_LENGTH).
+#define NTAG_FAST_READ_MAX_PAGES (64)
+
+// Cards whose block images the block cache keeps; the least recently used goes first.
+#define NFC_CACHE_TAGS (4)
+
+// MIFARE Classic keys tried, in table order, on a sector whose key is not yet known for
+// the card. sectors masks of NFC_KEY_ALL_SECTORS apply a key to every sector of a 1K card.
+#define NFC_KEY_TABLE_SIZE (8)
+#define MIFARE_1K_SECTORS (16)
+#define NFC_KEY_ALL_SECTORS (0xFFFF)
+
+// Longest a card still in the field takes to answer a listing, in ms.
+#define NFC_PRESENCE_TIMEOUT (20)
+// Trailer bytes 6-9: access conditions and the general purpose byte.
+#define MIFARE_ACCESS_BITS_LENGTH (4)
+
+// nfc-level error codes, above the range of PN532 error codes
+#define NFC_ERROR_WRONG_TAG (0x80) // the card in the field is not of the family asked for
+#define NFC_ERROR_VERIFY (0x81)    // a block read back differs from what was written
+#define NFC_ERROR_NO_ACCOUNT (0x82) // the card has no account in the local account table
+#define NFC_ERROR_REVOKED (0x83)    // the card is on the deny list
+
+/**
+ * A card listed by the PN532. tg is the logical number the PN532 gave it, used to route
+ * card commands to it with nfc_select_target. type is the BrTy it was listed with; for
+ * FeliCa cards uid holds the IDm. baud is the bit rate in use (PN532_BAUD_*) and max_baud
+ * the highest one the card announced for both directions (in its ATS for ISO14443-4
+ * cards), which nfc_set_target_baud can switch to.
+ */
+typedef struct
+{
+    uint8_t tg;
+    uint8_t type;
+    uint8_t baud;
+    uint8_t max_baud;
+    uint8_t sens_res[2];
+    uint8_t sel_res;
+    uint8_t uid[MIFARE_UID_MAX_LENGTH];
+    size_t uid_length;
+    uint8_t pmm[FELICA_PMM_LENGTH];
+} nfc_target_t;
+
+/**
+ * One card session: the card is detected once and each sector authenticated at most once
+ * however many blocks are read or written. round_trips is the number of PN532 commands
+ * the session took, filled in by nfc_transaction_end.
+ */
+typedef struct
+{
+    uint8_t uid[MIFARE_UID_MAX_LENGTH];
+    size_t uid_length;
+    uint8_t tg;
+    int authenticated_sector;
+    unsigned int start_commands;
+    unsigned int round_trips;
+} nfc_transaction_t;
+
+/**
+ * Card detection with InAutoPoll: the PN532 polls for each of types on its own, period
+ * x 150 ms apart, for poll_count rounds (PN532_AUTOPOLL_FOREVER never gives up), and only
+ * answers once a target is found. Types must be ISO14443A types (PN532_AUTOPOLL_*).
+ */
+typedef struct
+{
+    uint8_t poll_count;
+    uint8_t period;
+    uint8_t types[PN532_AUTOPOLL_MAX_TYPES];
+    size_t type_count;
+} nfc_autopoll_t;
+
+// Poll forever every 150 ms for a MIFARE card.
+extern const nfc_autopoll_t NFC_AUTOPOLL_DEFAULT;
+
+/**
+ * RF and protocol settings applied with RFConfiguration and SetParameters:
+ *   field: PN532_RF_FIELD_* bits (RF on, automatic RF collision avoidance)
+ *   atr_res_timeout, retry_timeout: timeout codes (see PN532_TIMEOUT_CODE_US) for ATR_RES
+ *     and for each InDataExchange/InCommunicateThru attempt
+ *   max_retry_com: extra attempts of a failed InDataExchange/InCommunicateThru
+ *   max_retry_atr, max_retry_psl, max_retry_passive: ATR_REQ, PSL_REQ and passive activation
+ *     attempts, PN532_RETRY_FOREVER for no limit
+ *   parameter_flags: PN532_PARAM_* flags
+ */
+typedef struct
+{
+    const char *name;
+    uint8_t field;
+    uint8_t atr_res_timeout;
+    uint8_t retry_timeout;
+    uint8_t max_retry_com;
+    uint8_t max_retry_atr;
+    uint8_t max_retry_psl;
+    uint8_t max_retry_passive;
+    uint8_t parameter_flags;
+} nfc_tuning_t;
+
+// The PN532's power-on settings: listing a card waits for one forever.
+extern const nfc_tuning_t NFC_TUNING_DEFAULT;
+// Door or turnstile: a listing without a card answers within a few ms, short timeouts,
+// no RATS for ISO14443-4 cards since only MIFARE Classic is used.
+extern const nfc_tuning_t NFC_TUNING_FAST_GATE;
+// Weak coupling or a noisy field: long timeouts, retried commands, endless activation.
+extern const nfc_tuning_t NFC_TUNING_ROBUST;
+
+/**
+ * Card detection statistics. wait_us is the time spent in nfc_detect_card and
+ * spi_transactions the bus traffic it cost, so the two give the idle cost of waiting.
+ */
+typedef struct
+{
+    unsigned int detections;
+    unsigned int timeouts;
+    unsigned int last_wait_us;
+    unsigned int wait_us;
+    unsigned int spi_transactions;
+} nfc_detect_stats_t;
+
+/**
+ * What the driver knows the PN532 holds, so commands that would change nothing are not
+ * sent. It is valid for one link generation (see pn532_link_generation): a reset, wakeup
+ * or failed exchange forgets all of it except the routing Tg.
+ *   sam_normal: SAMConfiguration has put the PN532 in normal mode
+ *   firmware: GetFirmwareVersion answer (IC, Ver, Rev, Support), if firmware_known
+ *   tuning: RF settings, if tuning_known; its name is "unknown" otherwise
+ *   target: Tg card commands go to
+ *   target_uid: UID of the card selected at target, target_uid_length 0 if none is known
+ *   target_sel_res: SEL_RES of that card (NFC_SEL_RES_*), telling its family apart
+ */
+typedef struct
+{
+    unsigned int generation;
+    bool sam_normal;
+    bool firmware_known;
+    uint8_t firmware[4];
+    bool tuning_known;
+    nfc_tuning_t tuning;
+    uint8_t target;
+    uint8_t target_uid[MIFARE_UID_MAX_LENGTH];
+    uint8_t target_uid_length;
+    uint8_t target_sel_res;
+} nfc_reader_state_t;
+
+/**
+ * Block cache counters. hits are blocks served from the cache and misses blocks read from
+ * the card; prefetches are balance blocks read ahead when a card is detected.
+ * write_backs are blocks written to the card and clean_writes writes skipped because the
+ * card already held the data. evictions are tag images dropped for room.
+ * key_hits are sector authentications that used the key remembered for the card, and
+ * key_misses keys from the key table the card refused.
+ */
+typedef struct
+{
+    unsigned int hits;
+    unsigned int misses;
+    unsigned int prefetches;
+    unsigned int write_backs;
+    unsigned int clean_writes;
+    unsigned int evictions;
+    unsigned int key_hits;
+    unsigned int key_misses;
+} nfc_cache_stats_t;
+
+/**
+ * A key table entry: key A (MIFARE_CMD_AUTH_A) or key B (MIFARE_CMD_AUTH_B), tried on the
+ * sectors whose bits are set in sectors.
+ */
+typedef struct
+{
+    uint8_t key_type;
+    uint8_t key[MIFARE_KEY_LENGTH];
+    uint16_t sectors;
+} nfc_key_t;
+
+/**
+ * What a provisioned card holds: balance as a value block in the balance block, copied to
+ * backup_block unless it is 0. With set_trailers the trailers of the sectors holding
+ * them get key_a, access_bits and key_b.
+ */
+typedef struct
+{
+    int32_t balance;
+    uint8_t backup_block;
+    bool set_trailers;
+    uint8_t key_a[MIFARE_KEY_LENGTH];
+    uint8_t access_bits[MIFARE_ACCESS_BITS_LENGTH];
+    uint8_t key_b[MIFARE_KEY_LENGTH];
+} nfc_provision_template_t;
+
+// Balance 0, no backup, trailers left alone; keys and access bits of a transport card.
+extern const nfc_provision_template_t NFC_PROVISION_DEFAULT;
+
 /**
  * @fn nfc_init
  * ---------------------
  * @description: Initializes pn532 and nfc capabilities.
+ * @param timing: SPI timing profile (see pn532.h), or NULL for the conservative one.
+ */
+void nfc_init(unsigned int reset_pin, unsigned int nss_pin, const pn532_timing_t *timing);
+
+/**
+ * @fn nfc_set_autopoll
+ * ---------------------
+ * @description: Sets how cards are detected. nfc_init selects NFC_AUTOPOLL_DEFAULT; NULL
+ * goes back to sending InListPassiveTarget over and over.
+ */
+void nfc_set_autopoll(const nfc_autopoll_t *config);
+
+/**
+ * @fn nfc_detect_card
+ * ---------------------
+ * @description: Waits up to timeout ms (0 waits forever) for a card and fills uid with
+ * its UID. The card is left selected as target 1, and the block cache forgets what it
+ * held about the card's blocks: the card may have been written elsewhere since.
+ * @returns length of the UID, or PN532_STATUS_ERROR if no card was found.
+ */
+int nfc_detect_card(uint8_t *uid, unsigned int timeout);
+
+/**
+ * @fn nfc_scan_card
+ * ---------------------
+ * @description: Puts the reader back in normal mode (see nfc_config_normal), then detects
+ * a card as nfc_detect_card does. Commands that wait for a tap use this, so they never
+ * detect with whatever mode the last command left the PN532 in.
+ * @returns length of the UID, or PN532_STATUS_ERROR if the reader could not be
+ * configured or no card was found.
+ */
+int nfc_scan_card(uint8_t *uid, unsigned int timeout);
+
+/**
+ * @fn nfc_get_detect_stats
+ * ---------------------
+ * @returns card detection statistics since nfc_init or nfc_reset_detect_stats.
+ */
+const nfc_detect_stats_t *nfc_get_detect_stats(void);
+
+/**
+ * @fn nfc_reset_detect_stats
+ * ---------------------
+ * @description: Zeroes the card detection statistics.
+ */
+void nfc_reset_detect_stats(void);
+
+/**
+ * @fn nfc_print_detect_stats
+ * ---------------------
+ * @description: Prints detection mode, latency of the last detection and what an idle
+ * minute of waiting costs in SPI transactions.
+ */
+void nfc_print_detect_stats(void);
+
+/**
+ * @fn nfc_apply_tuning
+ * ---------------------
+ * @description: Sends every setting of tuning to the PN532. On error the PN532 may hold a
+ * mix of old and new settings; nfc_get_tuning then reports "unknown".
+ * @returns PN532_STATUS_OK, or PN532_STATUS_ERROR.
+ */
+int nfc_apply_tuning(const nfc_tuning_t *tuning);
+
+/**
+ * @fn nfc_find_tuning
+ * ---------------------
+ * @returns the preset called name ("default", "fast-gate" or "robust"), or NULL.
+ */
+const nfc_tuning_t *nfc_find_tuning(const char *name);
+
+/**
+ * @fn nfc_get_tuning
+ * ---------------------
+ * @returns the settings last applied to the PN532. There is no command to read them back
+ * from the chip, so this is the driver's copy of what the chip acknowledged.
+ */
+const nfc_tuning_t *nfc_get_tuning(void);
+
+/**
+ * @fn nfc_print_tuning
+ * ---------------------
+ * @description: Prints the settings last applied to the PN532.
+ */
+void nfc_print_tuning(void);
+
+/**
+ * @fn nfc_config_normal
+ * ---------------------
+ * @description: Puts the PN532 in normal SAM mode (see pn532_config_normal) unless the
+ * reader state says it already is.
+ * @returns PN532_STATUS_OK, or PN532_STATUS_ERROR.
+ */
+int nfc_config_normal(void);
+
+/**
+ * @fn nfc_get_firmware_version
+ * ---------------------
+ * @description: Fills version with the 4 bytes of GetFirmwareVersion, asking the PN532
+ * only the first time in a link generation.
+ * @returns PN532_STATUS_OK, or PN532_STATUS_ERROR.
+ */
+int nfc_get_firmware_version(uint8_t *version);
+
+/**
+ * @fn nfc_get_reader_state
+ * ---------------------
+ * @returns what the driver knows the PN532 holds, after forgetting anything a reset or
+ * link error since invalidated.
+ */
+const nfc_reader_state_t *nfc_get_reader_state(void);
+
+/**
+ * @fn nfc_invalidate_reader_state
+ * ---------------------
+ * @description: Forgets the reader state, so the next operations send every command
+ * again. Use after talking to the PN532 around this driver.
+ */
+void nfc_invalidate_reader_state(void);
+
+/**
+ * @fn nfc_print_reader_state
+ * ---------------------
+ * @description: Prints the reader state.
  */
-void nfc_init(unsigned int reset_pin, unsigned int nss_pin);
+void nfc_print_reader_state(void);
+
+/**
+ * @fn nfc_cache_invalidate
+ * ---------------------
+ * @description: Forgets the cached image of the card with the given UID, or of every card
+ * if uid is NULL. Needed when a card may have been written elsewhere while it was known
+ * to be in the field; a card that refuses a command is forgotten on its own. The keys
+ * that worked for a card are kept unless uid is NULL.
+ */
+void nfc_cache_invalidate(const uint8_t *uid, size_t uid_length);
+
+/**
+ * @fn nfc_get_cache_stats
+ * ---------------------
+ * @returns block cache counters since the last reset.
+ */
+const nfc_cache_stats_t *nfc_get_cache_stats(void);
+
+/**
+ * @fn nfc_reset_cache_stats
+ * ---------------------
+ * @description: Zeroes the block cache counters.
+ */
+void nfc_reset_cache_stats(void);
+
+/**
+ * @fn nfc_print_cache_stats
+ * ---------------------
+ * @description: Prints the block cache counters.
+ */
+void nfc_print_cache_stats(void);
+
+/**
+ * @fn nfc_add_key
+ * ---------------------
+ * @description: Appends a key to the key table, tried after those already in it.
+ * @returns PN532_STATUS_OK, or PN532_STATUS_ERROR if the table is full or key_type is
+ * neither MIFARE_CMD_AUTH_A nor MIFARE_CMD_AUTH_B.
+ */
+int nfc_add_key(uint8_t key_type, const uint8_t *key, uint16_t sectors);
+
+/**
+ * @fn nfc_reset_keys
+ * ---------------------
+ * @description: Leaves only the transport key (key A FF FF FF FF FF FF, every sector) in
+ * the key table and forgets which keys worked for which cards. nfc_init does this.
+ */
+void nfc_reset_keys(void);
+
+/**
+ * @fn nfc_authenticate_sector
+ * ---------------------
+ * @description: Authenticates the sector of block_number on the card with the given UID.
+ * The key that last worked for this card and sector goes first, then the key table in
+ * order; the card is re-selected after each key it refuses, since a failed
+ * authentication halts it. The key that works is remembered for the card.
+ * @returns PN532 error code: that of the last key tried if none worked, or
+ * PN532_STATUS_ERROR if the table has no key for the sector.
+ */
+int nfc_authenticate_sector(const uint8_t *uid, size_t uid_length, size_t block_number);
 
 /**
  * @fn print_bytes
@@ -41,11 +449,158 @@ void nfc_init(unsigned int reset_pin, unsigned int nss_pin);
  */
 void print_bytes(uint8_t *buf, size_t bufsize);
 
+/**
+ * @fn pn532_list_passive_targets
+ * ---------------------
+ * @description: Lists up to max_targets (at most PN532_MAX_TARGETS) ISO14443A cards in the
+ * field into targets. With uid set, only the card with that UID is selected. Card commands
+ * go to the first target listed until nfc_select_target picks another.
+ * @returns number of targets listed, or PN532_STATUS_ERROR if none answered in timeout ms.
+ */
+int pn532_list_passive_targets(nfc_target_t *targets, size_t max_targets, const uint8_t *uid, size_t uid_length, unsigned int timeout);
+
+/**
+ * @fn pn532_list_felica_targets
+ * ---------------------
+ * @description: Lists up to max_targets FeliCa cards with the given system code
+ * (FELICA_SYSTEM_CODE_ANY for all) at card_baud, PN532_FELICA_212 or PN532_FELICA_424.
+ * @returns number of targets listed, or PN532_STATUS_ERROR if none answered in timeout ms.
+ */
+int pn532_list_felica_targets(nfc_target_t *targets, size_t max_targets, uint8_t card_baud, uint16_t system_code, unsigned int timeout);
+
+/**
+ * @fn nfc_set_target_baud
+ * ---------------------
+ * @description: Switches an ISO14443-4 target to baud (PN532_BAUD_*) in both directions
+ * with InPSL. The card must have announced the rate: baud <= target->max_baud.
+ * @returns PN532 error code.
+ */
+int nfc_set_target_baud(nfc_target_t *target, uint8_t baud);
+
+/**
+ * @fn nfc_read_binary
+ * ---------------------
+ * @description: Reads length bytes from offset of the current file of the current
+ * ISO14443-4 target with READ BINARY, NFC_READ_BINARY_CHUNK bytes per command.
+ * @returns PN532 error code, or PN532_STATUS_ERROR if the card refused the read.
+ */
+int nfc_read_binary(uint8_t *data, size_t offset, size_t length);
+
+/**
+ * @fn nfc_update_binary
+ * ---------------------
+ * @description: Writes length bytes to offset of the current file of the current
+ * ISO14443-4 target with UPDATE BINARY, NFC_UPDATE_BINARY_CHUNK bytes per command.
+ * @returns PN532 error code, or PN532_STATUS_ERROR if the card refused the write.
+ */
+int nfc_update_binary(const uint8_t *data, size_t offset, size_t length);
+
+/**
+ * @fn nfc_felica_read_blocks
+ * ---------------------
+ * @description: Reads count blocks from start of a service of a FeliCa target with Read
+ * Without Encryption, FELICA_MAX_READ_BLOCKS blocks per command.
+ * @param data: buffer of FELICA_BLOCK_LENGTH * count bytes.
+ * @returns PN532 error code, or PN532_STATUS_ERROR if the card refused the read.
+ */
+int nfc_felica_read_blocks(const nfc_target_t *target, uint16_t service_code, size_t start, size_t count, uint8_t *data);
+
+/**
+ * @fn nfc_ntag_get_version
+ * ---------------------
+ * @description: Sends GET_VERSION to the current NTAG21x/Ultralight EV1 target.
+ * @param version: buffer of NTAG_VERSION_LENGTH bytes.
+ * @returns PN532 error code, or PN532_STATUS_ERROR if the card gave no version.
+ */
+int nfc_ntag_get_version(uint8_t *version);
+
+/**
+ * @fn nfc_ntag_page_count
+ * ---------------------
+ * @returns number of pages of the card a GET_VERSION answer describes, or 0 if its
+ * storage size is not one of the NTAG21x/Ultralight EV1 sizes.
+ */
+size_t nfc_ntag_page_count(const uint8_t *version);
+
+/**
+ * @fn nfc_ntag_read_page
+ * ---------------------
+ * @description: Reads one page of the current NTAG/Ultralight target with READ.
+ * @param data: buffer of NTAG_PAGE_LENGTH bytes.
+ * @returns PN532 error code.
+ */
+int nfc_ntag_read_page(uint8_t *data, size_t page);
+
+/**
+ * @fn nfc_ntag_read_pages
+ * ---------------------
+ * @description: Reads count pages from start of the current NTAG21x target with FAST_READ,
+ * NTAG_FAST_READ_MAX_PAGES pages per InCommunicateThru exchange.
+ * @param data: buffer of NTAG_PAGE_LENGTH * count bytes.
+ * @returns PN532 error code, or PN532_STATUS_ERROR if the card returned too little.
+ */
+int nfc_ntag_read_pages(uint8_t *data, size_t start, size_t count);
+
+/**
+ * @fn nfc_ntag_write_page
+ * ---------------------
+ * @description: Writes NTAG_PAGE_LENGTH bytes to one page of the current
+ * NTAG/Ultralight target with WRITE.
+ * @returns PN532 error code.
+ */
+int nfc_ntag_write_page(const uint8_t *data, size_t page);
+
+/**
+ * @fn nfc_ntag_pwd_auth
+ * ---------------------
+ * @description: Unlocks the pages an NTAG21x protects (from AUTH0 on) with PWD_AUTH.
+ * @param pwd: NTAG_PWD_LENGTH byte password.
+ * @param pack: buffer of NTAG_PACK_LENGTH bytes for the card's acknowledge, or NULL.
+ * @returns PN532 error code; a wrong password leaves the card halted.
+ */
+int nfc_ntag_pwd_auth(const uint8_t *pwd, uint8_t *pack);
+
+/**
+ * @fn nfc_reselect
+ * ---------------------
+ * @description: Selects the card with the given UID directly, without an anticollision
+ * round over every card in the field. Nothing is sent if the reader state already has it
+ * selected.
+ * @returns its Tg, or PN532_STATUS_ERROR if it did not answer in timeout ms.
+ */
+int nfc_reselect(const uint8_t *uid, size_t uid_length, unsigned int timeout);
+
+/**
+ * @fn nfc_select_target
+ * ---------------------
+ * @description: Sends the card commands that follow (authenticate, read, write, value
+ * operations) to target tg. Switching targets halts the previous one, whose sector
+ * authentication is then lost.
+ */
+void nfc_select_target(uint8_t tg);
+
+/**
+ * @fn nfc_release_targets
+ * ---------------------
+ * @description: Records that no card is selected any more, after a command that released
+ * or replaced the listed targets (InRelease, InJumpForDEP, TgInitAsTarget).
+ */
+void nfc_release_targets(void);
+
+/**
+ * @fn nfc_current_target
+ * ---------------------
+ * @returns the Tg card commands currently go to.
+ */
+uint8_t nfc_current_target(void);
+
 /**
  * @fn pn532_read_passive_target
  * ---------------------
  * @desciption: Blocks until Mifare card is available and fills response with UID when found
  *     Will wait up to timeout seconds and return None if no card is found,  *     otherwise a bytearray with the UID of the found card is returned.
+ *     With card_baud PN532_FELICA_212 or PN532_FELICA_424, lists a FeliCa card and fills
+ *     response with its IDm.
  * @returns Length of UID, or -1 if error.
  */
 int pn532_read_passive_target(uint8_t *response, uint8_t card_baud, size_t timeout);
@@ -84,10 +639,177 @@ int pn532_read_block(uint8_t *response, size_t block_number);
  */
 int pn532_mifare_classic_write_block(uint8_t *data, size_t block_number);
 
+/**
+ * @fn pn532_mifare_increment
+ * ---------------------
+ * @description: Adds amount to value block block_number into the card's transfer buffer.
+ * Nothing is stored until pn532_mifare_transfer.
+ * @returns: PN532 error code.
+ */
+int pn532_mifare_increment(size_t block_number, int32_t amount);
+
+/**
+ * @fn pn532_mifare_decrement
+ * ---------------------
+ * @description: Subtracts amount from value block block_number into the transfer buffer.
+ * @returns: PN532 error code.
+ */
+int pn532_mifare_decrement(size_t block_number, int32_t amount);
+
+/**
+ * @fn pn532_mifare_restore
+ * ---------------------
+ * @description: Loads value block block_number unchanged into the transfer buffer.
+ * @returns: PN532 error code.
+ */
+int pn532_mifare_restore(size_t block_number);
+
+/**
+ * @fn pn532_mifare_transfer
+ * ---------------------
+ * @description: Writes the transfer buffer to block_number, which must be in the sector
+ * the value command ran in.
+ * @returns: PN532 error code.
+ */
+int pn532_mifare_transfer(size_t block_number);
+
+/**
+ * @fn read_blocks
+ * ---------------------
+ * @description: Reads count blocks starting at start from the card with the given UID,
+ * authenticating once per sector rather than once per block. Blocks in the block cache
+ * are not read again.
+ * @param response: buffer of 16 * count bytes; block start + i lands at response + 16 * i.
+ * @param skip_trailers: if true, sector trailers are not read and their slots are left as is.
+ * @returns: PN532 error code.
+ */
+int read_blocks(uint8_t *response, uint8_t *uid, size_t uid_length, size_t start, size_t count, bool skip_trailers);
+
+/**
+ * @fn write_blocks
+ * ---------------------
+ * @description: Writes count blocks starting at start to the card with the given UID,
+ * authenticating once per sector. Blocks the block cache shows the card already holds
+ * are skipped; the rest are marked dirty and written back.
+ * @param data: 16 * count bytes; block start + i is written from data + 16 * i.
+ * @param skip_trailers: if true, sector trailers are left untouched. Writing a trailer
+ * changes the sector's keys and access bits, so pass false only on purpose.
+ * @returns: PN532 error code.
+ */
+int write_blocks(uint8_t *data, uint8_t *uid, size_t uid_length, size_t start, size_t count, bool skip_trailers);
+
+/**
+ * @fn nfc_transaction_begin
+ * ---------------------
+ * @description: Configures the reader and waits for a card, which stays selected for the
+ * rest of the transaction. The balance block of a MIFARE Classic card is prefetched into
+ * the block cache, and its sector stays authenticated. A card on the deny list (denylist.h) is
+ * refused before anything is read from it.
+ * @returns: PN532 error code, or NFC_ERROR_REVOKED if the card is revoked.
+ */
+int nfc_transaction_begin(nfc_transaction_t *txn);
+
+/**
+ * @fn nfc_transaction_begin_target
+ * ---------------------
+ * @description: Starts a transaction with a card already listed by
+ * pn532_list_passive_targets. Transactions with several listed cards can be interleaved;
+ * each switch of card costs a new sector authentication.
+ * @returns PN532 error code.
+ */
+int nfc_transaction_begin_target(nfc_transaction_t *txn, const nfc_target_t *target);
+
+/**
+ * @fn nfc_transaction_read
+ * ---------------------
+ * @description: Reads a block of the transaction's card, authenticating its sector first
+ * unless that was the last sector authenticated. A cached block costs no RF traffic.
+ * @returns: PN532 error code.
+ */
+int nfc_transaction_read(nfc_transaction_t *txn, uint8_t *response, size_t block_number);
+
+/**
+ * @fn nfc_transaction_write
+ * ---------------------
+ * @description: Writes a block of the transaction's card, authenticating as needed. Data
+ * the block cache shows the card already holds is not written again.
+ * @returns: PN532 error code.
+ */
+int nfc_transaction_write(nfc_transaction_t *txn, uint8_t *data, size_t block_number);
+
+/**
+ * @fn nfc_transaction_end
+ * ---------------------
+ * @description: Closes the transaction.
+ * @returns: number of PN532 round trips the transaction took.
+ */
+unsigned int nfc_transaction_end(nfc_transaction_t *txn);
+
+/**
+ * @fn nfc_transaction_add_value
+ * ---------------------
+ * @description: Adds delta (which may be negative) to a value block on the card itself
+ * with INCREMENT or DECREMENT followed by TRANSFER back into the same block.
+ * @returns: PN532 error code; the card refuses blocks not in value block format.
+ */
+int nfc_transaction_add_value(nfc_transaction_t *txn, size_t block_number, int32_t delta);
+
+/**
+ * @fn nfc_transaction_backup_value
+ * ---------------------
+ * @description: Copies value block block_number to backup_block of the same sector with
+ * RESTORE and TRANSFER.
+ * @returns: PN532 error code.
+ */
+int nfc_transaction_backup_value(nfc_transaction_t *txn, size_t block_number, size_t backup_block);
+
+/**
+ * @fn update_balance
+ * ---------------------
+ * @description: Adds delta to the balance of a key card in a single transaction: detect,
+ * authenticate, then INCREMENT/DECREMENT and TRANSFER on the card. A balance block in the
+ * old raw format is converted to a value block on first use. Waits until card is scanned.
+ * The update is appended to the journal with the balance read before it (prefetched with
+ * the detection) and the balance read back from the card after it.
+ * @param balance: if not NULL, receives the new balance as read back.
+ * @param round_trips: if not NULL, receives the number of PN532 round trips used.
+ * @returns: PN532 error code, or NFC_ERROR_REVOKED if the card is on the deny list.
+ */
+int update_balance(int delta, int *balance, unsigned int *round_trips);
+
+/**
+ * @fn mifare_value_block
+ * ---------------------
+ * @description: Formats block as a MIFARE value block holding value: the value, its
+ * inverse and the value again (little-endian), then address, ~address, address, ~address.
+ */
+void mifare_value_block(uint8_t *block, int32_t value, uint8_t address);
+
+/**
+ * @fn mifare_parse_value_block
+ * ---------------------
+ * @returns: true and fills value if block is a well-formed value block.
+ */
+bool mifare_parse_value_block(const uint8_t *block, int32_t *value);
+
+/**
+ * @fn update_account_balance
+ * ---------------------
+ * @description: Like update_balance, against the card's account in the local account
+ * table (see accounts.h) instead of the card: only the UID is read, no sector is
+ * authenticated and no block read or written. Waits until card is scanned. The update
+ * is appended to the journal.
+ * @param balance: if not NULL, receives the new balance.
+ * @param round_trips: if not NULL, receives the number of PN532 round trips used.
+ * @returns: PN532 error code, NFC_ERROR_REVOKED if the card is on the deny list, or
+ * NFC_ERROR_NO_ACCOUNT if it has no account.
+ */
+int update_account_balance(int delta, int *balance, unsigned int *round_trips);
+
 /**
  * @fn get_balance
  * ---------------------
- * @description: Get balance of a key card. Waits until card is scanned.
+ * @description: Get balance of a key card, stored as a value block in block 6. Waits until card is scanned.
  *  @param value: an int passed by reference to write the current balance to.
  * @returns: returns pn532 error code.
  */
@@ -102,6 +824,30 @@ int get_balance(int *value);
  */
 int set_balance(int balance);
 
+/**
+ * @fn nfc_provision_card
+ * ---------------------
+ * @description: Brings the detected card with the given UID to the template, writing only
+ * the blocks that differ from it, then reads the written blocks back from the card. A
+ * trailer counts as different if its access bits do or its sector does not open with
+ * key_a; key B, which the access bits usually hide, is not compared. key_a is added to
+ * the key table if it is not there.
+ * @param written: if not NULL, set to the number of blocks written.
+ * @returns PN532 error code, NFC_ERROR_VERIFY if a block did not read back as written,
+ * or PN532_STATUS_ERROR if the template is invalid.
+ */
+int nfc_provision_card(const nfc_provision_template_t *tmpl, const uint8_t *uid, size_t uid_length, unsigned int *written);
+
+/**
+ * @fn nfc_wait_removal
+ * ---------------------
+ * @description: Waits up to timeout ms (0 waits forever) for the card with the given UID
+ * to leave the field, listing it by UID until it no longer answers within
+ * NFC_PRESENCE_TIMEOUT ms.
+ * @returns PN532_STATUS_OK once it left, or PN532_STATUS_ERROR if it is still there.
+ */
+int nfc_wait_removal(const uint8_t *uid, size_t uid_length, unsigned int timeout);
+
 /**
  * @fn get_block_info
  * ---------------------
@@ -112,6 +858,14 @@ int set_balance(int balance);
  */
 int get_block_info(uint8_t *response, size_t block_number);
 
+/**
+ * @fn get_blocks_info
+ * ---------------------
+ * @description: Waits for a card and reads count blocks starting at start into response.
+ * @returns pn532 error code if tag cannot be read or the range is out of bounds and PN532_ERROR_NONE if tag can be read
+ */
+int get_blocks_info(uint8_t *response, size_t start, size_t count);
+
 /**
  * @fn get_tag_info
  * ---------------------
@@ -120,4 +874,14 @@ int get_block_info(uint8_t *response, size_t block_number);
  */
 int get_tag_info(uint8_t *response, size_t response_length);
 
+/**
+ * @fn get_ntag_info
+ * ---------------------
+ * @description: Waits for a card and, if it is an NTAG21x/Ultralight EV1, reads all its
+ * pages (up to response length) with GET_VERSION and FAST_READ.
+ * @param pages: set to the number of pages read.
+ * @returns NFC_ERROR_WRONG_TAG if the card is of another family, else pn532 error code
+ */
+int get_ntag_info(uint8_t *response, size_t response_length, size_t *pages);
+
 #endif // _NFC_H
\ No newline at end of file
@@ -0,0 +1,135 @@
+/**
+ * @file nfc_dep.h
+ * ---------------------
+ * @brief NFC-DEP (ISO 18092) data channel between two PN532 terminals. One terminal
+ * listens as a target, the other activates it as initiator; then the initiator sends
+ * requests and the target answers each with a reply. Messages longer than one PN532
+ * command holds are chained with the MI (More Information) bit.
+ */
+
+#ifndef _NFC_DEP_H
+#define _NFC_DEP_H
+
+#include "pn532.h"
+
+// Message bytes per InDataExchange/TgGetData/TgSetData; the PN532 splits a chunk into
+// RF frames itself.
+#define NFC_DEP_CHUNK (256)
+// MI bit of the InDataExchange Tg byte and of the status byte of the responses.
+#define NFC_DEP_MI (0x40)
+#define NFC_DEP_NFCID3_LENGTH (10)
+// p2p-bench messages; the target answers each with its length in 4 bytes.
+#define NFC_DEP_BENCH_MESSAGE (1024)
+#define NFC_DEP_BENCH_REPLY (4)
+
+/**
+ * Traffic over a link. frames counts PN532 commands that carried message chunks,
+ * frame_us the time spent in them and max_frame_us the slowest one.
+ */
+typedef struct
+{
+    unsigned int messages;
+    unsigned int frames;
+    unsigned int bytes_sent;
+    unsigned int bytes_received;
+    unsigned int frame_us;
+    unsigned int max_frame_us;
+} nfc_dep_stats_t;
+
+/**
+ * An activated NFC-DEP link. tg is the peer's logical number on the initiator side.
+ * baud is the bit rate in use (PN532_BAUD_*) and max_baud the highest one the peer
+ * announced for both directions in its ATR.
+ */
+typedef struct
+{
+    bool initiator;
+    uint8_t tg;
+    uint8_t baud;
+    uint8_t max_baud;
+    uint8_t nfcid3[NFC_DEP_NFCID3_LENGTH];
+    nfc_dep_stats_t stats;
+} nfc_dep_link_t;
+
+/**
+ * @fn nfc_dep_initiate
+ * ---------------------
+ * @description: Activates a listening peer with InJumpForDEP in active mode at 106 kbps,
+ * then raises the bit rate with InPSL to the highest one its ATR_RES announced.
+ * @returns PN532 error code, or PN532_STATUS_ERROR if no peer answered in timeout ms.
+ */
+int nfc_dep_initiate(nfc_dep_link_t *link, unsigned int timeout);
+
+/**
+ * @fn nfc_dep_listen
+ * ---------------------
+ * @description: Waits as an NFC-DEP target (TgInitAsTarget) for an initiator to
+ * activate this terminal.
+ * @returns PN532_STATUS_OK, or PN532_STATUS_ERROR if none did in timeout ms (0: never).
+ */
+int nfc_dep_listen(nfc_dep_link_t *link, unsigned int timeout);
+
+/**
+ * @fn nfc_dep_transceive
+ * ---------------------
+ * @description: Initiator: sends a request of request_length bytes and receives the
+ * target's reply, both chained over as many InDataExchange commands as they take.
+ * @returns length of the reply, or PN532_STATUS_ERROR if an exchange failed or the reply
+ * does not fit in response_size bytes.
+ */
+int nfc_dep_transceive(nfc_dep_link_t *link, const uint8_t *request, size_t request_length, uint8_t *response, size_t response_size);
+
+/**
+ * @fn nfc_dep_receive
+ * ---------------------
+ * @description: Target: receives the initiator's next request with TgGetData.
+ * @returns its length, or PN532_STATUS_ERROR if an exchange failed or it does not fit in
+ * size bytes.
+ */
+int nfc_dep_receive(nfc_dep_link_t *link, uint8_t *data, size_t size);
+
+/**
+ * @fn nfc_dep_reply
+ * ---------------------
+ * @description: Target: answers the request just received, chaining with TgSetMetaData
+ * and ending with TgSetData.
+ * @returns PN532 error code, or PN532_STATUS_ERROR if an exchange failed.
+ */
+int nfc_dep_reply(nfc_dep_link_t *link, const uint8_t *data, size_t length);
+
+/**
+ * @fn nfc_dep_release
+ * ---------------------
+ * @description: Initiator: ends the link with InRelease.
+ * @returns PN532 error code, or PN532_STATUS_ERROR if the PN532 did not answer.
+ */
+int nfc_dep_release(nfc_dep_link_t *link);
+
+/**
+ * @fn nfc_dep_bench
+ * ---------------------
+ * @description: p2p-bench initiator side: sends total bytes in NFC_DEP_BENCH_MESSAGE
+ * byte messages, checks each length the target echoes back, then ends with an empty
+ * message.
+ * @returns PN532_STATUS_OK, or PN532_STATUS_ERROR if an exchange failed.
+ */
+int nfc_dep_bench(nfc_dep_link_t *link, size_t total);
+
+/**
+ * @fn nfc_dep_bench_serve
+ * ---------------------
+ * @description: p2p-bench target side: answers each message with its length until the
+ * empty one that ends the run.
+ * @returns PN532_STATUS_OK, or PN532_STATUS_ERROR if an exchange failed.
+ */
+int nfc_dep_bench_serve(nfc_dep_link_t *link);
+
+/**
+ * @fn nfc_dep_print_stats
+ * ---------------------
+ * @description: Prints the link's bit rate, sustained bytes per second and per-frame
+ * latency.
+ */
+void nfc_dep_print_stats(const nfc_dep_link_t *link);
+
+#endif // _NFC_DEP_H
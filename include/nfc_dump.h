@@ -0,0 +1,62 @@
+/**
+ * @file nfc_dump.h
+ * ---------------------
+ * @brief Binary records of `dump --binary`, one per block as it is read off a card:
+ *
+ *   sync, UID length, UID, block number, status, 16 data bytes, CRC (2 bytes, MSB first)
+ *
+ * The CRC is CRC-16/CCITT-FALSE over everything after the sync byte. status is the PN532
+ * error code of the read (the data is zero if it is not 0). A record with block number
+ * NFC_DUMP_END_BLOCK closes a card; its status is that of the whole dump. Shared by the
+ * Pi and the host decoder in src/tools, so it needs nothing beyond the C library headers.
+ */
+
+#ifndef _NFC_DUMP_H
+#define _NFC_DUMP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define NFC_DUMP_SYNC (0xA5)
+#define NFC_DUMP_UID_MAX_LENGTH (10)
+#define NFC_DUMP_DATA_LENGTH (16)
+#define NFC_DUMP_END_BLOCK (0xFF)
+// Sync, UID length, block, status and CRC around the UID and data.
+#define NFC_DUMP_RECORD_MAX_LENGTH (6 + NFC_DUMP_UID_MAX_LENGTH + NFC_DUMP_DATA_LENGTH)
+#define NFC_DUMP_BAD (-1)
+
+typedef struct
+{
+    uint8_t uid[NFC_DUMP_UID_MAX_LENGTH];
+    uint8_t uid_length;
+    uint8_t block;
+    uint8_t status;
+    uint8_t data[NFC_DUMP_DATA_LENGTH];
+} nfc_dump_record_t;
+
+/**
+ * @fn nfc_dump_crc
+ * ---------------------
+ * @returns CRC-16/CCITT-FALSE of length bytes.
+ */
+uint16_t nfc_dump_crc(const uint8_t *bytes, size_t length);
+
+/**
+ * @fn nfc_dump_encode
+ * ---------------------
+ * @description: Writes record to out, which holds NFC_DUMP_RECORD_MAX_LENGTH bytes.
+ * @returns number of bytes written, or 0 if the UID is too long.
+ */
+size_t nfc_dump_encode(const nfc_dump_record_t *record, uint8_t *out);
+
+/**
+ * @fn nfc_dump_decode
+ * ---------------------
+ * @description: Decodes the record at the start of buf into record.
+ * @returns number of bytes the record took, 0 if buf holds only its beginning, or
+ * NFC_DUMP_BAD if buf does not start with a record; drop a byte and try again then,
+ * which skips console text and resynchronizes after a corrupted record.
+ */
+int nfc_dump_decode(const uint8_t *buf, size_t length, nfc_dump_record_t *record);
+
+#endif // _NFC_DUMP_H
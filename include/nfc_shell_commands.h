@@ -43,4 +43,84 @@ int cmd_check_tag_balance(int argc, const char *argv[]);
  */
 int cmd_pay_tag(int argc, const char *argv[]);
 
+/**
+ * @fn cmd_stats
+ * ---------------------
+ * @description: Prints PN532 link and card detection statistics and the reader state.
+ * "stats reset" zeroes the statistics.
+ */
+int cmd_stats(int argc, const char *argv[]);
+
+/**
+ * @fn cmd_detect
+ * ---------------------
+ * @description: Waits for a card, up to the number of seconds given by the second argument
+ * or forever, then prints its UID and the card detection statistics.
+ */
+int cmd_detect(int argc, const char *argv[]);
+
+/**
+ * @fn cmd_tune
+ * ---------------------
+ * @description: Applies the RF tuning preset named by the second argument, then prints the
+ * active RF tuning.
+ */
+int cmd_tune(int argc, const char *argv[]);
+
+/**
+ * @fn cmd_p2p_bench
+ * ---------------------
+ * @description: Runs p2p-bench against a second terminal over NFC-DEP. As "initiator" it
+ * sends the number of kilobytes given by the third argument (default 16) and prints the
+ * throughput and per-frame latency; as "target" it answers one run.
+ */
+int cmd_p2p_bench(int argc, const char *argv[]);
+
+/**
+ * @fn cmd_dump
+ * ---------------------
+ * @description: Reads every block of a MIFARE Classic 1K card from the card itself. Prints
+ * them as the read table, or with "--binary" streams each block as a binary record
+ * (see nfc_dump.h) as soon as its sector is read, for src/tools/dump_decode.c to decode.
+ */
+int cmd_dump(int argc, const char *argv[]);
+
+/**
+ * @fn cmd_journal
+ * ---------------------
+ * @description: Prints the newest balance updates in the journal, as many as the second
+ * argument says, and its statistics. With "sync" commits pending entries at once.
+ */
+int cmd_journal(int argc, const char *argv[]);
+
+/**
+ * @fn cmd_account
+ * ---------------------
+ * @description: Manages the local account table. "list" prints every account, "add" and
+ * "set" open an account for the scanned card or set its balance, "check" prints it,
+ * "local on" makes pay and charge update accounts instead of cards, and "clear" empties
+ * the table. With no arguments prints where pay and charge go and the table statistics.
+ */
+int cmd_account(int argc, const char *argv[]);
+
+/**
+ * @fn cmd_deny
+ * ---------------------
+ * @description: Manages the deny list of revoked cards. "add" revokes the UIDs given in
+ * hex, "tap" the scanned card, and "load" those sent over the serial console one per
+ * line. "bench" times checks against the list and "clear" empties it. With no arguments
+ * prints the list statistics.
+ */
+int cmd_deny(int argc, const char *argv[]);
+
+/**
+ * @fn cmd_provision
+ * ---------------------
+ * @description: Provisions cards one after the other with the balance given by the second
+ * argument, optionally backed up to the block given by the third. With key A, access bits
+ * and key B after that, the trailers of those sectors are set too. Prints a line per
+ * card and, once no card has come for a while, cards per minute and failures.
+ */
+int cmd_provision(int argc, const char *argv[]);
+
 #endif // _NFC_SHELL_COMMANDS_H
\ No newline at end of file
@@ -14,8 +14,11 @@
 #include <stdbool.h>
 #include <printf.h>
 #include <stdint.h>
+#include <stddef.h>
 
-#define PN532_FRAME_MAX_LENGTH 255
+// Frame data (TFI, command, parameters) of a normal frame and of an extended one.
+#define PN532_NORMAL_FRAME_MAX_LENGTH 255
+#define PN532_FRAME_MAX_LENGTH 264
 #define PN532_DEFAULT_TIMEOUT 1000
 
 // Communication bytes
@@ -60,7 +63,45 @@
 #define PN532_COMMAND_TGRESPONSETOINITIATOR (0x90)
 #define PN532_COMMAND_TGGETTARGETSTATUS (0x8A)
 
+// InListPassiveTarget baud rate and modulation types (BrTy)
 #define PN532_MIFARE_ISO14443A (0x00)
+#define PN532_FELICA_212 (0x01)
+#define PN532_FELICA_424 (0x02)
+
+// InPSL bit rates (BRit, BRti)
+#define PN532_BAUD_106 (0x00)
+#define PN532_BAUD_212 (0x01)
+#define PN532_BAUD_424 (0x02)
+
+// InAutoPoll: PollNr 0xFF polls until a target shows up, Period is in 150 ms units.
+#define PN532_AUTOPOLL_FOREVER (0xFF)
+#define PN532_AUTOPOLL_PERIOD_MS (150)
+#define PN532_AUTOPOLL_MAX_TYPES (15)
+// InAutoPoll target types
+#define PN532_AUTOPOLL_GENERIC_106 (0x00)
+#define PN532_AUTOPOLL_MIFARE (0x10)
+#define PN532_AUTOPOLL_ISO14443_4A (0x20)
+
+// RFConfiguration items
+#define PN532_RFCONFIG_FIELD (0x01)
+#define PN532_RFCONFIG_TIMINGS (0x02)
+#define PN532_RFCONFIG_MAX_RETRY_COM (0x04)
+#define PN532_RFCONFIG_MAX_RETRIES (0x05)
+// RFConfiguration item PN532_RFCONFIG_FIELD bits
+#define PN532_RF_FIELD_ON (0x01)
+#define PN532_RF_FIELD_AUTO_RFCA (0x02)
+// Retry count that never gives up
+#define PN532_RETRY_FOREVER (0xFF)
+// RFConfiguration timeouts are codes: 0 is none, n is 100 us << (n - 1), up to 0x10.
+#define PN532_TIMEOUT_CODE_US(code) ((code) ? 100u << ((code)-1) : 0)
+
+// SetParameters flags
+#define PN532_PARAM_NAD_USED (0x01)
+#define PN532_PARAM_DID_USED (0x02)
+#define PN532_PARAM_AUTO_ATR_RES (0x04)
+#define PN532_PARAM_AUTO_RATS (0x10)
+#define PN532_PARAM_ISO14443_4_PICC (0x20)
+#define PN532_PARAM_REMOVE_PRE_POST (0x40)
 
 /* Official PN532 Errors Definitions */
 #define PN532_ERROR_NONE (0x00)
@@ -69,15 +110,199 @@
 #define PN532_STATUS_ERROR (-1)
 #define PN532_STATUS_OK (0)
 
-// Constants
-typedef unsigned int size_t;
+/**
+ * SPI transport timing, in microseconds. NSS setup is the time from NSS low to the first
+ * clock edge, NSS hold the time from the last clock edge to NSS high, the frame gap the
+ * minimum NSS high time between two transactions, and the wakeup delay the oscillator
+ * start time (T_osc_start) the PN532 needs after NSS low when leaving power down.
+ */
+typedef struct
+{
+    unsigned int nss_setup_us;
+    unsigned int nss_hold_us;
+    unsigned int frame_gap_us;
+    unsigned int wakeup_us;
+} pn532_timing_t;
+
+// Datasheet minimums with a 10x margin; safe for long wires and slow level shifters.
+extern const pn532_timing_t PN532_TIMING_CONSERVATIVE;
+// Datasheet minimums rounded up to whole microseconds.
+extern const pn532_timing_t PN532_TIMING_FAST;
+
+/**
+ * Link statistics. Times are in microseconds. ready_saved_us estimates how much sooner
+ * IRQ mode noticed the chip was ready than the 10 ms + 5 ms status polling would have.
+ * The last four count the recovery ladder: frames that failed to decode, NACKs asking
+ * for a response again, commands resent, and bring-ups after the resends ran out.
+ */
+typedef struct
+{
+    unsigned int commands;
+    unsigned int ready_waits;
+    unsigned int ready_wait_us;
+    unsigned int ready_saved_us;
+    unsigned int irq_wakeups;
+    unsigned int status_polls;
+    unsigned int spi_transactions;
+    unsigned int frame_errors;
+    unsigned int nacks;
+    unsigned int retries;
+    unsigned int link_resets;
+} pn532_stats_t;
+
+/**
+ * How the last bring-up went. ready_us runs from the reset to the first answer to
+ * GetFirmwareVersion; full_reset is set when the fast reset got no answer and the
+ * full-length reset and wakeup sequence ran.
+ */
+typedef struct
+{
+    unsigned int ready_us;
+    unsigned int probes;
+    bool full_reset;
+    bool ready;
+} pn532_bring_up_t;
+
+/**
+ * A command frame built once and kept bit-reversed, ready to be clocked out as is. Used
+ * for constant commands that are sent over and over.
+ */
+#define PN532_PREBUILT_MAX_LENGTH 32
+typedef struct
+{
+    uint8_t command;
+    size_t length;
+    uint8_t wire[PN532_PREBUILT_MAX_LENGTH];
+} pn532_frame_t;
+
+/**
+ * Incremental decoder for frames received from the PN532. Bytes can be fed in any number
+ * of pieces; pn532_decoder_need says how many more the frame needs at least, so a reader
+ * can clock the header first and then exactly LEN + 2 more bytes. Extended frames, whose
+ * LEN and LCS read FF FF, carry a 2-byte length after them. Frame data is written to data
+ * and never past capacity.
+ */
+typedef enum
+{
+    PN532_DECODE_PREAMBLE,
+    PN532_DECODE_LEN,
+    PN532_DECODE_LCS,
+    PN532_DECODE_LENM, // extended frame: 00 FF FF FF LENM LENL LCS
+    PN532_DECODE_LENL,
+    PN532_DECODE_EXTENDED_LCS,
+    PN532_DECODE_DATA,
+    PN532_DECODE_DCS,
+    PN532_DECODE_POSTAMBLE,
+    PN532_DECODE_DONE,
+    PN532_DECODE_ERROR,
+} pn532_decode_state_t;
+
+typedef enum
+{
+    PN532_DECODE_BAD_START = 1,
+    PN532_DECODE_BAD_LCS,
+    PN532_DECODE_TOO_LONG,
+    PN532_DECODE_BAD_DCS,
+} pn532_decode_error_t;
+
+typedef enum
+{
+    PN532_FRAME_INVALID,
+    PN532_FRAME_INFORMATION,
+    PN532_FRAME_ACK,
+    PN532_FRAME_NACK,
+} pn532_frame_kind_t;
+
+typedef struct
+{
+    pn532_decode_state_t state;
+    pn532_decode_error_t error;
+    pn532_frame_kind_t kind;
+    uint8_t *data;
+    size_t capacity;
+    size_t length;
+    size_t received;
+    size_t zeros;
+    uint8_t checksum;
+} pn532_decoder_t;
 
 /**
  * @fn pn532_init
  * ---------------------
- * @description:Initializes spi interface and resets PN532 module.
+ * @description:Initializes spi interface and brings the PN532 module up with
+ * pn532_bring_up(false).
+ * @param timing: SPI timing profile to use, or NULL for PN532_TIMING_CONSERVATIVE.
+ */
+void pn532_init(unsigned int reset_pin, unsigned int nss_pin, const pn532_timing_t *timing);
+
+/**
+ * @fn pn532_bring_up
+ * ---------------------
+ * @description: Resets the PN532 and waits until it answers GetFirmwareVersion. The fast
+ * way pulses reset briefly and probes with a short backoff; if that gets no answer, or
+ * with full set, pn532_reset and pn532_wakeup run at full length before probing.
+ * @returns PN532_STATUS_OK, or PN532_STATUS_ERROR if the PN532 never answered.
+ */
+int pn532_bring_up(bool full);
+
+/**
+ * @fn pn532_get_bring_up
+ * ---------------------
+ * @returns how the last bring-up went.
+ */
+const pn532_bring_up_t *pn532_get_bring_up(void);
+
+/**
+ * @fn pn532_print_bring_up
+ * ---------------------
+ * @description: Prints the time the last bring-up took until the PN532 was ready.
+ */
+void pn532_print_bring_up(void);
+
+/**
+ * @fn pn532_set_timing
+ * ---------------------
+ * @description: Switches the SPI timing profile. NULL selects PN532_TIMING_CONSERVATIVE.
+ */
+void pn532_set_timing(const pn532_timing_t *timing);
+
+/**
+ * @fn pn532_enable_irq
+ * ---------------------
+ * @description: Switches pn532_wait_ready from status polling to waiting for the falling
+ * edge of the PN532 IRQ line on irq_pin. Requires gpio_interrupts_init and interrupts to
+ * be enabled. Status is still polled occasionally in case an edge is missed.
+ */
+void pn532_enable_irq(unsigned int irq_pin);
+
+/**
+ * @fn pn532_disable_irq
+ * ---------------------
+ * @description: Returns pn532_wait_ready to status polling, and stops edge detection on
+ * the IRQ pin.
+ */
+void pn532_disable_irq(void);
+
+/**
+ * @fn pn532_get_stats
+ * ---------------------
+ * @returns link statistics accumulated since init or the last pn532_reset_stats.
+ */
+const pn532_stats_t *pn532_get_stats(void);
+
+/**
+ * @fn pn532_reset_stats
+ * ---------------------
+ * @description: Zeroes the link statistics.
  */
-void pn532_init(unsigned int reset_pin, unsigned int nss_pin);
+void pn532_reset_stats(void);
+
+/**
+ * @fn pn532_print_stats
+ * ---------------------
+ * @description: Prints the link statistics.
+ */
+void pn532_print_stats(void);
 
 /**
  * @fn pn532_reset
@@ -117,7 +342,8 @@ void pn532_write_data(uint8_t *data, size_t bufsize);
 /**
  * @fn pn532_wait_ready
  * ---------------------
- * @returns true if this function reads a SPI ready response from pn532 in timeout time
+ * @description: Waits for the IRQ line if enabled, otherwise polls the status byte.
+ * @returns true if this function reads a SPI ready response from pn532 in timeout ms
  */
 bool pn532_wait_ready(unsigned int timeout);
 
@@ -125,18 +351,43 @@ bool pn532_wait_ready(unsigned int timeout);
  * @fn pn532_write_frame
  * ---------------------
  * @description: Structures message to send across spi by adding certain communication bytes.
+ * Data longer than PN532_NORMAL_FRAME_MAX_LENGTH goes out as an extended frame.
  * @returns PN532_STATUS_ERROR if failed and PN532_STATUS_OK if suceeded
  */
 int pn532_write_frame(uint8_t *data, size_t bufsize);
 
 /**
- * @fn pn532_write_frame
+ * @fn pn532_read_frame
  * ---------------------
- * @description: Reads response frame of at most bufsize bytes.
+ * @description: Reads response frame of at most bufsize bytes, clocking only as many
+ * bytes as the frame is long.
  * @returns PN532_STATUS_ERROR if failed and PN532_STATUS_OK if suceeded
  */
 int pn532_read_frame(uint8_t *data, size_t bufsize);
 
+/**
+ * @fn pn532_decoder_init
+ * ---------------------
+ * @description: Starts decoding a new frame whose data goes to data (capacity bytes).
+ */
+void pn532_decoder_init(pn532_decoder_t *decoder, uint8_t *data, size_t capacity);
+
+/**
+ * @fn pn532_decoder_feed
+ * ---------------------
+ * @description: Runs count received bytes through the decoder. Stops at the end of the
+ * frame or at the first error (state PN532_DECODE_ERROR, reason in error).
+ * @returns number of bytes consumed.
+ */
+size_t pn532_decoder_feed(pn532_decoder_t *decoder, const uint8_t *bytes, size_t count);
+
+/**
+ * @fn pn532_decoder_need
+ * ---------------------
+ * @returns the least number of bytes the frame still needs, 0 once done or failed.
+ */
+size_t pn532_decoder_need(const pn532_decoder_t *decoder);
+
 /**
  * @fn pn532_send_receive
  * ---------------------
@@ -145,6 +396,69 @@ int pn532_read_frame(uint8_t *data, size_t bufsize);
  */
 int pn532_send_receive(uint8_t command, uint8_t *response, size_t response_length, uint8_t *params, size_t params_length, unsigned int timeout);
 
+/**
+ * @fn pn532_send_receive_once
+ * ---------------------
+ * @description: Like pn532_send_receive, but once the PN532 has acknowledged the command
+ * it is never sent again, even if its response cannot be read: for commands whose effect
+ * must not happen twice, such as passing a message chunk to an NFC-DEP peer.
+ * @returns number of bytes received back from the HAT, or PN532_STATUS_ERROR.
+ */
+int pn532_send_receive_once(uint8_t command, uint8_t *response, size_t response_length, uint8_t *params, size_t params_length, unsigned int timeout);
+
+/**
+ * @fn pn532_link_generation
+ * ---------------------
+ * @returns a counter that changes whenever the PN532 may have lost its configuration:
+ * on reset, wakeup and every exchange that lost a frame. State cached about the chip is
+ * only valid while this stays the same. A command that merely timed out, such as a
+ * target listing with no card in the field, leaves it alone.
+ */
+unsigned int pn532_link_generation(void);
+
+/**
+ * @fn pn532_send_command
+ * ---------------------
+ * @description: First half of pn532_send_receive: sends command with params and waits for
+ * the ACK, leaving the PN532 executing it. For commands that can run for seconds, such as
+ * InAutoPoll; collect the answer with pn532_await_response or cancel with pn532_abort.
+ * @returns PN532_STATUS_OK once the command is acknowledged, else PN532_STATUS_ERROR.
+ */
+int pn532_send_command(uint8_t command, uint8_t *params, size_t params_length, unsigned int timeout);
+
+/**
+ * @fn pn532_await_response
+ * ---------------------
+ * @description: Waits up to timeout ms (0 waits forever) for the response to a command
+ * started with pn532_send_command and writes it into response. The wait is built for
+ * idling: in IRQ mode it sleeps on the IRQ line and only checks status once a second.
+ * @returns number of response bytes, or PN532_STATUS_ERROR if none arrived in time.
+ */
+int pn532_await_response(uint8_t command, uint8_t *response, size_t response_length, unsigned int timeout);
+
+/**
+ * @fn pn532_abort
+ * ---------------------
+ * @description: Sends an ACK frame, which makes the PN532 drop the command it is running.
+ */
+void pn532_abort(void);
+
+/**
+ * @fn pn532_frame_prebuild
+ * ---------------------
+ * @description: Builds the complete SPI write for command with params into frame.
+ * @returns PN532_STATUS_ERROR if the frame does not fit in PN532_PREBUILT_MAX_LENGTH.
+ */
+int pn532_frame_prebuild(pn532_frame_t *frame, uint8_t command, const uint8_t *params, size_t params_length);
+
+/**
+ * @fn pn532_send_receive_frame
+ * ---------------------
+ * @description: Like pn532_send_receive, for a frame made by pn532_frame_prebuild.
+ * @returns number of bytes received back from the HAT, or PN532_STATUS_ERROR if something went wrong
+ */
+int pn532_send_receive_frame(const pn532_frame_t *frame, uint8_t *response, size_t response_length, unsigned int timeout);
+
 /**
  * @fn pn532_get_firmware
  * ---------------------
@@ -173,6 +487,22 @@ int pn532_config_normal();
  */
 int pn532_sam_config(uint8_t mode, uint8_t timeout, uint8_t use_irq_pin);
 
+/**
+ * @fn pn532_rf_configuration
+ * ---------------------
+ * @description: Sends RFConfiguration item (PN532_RFCONFIG_*) with its configuration data.
+ * @returns PN532_STATUS_OK after completing
+ */
+int pn532_rf_configuration(uint8_t item, const uint8_t *data, size_t length);
+
+/**
+ * @fn pn532_set_parameters
+ * ---------------------
+ * @description: Sets the PN532's internal parameter flags (PN532_PARAM_*).
+ * @returns PN532_STATUS_OK after completing
+ */
+int pn532_set_parameters(uint8_t flags);
+
 int tag_data_dump();
 
 #endif // _PN532_H
\ No newline at end of file
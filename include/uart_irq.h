@@ -0,0 +1,45 @@
+/**
+ * @file uart_irq.h
+ * ---------------------
+ * @brief Mini UART transmit side for interrupt-driven output: the TX FIFO and its
+ * "FIFO empty" interrupt. libpi's uart module keeps the line set up; this only adds what
+ * it leaves out. The host tests replace it with a simulated UART.
+ */
+
+#ifndef _UART_IRQ_H
+#define _UART_IRQ_H
+
+#include <interrupts.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @fn uart_irq_init
+ * ---------------------
+ * @description: Routes the mini UART interrupt to handler, which runs whenever the TX
+ * interrupt is enabled and the TX FIFO is empty. Interrupts must be initialized.
+ */
+void uart_irq_init(handler_fn_t handler);
+
+/**
+ * @fn uart_irq_tx_ready
+ * ---------------------
+ * @returns true if the TX FIFO can take another byte.
+ */
+bool uart_irq_tx_ready(void);
+
+/**
+ * @fn uart_irq_tx_put
+ * ---------------------
+ * @description: Puts a byte in the TX FIFO, which must have room for it.
+ */
+void uart_irq_tx_put(uint8_t byte);
+
+/**
+ * @fn uart_irq_tx_enable
+ * ---------------------
+ * @description: Turns the TX FIFO empty interrupt on or off.
+ */
+void uart_irq_tx_enable(bool enable);
+
+#endif // _UART_IRQ_H
@@ -0,0 +1,30 @@
+/**
+ * @file uid.h
+ * ---------------------
+ * @brief Card UIDs as keys: the hash and the length check shared by the tables keyed by
+ * UID (accounts.h, denylist.h).
+ */
+
+#ifndef _UID_H
+#define _UID_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @fn uid_hash
+ * ---------------------
+ * @description: 32-bit FNV-1a of the UID. Its length goes in first, so a 4-byte UID and
+ * a longer one starting with the same bytes land apart.
+ */
+uint32_t uid_hash(const uint8_t *uid, size_t uid_length);
+
+/**
+ * @fn uid_length_valid
+ * ---------------------
+ * @returns true if uid_length is that of an ISO/IEC 14443-3 UID: 4, 7 or 10 bytes.
+ */
+bool uid_length_valid(size_t uid_length);
+
+#endif // _UID_H
@@ -12,9 +12,11 @@
 #include <interrupts.h>
 #include <gpio_interrupts.h>
 #include <nfc.h>
+#include <console.h>
 
 static const unsigned int RESET_PIN = GPIO_PIN20;
 static const unsigned int NSS_PIN = GPIO_PIN4;
+static const unsigned int IRQ_PIN = GPIO_PIN12; // jumper the HAT's IRQ line to this pin
 
 void main(void)
 {
@@ -22,11 +24,16 @@ void main(void)
     interrupts_init();
     gpio_interrupts_init();
     interrupts_global_enable(); // everything fully initialized, now turn on interrupts
+    console_init();
     keyboard_init(GPIO_PIN5, GPIO_PIN6);
-    shell_init(printf);
-    nfc_init(RESET_PIN, NSS_PIN);
+    shell_init(console_printf);
+    nfc_init(RESET_PIN, NSS_PIN, &PN532_TIMING_FAST);
+    pn532_print_bring_up();
+    pn532_enable_irq(IRQ_PIN);
+    nfc_apply_tuning(&NFC_TUNING_FAST_GATE);
 
     shell_run();
 
+    console_flush();
     uart_putchar(EOT);
 }
\ No newline at end of file
@@ -0,0 +1,147 @@
+/**
+ * @file accounts.c
+ * ---------------------
+ * @brief Implements accounts.h
+ */
+
+#include <accounts.h>
+#include <uid.h>
+#include <console.h>
+#include <string.h>
+
+#define SLOT_MASK (ACCOUNTS_SLOTS - 1)
+
+static account_t _slots[ACCOUNTS_SLOTS];
+static size_t _count;
+static accounts_stats_t _stats;
+
+/**
+ * @fn find_slot
+ * ---------------------
+ * @description: Probes from the home slot of uid until it finds its account or an empty
+ * slot. Accounts are never removed, so no account lies beyond an empty slot, nor further
+ * than max_displacement from home.
+ * @param probes: receives the number of slots looked at.
+ * @returns the slot of the account, else the empty slot it would go in, or NULL if
+ * there is neither within max_displacement.
+ */
+static account_t *find_slot(const uint8_t *uid, size_t uid_length, size_t max_displacement, size_t *probes)
+{
+    size_t home = uid_hash(uid, uid_length) & SLOT_MASK;
+    for (size_t i = 0; i <= max_displacement; i++)
+    {
+        account_t *slot = &_slots[(home + i) & SLOT_MASK];
+        *probes = i + 1;
+        if (slot->uid_length == 0 || (slot->uid_length == uid_length && memcmp(slot->uid, uid, uid_length) == 0))
+        {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+account_t *accounts_find(const uint8_t *uid, size_t uid_length)
+{
+    size_t probes;
+    account_t *slot = find_slot(uid, uid_length, _stats.max_displacement, &probes);
+    _stats.lookups++;
+    _stats.probes += probes;
+    return slot && slot->uid_length != 0 ? slot : NULL;
+}
+
+account_t *accounts_add(const uint8_t *uid, size_t uid_length, int32_t balance)
+{
+    if (!uid_length_valid(uid_length) || _count == ACCOUNTS_MAX)
+    {
+        return NULL;
+    }
+
+    // The table is at most half full, so an empty slot always turns up.
+    size_t probes;
+    account_t *slot = find_slot(uid, uid_length, ACCOUNTS_SLOTS - 1, &probes);
+    if (slot->uid_length != 0)
+    {
+        return NULL;
+    }
+    if (probes - 1 > _stats.max_displacement)
+    {
+        _stats.max_displacement = probes - 1;
+    }
+
+    slot->balance = balance;
+    slot->uid_length = uid_length;
+    memcpy(slot->uid, uid, uid_length);
+    _count++;
+    return slot;
+}
+
+bool accounts_update(const uint8_t *uid, size_t uid_length, int32_t delta, int32_t *balance)
+{
+    account_t *account = accounts_find(uid, uid_length);
+    if (!account)
+    {
+        return false;
+    }
+    account->balance += delta;
+    if (balance)
+    {
+        *balance = account->balance;
+    }
+    return true;
+}
+
+bool accounts_set(const uint8_t *uid, size_t uid_length, int32_t balance, int32_t *old_balance)
+{
+    account_t *account = accounts_find(uid, uid_length);
+    if (!account)
+    {
+        return false;
+    }
+    if (old_balance)
+    {
+        *old_balance = account->balance;
+    }
+    account->balance = balance;
+    return true;
+}
+
+const account_t *accounts_next(size_t *position)
+{
+    while (*position < ACCOUNTS_SLOTS)
+    {
+        const account_t *slot = &_slots[(*position)++];
+        if (slot->uid_length != 0)
+        {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+size_t accounts_count(void)
+{
+    return _count;
+}
+
+const accounts_stats_t *accounts_get_stats(void)
+{
+    return &_stats;
+}
+
+void accounts_print_stats(void)
+{
+    console_printf("Accounts: %d of %d in %d slots, ", (int)_count, ACCOUNTS_MAX, ACCOUNTS_SLOTS);
+    if (_stats.lookups > 0)
+    {
+        console_printf("%d lookups, %d.%02d probes each, ", _stats.lookups, _stats.probes / _stats.lookups,
+                       100 * (_stats.probes % _stats.lookups) / _stats.lookups);
+    }
+    console_printf("at most %d probes\n", _stats.max_displacement + 1);
+}
+
+void accounts_clear(void)
+{
+    memset(_slots, 0, sizeof(_slots));
+    _count = 0;
+    memset(&_stats, 0, sizeof(_stats));
+}
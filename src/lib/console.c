@@ -0,0 +1,241 @@
+/**
+ * @file console.c
+ * ---------------------
+ * @brief Implements console.h
+ */
+
+#include <console.h>
+#include <uart_irq.h>
+#include <printf.h>
+#include <timer.h>
+#include <stdarg.h>
+
+// Table rows: 16 bytes as hex after a label.
+#define TABLE_ROW_BYTES (16)
+#define TABLE_LINE_MAX (16 + 3 * TABLE_ROW_BYTES)
+
+// The interrupt handler only moves _tail and the writers only move _head; both count up
+// forever and index the buffer modulo its size.
+static volatile uint8_t _tx[CONSOLE_TX_BUFFER_SIZE];
+static volatile unsigned int _head, _tail;
+static bool _irq_driven;
+
+/**
+ * @fn tx_handler
+ * ---------------------
+ * @description: Mini UART interrupt: refills the TX FIFO from the ring buffer and turns
+ * the interrupt off once the buffer is empty.
+ */
+static bool tx_handler(unsigned int pc)
+{
+    while (_tail != _head && uart_irq_tx_ready())
+    {
+        uart_irq_tx_put(_tx[_tail % CONSOLE_TX_BUFFER_SIZE]);
+        _tail++;
+    }
+    if (_tail == _head)
+    {
+        uart_irq_tx_enable(false);
+        // A byte queued since the check above would otherwise wait for the next write.
+        if (_tail != _head)
+        {
+            uart_irq_tx_enable(true);
+        }
+    }
+    return true;
+}
+
+void console_init(void)
+{
+    _head = _tail = 0;
+    uart_irq_init(tx_handler);
+    _irq_driven = true;
+}
+
+/**
+ * @fn queue_byte
+ * ---------------------
+ * @description: Adds a byte to the ring buffer, waiting for room if it is full. Before
+ * console_init the byte goes straight to the UART.
+ */
+static void queue_byte(uint8_t byte)
+{
+    if (!_irq_driven)
+    {
+        while (!uart_irq_tx_ready())
+        {
+            timer_delay_us(CONSOLE_BYTE_US);
+        }
+        uart_irq_tx_put(byte);
+        return;
+    }
+    while (_head - _tail == CONSOLE_TX_BUFFER_SIZE)
+    {
+        uart_irq_tx_enable(true);
+        timer_delay_us(CONSOLE_BYTE_US);
+    }
+    _tx[_head % CONSOLE_TX_BUFFER_SIZE] = byte;
+    _head++;
+}
+
+/**
+ * @fn start_tx
+ * ---------------------
+ * @description: Lets the interrupt drain what was just queued.
+ */
+static void start_tx(void)
+{
+    if (_irq_driven && _head != _tail)
+    {
+        uart_irq_tx_enable(true);
+    }
+}
+
+/**
+ * @fn queue_text
+ * ---------------------
+ * @description: Queues text with "\n" sent as "\r\n".
+ */
+static void queue_text(const char *text, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        if (text[i] == '\n')
+        {
+            queue_byte('\r');
+        }
+        queue_byte(text[i]);
+    }
+    start_tx();
+}
+
+int console_printf(const char *format, ...)
+{
+    char buf[CONSOLE_FORMAT_MAX];
+    va_list args;
+
+    va_start(args, format);
+    int length = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (length < 0)
+    {
+        return length;
+    }
+    queue_text(buf, length < sizeof(buf) ? length : sizeof(buf) - 1);
+    return length;
+}
+
+void console_write(const uint8_t *bytes, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        queue_byte(bytes[i]);
+    }
+    start_tx();
+}
+
+void console_print_table(const uint8_t *bytes, size_t length, size_t first_label, size_t label_step)
+{
+    char line[TABLE_LINE_MAX];
+    size_t columns = length < TABLE_ROW_BYTES ? length : TABLE_ROW_BYTES;
+
+    // Header: "\n     " and the column numbers, right-aligned in 2 characters.
+    size_t n = 0;
+    line[n++] = '\n';
+    for (int i = 0; i < 5; i++)
+    {
+        line[n++] = ' ';
+    }
+    for (size_t i = 0; i < columns; i++)
+    {
+        n += format_decimal(line + n, i, 2, ' ');
+        line[n++] = ' ';
+    }
+    queue_text(line, n);
+
+    for (size_t row = 0; row * TABLE_ROW_BYTES < length; row++)
+    {
+        size_t count = length - row * TABLE_ROW_BYTES;
+        n = 0;
+        line[n++] = '\n';
+        n += format_decimal(line + n, first_label + row * label_step, 2, '0');
+        line[n++] = ' ';
+        line[n++] = ':';
+        line[n++] = ' ';
+        n += format_hex_bytes(line + n, bytes + row * TABLE_ROW_BYTES, count < TABLE_ROW_BYTES ? count : TABLE_ROW_BYTES);
+        queue_text(line, n);
+    }
+    queue_text("\n", 1);
+}
+
+size_t console_pending(void)
+{
+    return _head - _tail;
+}
+
+void console_flush(void)
+{
+    start_tx();
+    while (_head != _tail)
+    {
+        timer_delay_us(CONSOLE_BYTE_US);
+    }
+}
+
+size_t format_hex_bytes(char *out, const uint8_t *bytes, size_t count)
+{
+    static const char DIGITS[] = "0123456789abcdef";
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        out[n++] = DIGITS[bytes[i] >> 4];
+        out[n++] = DIGITS[bytes[i] & 0x0F];
+        out[n++] = ' ';
+    }
+    out[n] = '\0';
+    return n;
+}
+
+int parse_hex_bytes(const char *text, uint8_t *bytes, size_t max_length)
+{
+    size_t digits = 0;
+    for (; *text != '\0'; text++)
+    {
+        char c = *text;
+        if (c == ' ' || c == ':')
+        {
+            continue;
+        }
+        int value = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (value < 0 || digits == 2 * max_length)
+        {
+            return -1;
+        }
+        bytes[digits / 2] = digits % 2 ? (bytes[digits / 2] << 4) | value : value;
+        digits++;
+    }
+    return digits % 2 == 0 ? (int)(digits / 2) : -1;
+}
+
+size_t format_decimal(char *out, unsigned int value, size_t width, char pad)
+{
+    char digits[10];
+    size_t count = 0;
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+
+    size_t n = 0;
+    while (n + count < width)
+    {
+        out[n++] = pad;
+    }
+    while (count > 0)
+    {
+        out[n++] = digits[--count];
+    }
+    out[n] = '\0';
+    return n;
+}
@@ -0,0 +1,148 @@
+/**
+ * @file denylist.c
+ * ---------------------
+ * @brief Implements denylist.h
+ */
+
+#include <denylist.h>
+#include <uid.h>
+#include <console.h>
+#include <string.h>
+
+#define SLOT_MASK (DENYLIST_SLOTS - 1)
+#define BLOOM_MASK (DENYLIST_BLOOM_BITS - 1)
+
+typedef struct
+{
+    uint8_t uid_length;
+    uint8_t uid[DENYLIST_UID_MAX_LENGTH];
+} revoked_t;
+
+static uint32_t _bloom[DENYLIST_BLOOM_BITS / 32];
+static revoked_t _slots[DENYLIST_SLOTS];
+static size_t _count;
+static denylist_stats_t _stats;
+
+/**
+ * @fn bloom_step
+ * ---------------------
+ * @description: Second hash for the Bloom filter, derived from the first by a
+ * multiply-xorshift mix. The bits of a UID are hash + i * step for i < k (double
+ * hashing); step is odd so they never repeat.
+ */
+static uint32_t bloom_step(uint32_t hash)
+{
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    return hash | 1;
+}
+
+/**
+ * @fn find_slot
+ * ---------------------
+ * @returns the slot of uid in the exact set, or the empty slot where probing for it
+ * ends. UIDs are never removed one by one, so no tombstones are needed.
+ */
+static revoked_t *find_slot(const uint8_t *uid, size_t uid_length, uint32_t hash)
+{
+    for (size_t i = hash & SLOT_MASK;; i = (i + 1) & SLOT_MASK)
+    {
+        revoked_t *slot = &_slots[i];
+        if (slot->uid_length == 0 || (slot->uid_length == uid_length && memcmp(slot->uid, uid, uid_length) == 0))
+        {
+            return slot;
+        }
+    }
+}
+
+bool denylist_add(const uint8_t *uid, size_t uid_length)
+{
+    if (!uid_length_valid(uid_length))
+    {
+        return false;
+    }
+
+    uint32_t hash = uid_hash(uid, uid_length);
+    revoked_t *slot = find_slot(uid, uid_length, hash);
+    if (slot->uid_length != 0)
+    {
+        return true;
+    }
+    if (_count == DENYLIST_MAX)
+    {
+        return false;
+    }
+    slot->uid_length = uid_length;
+    memcpy(slot->uid, uid, uid_length);
+    _count++;
+
+    uint32_t step = bloom_step(hash);
+    for (int i = 0; i < DENYLIST_BLOOM_HASHES; i++, hash += step)
+    {
+        _bloom[(hash & BLOOM_MASK) / 32] |= 1u << (hash % 32);
+    }
+    return true;
+}
+
+bool denylist_contains(const uint8_t *uid, size_t uid_length)
+{
+    _stats.checks++;
+    uint32_t hash = uid_hash(uid, uid_length);
+    uint32_t bit = hash, step = bloom_step(hash);
+    for (int i = 0; i < DENYLIST_BLOOM_HASHES; i++, bit += step)
+    {
+        if (!(_bloom[(bit & BLOOM_MASK) / 32] & (1u << (bit % 32))))
+        {
+            return false;
+        }
+    }
+
+    _stats.filter_passes++;
+    if (find_slot(uid, uid_length, hash)->uid_length == 0)
+    {
+        return false;
+    }
+    _stats.hits++;
+    return true;
+}
+
+bool denylist_parse_uid(const char *text, uint8_t *uid, size_t *uid_length)
+{
+    int length = parse_hex_bytes(text, uid, DENYLIST_UID_MAX_LENGTH);
+    if (length < 0 || !uid_length_valid(length))
+    {
+        return false;
+    }
+    *uid_length = length;
+    return true;
+}
+
+size_t denylist_count(void)
+{
+    return _count;
+}
+
+const denylist_stats_t *denylist_get_stats(void)
+{
+    return &_stats;
+}
+
+void denylist_reset_stats(void)
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+void denylist_print_stats(void)
+{
+    console_printf("Deny list: %d revoked UIDs, %d checks, %d passed the filter, %d revoked\n", (int)_count,
+                   _stats.checks, _stats.filter_passes, _stats.hits);
+}
+
+void denylist_clear(void)
+{
+    memset(_bloom, 0, sizeof(_bloom));
+    memset(_slots, 0, sizeof(_slots));
+    _count = 0;
+    denylist_reset_stats();
+}
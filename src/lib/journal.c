@@ -0,0 +1,325 @@
+/**
+ * @file journal.c
+ * ---------------------
+ * @brief Implements journal.h
+ */
+
+#include <journal.h>
+#include <nfc_dump.h>
+#include <console.h>
+#include <timer.h>
+#include <string.h>
+
+#define RECORD_UID_OFFSET (22)
+#define RECORD_CRC_OFFSET (JOURNAL_RECORD_LENGTH - 2)
+
+// Entries [_committed, _head) are pending; both count up forever and index the ring
+// modulo its size.
+static journal_entry_t _ring[JOURNAL_CAPACITY];
+static unsigned int _head, _committed;
+static uint32_t _sequence;
+static journal_stats_t _stats;
+
+// The device and the block being filled, kept as it is on the device.
+static journal_device_t _device;
+static bool _attached;
+static uint8_t _block[JOURNAL_BLOCK_MAX];
+static size_t _block_number, _block_fill;
+
+static void put32(uint8_t *out, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        out[i] = value >> (8 * i);
+    }
+}
+
+static uint32_t get32(const uint8_t *in)
+{
+    return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+void journal_encode(const journal_entry_t *entry, uint8_t *out)
+{
+    memset(out, 0, JOURNAL_RECORD_LENGTH);
+    put32(out, entry->sequence);
+    put32(out + 4, entry->ticks);
+    put32(out + 8, entry->old_balance);
+    put32(out + 12, entry->new_balance);
+    put32(out + 16, entry->amount);
+    out[20] = entry->status;
+    out[21] = entry->uid_length;
+    memcpy(out + RECORD_UID_OFFSET, entry->uid, entry->uid_length);
+    uint16_t crc = nfc_dump_crc(out, RECORD_CRC_OFFSET);
+    out[RECORD_CRC_OFFSET] = crc >> 8;
+    out[RECORD_CRC_OFFSET + 1] = crc & 0xFF;
+}
+
+bool journal_decode(const uint8_t *record, journal_entry_t *entry)
+{
+    uint16_t crc = record[RECORD_CRC_OFFSET] << 8 | record[RECORD_CRC_OFFSET + 1];
+    if (record[21] > JOURNAL_UID_MAX_LENGTH || nfc_dump_crc(record, RECORD_CRC_OFFSET) != crc)
+    {
+        return false;
+    }
+    entry->sequence = get32(record);
+    entry->ticks = get32(record + 4);
+    entry->old_balance = get32(record + 8);
+    entry->new_balance = get32(record + 12);
+    entry->amount = get32(record + 16);
+    entry->status = record[20];
+    entry->uid_length = record[21];
+    memset(entry->uid, 0, sizeof(entry->uid));
+    memcpy(entry->uid, record + RECORD_UID_OFFSET, entry->uid_length);
+    return true;
+}
+
+/**
+ * @fn records_per_block
+ * ---------------------
+ * @returns number of records that fit in a block of the attached device.
+ */
+static size_t records_per_block(void)
+{
+    return _device.block_size / JOURNAL_RECORD_LENGTH;
+}
+
+/**
+ * @fn next_block
+ * ---------------------
+ * @description: Moves on to an empty block after the current one, wrapping around the
+ * device and overwriting its oldest records.
+ */
+static void next_block(void)
+{
+    _block_number = (_block_number + 1) % _device.block_count;
+    _block_fill = 0;
+    memset(_block, 0, sizeof(_block));
+}
+
+/**
+ * @fn find_newest
+ * ---------------------
+ * @description: Scans the device for the record with the highest sequence number and
+ * leaves the block it is in staged, with the records up to it.
+ * @returns 0, or -1 if a block could not be read.
+ */
+static int find_newest(void)
+{
+    bool found = false;
+    uint32_t newest = 0;
+    size_t newest_block = 0, newest_fill = 0;
+
+    for (size_t block = 0; block < _device.block_count; block++)
+    {
+        if (_device.read(_device.context, block, _block) != 0)
+        {
+            return -1;
+        }
+        for (size_t slot = 0; slot < records_per_block(); slot++)
+        {
+            journal_entry_t entry;
+            if (journal_decode(_block + slot * JOURNAL_RECORD_LENGTH, &entry) && (!found || entry.sequence > newest))
+            {
+                found = true;
+                newest = entry.sequence;
+                newest_block = block;
+                newest_fill = slot + 1;
+            }
+        }
+    }
+
+    memset(_block, 0, sizeof(_block));
+    _block_number = 0;
+    _block_fill = 0;
+    if (!found)
+    {
+        return 0;
+    }
+    if (_device.read(_device.context, newest_block, _block) != 0)
+    {
+        return -1;
+    }
+    memset(_block + newest_fill * JOURNAL_RECORD_LENGTH, 0, sizeof(_block) - newest_fill * JOURNAL_RECORD_LENGTH);
+    _block_number = newest_block;
+    _block_fill = newest_fill;
+    if (_block_fill == records_per_block())
+    {
+        next_block();
+    }
+
+    // Number what is pending, and everything after it, on from the newest record.
+    _sequence = newest + 1;
+    for (unsigned int i = _committed; i != _head; i++)
+    {
+        _ring[i % JOURNAL_CAPACITY].sequence = _sequence++;
+    }
+    return 0;
+}
+
+int journal_attach(const journal_device_t *device)
+{
+    _attached = false;
+    if (!device)
+    {
+        _committed = _head;
+        return 0;
+    }
+    if (device->block_size > JOURNAL_BLOCK_MAX || device->block_size < JOURNAL_RECORD_LENGTH || device->block_count == 0)
+    {
+        console_printf("Journal: device blocks of %d bytes not supported\n", (int)device->block_size);
+        return -1;
+    }
+
+    _device = *device;
+    if (find_newest() != 0)
+    {
+        console_printf("Journal: device could not be read\n");
+        return -1;
+    }
+    _attached = true;
+    return 0;
+}
+
+void journal_append(const uint8_t *uid, size_t uid_length, int32_t old_balance, int32_t new_balance, int32_t amount, uint8_t status)
+{
+    if (_head - _committed == JOURNAL_CAPACITY)
+    {
+        _committed++;
+        _stats.dropped++;
+    }
+
+    journal_entry_t *entry = &_ring[_head % JOURNAL_CAPACITY];
+    if (uid_length > JOURNAL_UID_MAX_LENGTH)
+    {
+        uid_length = JOURNAL_UID_MAX_LENGTH;
+    }
+    entry->sequence = _sequence++;
+    entry->ticks = timer_get_ticks();
+    entry->old_balance = old_balance;
+    entry->new_balance = new_balance;
+    entry->amount = amount;
+    entry->status = status;
+    entry->uid_length = uid_length;
+    memcpy(entry->uid, uid, uid_length);
+    _head++;
+    _stats.appended++;
+
+    // Without a device there is nothing to commit to.
+    if (!_attached)
+    {
+        _committed = _head;
+    }
+}
+
+int journal_commit(void)
+{
+    if (!_attached || _committed == _head)
+    {
+        return 0;
+    }
+
+    // Stage records until a block is full or nothing is left, then write the block. Only
+    // entries in a block that was written count as committed.
+    size_t fill_start = _block_fill;
+    unsigned int next = _committed;
+    while (next != _head)
+    {
+        journal_encode(&_ring[next % JOURNAL_CAPACITY], _block + _block_fill * JOURNAL_RECORD_LENGTH);
+        _block_fill++;
+        next++;
+        if (_block_fill < records_per_block() && next != _head)
+        {
+            continue;
+        }
+
+        if (_device.write(_device.context, _block_number, _block) != 0)
+        {
+            memset(_block + fill_start * JOURNAL_RECORD_LENGTH, 0, (_block_fill - fill_start) * JOURNAL_RECORD_LENGTH);
+            _block_fill = fill_start;
+            _stats.write_errors++;
+            console_printf("Journal: write of block %d failed\n", (int)_block_number);
+            return -1;
+        }
+        _stats.block_writes++;
+        _stats.committed += next - _committed;
+        _committed = next;
+        if (_block_fill == records_per_block())
+        {
+            next_block();
+        }
+        fill_start = _block_fill;
+    }
+    _stats.commits++;
+    return 0;
+}
+
+size_t journal_pending(void)
+{
+    return _head - _committed;
+}
+
+bool journal_get(size_t index, journal_entry_t *entry)
+{
+    if (index >= _head || index >= JOURNAL_CAPACITY)
+    {
+        return false;
+    }
+    *entry = _ring[(_head - 1 - index) % JOURNAL_CAPACITY];
+    return true;
+}
+
+const journal_stats_t *journal_get_stats(void)
+{
+    return &_stats;
+}
+
+/**
+ * @fn print_balance
+ * ---------------------
+ * @description: Prints a balance, or "?" if it is not known.
+ */
+static void print_balance(int32_t balance)
+{
+    if (balance == JOURNAL_BALANCE_UNKNOWN)
+    {
+        console_printf("?");
+    }
+    else
+    {
+        console_printf("%d", (int)balance);
+    }
+}
+
+void journal_print(size_t count)
+{
+    journal_entry_t entry;
+    char uid[3 * JOURNAL_UID_MAX_LENGTH + 1];
+
+    for (size_t i = count; i-- > 0;)
+    {
+        if (!journal_get(i, &entry))
+        {
+            continue;
+        }
+        format_hex_bytes(uid, entry.uid, entry.uid_length);
+        console_printf("#%d at %d ms: %d, ", (int)entry.sequence, (int)(entry.ticks / 1000), (int)entry.amount);
+        print_balance(entry.old_balance);
+        console_printf(" -> ");
+        print_balance(entry.new_balance);
+        console_printf(", status 0x%02x, UID %s\n", entry.status, uid);
+    }
+    console_printf("Journal: %d appended, %d committed in %d commits (%d block writes), %d pending, %d dropped, %d write errors%s\n",
+                   _stats.appended, _stats.committed, _stats.commits, _stats.block_writes, (int)journal_pending(),
+                   _stats.dropped, _stats.write_errors, _attached ? "" : ", no device");
+}
+
+void journal_reset(void)
+{
+    _head = _committed = 0;
+    _sequence = 0;
+    _attached = false;
+    _block_number = _block_fill = 0;
+    memset(_block, 0, sizeof(_block));
+    memset(&_stats, 0, sizeof(_stats));
+}
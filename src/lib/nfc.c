@@ -5,303 +5,2225 @@
  */
 
 #include <nfc.h>
+#include <console.h>
+#include <journal.h>
+#include <accounts.h>
+#include <denylist.h>
 
 #define BALANCE_BLOCK 6
+#define MIFARE_1K_BLOCKS 64
+#define MIFARE_BLOCKS_PER_SECTOR 4
 
-void nfc_init(unsigned int reset_pin, unsigned int nss_pin)
+static const nfc_key_t KEY_DEFAULT = {
+    .key_type = MIFARE_CMD_AUTH_A,
+    .key = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF},
+    .sectors = NFC_KEY_ALL_SECTORS,
+};
+
+// InListPassiveTarget for one ISO14443A target at 106 kbps, the only listing ever sent.
+static const uint8_t LIST_ONE_106A[] = {0x01, PN532_MIFARE_ISO14443A};
+static pn532_frame_t _list_one_106a;
+
+const nfc_autopoll_t NFC_AUTOPOLL_DEFAULT = {
+    .poll_count = PN532_AUTOPOLL_FOREVER,
+    .period = 1,
+    .types = {PN532_AUTOPOLL_MIFARE},
+    .type_count = 1,
+};
+static nfc_autopoll_t _autopoll;
+static bool _autopoll_enabled;
+static nfc_detect_stats_t _detect_stats;
+
+const nfc_tuning_t NFC_TUNING_DEFAULT = {
+    .name = "default",
+    .field = PN532_RF_FIELD_ON | PN532_RF_FIELD_AUTO_RFCA,
+    .atr_res_timeout = 0x0B, // 102.4 ms
+    .retry_timeout = 0x0A,   // 51.2 ms
+    .max_retry_com = 0,
+    .max_retry_atr = PN532_RETRY_FOREVER,
+    .max_retry_psl = 1,
+    .max_retry_passive = PN532_RETRY_FOREVER,
+    .parameter_flags = PN532_PARAM_AUTO_ATR_RES | PN532_PARAM_AUTO_RATS,
+};
+const nfc_tuning_t NFC_TUNING_FAST_GATE = {
+    .name = "fast-gate",
+    .field = PN532_RF_FIELD_ON | PN532_RF_FIELD_AUTO_RFCA,
+    .atr_res_timeout = 0x08, // 12.8 ms
+    .retry_timeout = 0x07,   // 6.4 ms
+    .max_retry_com = 0,
+    .max_retry_atr = 1,
+    .max_retry_psl = 1,
+    .max_retry_passive = 2,
+    .parameter_flags = PN532_PARAM_AUTO_ATR_RES,
+};
+const nfc_tuning_t NFC_TUNING_ROBUST = {
+    .name = "robust",
+    .field = PN532_RF_FIELD_ON | PN532_RF_FIELD_AUTO_RFCA,
+    .atr_res_timeout = 0x0C, // 204.8 ms
+    .retry_timeout = 0x0C,   // 204.8 ms
+    .max_retry_com = 3,
+    .max_retry_atr = PN532_RETRY_FOREVER,
+    .max_retry_psl = 3,
+    .max_retry_passive = PN532_RETRY_FOREVER,
+    .parameter_flags = PN532_PARAM_AUTO_ATR_RES | PN532_PARAM_AUTO_RATS,
+};
+static const nfc_tuning_t *const TUNING_PRESETS[] = {&NFC_TUNING_DEFAULT, &NFC_TUNING_FAST_GATE, &NFC_TUNING_ROBUST};
+
+const nfc_provision_template_t NFC_PROVISION_DEFAULT = {
+    .key_a = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF},
+    .access_bits = {0xFF, 0x07, 0x80, 0x69},
+    .key_b = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF},
+};
+
+// What the PN532 is known to hold, for the link generation in _state.generation.
+static nfc_reader_state_t _state = {.target = 1};
+
+// Block cache: 16-byte block images of recently seen cards, keyed by UID. A valid block
+// holds what the card holds; a dirty one is newer and waits to be written back. Blocks
+// stay valid from a card's detection until it is detected again.
+#define BLOCK_BIT(block_number) ((uint64_t)1 << (block_number))
+typedef struct
+{
+    uint8_t uid[MIFARE_UID_MAX_LENGTH];
+    size_t uid_length; // 0: free
+    unsigned int last_used;
+    uint64_t valid;
+    uint64_t dirty;
+    uint8_t blocks[MIFARE_1K_BLOCKS][MIFARE_BLOCK_LENGTH];
+    uint8_t sector_keys[MIFARE_1K_SECTORS]; // key table index + 1 of the key that worked, 0: unknown
+} cache_entry_t;
+static cache_entry_t _cache[NFC_CACHE_TAGS];
+static unsigned int _cache_clock;
+static nfc_cache_stats_t _cache_stats;
+
+static nfc_key_t _keys[NFC_KEY_TABLE_SIZE];
+static size_t _key_count;
+
+/**
+ * @fn state_refresh
+ * ---------------------
+ * @description: Forgets everything known about the PN532 if the link went through a
+ * reset, wakeup or lost frame since the state was recorded. The routing Tg is the
+ * driver's own choice and survives.
+ */
+static void state_refresh(void)
+{
+    if (_state.generation == pn532_link_generation())
+    {
+        return;
+    }
+    _state.generation = pn532_link_generation();
+    _state.sam_normal = false;
+    _state.firmware_known = false;
+    _state.tuning_known = false;
+    _state.tuning.name = "unknown";
+    _state.target_uid_length = 0;
+}
+
+/**
+ * @fn state_set_target
+ * ---------------------
+ * @description: Records target as selected: card commands go to its Tg from now on.
+ */
+static void state_set_target(const nfc_target_t *target)
+{
+    state_refresh();
+    _state.target = target->tg;
+    _state.target_uid_length = target->uid_length;
+    memcpy(_state.target_uid, target->uid, target->uid_length);
+    _state.target_sel_res = target->sel_res;
+}
+
+/**
+ * @fn card_status
+ * ---------------------
+ * @description: Passes a card command's status through. Any failure leaves a MIFARE card
+ * halted (a failed authentication) or gone, so it is no longer known to be selected.
+ */
+static int card_status(int status)
+{
+    if (status != PN532_ERROR_NONE)
+    {
+        _state.target_uid_length = 0;
+    }
+    return status;
+}
+
+void nfc_init(unsigned int reset_pin, unsigned int nss_pin, const pn532_timing_t *timing)
+{
+    pn532_init(reset_pin, nss_pin, timing);
+    pn532_frame_prebuild(&_list_one_106a, PN532_COMMAND_INLISTPASSIVETARGET,
+                         LIST_ONE_106A, sizeof(LIST_ONE_106A));
+    nfc_set_autopoll(&NFC_AUTOPOLL_DEFAULT);
+    nfc_reset_detect_stats();
+    nfc_reset_keys();
+    nfc_reset_cache_stats();
+
+    // The reset in pn532_init restored the chip's default settings and left SAM unset.
+    nfc_invalidate_reader_state();
+    _state.tuning = NFC_TUNING_DEFAULT;
+    _state.tuning_known = true;
+}
+
+int nfc_config_normal(void)
+{
+    state_refresh();
+    if (_state.sam_normal)
+    {
+        return PN532_STATUS_OK;
+    }
+    if (pn532_config_normal() == PN532_STATUS_ERROR)
+    {
+        return PN532_STATUS_ERROR;
+    }
+    state_refresh();
+    _state.sam_normal = true;
+    return PN532_STATUS_OK;
+}
+
+int nfc_get_firmware_version(uint8_t *version)
+{
+    state_refresh();
+    if (!_state.firmware_known)
+    {
+        if (pn532_get_firmware_version(_state.firmware) == PN532_STATUS_ERROR)
+        {
+            return PN532_STATUS_ERROR;
+        }
+        state_refresh();
+        _state.firmware_known = true;
+    }
+    memcpy(version, _state.firmware, sizeof(_state.firmware));
+    return PN532_STATUS_OK;
+}
+
+/**
+ * @fn same_tuning
+ * ---------------------
+ * @returns true if a and b hold the same settings, whatever their names.
+ */
+static bool same_tuning(const nfc_tuning_t *a, const nfc_tuning_t *b)
+{
+    return a->field == b->field && a->atr_res_timeout == b->atr_res_timeout &&
+           a->retry_timeout == b->retry_timeout && a->max_retry_com == b->max_retry_com &&
+           a->max_retry_atr == b->max_retry_atr && a->max_retry_psl == b->max_retry_psl &&
+           a->max_retry_passive == b->max_retry_passive && a->parameter_flags == b->parameter_flags;
+}
+
+int nfc_apply_tuning(const nfc_tuning_t *tuning)
+{
+    uint8_t field[] = {tuning->field};
+    uint8_t timings[] = {0x00, tuning->atr_res_timeout, tuning->retry_timeout};
+    uint8_t retry_com[] = {tuning->max_retry_com};
+    uint8_t retries[] = {tuning->max_retry_atr, tuning->max_retry_psl, tuning->max_retry_passive};
+
+    state_refresh();
+    if (_state.tuning_known && same_tuning(&_state.tuning, tuning))
+    {
+        _state.tuning.name = tuning->name;
+        return PN532_STATUS_OK;
+    }
+
+    _state.tuning_known = false;
+    _state.tuning.name = "unknown";
+    if (pn532_rf_configuration(PN532_RFCONFIG_FIELD, field, sizeof(field)) == PN532_STATUS_ERROR ||
+        pn532_rf_configuration(PN532_RFCONFIG_TIMINGS, timings, sizeof(timings)) == PN532_STATUS_ERROR ||
+        pn532_rf_configuration(PN532_RFCONFIG_MAX_RETRY_COM, retry_com, sizeof(retry_com)) == PN532_STATUS_ERROR ||
+        pn532_rf_configuration(PN532_RFCONFIG_MAX_RETRIES, retries, sizeof(retries)) == PN532_STATUS_ERROR ||
+        pn532_set_parameters(tuning->parameter_flags) == PN532_STATUS_ERROR)
+    {
+        console_printf("Failed to apply RF tuning %s!", tuning->name);
+        return PN532_STATUS_ERROR;
+    }
+    state_refresh();
+    _state.tuning = *tuning;
+    _state.tuning_known = true;
+    return PN532_STATUS_OK;
+}
+
+const nfc_tuning_t *nfc_find_tuning(const char *name)
+{
+    for (size_t i = 0; i < sizeof(TUNING_PRESETS) / sizeof(TUNING_PRESETS[0]); i++)
+    {
+        if (strcmp(TUNING_PRESETS[i]->name, name) == 0)
+        {
+            return TUNING_PRESETS[i];
+        }
+    }
+    return NULL;
+}
+
+const nfc_tuning_t *nfc_get_tuning(void)
+{
+    state_refresh();
+    return &_state.tuning;
+}
+
+/**
+ * @fn print_retries
+ * ---------------------
+ * @description: Prints a retry count, or "forever".
+ */
+static void print_retries(const char *label, uint8_t retries)
+{
+    if (retries == PN532_RETRY_FOREVER)
+        console_printf("%s: forever", label);
+    else
+        console_printf("%s: %d", label, retries);
+}
+
+void nfc_print_tuning(void)
+{
+    state_refresh();
+    console_printf("tuning: %s\n", _state.tuning.name);
+    console_printf("rf field: %s, auto rfca: %s\n", _state.tuning.field & PN532_RF_FIELD_ON ? "on" : "off",
+           _state.tuning.field & PN532_RF_FIELD_AUTO_RFCA ? "on" : "off");
+    console_printf("atr_res timeout: %d us, command timeout: %d us, command retries: %d\n",
+           PN532_TIMEOUT_CODE_US(_state.tuning.atr_res_timeout), PN532_TIMEOUT_CODE_US(_state.tuning.retry_timeout),
+           _state.tuning.max_retry_com);
+    print_retries("atr retries", _state.tuning.max_retry_atr);
+    print_retries(", psl retries", _state.tuning.max_retry_psl);
+    print_retries(", activation retries", _state.tuning.max_retry_passive);
+    console_printf("\nparameters: 0x%02x (auto atr_res: %s, auto rats: %s)\n", _state.tuning.parameter_flags,
+           _state.tuning.parameter_flags & PN532_PARAM_AUTO_ATR_RES ? "on" : "off",
+           _state.tuning.parameter_flags & PN532_PARAM_AUTO_RATS ? "on" : "off");
+}
+
+void nfc_select_target(uint8_t tg)
+{
+    state_refresh();
+    if (_state.target != tg)
+    {
+        _state.target = tg;
+        _state.target_uid_length = 0;
+    }
+}
+
+void nfc_release_targets(void)
+{
+    state_refresh();
+    _state.target_uid_length = 0;
+}
+
+uint8_t nfc_current_target(void)
+{
+    return _state.target;
+}
+
+const nfc_reader_state_t *nfc_get_reader_state(void)
+{
+    state_refresh();
+    return &_state;
+}
+
+void nfc_invalidate_reader_state(void)
+{
+    _state.generation = pn532_link_generation() - 1;
+    state_refresh();
+}
+
+void nfc_print_reader_state(void)
 {
-    pn532_init(reset_pin, nss_pin);
+    state_refresh();
+    console_printf("reader state (link generation %d): sam %s, tuning %s", _state.generation,
+           _state.sam_normal ? "normal" : "unknown", _state.tuning.name);
+    if (_state.firmware_known)
+        console_printf(", firmware %d.%d", _state.firmware[1], _state.firmware[2]);
+    console_printf("\ntarget %d", _state.target);
+    if (_state.target_uid_length == 0)
+        console_printf(", no card known to be selected\n");
+    else
+    {
+        console_printf(", selected card");
+        for (int i = 0; i < _state.target_uid_length; i++)
+            console_printf(" %02x", _state.target_uid[i]);
+        console_printf(" (SEL_RES %02x)\n", _state.target_sel_res);
+    }
+}
+
+void nfc_set_autopoll(const nfc_autopoll_t *config)
+{
+    _autopoll_enabled = config != NULL;
+    if (config)
+    {
+        _autopoll = *config;
+        if (_autopoll.type_count > PN532_AUTOPOLL_MAX_TYPES)
+            _autopoll.type_count = PN532_AUTOPOLL_MAX_TYPES;
+    }
 }
 
 void print_bytes(uint8_t *buf, size_t bufsize)
 {
-    // Print vertical line numbers
-    printf("\n     ");
-    int num_length = bufsize < 16 ? bufsize : 16;
-    for (int i = 0; i < num_length; i++)
+    console_print_table(buf, bufsize, 0, 1);
+}
+
+/**
+ * @fn parse_target_106a
+ * ---------------------
+ * @description: Fills target from one ISO14443A target record: Tg, SENS_RES (2 bytes),
+ * SEL_RES, UID length, UID, and for ISO14443-4 cards the ATS, which is skipped.
+ * @returns length of the record, or PN532_STATUS_ERROR.
+ */
+static int parse_target_106a(const uint8_t *data, size_t length, nfc_target_t *target)
+{
+    if (length < 5 || data[4] > MIFARE_UID_MAX_LENGTH || 5 + (size_t)data[4] > length)
+    {
+        console_printf("Found card with unexpectedly long UID!");
+        return PN532_STATUS_ERROR;
+    }
+    target->tg = data[0];
+    target->type = PN532_MIFARE_ISO14443A;
+    target->baud = target->max_baud = PN532_BAUD_106;
+    target->sens_res[0] = data[1];
+    target->sens_res[1] = data[2];
+    target->sel_res = data[3];
+    target->uid_length = data[4];
+    memcpy(target->uid, data + 5, data[4]);
+
+    size_t record = 5 + data[4];
+    if ((target->sel_res & NFC_SEL_RES_ISO14443_4) && record < length)
+    {
+        // ATS: TL (counting itself), T0, then TA(1) if T0 says so. TA(1) lists the rates
+        // the card takes (DR, high nibble) and sends (DS, low nibble): bit 0 212, bit 1 424.
+        const uint8_t *ats = data + record;
+        if (ats[0] >= 3 && record + ats[0] <= length && (ats[1] & 0x10))
+        {
+            uint8_t rates = ats[2] & (ats[2] >> 4);
+            target->max_baud = (rates & 0x02) ? PN532_BAUD_424 : (rates & 0x01) ? PN532_BAUD_212 : PN532_BAUD_106;
+        }
+        record += ats[0];
+    }
+    return record <= length ? (int)record : PN532_STATUS_ERROR;
+}
+
+/**
+ * @fn parse_target_felica
+ * ---------------------
+ * @description: Fills target from one FeliCa target record: Tg, then the POL_RES: its
+ * length, response code 0x01, IDm, PMm and, if asked for, the system code.
+ * @returns length of the record, or PN532_STATUS_ERROR.
+ */
+static int parse_target_felica(const uint8_t *data, size_t length, uint8_t card_baud, nfc_target_t *target)
+{
+    if (length < 2 || data[1] < 2 + FELICA_IDM_LENGTH + FELICA_PMM_LENGTH || 1 + (size_t)data[1] > length)
+    {
+        console_printf("Found FeliCa card with a malformed polling response!");
+        return PN532_STATUS_ERROR;
+    }
+    target->tg = data[0];
+    target->type = card_baud;
+    target->baud = target->max_baud = card_baud == PN532_FELICA_424 ? PN532_BAUD_424 : PN532_BAUD_212;
+    target->sel_res = 0;
+    target->uid_length = FELICA_IDM_LENGTH;
+    memcpy(target->uid, data + 3, FELICA_IDM_LENGTH);
+    memcpy(target->pmm, data + 3 + FELICA_IDM_LENGTH, FELICA_PMM_LENGTH);
+    return 1 + data[1];
+}
+
+/**
+ * @fn uid_initiator_data
+ * ---------------------
+ * @description: Writes the InListPassiveTarget initiator data that selects the card with
+ * the given UID: the UID, with a cascade tag in front of each of its first cascade levels
+ * for double and triple size UIDs.
+ * @returns number of bytes written, or 0 for an invalid UID length.
+ */
+static size_t uid_initiator_data(const uint8_t *uid, size_t uid_length, uint8_t *data)
+{
+    size_t length = 0, start = 0;
+    if (uid_length != MIFARE_UID_SINGLE_LENGTH && uid_length != MIFARE_UID_DOUBLE_LENGTH &&
+        uid_length != MIFARE_UID_TRIPLE_LENGTH)
+    {
+        return 0;
+    }
+    while (uid_length - start > 4)
+    {
+        data[length++] = NFC_CASCADE_TAG;
+        memcpy(data + length, uid + start, 3);
+        length += 3;
+        start += 3;
+    }
+    memcpy(data + length, uid + start, 4);
+    return length + 4;
+}
+
+/**
+ * @fn list_targets
+ * ---------------------
+ * @description: Sends InListPassiveTarget with params (MaxTg, BrTy, initiator data) and
+ * parses the target records that come back.
+ * @returns number of targets listed, or PN532_STATUS_ERROR.
+ */
+static int list_targets(uint8_t *params, size_t params_length, nfc_target_t *targets, unsigned int timeout)
+{
+    uint8_t buf[PN532_FRAME_MAX_LENGTH];
+    int length = pn532_send_receive(PN532_COMMAND_INLISTPASSIVETARGET, buf, sizeof(buf),
+                                    params, params_length, timeout);
+    // Listing releases whatever was selected before.
+    _state.target_uid_length = 0;
+    if (length < 1)
+    {
+        // No card answered: stop the PN532 from listening on.
+        pn532_abort();
+        return PN532_STATUS_ERROR;
+    }
+
+    size_t count = buf[0] < params[0] ? buf[0] : params[0];
+    size_t position = 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        int record = params[1] == PN532_MIFARE_ISO14443A
+                         ? parse_target_106a(buf + position, length - position, &targets[i])
+                         : parse_target_felica(buf + position, length - position, params[1], &targets[i]);
+        if (record == PN532_STATUS_ERROR)
+        {
+            return PN532_STATUS_ERROR;
+        }
+        position += record;
+    }
+    if (count > 0)
+    {
+        state_set_target(&targets[0]);
+    }
+    return count;
+}
+
+int pn532_list_passive_targets(nfc_target_t *targets, size_t max_targets, const uint8_t *uid, size_t uid_length, unsigned int timeout)
+{
+    uint8_t params[2 + 12];
+    size_t params_length = 2;
+
+    if (max_targets == 0)
+    {
+        return PN532_STATUS_ERROR;
+    }
+    params[0] = max_targets > PN532_MAX_TARGETS ? PN532_MAX_TARGETS : max_targets;
+    params[1] = PN532_MIFARE_ISO14443A;
+    if (uid != NULL)
+    {
+        size_t initiator_length = uid_initiator_data(uid, uid_length, params + 2);
+        if (initiator_length == 0)
+        {
+            return PN532_STATUS_ERROR;
+        }
+        params_length += initiator_length;
+    }
+    return list_targets(params, params_length, targets, timeout);
+}
+
+int pn532_list_felica_targets(nfc_target_t *targets, size_t max_targets, uint8_t card_baud, uint16_t system_code, unsigned int timeout)
+{
+    // Initiator data is a FeliCa polling request: system code, request code 1 (also
+    // return the system code) and time slot 0.
+    uint8_t params[] = {max_targets > PN532_MAX_TARGETS ? PN532_MAX_TARGETS : max_targets, card_baud,
+                        FELICA_CMD_POLLING, system_code >> 8, system_code & 0xFF, 0x01, 0x00};
+
+    if (max_targets == 0 || (card_baud != PN532_FELICA_212 && card_baud != PN532_FELICA_424))
+    {
+        return PN532_STATUS_ERROR;
+    }
+    return list_targets(params, sizeof(params), targets, timeout);
+}
+
+int nfc_set_target_baud(nfc_target_t *target, uint8_t baud)
+{
+    uint8_t params[] = {target->tg, baud, baud};
+    uint8_t response[1] = {0xFF};
+
+    if (target->type != PN532_MIFARE_ISO14443A || baud > target->max_baud)
+    {
+        return PN532_STATUS_ERROR;
+    }
+    if (pn532_send_receive(PN532_COMMAND_INPSL, response, sizeof(response), params, sizeof(params), PN532_DEFAULT_TIMEOUT) == PN532_STATUS_ERROR)
+    {
+        return PN532_STATUS_ERROR;
+    }
+    if (response[0] == PN532_ERROR_NONE)
+    {
+        target->baud = baud;
+    }
+    return response[0];
+}
+
+int nfc_read_binary(uint8_t *data, size_t offset, size_t length)
+{
+    uint8_t buf[1 + NFC_READ_BINARY_CHUNK + 2];
+
+    while (length > 0)
+    {
+        size_t chunk = length < NFC_READ_BINARY_CHUNK ? length : NFC_READ_BINARY_CHUNK;
+        uint8_t params[] = {_state.target, 0x00, 0xB0, offset >> 8, offset & 0xFF, chunk & 0xFF};
+        int received = pn532_send_receive(PN532_COMMAND_INDATAEXCHANGE, buf, sizeof(buf), params, sizeof(params), PN532_DEFAULT_TIMEOUT);
+        if (received == PN532_STATUS_ERROR)
+        {
+            return PN532_STATUS_ERROR;
+        }
+        if (buf[0] != PN532_ERROR_NONE)
+        {
+            return buf[0];
+        }
+        // Status, data, then SW1 SW2 = 90 00 on success.
+        if (received != 1 + chunk + 2 || buf[1 + chunk] != 0x90 || buf[2 + chunk] != 0x00)
+        {
+            console_printf("READ BINARY at %d refused!", (int)offset);
+            return PN532_STATUS_ERROR;
+        }
+        memcpy(data, buf + 1, chunk);
+        data += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+    return PN532_ERROR_NONE;
+}
+
+int nfc_update_binary(const uint8_t *data, size_t offset, size_t length)
+{
+    // Tg, then CLA INS P1 P2 Lc and the data.
+    uint8_t params[1 + 5 + NFC_UPDATE_BINARY_CHUNK];
+    uint8_t buf[1 + 2];
+
+    while (length > 0)
+    {
+        size_t chunk = length < NFC_UPDATE_BINARY_CHUNK ? length : NFC_UPDATE_BINARY_CHUNK;
+        params[0] = _state.target;
+        params[1] = 0x00;
+        params[2] = 0xD6;
+        params[3] = offset >> 8;
+        params[4] = offset & 0xFF;
+        params[5] = chunk;
+        memcpy(params + 6, data, chunk);
+        int received = pn532_send_receive(PN532_COMMAND_INDATAEXCHANGE, buf, sizeof(buf), params, 6 + chunk, PN532_DEFAULT_TIMEOUT);
+        if (received == PN532_STATUS_ERROR)
+        {
+            return PN532_STATUS_ERROR;
+        }
+        if (buf[0] != PN532_ERROR_NONE)
+        {
+            return buf[0];
+        }
+        if (received != 3 || buf[1] != 0x90 || buf[2] != 0x00)
+        {
+            console_printf("UPDATE BINARY at %d refused!", (int)offset);
+            return PN532_STATUS_ERROR;
+        }
+        data += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+    return PN532_ERROR_NONE;
+}
+
+int nfc_felica_read_blocks(const nfc_target_t *target, uint16_t service_code, size_t start, size_t count, uint8_t *data)
+{
+    // Command: length, code, IDm, one service (code little-endian), block list of 2-byte
+    // elements (0x80, block number). Response: status, length, code, IDm, status flags 1
+    // and 2, block count, blocks.
+    uint8_t params[1 + 14 + 2 * FELICA_MAX_READ_BLOCKS];
+    uint8_t buf[1 + 13 + FELICA_BLOCK_LENGTH * FELICA_MAX_READ_BLOCKS];
+
+    while (count > 0)
+    {
+        size_t chunk = count < FELICA_MAX_READ_BLOCKS ? count : FELICA_MAX_READ_BLOCKS;
+        params[0] = target->tg;
+        params[1] = 14 + 2 * chunk;
+        params[2] = FELICA_CMD_READ_WITHOUT_ENCRYPTION;
+        memcpy(params + 3, target->uid, FELICA_IDM_LENGTH);
+        params[11] = 1;
+        params[12] = service_code & 0xFF;
+        params[13] = service_code >> 8;
+        params[14] = chunk;
+        for (size_t i = 0; i < chunk; i++)
+        {
+            params[15 + 2 * i] = 0x80;
+            params[16 + 2 * i] = start + i;
+        }
+
+        int received = pn532_send_receive(PN532_COMMAND_INDATAEXCHANGE, buf, sizeof(buf), params, 1 + params[1], PN532_DEFAULT_TIMEOUT);
+        if (received == PN532_STATUS_ERROR)
+        {
+            return PN532_STATUS_ERROR;
+        }
+        if (buf[0] != PN532_ERROR_NONE)
+        {
+            return buf[0];
+        }
+        if (received != 1 + 13 + FELICA_BLOCK_LENGTH * chunk || buf[2] != FELICA_CMD_READ_WITHOUT_ENCRYPTION + 1 ||
+            buf[11] != 0x00 || buf[13] != chunk)
+        {
+            console_printf("FeliCa read of block %d refused!", (int)start);
+            return PN532_STATUS_ERROR;
+        }
+        memcpy(data, buf + 14, FELICA_BLOCK_LENGTH * chunk);
+        data += FELICA_BLOCK_LENGTH * chunk;
+        start += chunk;
+        count -= chunk;
+    }
+    return PN532_ERROR_NONE;
+}
+
+/**
+ * @fn ntag_communicate
+ * ---------------------
+ * @description: Sends an NTAG command to the current target with InCommunicateThru, which
+ * passes it on as is: unlike InDataExchange it knows nothing of the command set, so it
+ * carries GET_VERSION, FAST_READ and PWD_AUTH.
+ * @returns number of response bytes after the status in buf[0], or PN532_STATUS_ERROR.
+ */
+static int ntag_communicate(uint8_t *command, size_t command_length, uint8_t *buf, size_t bufsize)
+{
+    int received = pn532_send_receive(PN532_COMMAND_INCOMMUNICATETHRU, buf, bufsize, command, command_length, PN532_DEFAULT_TIMEOUT);
+    if (received < 1)
+    {
+        return PN532_STATUS_ERROR;
+    }
+    return received - 1;
+}
+
+int nfc_ntag_get_version(uint8_t *version)
+{
+    uint8_t command[] = {NTAG_CMD_GET_VERSION};
+    uint8_t buf[1 + NTAG_VERSION_LENGTH];
+
+    int received = ntag_communicate(command, sizeof(command), buf, sizeof(buf));
+    if (received == PN532_STATUS_ERROR)
+    {
+        return PN532_STATUS_ERROR;
+    }
+    if (buf[0] != PN532_ERROR_NONE)
+    {
+        return card_status(buf[0]);
+    }
+    if (received != NTAG_VERSION_LENGTH)
+    {
+        console_printf("GET_VERSION answered with %d bytes!", received);
+        return PN532_STATUS_ERROR;
+    }
+    memcpy(version, buf + 1, NTAG_VERSION_LENGTH);
+    return PN532_ERROR_NONE;
+}
+
+size_t nfc_ntag_page_count(const uint8_t *version)
+{
+    // Byte 6 is the storage size: user memory plus the pages around it.
+    switch (version[6])
+    {
+    case 0x0B: // Ultralight EV1 MF0UL11
+        return 20;
+    case 0x0E: // Ultralight EV1 MF0UL21
+        return 41;
+    case 0x0F: // NTAG213
+        return 45;
+    case 0x11: // NTAG215
+        return 135;
+    case 0x13: // NTAG216
+        return 231;
+    }
+    return 0;
+}
+
+int nfc_ntag_read_page(uint8_t *data, size_t page)
+{
+    // READ returns 4 pages from page on; only the first is kept.
+    uint8_t buf[MIFARE_BLOCK_LENGTH];
+    int status = pn532_read_block(buf, page);
+    if (status != PN532_ERROR_NONE)
+    {
+        return status;
+    }
+    memcpy(data, buf, NTAG_PAGE_LENGTH);
+    return PN532_ERROR_NONE;
+}
+
+int nfc_ntag_read_pages(uint8_t *data, size_t start, size_t count)
+{
+    uint8_t buf[1 + NTAG_PAGE_LENGTH * NTAG_FAST_READ_MAX_PAGES];
+
+    while (count > 0)
+    {
+        size_t chunk = count < NTAG_FAST_READ_MAX_PAGES ? count : NTAG_FAST_READ_MAX_PAGES;
+        uint8_t command[] = {NTAG_CMD_FAST_READ, start & 0xFF, (start + chunk - 1) & 0xFF};
+        int received = ntag_communicate(command, sizeof(command), buf, sizeof(buf));
+        if (received == PN532_STATUS_ERROR)
+        {
+            return PN532_STATUS_ERROR;
+        }
+        if (buf[0] != PN532_ERROR_NONE)
+        {
+            return card_status(buf[0]);
+        }
+        if (received != NTAG_PAGE_LENGTH * chunk)
+        {
+            console_printf("FAST_READ of pages %d-%d refused!", (int)start, (int)(start + chunk - 1));
+            return PN532_STATUS_ERROR;
+        }
+        memcpy(data, buf + 1, NTAG_PAGE_LENGTH * chunk);
+        data += NTAG_PAGE_LENGTH * chunk;
+        start += chunk;
+        count -= chunk;
+    }
+    return PN532_ERROR_NONE;
+}
+
+int nfc_ntag_write_page(const uint8_t *data, size_t page)
+{
+    uint8_t params[3 + NTAG_PAGE_LENGTH] = {_state.target, MIFARE_ULTRALIGHT_CMD_WRITE, page & 0xFF};
+    uint8_t response[1];
+    memcpy(params + 3, data, NTAG_PAGE_LENGTH);
+
+    if (pn532_send_receive(PN532_COMMAND_INDATAEXCHANGE, response, sizeof(response), params, sizeof(params), PN532_DEFAULT_TIMEOUT) < 1)
+    {
+        return card_status(PN532_STATUS_ERROR);
+    }
+    return card_status(response[0]);
+}
+
+int nfc_ntag_pwd_auth(const uint8_t *pwd, uint8_t *pack)
+{
+    uint8_t command[1 + NTAG_PWD_LENGTH] = {NTAG_CMD_PWD_AUTH};
+    uint8_t buf[1 + NTAG_PACK_LENGTH];
+    memcpy(command + 1, pwd, NTAG_PWD_LENGTH);
+
+    int received = ntag_communicate(command, sizeof(command), buf, sizeof(buf));
+    if (received == PN532_STATUS_ERROR)
+    {
+        return PN532_STATUS_ERROR;
+    }
+    if (buf[0] != PN532_ERROR_NONE)
+    {
+        return card_status(buf[0]);
+    }
+    if (received != NTAG_PACK_LENGTH)
+    {
+        console_printf("PWD_AUTH answered with %d bytes!", received);
+        return PN532_STATUS_ERROR;
+    }
+    if (pack)
+    {
+        memcpy(pack, buf + 1, NTAG_PACK_LENGTH);
+    }
+    return PN532_ERROR_NONE;
+}
+
+int nfc_reselect(const uint8_t *uid, size_t uid_length, unsigned int timeout)
+{
+    // Already selected and nothing has failed since: listing it again changes nothing.
+    state_refresh();
+    if (_state.target_uid_length == uid_length && memcmp(_state.target_uid, uid, uid_length) == 0)
+    {
+        return _state.target;
+    }
+
+    nfc_target_t target;
+    if (pn532_list_passive_targets(&target, 1, uid, uid_length, timeout) != 1)
+    {
+        return PN532_STATUS_ERROR;
+    }
+    return target.tg;
+}
+
+int pn532_read_passive_target(uint8_t *response, uint8_t card_baud, size_t timeout)
+{
+    if (card_baud == PN532_FELICA_212 || card_baud == PN532_FELICA_424)
+    {
+        nfc_target_t felica;
+        if (pn532_list_felica_targets(&felica, 1, card_baud, FELICA_SYSTEM_CODE_ANY, timeout) != 1)
+        {
+            return PN532_STATUS_ERROR;
+        }
+        memcpy(response, felica.uid, felica.uid_length);
+        return felica.uid_length;
+    }
+
+    // Send passive read command for 1 card.
+    uint8_t params[] = {0x01, card_baud};
+    uint8_t buf[1 + 5 + MIFARE_UID_MAX_LENGTH];
+    nfc_target_t target;
+    int length;
+    if (card_baud == PN532_MIFARE_ISO14443A)
+    {
+        length = pn532_send_receive_frame(&_list_one_106a, buf, sizeof(buf), timeout);
+    }
+    else
+    {
+        length = pn532_send_receive(PN532_COMMAND_INLISTPASSIVETARGET,
+                                    buf, sizeof(buf), params, sizeof(params), timeout);
+    }
+    _state.target_uid_length = 0;
+
+    if (length < 1)
+    {
+        // No card found: stop the PN532 from listening on, as list_targets does.
+        pn532_abort();
+        return PN532_STATUS_ERROR;
+    }
+
+    // MaxTg is 1, so anything but one target means no card answered the activation
+    // retries (see nfc_tuning_t).
+    if (buf[0] != 0x01)
+    {
+        return PN532_STATUS_ERROR;
+    }
+    size_t received = length < sizeof(buf) ? length : sizeof(buf);
+    if (parse_target_106a(buf + 1, received - 1, &target) == PN532_STATUS_ERROR)
+    {
+        return PN532_STATUS_ERROR;
+    }
+    state_set_target(&target);
+    memcpy(response, target.uid, target.uid_length);
+    return target.uid_length;
+}
+
+/**
+ * @fn relist_detect
+ * ---------------------
+ * @description: Detects a card by sending InListPassiveTarget until one answers.
+ * @returns length of the UID, or PN532_STATUS_ERROR after timeout ms (0: never).
+ */
+static int relist_detect(uint8_t *uid, unsigned int timeout)
+{
+    unsigned int timestart = timer_get_ticks();
+    while (timeout == 0 || timer_get_ticks() - timestart < 1000 * timeout)
+    {
+        int uid_len = pn532_read_passive_target(uid, PN532_MIFARE_ISO14443A, PN532_DEFAULT_TIMEOUT);
+        if (uid_len != PN532_STATUS_ERROR)
+        {
+            return uid_len;
+        }
+    }
+    return PN532_STATUS_ERROR;
+}
+
+/**
+ * @fn autopoll_detect
+ * ---------------------
+ * @description: Detects a card with InAutoPoll. The PN532 polls on its own and the wait
+ * for its answer idles on the IRQ line; a round limit that runs out restarts the poll.
+ * @returns length of the UID, or PN532_STATUS_ERROR after timeout ms (0: never).
+ */
+static int autopoll_detect(uint8_t *uid, unsigned int timeout)
+{
+    // NbTg, then Type, target data length and ISO14443A target data of the first target.
+    uint8_t buf[PN532_FRAME_MAX_LENGTH];
+    uint8_t params[2 + PN532_AUTOPOLL_MAX_TYPES];
+    params[0] = _autopoll.poll_count;
+    params[1] = _autopoll.period;
+    memcpy(params + 2, _autopoll.types, _autopoll.type_count);
+
+    unsigned int timestart = timer_get_ticks();
+    while (1)
+    {
+        unsigned int remaining = 0;
+        if (timeout != 0)
+        {
+            unsigned int elapsed = (timer_get_ticks() - timestart) / 1000;
+            if (elapsed >= timeout)
+                return PN532_STATUS_ERROR;
+            remaining = timeout - elapsed;
+        }
+
+        if (pn532_send_command(PN532_COMMAND_INAUTOPOLL, params, 2 + _autopoll.type_count,
+                               PN532_DEFAULT_TIMEOUT) == PN532_STATUS_ERROR)
+        {
+            return PN532_STATUS_ERROR;
+        }
+        _state.target_uid_length = 0;
+        int length = pn532_await_response(PN532_COMMAND_INAUTOPOLL, buf, sizeof(buf), remaining);
+        if (length == PN532_STATUS_ERROR)
+        {
+            // Still polling: stop it so the next command is not refused.
+            pn532_abort();
+            return PN532_STATUS_ERROR;
+        }
+        if (length >= 3 && buf[0] > 0)
+        {
+            if (buf[1] != PN532_AUTOPOLL_GENERIC_106 && buf[1] != PN532_AUTOPOLL_MIFARE &&
+                buf[1] != PN532_AUTOPOLL_ISO14443_4A)
+            {
+                console_printf("Autopoll found unsupported target type 0x%02x!", buf[1]);
+                return PN532_STATUS_ERROR;
+            }
+            nfc_target_t target;
+            size_t received = length < sizeof(buf) ? length : sizeof(buf);
+            if (parse_target_106a(buf + 3, received - 3, &target) == PN532_STATUS_ERROR)
+            {
+                return PN532_STATUS_ERROR;
+            }
+            state_set_target(&target);
+            memcpy(uid, target.uid, target.uid_length);
+            return target.uid_length;
+        }
+    }
+}
+
+int nfc_detect_card(uint8_t *uid, unsigned int timeout)
+{
+    unsigned int timestart = timer_get_ticks();
+    unsigned int spi_start = pn532_get_stats()->spi_transactions;
+
+    int uid_len = _autopoll_enabled ? autopoll_detect(uid, timeout) : relist_detect(uid, timeout);
+
+    unsigned int elapsed = timer_get_ticks() - timestart;
+    _detect_stats.wait_us += elapsed;
+    _detect_stats.spi_transactions += pn532_get_stats()->spi_transactions - spi_start;
+    if (uid_len == PN532_STATUS_ERROR)
+    {
+        _detect_stats.timeouts++;
+    }
+    else
+    {
+        _detect_stats.detections++;
+        _detect_stats.last_wait_us = elapsed;
+        // The card may have left the field and been changed elsewhere since it was last
+        // seen: its image only holds for this presence. Its remembered keys are kept.
+        nfc_cache_invalidate(uid, uid_len);
+    }
+    return uid_len;
+}
+
+int nfc_scan_card(uint8_t *uid, unsigned int timeout)
+{
+    if (nfc_config_normal() == PN532_STATUS_ERROR)
+    {
+        return PN532_STATUS_ERROR;
+    }
+    return nfc_detect_card(uid, timeout);
+}
+
+const nfc_detect_stats_t *nfc_get_detect_stats(void)
+{
+    return &_detect_stats;
+}
+
+void nfc_reset_detect_stats(void)
+{
+    memset(&_detect_stats, 0, sizeof(_detect_stats));
+}
+
+void nfc_print_detect_stats(void)
+{
+    unsigned int wait_ms = _detect_stats.wait_us / 1000;
+    if (_autopoll_enabled && _autopoll.poll_count == PN532_AUTOPOLL_FOREVER)
+        console_printf("detection: autopoll every %d ms\n", _autopoll.period * PN532_AUTOPOLL_PERIOD_MS);
+    else if (_autopoll_enabled)
+        console_printf("detection: autopoll, %d rounds every %d ms\n", _autopoll.poll_count,
+               _autopoll.period * PN532_AUTOPOLL_PERIOD_MS);
+    else
+        console_printf("detection: InListPassiveTarget re-listing\n");
+    console_printf("cards detected: %d, timeouts: %d, last detection took %d ms\n",
+           _detect_stats.detections, _detect_stats.timeouts, _detect_stats.last_wait_us / 1000);
+    // Per minute from tenths of a second, so a long wait does not overflow.
+    unsigned int tenths = wait_ms / 100 ? wait_ms / 100 : 1;
+    console_printf("waiting: %d ms, %d spi transactions (%d per minute)\n", wait_ms,
+           _detect_stats.spi_transactions, _detect_stats.spi_transactions * 600 / tenths);
+}
+
+int pn532_authenticate_block(uint8_t *uid, size_t uid_length, size_t block_number, size_t key_number, uint8_t *key)
+{
+    // Build parameters for InDataExchange command to authenticate MiFare card.
+    uint8_t response[1] = {0xFF};
+    uint8_t params[3 + MIFARE_UID_MAX_LENGTH + MIFARE_KEY_LENGTH];
+    params[0] = _state.target;
+    params[1] = key_number & 0xFF;
+    params[2] = block_number & 0xFF;
+
+    // params[3:3+keylen] = key
+    for (int i = 0; i < MIFARE_KEY_LENGTH; i++)
+    {
+        params[3 + i] = key[i];
+    }
+    // params[3+keylen:] = uid
+    for (int i = 0; i < uid_length; i++)
+    {
+        params[3 + MIFARE_KEY_LENGTH + i] = uid[i];
+    }
+
+    // Send InDataExchange request
+    if (pn532_send_receive(PN532_COMMAND_INDATAEXCHANGE, response, sizeof(response), params, 3 + MIFARE_KEY_LENGTH + uid_length, PN532_DEFAULT_TIMEOUT) < 1)
+    {
+        console_printf("Authentication of block %d got no answer!\n", (int)block_number);
+        return card_status(PN532_STATUS_ERROR);
+    }
+    return card_status(response[0]);
+}
+
+int pn532_read_block(uint8_t *response, size_t block_number)
+{
+    uint8_t params[] = {_state.target, MIFARE_CMD_READ, block_number & 0xFF};
+    uint8_t buf[MIFARE_BLOCK_LENGTH + 1];
+    // Send InDataExchange request to read block of MiFare data.
+
+    int received = pn532_send_receive(PN532_COMMAND_INDATAEXCHANGE, buf, sizeof(buf), params, sizeof(params), PN532_DEFAULT_TIMEOUT);
+    if (received < 1)
+    {
+        return card_status(PN532_STATUS_ERROR);
+    }
+
+    // Check first response is 0x00 to show success.
+    if (buf[0] != PN532_ERROR_NONE)
+    {
+        return card_status(buf[0]);
+    }
+    // A short answer must not be taken for the block, least of all by the block cache.
+    if (received < 1 + MIFARE_BLOCK_LENGTH)
+    {
+        console_printf("Read of block %d returned %d bytes!\n", (int)block_number, received - 1);
+        return card_status(PN532_STATUS_ERROR);
+    }
+    for (int i = 0; i < MIFARE_BLOCK_LENGTH; i++)
+    {
+        response[i] = buf[i + 1];
+    }
+    return buf[0];
+}
+
+int pn532_mifare_classic_write_block(uint8_t *data, size_t block_number)
+{
+    uint8_t params[MIFARE_BLOCK_LENGTH + 3];
+    uint8_t response[1];
+    params[0] = _state.target;
+    params[1] = MIFARE_CMD_WRITE;
+    params[2] = block_number & 0xFF;
+
+    for (int i = 0; i < MIFARE_BLOCK_LENGTH; i++)
+    {
+        params[3 + i] = data[i];
+    }
+
+    if (pn532_send_receive(PN532_COMMAND_INDATAEXCHANGE, response, sizeof(response), params, sizeof(params), PN532_DEFAULT_TIMEOUT) < 1)
+    {
+        return card_status(PN532_STATUS_ERROR);
+    }
+    return card_status(response[0]);
+}
+
+/**
+ * @fn mifare_value_command
+ * ---------------------
+ * @description: Sends a MIFARE value command (INCREMENT, DECREMENT or RESTORE) with its
+ * 4-byte little-endian operand. The result stays in the card's transfer buffer until a
+ * TRANSFER.
+ * @returns PN532 error code.
+ */
+static int mifare_value_command(uint8_t command, size_t block_number, int32_t operand)
+{
+    uint8_t params[] = {_state.target, command, block_number & 0xFF,
+                        operand & 0xFF, (operand >> 8) & 0xFF, (operand >> 16) & 0xFF, (operand >> 24) & 0xFF};
+    uint8_t response[1];
+
+    if (pn532_send_receive(PN532_COMMAND_INDATAEXCHANGE, response, sizeof(response), params, sizeof(params), PN532_DEFAULT_TIMEOUT) < 1)
+    {
+        return card_status(PN532_STATUS_ERROR);
+    }
+    return card_status(response[0]);
+}
+
+int pn532_mifare_increment(size_t block_number, int32_t amount)
+{
+    return mifare_value_command(MIFARE_CMD_INCREMENT, block_number, amount);
+}
+
+int pn532_mifare_decrement(size_t block_number, int32_t amount)
+{
+    return mifare_value_command(MIFARE_CMD_DECREMENT, block_number, amount);
+}
+
+int pn532_mifare_restore(size_t block_number)
+{
+    return mifare_value_command(MIFARE_CMD_STORE, block_number, 0);
+}
+
+int pn532_mifare_transfer(size_t block_number)
+{
+    uint8_t params[] = {_state.target, MIFARE_CMD_TRANSFER, block_number & 0xFF};
+    uint8_t response[1];
+
+    if (pn532_send_receive(PN532_COMMAND_INDATAEXCHANGE, response, sizeof(response), params, sizeof(params), PN532_DEFAULT_TIMEOUT) < 1)
+    {
+        return card_status(PN532_STATUS_ERROR);
+    }
+    return card_status(response[0]);
+}
+
+void mifare_value_block(uint8_t *block, int32_t value, uint8_t address)
+{
+    // value, ~value, value (little-endian), then address, ~address, address, ~address
+    for (int i = 0; i < 4; i++)
+    {
+        uint8_t byte = (value >> (8 * i)) & 0xFF;
+        block[i] = byte;
+        block[4 + i] = ~byte;
+        block[8 + i] = byte;
+    }
+    block[12] = address;
+    block[13] = ~address;
+    block[14] = address;
+    block[15] = ~address;
+}
+
+bool mifare_parse_value_block(const uint8_t *block, int32_t *value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        if (block[i] != block[8 + i] || block[i] != (uint8_t)~block[4 + i])
+        {
+            return false;
+        }
+    }
+    if (block[12] != block[14] || block[13] != block[15] || block[12] != (uint8_t)~block[13])
+    {
+        return false;
+    }
+
+    *value = block[0] | (block[1] << 8) | (block[2] << 16) | ((uint32_t)block[3] << 24);
+    return true;
+}
+
+/**
+ * @fn is_sector_trailer
+ * ---------------------
+ * @returns true if block_number is the last block of its sector (keys and access bits).
+ */
+static bool is_sector_trailer(size_t block_number)
+{
+    return block_number % MIFARE_BLOCKS_PER_SECTOR == MIFARE_BLOCKS_PER_SECTOR - 1;
+}
+
+/*---------------------- BLOCK CACHE ----------------------*/
+
+/**
+ * @fn cache_find
+ * ---------------------
+ * @returns the cached image of the card with the given UID, marked as just used, or NULL.
+ */
+static cache_entry_t *cache_find(const uint8_t *uid, size_t uid_length)
+{
+    for (size_t i = 0; i < NFC_CACHE_TAGS; i++)
+    {
+        cache_entry_t *entry = &_cache[i];
+        if (entry->uid_length == uid_length && memcmp(entry->uid, uid, uid_length) == 0)
+        {
+            entry->last_used = ++_cache_clock;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @fn cache_entry
+ * ---------------------
+ * @returns the cached image of the card with the given UID, starting an empty one in a
+ * free slot or in place of the least recently used card if there is none.
+ */
+static cache_entry_t *cache_entry(const uint8_t *uid, size_t uid_length)
+{
+    cache_entry_t *entry = cache_find(uid, uid_length);
+    if (entry)
+    {
+        return entry;
+    }
+
+    entry = &_cache[0];
+    for (size_t i = 1; i < NFC_CACHE_TAGS && entry->uid_length != 0; i++)
+    {
+        if (_cache[i].uid_length == 0 || _cache[i].last_used < entry->last_used)
+        {
+            entry = &_cache[i];
+        }
+    }
+    if (entry->uid_length != 0)
+    {
+        _cache_stats.evictions++;
+    }
+    memcpy(entry->uid, uid, uid_length);
+    entry->uid_length = uid_length;
+    entry->last_used = ++_cache_clock;
+    entry->valid = entry->dirty = 0;
+    return entry;
+}
+
+/**
+ * @fn cache_block
+ * ---------------------
+ * @returns the cached image of a block of the card with the given UID, or NULL if the
+ * cache does not hold it.
+ */
+static uint8_t *cache_block(const uint8_t *uid, size_t uid_length, size_t block_number)
+{
+    cache_entry_t *entry = cache_find(uid, uid_length);
+    if (!entry || !(entry->valid & BLOCK_BIT(block_number)))
+    {
+        return NULL;
+    }
+    return entry->blocks[block_number];
+}
+
+/**
+ * @fn cache_read
+ * ---------------------
+ * @description: Copies a block from the cache into response if it holds it.
+ * @returns true on a hit; a miss is counted once the block is read from the card.
+ */
+static bool cache_read(const uint8_t *uid, size_t uid_length, size_t block_number, uint8_t *response)
+{
+    uint8_t *block = cache_block(uid, uid_length, block_number);
+    if (!block)
+    {
+        return false;
+    }
+    memcpy(response, block, MIFARE_BLOCK_LENGTH);
+    _cache_stats.hits++;
+    return true;
+}
+
+/**
+ * @fn cache_forget
+ * ---------------------
+ * @description: Drops the image of one block, whose contents on the card are not known.
+ */
+static void cache_forget(const uint8_t *uid, size_t uid_length, size_t block_number)
+{
+    cache_entry_t *entry = cache_find(uid, uid_length);
+    if (entry)
+    {
+        entry->valid &= ~BLOCK_BIT(block_number);
+        entry->dirty &= ~BLOCK_BIT(block_number);
+    }
+}
+
+/**
+ * @fn cache_fill
+ * ---------------------
+ * @description: Records data as what the card holds in a block.
+ */
+static void cache_fill(const uint8_t *uid, size_t uid_length, size_t block_number, const uint8_t *data)
+{
+    cache_entry_t *entry = cache_entry(uid, uid_length);
+    memcpy(entry->blocks[block_number], data, MIFARE_BLOCK_LENGTH);
+    entry->valid |= BLOCK_BIT(block_number);
+    entry->dirty &= ~BLOCK_BIT(block_number);
+}
+
+/**
+ * @fn cache_stage
+ * ---------------------
+ * @description: Puts data for a block in the cache, dirty unless the card is known to
+ * hold it already.
+ * @returns true if the block must be written back.
+ */
+static bool cache_stage(const uint8_t *uid, size_t uid_length, size_t block_number, const uint8_t *data)
+{
+    cache_entry_t *entry = cache_entry(uid, uid_length);
+    if ((entry->valid & BLOCK_BIT(block_number)) && memcmp(entry->blocks[block_number], data, MIFARE_BLOCK_LENGTH) == 0)
+    {
+        _cache_stats.clean_writes++;
+        return false;
+    }
+    memcpy(entry->blocks[block_number], data, MIFARE_BLOCK_LENGTH);
+    entry->valid |= BLOCK_BIT(block_number);
+    entry->dirty |= BLOCK_BIT(block_number);
+    return true;
+}
+
+/**
+ * @fn cache_written
+ * ---------------------
+ * @description: Marks a dirty block as written back. A sector trailer reads back with its
+ * key A hidden, so its image is dropped rather than kept.
+ */
+static void cache_written(const uint8_t *uid, size_t uid_length, size_t block_number)
+{
+    cache_entry_t *entry = cache_entry(uid, uid_length);
+    entry->dirty &= ~BLOCK_BIT(block_number);
+    if (is_sector_trailer(block_number))
+    {
+        entry->valid &= ~BLOCK_BIT(block_number);
+    }
+    _cache_stats.write_backs++;
+}
+
+/**
+ * @fn cache_result
+ * ---------------------
+ * @description: Passes a card command's status through. A card that refused a command,
+ * or did not answer, may not hold what its image says, so the image is dropped.
+ */
+static int cache_result(const uint8_t *uid, size_t uid_length, int status)
+{
+    if (status != PN532_ERROR_NONE)
+    {
+        nfc_cache_invalidate(uid, uid_length);
+    }
+    return status;
+}
+
+void nfc_cache_invalidate(const uint8_t *uid, size_t uid_length)
+{
+    for (size_t i = 0; i < NFC_CACHE_TAGS; i++)
+    {
+        cache_entry_t *entry = &_cache[i];
+        if (uid == NULL)
+        {
+            memset(entry, 0, sizeof(*entry));
+        }
+        else if (entry->uid_length == uid_length && memcmp(entry->uid, uid, uid_length) == 0)
+        {
+            entry->valid = entry->dirty = 0;
+        }
+    }
+}
+
+/**
+ * @fn cache_prefetch
+ * ---------------------
+ * @description: Reads the balance block of a newly detected MIFARE Classic card into the
+ * cache, betting that the command that detected it wants the balance. Only the one block:
+ * detection drops the card's image, so every block read ahead is paid on every tap.
+ * Nothing is sent if the block is already cached or the card is of another family. A
+ * refused authentication halts the card, which is then selected again.
+ * @returns the sector left authenticated, or -1.
+ */
+static int cache_prefetch(const uint8_t *uid, size_t uid_length)
+{
+    size_t first = BALANCE_BLOCK - BALANCE_BLOCK % MIFARE_BLOCKS_PER_SECTOR;
+    uint8_t buf[MIFARE_BLOCK_LENGTH];
+
+    if (_state.target_sel_res != NFC_SEL_RES_MIFARE_CLASSIC_1K)
+    {
+        return -1;
+    }
+    cache_entry_t *entry = cache_entry(uid, uid_length);
+    if (entry->valid & BLOCK_BIT(BALANCE_BLOCK))
+    {
+        return -1;
+    }
+    if (nfc_authenticate_sector(uid, uid_length, first) != PN532_ERROR_NONE)
+    {
+        return -1;
+    }
+    if (cache_result(uid, uid_length, pn532_read_block(buf, BALANCE_BLOCK)) != PN532_ERROR_NONE)
+    {
+        return -1;
+    }
+    cache_fill(uid, uid_length, BALANCE_BLOCK, buf);
+    _cache_stats.prefetches++;
+    return first / MIFARE_BLOCKS_PER_SECTOR;
+}
+
+const nfc_cache_stats_t *nfc_get_cache_stats(void)
+{
+    return &_cache_stats;
+}
+
+void nfc_reset_cache_stats(void)
+{
+    memset(&_cache_stats, 0, sizeof(_cache_stats));
+}
+
+void nfc_print_cache_stats(void)
+{
+    int tags = 0;
+    for (size_t i = 0; i < NFC_CACHE_TAGS; i++)
+    {
+        tags += _cache[i].uid_length != 0;
+    }
+    console_printf("block cache: %d of %d tags, %d hits, %d misses, %d prefetched\n", tags, NFC_CACHE_TAGS,
+           _cache_stats.hits, _cache_stats.misses, _cache_stats.prefetches);
+    console_printf("written back: %d blocks, %d unchanged writes skipped, %d evictions\n", _cache_stats.write_backs,
+           _cache_stats.clean_writes, _cache_stats.evictions);
+    console_printf("keys: %d in table, %d remembered keys used, %d refused\n", (int)_key_count,
+           _cache_stats.key_hits, _cache_stats.key_misses);
+}
+
+/*---------------------- KEY TABLE ----------------------*/
+
+int nfc_add_key(uint8_t key_type, const uint8_t *key, uint16_t sectors)
+{
+    if (_key_count == NFC_KEY_TABLE_SIZE || (key_type != MIFARE_CMD_AUTH_A && key_type != MIFARE_CMD_AUTH_B))
+    {
+        console_printf("Key table is full or key type %02x is unknown!\n", key_type);
+        return PN532_STATUS_ERROR;
+    }
+    _keys[_key_count].key_type = key_type;
+    memcpy(_keys[_key_count].key, key, MIFARE_KEY_LENGTH);
+    _keys[_key_count].sectors = sectors;
+    _key_count++;
+    return PN532_STATUS_OK;
+}
+
+void nfc_reset_keys(void)
+{
+    // Remembered keys are indexes into the table, so they go with it.
+    nfc_cache_invalidate(NULL, 0);
+    _keys[0] = KEY_DEFAULT;
+    _key_count = 1;
+}
+
+/**
+ * @fn find_key
+ * ---------------------
+ * @returns key table index + 1 of key A or B (key_type) with the given bytes, or 0.
+ */
+static size_t find_key(uint8_t key_type, const uint8_t *key)
+{
+    for (size_t i = 0; i < _key_count; i++)
+    {
+        if (_keys[i].key_type == key_type && memcmp(_keys[i].key, key, MIFARE_KEY_LENGTH) == 0)
+        {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @fn try_key
+ * ---------------------
+ * @description: Authenticates with one key table entry, re-selecting the card if it
+ * refuses the key.
+ * @returns PN532 error code.
+ */
+static int try_key(const uint8_t *uid, size_t uid_length, size_t block_number, size_t index)
+{
+    nfc_key_t *key = &_keys[index];
+    int pn532_error = pn532_authenticate_block((uint8_t *)uid, uid_length, block_number, key->key_type, key->key);
+    if (pn532_error != PN532_ERROR_NONE)
+    {
+        _cache_stats.key_misses++;
+        nfc_reselect(uid, uid_length, PN532_DEFAULT_TIMEOUT);
+    }
+    return pn532_error;
+}
+
+int nfc_authenticate_sector(const uint8_t *uid, size_t uid_length, size_t block_number)
+{
+    size_t sector = block_number / MIFARE_BLOCKS_PER_SECTOR;
+    cache_entry_t *entry = cache_entry(uid, uid_length);
+    int pn532_error = PN532_STATUS_ERROR;
+
+    // The key that worked last time is almost always the one that works now.
+    size_t known = entry->sector_keys[sector];
+    if (known)
+    {
+        pn532_error = try_key(uid, uid_length, block_number, known - 1);
+        if (pn532_error == PN532_ERROR_NONE)
+        {
+            _cache_stats.key_hits++;
+            return PN532_ERROR_NONE;
+        }
+        entry->sector_keys[sector] = 0;
+    }
+
+    for (size_t i = 0; i < _key_count; i++)
+    {
+        if (i + 1 == known || !(_keys[i].sectors & (1 << sector)))
+        {
+            continue;
+        }
+        pn532_error = try_key(uid, uid_length, block_number, i);
+        if (pn532_error == PN532_ERROR_NONE)
+        {
+            entry->sector_keys[sector] = i + 1;
+            return PN532_ERROR_NONE;
+        }
+    }
+    return pn532_error;
+}
+
+/**
+ * @fn wait_for_card
+ * ---------------------
+ * @description: Blocks until a card is in the field, fills uid with its UID and, unless
+ * the card is revoked, prefetches its balance block (see cache_prefetch).
+ * @param authenticated_sector: if not NULL, receives the sector the prefetch left
+ * authenticated, or -1.
+ * @returns length of the UID.
+ */
+static int wait_for_card(uint8_t *uid, int *authenticated_sector)
+{
+    while (1)
+    {
+        int uid_len = nfc_scan_card(uid, 0);
+        if (uid_len != PN532_STATUS_ERROR)
+        {
+            // Nothing is read from a revoked card.
+            int sector = denylist_contains(uid, uid_len) ? -1 : cache_prefetch(uid, uid_len);
+            if (authenticated_sector)
+            {
+                *authenticated_sector = sector;
+            }
+            return uid_len;
+        }
+    }
+}
+
+/**
+ * @fn block_to_balance
+ * ---------------------
+ * @returns balance held in the balance block: a value block, or on cards written before
+ * value blocks were used, a big-endian int in its first 4 bytes.
+ */
+static int block_to_balance(const uint8_t *block)
+{
+    int32_t value;
+    if (mifare_parse_value_block(block, &value))
+    {
+        return value;
+    }
+
+    int balance = 0;
+    for (int byte = 0; byte < 4; byte++)
+    {
+        balance <<= 8;
+        balance |= block[byte];
+    }
+    return balance;
+}
+
+int nfc_transaction_begin(nfc_transaction_t *txn)
+{
+    txn->start_commands = pn532_get_stats()->commands;
+    txn->round_trips = 0;
+    txn->authenticated_sector = -1;
+    txn->uid_length = 0;
+
+    if (nfc_config_normal() == PN532_STATUS_ERROR)
+    {
+        return PN532_STATUS_ERROR;
+    }
+    txn->uid_length = wait_for_card(txn->uid, &txn->authenticated_sector);
+    txn->tg = _state.target;
+    if (denylist_contains(txn->uid, txn->uid_length))
+    {
+        return NFC_ERROR_REVOKED;
+    }
+    return PN532_ERROR_NONE;
+}
+
+int nfc_transaction_begin_target(nfc_transaction_t *txn, const nfc_target_t *target)
+{
+    txn->start_commands = pn532_get_stats()->commands;
+    txn->round_trips = 0;
+    txn->authenticated_sector = -1;
+    txn->tg = target->tg;
+    txn->uid_length = target->uid_length;
+    memcpy(txn->uid, target->uid, target->uid_length);
+    return PN532_ERROR_NONE;
+}
+
+/**
+ * @fn transaction_authenticate
+ * ---------------------
+ * @description: Authenticates the sector of block_number unless it already is.
+ * @returns PN532 error code.
+ */
+static int transaction_authenticate(nfc_transaction_t *txn, size_t block_number)
+{
+    // Talking to another target halts this one, so its authentication is gone.
+    if (nfc_current_target() != txn->tg)
     {
-        if (i > 9)
-            printf("%d ", i);
-        else
-            printf(" %d ", i);
+        nfc_select_target(txn->tg);
+        txn->authenticated_sector = -1;
     }
 
-    for (int i = 0; i < bufsize; i++)
+    int sector = block_number / MIFARE_BLOCKS_PER_SECTOR;
+    if (txn->authenticated_sector == sector)
     {
-        if (i % 16 == 0)
-            printf("\n%02d : ", i / 16);
-        printf("%02x ", buf[i]);
+        return PN532_ERROR_NONE;
     }
-    printf("\n");
+
+    // A refused key re-selects the card, which may come back as the current target.
+    int pn532_error = nfc_authenticate_sector(txn->uid, txn->uid_length, block_number);
+    txn->tg = nfc_current_target();
+    txn->authenticated_sector = pn532_error ? -1 : sector;
+    return pn532_error;
 }
 
-int pn532_read_passive_target(uint8_t *response, uint8_t card_baud, size_t timeout)
+int nfc_transaction_read(nfc_transaction_t *txn, uint8_t *response, size_t block_number)
 {
-    // Send passive read command for 1 card.  Expect at most a 7 byte UUID.
-    uint8_t params[] = {0x01, card_baud};
-    uint8_t buf[19];
-    int length = pn532_send_receive(PN532_COMMAND_INLISTPASSIVETARGET,
-                                    buf, sizeof(buf), params, sizeof(params), timeout);
+    if (cache_read(txn->uid, txn->uid_length, block_number, response))
+    {
+        return PN532_ERROR_NONE;
+    }
 
-    if (length < 0)
+    int pn532_error = transaction_authenticate(txn, block_number);
+    if (pn532_error == PN532_ERROR_NONE)
+    {
+        pn532_error = pn532_read_block(response, block_number);
+    }
+    if (cache_result(txn->uid, txn->uid_length, pn532_error) == PN532_ERROR_NONE)
     {
-        return PN532_STATUS_ERROR; // No card found
+        cache_fill(txn->uid, txn->uid_length, block_number, response);
+        _cache_stats.misses++;
     }
+    return pn532_error;
+}
 
-    // Check only 1 card with up to a 7 byte UID is present.
-    if (buf[0] != 0x01)
+int nfc_transaction_write(nfc_transaction_t *txn, uint8_t *data, size_t block_number)
+{
+    if (!cache_stage(txn->uid, txn->uid_length, block_number, data))
     {
-        printf("Response byte: %d\n", buf[0]); // ASK KAI
-        printf("More than one card detected!");
-        return PN532_STATUS_ERROR;
+        return PN532_ERROR_NONE;
     }
-    if (buf[5] > 7)
+
+    int pn532_error = transaction_authenticate(txn, block_number);
+    if (pn532_error == PN532_ERROR_NONE)
     {
-        printf("Found card with unexpectedly long UID!");
-        return PN532_STATUS_ERROR;
+        pn532_error = pn532_mifare_classic_write_block(data, block_number);
     }
-    for (uint8_t i = 0; i < buf[5]; i++)
+    if (cache_result(txn->uid, txn->uid_length, pn532_error) == PN532_ERROR_NONE)
     {
-        response[i] = buf[6 + i];
+        cache_written(txn->uid, txn->uid_length, block_number);
     }
-    return buf[5];
+    return pn532_error;
 }
 
-int pn532_authenticate_block(uint8_t *uid, size_t uid_length, size_t block_number, size_t key_number, uint8_t *key)
+unsigned int nfc_transaction_end(nfc_transaction_t *txn)
 {
-    // Build parameters for InDataExchange command to authenticate MiFare card.
-    uint8_t response[1] = {0xFF};
-    uint8_t params[3 + MIFARE_UID_MAX_LENGTH + MIFARE_KEY_LENGTH];
-    params[0] = 0x01;
-    params[1] = key_number & 0xFF;
-    params[2] = block_number & 0xFF;
+    txn->round_trips = pn532_get_stats()->commands - txn->start_commands;
+    txn->authenticated_sector = -1;
+    return txn->round_trips;
+}
 
-    // params[3:3+keylen] = key
-    for (int i = 0; i < MIFARE_KEY_LENGTH; i++)
+int nfc_transaction_add_value(nfc_transaction_t *txn, size_t block_number, int32_t delta)
+{
+    int pn532_error = transaction_authenticate(txn, block_number);
+    if (pn532_error)
     {
-        params[3 + i] = key[i];
+        return pn532_error;
     }
-    // params[3+keylen:] = uid
-    for (int i = 0; i < uid_length; i++)
+
+    pn532_error = delta >= 0 ? pn532_mifare_increment(block_number, delta)
+                             : pn532_mifare_decrement(block_number, -delta);
+    if (pn532_error == PN532_ERROR_NONE)
     {
-        params[3 + MIFARE_KEY_LENGTH + i] = uid[i];
+        pn532_error = pn532_mifare_transfer(block_number);
+    }
+    if (cache_result(txn->uid, txn->uid_length, pn532_error))
+    {
+        // A refused value command halts a Classic card.
+        txn->authenticated_sector = -1;
+        return pn532_error;
     }
 
-    // Send InDataExchange request
-    pn532_send_receive(PN532_COMMAND_INDATAEXCHANGE, response, sizeof(response), params, 3 + MIFARE_KEY_LENGTH + uid_length, PN532_DEFAULT_TIMEOUT);
-    return response[0];
+    // The card did the arithmetic; a cached image of the block can follow it.
+    uint8_t *block = cache_block(txn->uid, txn->uid_length, block_number);
+    int32_t value;
+    if (block && mifare_parse_value_block(block, &value))
+    {
+        mifare_value_block(block, value + delta, block[12]);
+    }
+    else
+    {
+        cache_forget(txn->uid, txn->uid_length, block_number);
+    }
+    return pn532_error;
 }
 
-int pn532_read_block(uint8_t *response, size_t block_number)
+int nfc_transaction_backup_value(nfc_transaction_t *txn, size_t block_number, size_t backup_block)
 {
-    uint8_t params[] = {0x01, MIFARE_CMD_READ, block_number & 0xFF};
-    uint8_t buf[MIFARE_BLOCK_LENGTH + 1];
-    // Send InDataExchange request to read block of MiFare data.
-
-    pn532_send_receive(PN532_COMMAND_INDATAEXCHANGE, buf, sizeof(buf), params, sizeof(params), PN532_DEFAULT_TIMEOUT);
+    if (block_number / MIFARE_BLOCKS_PER_SECTOR != backup_block / MIFARE_BLOCKS_PER_SECTOR)
+    {
+        return PN532_STATUS_ERROR; // transfer only reaches blocks of the same sector
+    }
 
-    // Check first response is 0x00 to show success.
-    if (buf[0] != PN532_ERROR_NONE)
+    int pn532_error = transaction_authenticate(txn, block_number);
+    if (pn532_error == PN532_ERROR_NONE)
     {
-        return buf[0];
+        pn532_error = pn532_mifare_restore(block_number);
     }
-    for (int i = 0; i < MIFARE_BLOCK_LENGTH; i++)
+    if (pn532_error == PN532_ERROR_NONE)
     {
-        response[i] = buf[i + 1];
+        pn532_error = pn532_mifare_transfer(backup_block);
     }
-    return buf[0];
+    if (cache_result(txn->uid, txn->uid_length, pn532_error) == PN532_ERROR_NONE)
+    {
+        // The backup is a copy of the block, address byte included.
+        uint8_t *block = cache_block(txn->uid, txn->uid_length, block_number);
+        if (block)
+        {
+            cache_fill(txn->uid, txn->uid_length, backup_block, block);
+        }
+        else
+        {
+            cache_forget(txn->uid, txn->uid_length, backup_block);
+        }
+    }
+    return pn532_error;
 }
 
-int pn532_mifare_classic_write_block(uint8_t *data, size_t block_number)
+int get_balance(int *value)
 {
-    uint8_t params[MIFARE_BLOCK_LENGTH + 3];
-    uint8_t response[1];
-    params[0] = 0x01; // Max card numbers
-    params[1] = MIFARE_CMD_WRITE;
-    params[2] = block_number & 0xFF;
+    nfc_transaction_t txn;
+    uint8_t buf[MIFARE_BLOCK_LENGTH];
 
-    for (int i = 0; i < MIFARE_BLOCK_LENGTH; i++)
+    int pn532_error = nfc_transaction_begin(&txn);
+    if (pn532_error == PN532_ERROR_NONE)
     {
-        params[3 + i] = data[i];
+        pn532_error = nfc_transaction_read(&txn, buf, BALANCE_BLOCK);
     }
+    nfc_transaction_end(&txn);
 
-    if (pn532_send_receive(PN532_COMMAND_INDATAEXCHANGE, response, sizeof(response), params, sizeof(params), PN532_DEFAULT_TIMEOUT) == PN532_STATUS_ERROR)
+    if (pn532_error)
     {
-        return PN532_STATUS_ERROR;
+        return pn532_error;
     }
-    return response[0];
+    *value = block_to_balance(buf);
+    return PN532_ERROR_NONE;
 }
 
-int get_balance(int *value)
+int set_balance(int balance)
 {
-    if (pn532_config_normal() == PN532_STATUS_ERROR)
+    nfc_transaction_t txn;
+    uint8_t buf[MIFARE_BLOCK_LENGTH];
+    mifare_value_block(buf, balance, BALANCE_BLOCK);
+
+    int pn532_error = nfc_transaction_begin(&txn);
+    if (pn532_error == PN532_ERROR_NONE)
     {
-        return PN532_STATUS_ERROR;
+        pn532_error = nfc_transaction_write(&txn, buf, BALANCE_BLOCK);
     }
+    nfc_transaction_end(&txn);
+    return pn532_error;
+}
 
-    uint8_t uid[MIFARE_UID_MAX_LENGTH];
-    int32_t uid_len;
+/**
+ * @fn migrate_balance
+ * ---------------------
+ * @description: Called after a value command on the balance block failed with
+ * value_error. Re-selects the same card, since the failure halted it, and reads the block
+ * afresh. Only a block that is not yet a value block is rewritten, as one holding its old
+ * balance plus delta. A value block means the failure was something else, e.g. a lost
+ * TRANSFER acknowledgement after the card had already written the block, so delta is not
+ * applied again.
+ * @returns PN532 error code, value_error if the block is a value block already.
+ */
+static int migrate_balance(nfc_transaction_t *txn, int delta, int value_error)
+{
+    uint8_t buf[MIFARE_BLOCK_LENGTH];
 
-    while (1)
+    int tg = nfc_reselect(txn->uid, txn->uid_length, NFC_PRESENCE_TIMEOUT);
+    if (tg == PN532_STATUS_ERROR)
     {
-        // Check if a card is available to read
-        uid_len = pn532_read_passive_target(uid, PN532_MIFARE_ISO14443A, 1000);
-        if (uid_len != PN532_STATUS_ERROR)
-            break;
+        return value_error;
     }
+    txn->tg = tg;
+    txn->authenticated_sector = -1;
+    // The failure dropped the card's cached image, so this reads the card.
+    int pn532_error = nfc_transaction_read(txn, buf, BALANCE_BLOCK);
+    if (pn532_error != PN532_ERROR_NONE)
+    {
+        return pn532_error;
+    }
+    int32_t value;
+    if (mifare_parse_value_block(buf, &value))
+    {
+        return value_error;
+    }
+    mifare_value_block(buf, block_to_balance(buf) + delta, BALANCE_BLOCK);
+    return nfc_transaction_write(txn, buf, BALANCE_BLOCK);
+}
 
-    uint8_t buf[255];
-    uint8_t key_a[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}; // store the default passcode for the tag blocks
-    unsigned int pn532_error = PN532_ERROR_NONE;
+int update_balance(int delta, int *balance, unsigned int *round_trips)
+{
+    nfc_transaction_t txn;
+    uint8_t buf[MIFARE_BLOCK_LENGTH];
 
-    pn532_error = pn532_authenticate_block(uid, uid_len, 6, MIFARE_CMD_AUTH_A, key_a);
-    pn532_error = pn532_read_block(buf, 6);
+    // The card does the arithmetic: detect, authenticate, INCREMENT/DECREMENT, TRANSFER.
+    // The journal records the balance as read before and read back after, never as
+    // worked out from delta. The balance before was prefetched with the detection.
+    unsigned int start_commands = pn532_get_stats()->commands;
+    int32_t old_balance = JOURNAL_BALANCE_UNKNOWN, new_balance = JOURNAL_BALANCE_UNKNOWN;
+    int pn532_error = nfc_transaction_begin(&txn);
+    if (pn532_error == PN532_ERROR_NONE)
+    {
+        pn532_error = nfc_transaction_read(&txn, buf, BALANCE_BLOCK);
+    }
+    if (pn532_error == PN532_ERROR_NONE)
+    {
+        old_balance = block_to_balance(buf);
+        pn532_error = nfc_transaction_add_value(&txn, BALANCE_BLOCK, delta);
+        if (pn532_error != PN532_ERROR_NONE && pn532_error != PN532_STATUS_ERROR)
+        {
+            pn532_error = migrate_balance(&txn, delta, pn532_error);
+        }
+    }
 
-    if (pn532_error)
+    // Read back from the card, not from the image the cache worked out.
+    int update_error = pn532_error;
+    if (pn532_error == PN532_ERROR_NONE)
     {
-        return pn532_error;
+        cache_forget(txn.uid, txn.uid_length, BALANCE_BLOCK);
+        int read_error = nfc_transaction_read(&txn, buf, BALANCE_BLOCK);
+        if (read_error == PN532_ERROR_NONE)
+        {
+            new_balance = block_to_balance(buf);
+        }
+        if (balance)
+        {
+            // Without the read there is no balance to report.
+            pn532_error = read_error;
+            *balance = new_balance;
+        }
     }
 
-    int balance = 0;
-    for (int byte = 0; byte < 4; byte++)
+    nfc_transaction_end(&txn);
+    // Journaled in RAM only; the shell commits it once the card is done with.
+    if (txn.uid_length > 0)
     {
-        balance <<= 8;
-        balance |= buf[byte];
+        journal_append(txn.uid, txn.uid_length, old_balance, new_balance, delta, update_error);
+    }
+    if (round_trips)
+    {
+        *round_trips = pn532_get_stats()->commands - start_commands;
     }
+    return pn532_error;
+}
 
-    memcpy(value, &balance, 4); // copy balance over to or value
+int update_account_balance(int delta, int *balance, unsigned int *round_trips)
+{
+    uint8_t uid[MIFARE_UID_MAX_LENGTH];
+    unsigned int start_commands = pn532_get_stats()->commands;
 
-    return PN532_ERROR_NONE;
+    int uid_length = nfc_scan_card(uid, 0);
+    if (uid_length == PN532_STATUS_ERROR)
+    {
+        return PN532_STATUS_ERROR;
+    }
+
+    int32_t new_balance;
+    int pn532_error = PN532_ERROR_NONE;
+    if (denylist_contains(uid, uid_length))
+    {
+        pn532_error = NFC_ERROR_REVOKED;
+        journal_append(uid, uid_length, JOURNAL_BALANCE_UNKNOWN, JOURNAL_BALANCE_UNKNOWN, delta, pn532_error);
+    }
+    else if (accounts_update(uid, uid_length, delta, &new_balance))
+    {
+        journal_append(uid, uid_length, new_balance - delta, new_balance, delta, pn532_error);
+        if (balance)
+        {
+            *balance = new_balance;
+        }
+    }
+    else
+    {
+        pn532_error = NFC_ERROR_NO_ACCOUNT;
+        journal_append(uid, uid_length, JOURNAL_BALANCE_UNKNOWN, JOURNAL_BALANCE_UNKNOWN, delta, pn532_error);
+    }
+
+    if (round_trips)
+    {
+        *round_trips = pn532_get_stats()->commands - start_commands;
+    }
+    return pn532_error;
 }
 
-int set_balance(int balance)
+int read_blocks(uint8_t *response, uint8_t *uid, size_t uid_length, size_t start, size_t count, bool skip_trailers)
 {
-    uint8_t DATA[16];
-    memset(&DATA, 0x00, 16);
-    for (int i = 0; i < 4; i++) // store balance in DATA
+    if (start + count > MIFARE_1K_BLOCKS)
     {
-
-        uint8_t byte = (balance >> (8 * i)) & 0xff;
-        DATA[3 - i] = byte;
+        return PN532_STATUS_ERROR;
     }
 
-    uint8_t uid[MIFARE_UID_MAX_LENGTH];
-    uint8_t key_a[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
-    unsigned int pn532_error = PN532_ERROR_NONE;
-    int32_t uid_len = 0;
+    int sector = -1;
+    int pn532_error = PN532_ERROR_NONE;
+    for (size_t block_number = start; block_number < start + count; block_number++)
+    {
+        uint8_t *block = response + MIFARE_BLOCK_LENGTH * (block_number - start);
+        if ((skip_trailers && is_sector_trailer(block_number)) || cache_read(uid, uid_length, block_number, block))
+        {
+            continue;
+        }
 
-    if (pn532_config_normal() == PN532_STATUS_ERROR)
+        // One authentication covers every block of a sector.
+        if (block_number / MIFARE_BLOCKS_PER_SECTOR != sector)
+        {
+            pn532_error = nfc_authenticate_sector(uid, uid_length, block_number);
+            if (pn532_error)
+            {
+                return cache_result(uid, uid_length, pn532_error);
+            }
+            sector = block_number / MIFARE_BLOCKS_PER_SECTOR;
+        }
+
+        pn532_error = pn532_read_block(block, block_number);
+        if (pn532_error)
+        {
+            return cache_result(uid, uid_length, pn532_error);
+        }
+        cache_fill(uid, uid_length, block_number, block);
+        _cache_stats.misses++;
+    }
+    return PN532_ERROR_NONE;
+}
+
+int write_blocks(uint8_t *data, uint8_t *uid, size_t uid_length, size_t start, size_t count, bool skip_trailers)
+{
+    if (start + count > MIFARE_1K_BLOCKS)
     {
         return PN532_STATUS_ERROR;
     }
 
-    // wait for card to be available for writing
-    while (1)
+    // Stage every block first: those the card already holds stay clean.
+    uint64_t dirty = 0;
+    for (size_t block_number = start; block_number < start + count; block_number++)
     {
-        // Check if a card is available to read
-        uid_len = pn532_read_passive_target(uid, PN532_MIFARE_ISO14443A, 1000);
-        if (uid_len != PN532_STATUS_ERROR)
-            break;
+        if (!(skip_trailers && is_sector_trailer(block_number)) &&
+            cache_stage(uid, uid_length, block_number, data + MIFARE_BLOCK_LENGTH * (block_number - start)))
+        {
+            dirty |= BLOCK_BIT(block_number);
+        }
     }
 
-    // Write to balance block
-    uint8_t block_number = BALANCE_BLOCK;
-    pn532_error = pn532_authenticate_block(uid, uid_len, block_number, MIFARE_CMD_AUTH_A, key_a);
-    if (pn532_error)
-        return pn532_error;
+    // Then write back the dirty ones, one authentication per sector that has any.
+    int sector = -1;
+    int pn532_error = PN532_ERROR_NONE;
+    for (size_t block_number = start; block_number < start + count; block_number++)
+    {
+        if (!(dirty & BLOCK_BIT(block_number)))
+        {
+            continue;
+        }
 
-    pn532_error = pn532_mifare_classic_write_block(DATA, block_number);
-    if (pn532_error)
-        return pn532_error;
+        if (block_number / MIFARE_BLOCKS_PER_SECTOR != sector)
+        {
+            pn532_error = nfc_authenticate_sector(uid, uid_length, block_number);
+            if (pn532_error)
+            {
+                return cache_result(uid, uid_length, pn532_error);
+            }
+            sector = block_number / MIFARE_BLOCKS_PER_SECTOR;
+        }
 
+        pn532_error = pn532_mifare_classic_write_block(data + MIFARE_BLOCK_LENGTH * (block_number - start), block_number);
+        if (pn532_error)
+        {
+            return cache_result(uid, uid_length, pn532_error);
+        }
+        cache_written(uid, uid_length, block_number);
+    }
     return PN532_ERROR_NONE;
 }
 
-int get_block_info(uint8_t *response, size_t block_number)
+int get_blocks_info(uint8_t *response, size_t start, size_t count)
 {
-    block_number = block_number > 63 ? 63 : block_number;
+    if (start + count > MIFARE_1K_BLOCKS)
+    {
+        return PN532_STATUS_ERROR;
+    }
 
-    if (pn532_config_normal() == PN532_STATUS_ERROR)
+    if (nfc_config_normal() == PN532_STATUS_ERROR)
     {
         return PN532_STATUS_ERROR;
     }
 
     uint8_t uid[MIFARE_UID_MAX_LENGTH];
-    int32_t uid_len;
+    int32_t uid_len = wait_for_card(uid, NULL);
 
-    while (1)
+    return read_blocks(response, uid, uid_len, start, count, false);
+}
+
+/**
+ * @fn provision_trailer_matches
+ * ---------------------
+ * @description: A trailer reads back with key A hidden, so its access bits are compared
+ * and key A is taken to be the one its sector last opened with.
+ * @returns true if the trailer read as current already holds the template's.
+ */
+static bool provision_trailer_matches(const uint8_t *uid, size_t uid_length, size_t sector, const uint8_t *current, const nfc_provision_template_t *tmpl)
+{
+    cache_entry_t *entry = cache_find(uid, uid_length);
+    return entry && entry->sector_keys[sector] != 0 &&
+           entry->sector_keys[sector] == find_key(MIFARE_CMD_AUTH_A, tmpl->key_a) &&
+           memcmp(current + MIFARE_KEY_LENGTH, tmpl->access_bits, MIFARE_ACCESS_BITS_LENGTH) == 0;
+}
+
+/**
+ * @fn provision_sector
+ * ---------------------
+ * @description: Reads a sector, lays the template over it in image and writes back the
+ * blocks that changed, all under one authentication.
+ * @returns PN532 error code.
+ */
+static int provision_sector(const nfc_provision_template_t *tmpl, const uint8_t *uid, size_t uid_length, size_t sector, uint8_t *image, unsigned int *changes)
+{
+    uint8_t current[MIFARE_BLOCKS_PER_SECTOR * MIFARE_BLOCK_LENGTH];
+    size_t first = sector * MIFARE_BLOCKS_PER_SECTOR;
+    size_t trailer = first + MIFARE_BLOCKS_PER_SECTOR - 1;
+
+    int pn532_error = read_blocks(current, (uint8_t *)uid, uid_length, first, MIFARE_BLOCKS_PER_SECTOR, false);
+    if (pn532_error != PN532_ERROR_NONE)
     {
-        // Check if a card is available to be read
-        uid_len = pn532_read_passive_target(uid, PN532_MIFARE_ISO14443A, PN532_DEFAULT_TIMEOUT);
-        if (uid_len != PN532_STATUS_ERROR)
+        return pn532_error;
+    }
+    memcpy(image, current, sizeof(current));
+    for (size_t block_number = first; block_number < trailer; block_number++)
+    {
+        // A backup is a copy of the balance block, address byte included.
+        if (block_number == BALANCE_BLOCK || block_number == tmpl->backup_block)
         {
-            break;
+            mifare_value_block(image + MIFARE_BLOCK_LENGTH * (block_number - first), tmpl->balance, BALANCE_BLOCK);
         }
     }
+    uint8_t *trailer_image = image + MIFARE_BLOCK_LENGTH * (trailer - first);
+    bool new_trailer = tmpl->set_trailers && !provision_trailer_matches(uid, uid_length, sector, trailer_image, tmpl);
+    if (new_trailer)
+    {
+        memcpy(trailer_image, tmpl->key_a, MIFARE_KEY_LENGTH);
+        memcpy(trailer_image + MIFARE_KEY_LENGTH, tmpl->access_bits, MIFARE_ACCESS_BITS_LENGTH);
+        memcpy(trailer_image + MIFARE_KEY_LENGTH + MIFARE_ACCESS_BITS_LENGTH, tmpl->key_b, MIFARE_KEY_LENGTH);
+    }
 
-    uint8_t buf[255];
-    uint8_t key_a[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}; // store the default passcode for the tag blocks
-    size_t pn532_error = PN532_ERROR_NONE;
-
-    pn532_error = pn532_authenticate_block(uid, uid_len, block_number, MIFARE_CMD_AUTH_A, key_a);
-    if (pn532_error)
+    unsigned int changed = 0;
+    for (size_t i = 0; i < MIFARE_BLOCKS_PER_SECTOR; i++)
     {
-        return pn532_error;
+        changed += memcmp(image + MIFARE_BLOCK_LENGTH * i, current + MIFARE_BLOCK_LENGTH * i, MIFARE_BLOCK_LENGTH) != 0;
     }
-    pn532_error = pn532_read_block(buf, block_number);
-    if (pn532_error)
+    if (changed == 0)
+    {
+        return PN532_ERROR_NONE;
+    }
+    // Blocks the image leaves as read stay clean in the cache, so only the changed go out.
+    pn532_error = write_blocks(image, (uint8_t *)uid, uid_length, first, MIFARE_BLOCKS_PER_SECTOR, false);
+    if (pn532_error != PN532_ERROR_NONE)
     {
         return pn532_error;
     }
-
-    memcpy(response, buf, 16);
-
+    if (new_trailer)
+    {
+        // The sector opens with the new key A from now on.
+        cache_entry(uid, uid_length)->sector_keys[sector] = find_key(MIFARE_CMD_AUTH_A, tmpl->key_a);
+    }
+    *changes += changed;
     return PN532_ERROR_NONE;
 }
 
-int get_tag_info(uint8_t *response, size_t response_length)
+int nfc_provision_card(const nfc_provision_template_t *tmpl, const uint8_t *uid, size_t uid_length, unsigned int *written)
 {
-    if (pn532_config_normal() == PN532_STATUS_ERROR)
+    // The balance sector and that of the backup.
+    uint8_t images[2][MIFARE_BLOCKS_PER_SECTOR * MIFARE_BLOCK_LENGTH];
+    size_t sectors[2] = {BALANCE_BLOCK / MIFARE_BLOCKS_PER_SECTOR, tmpl->backup_block / MIFARE_BLOCKS_PER_SECTOR};
+    size_t sector_count = tmpl->backup_block && sectors[1] != sectors[0] ? 2 : 1;
+
+    if (tmpl->backup_block != 0 && (tmpl->backup_block >= MIFARE_1K_BLOCKS || tmpl->backup_block == BALANCE_BLOCK ||
+                                    is_sector_trailer(tmpl->backup_block)))
+    {
+        console_printf("Block %d cannot hold the balance backup!\n", tmpl->backup_block);
+        return PN532_STATUS_ERROR;
+    }
+    if (tmpl->set_trailers && !find_key(MIFARE_CMD_AUTH_A, tmpl->key_a) &&
+        nfc_add_key(MIFARE_CMD_AUTH_A, tmpl->key_a, NFC_KEY_ALL_SECTORS) == PN532_STATUS_ERROR)
     {
         return PN532_STATUS_ERROR;
     }
 
-    uint8_t uid[MIFARE_UID_MAX_LENGTH];
-    int32_t uid_len;
-
-    // Wait until card is attempted to be read
-    while (1)
+    unsigned int changes = 0;
+    bool changed[2] = {false, false};
+    for (size_t i = 0; i < sector_count; i++)
     {
-        uid_len = pn532_read_passive_target(uid, PN532_MIFARE_ISO14443A, PN532_DEFAULT_TIMEOUT);
-        if (uid_len != PN532_STATUS_ERROR)
+        unsigned int before = changes;
+        int pn532_error = provision_sector(tmpl, uid, uid_length, sectors[i], images[i], &changes);
+        if (pn532_error != PN532_ERROR_NONE)
         {
-            break;
+            return pn532_error;
         }
+        changed[i] = changes != before;
+    }
+    if (written)
+    {
+        *written = changes;
     }
 
-    uint8_t buf[255];
-    uint8_t key_a[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}; // store the default passcode for the tag blocks
-    size_t pn532_error = PN532_ERROR_NONE;
-
-    // Read block data into buf
-    for (size_t block_number = 0; block_number < response_length / 16; block_number++)
+    // Verify against the card itself, not the images just staged.
+    nfc_cache_invalidate(uid, uid_length);
+    for (size_t i = 0; i < sector_count; i++)
     {
-        pn532_error = pn532_authenticate_block(uid, uid_len, block_number, MIFARE_CMD_AUTH_A, key_a);
-        if (pn532_error)
+        uint8_t current[MIFARE_BLOCKS_PER_SECTOR * MIFARE_BLOCK_LENGTH];
+        size_t trailer = MIFARE_BLOCKS_PER_SECTOR - 1;
+        if (!changed[i])
+        {
+            continue;
+        }
+        int pn532_error = read_blocks(current, (uint8_t *)uid, uid_length, sectors[i] * MIFARE_BLOCKS_PER_SECTOR,
+                                      MIFARE_BLOCKS_PER_SECTOR, false);
+        if (pn532_error != PN532_ERROR_NONE)
         {
             return pn532_error;
         }
+        if (memcmp(current, images[i], MIFARE_BLOCK_LENGTH * trailer) != 0 ||
+            (tmpl->set_trailers && !provision_trailer_matches(uid, uid_length, sectors[i], current + MIFARE_BLOCK_LENGTH * trailer, tmpl)))
+        {
+            console_printf("Sector %d did not read back as written!\n", (int)sectors[i]);
+            return NFC_ERROR_VERIFY;
+        }
+    }
+    return PN532_ERROR_NONE;
+}
 
-        pn532_error = pn532_read_block(buf, block_number);
-        if (pn532_error)
+int nfc_wait_removal(const uint8_t *uid, size_t uid_length, unsigned int timeout)
+{
+    nfc_target_t target;
+    unsigned int timestart = timer_get_ticks();
+    while (timeout == 0 || timer_get_ticks() - timestart < 1000 * timeout)
+    {
+        if (pn532_list_passive_targets(&target, 1, uid, uid_length, NFC_PRESENCE_TIMEOUT) != 1)
         {
-            return pn532_error;
+            return PN532_STATUS_OK;
         }
+    }
+    return PN532_STATUS_ERROR;
+}
+
+int get_block_info(uint8_t *response, size_t block_number)
+{
+    block_number = block_number > 63 ? 63 : block_number;
+    return get_blocks_info(response, block_number, 1);
+}
+
+int get_tag_info(uint8_t *response, size_t response_length)
+{
+    size_t count = response_length / MIFARE_BLOCK_LENGTH;
+    return get_blocks_info(response, 0, count < MIFARE_1K_BLOCKS ? count : MIFARE_1K_BLOCKS);
+}
 
-        memcpy(response + 16 * block_number, buf, 16);
+int get_ntag_info(uint8_t *response, size_t response_length, size_t *pages)
+{
+    *pages = 0;
+    if (nfc_config_normal() == PN532_STATUS_ERROR)
+    {
+        return PN532_STATUS_ERROR;
     }
 
-    return PN532_ERROR_NONE;
+    uint8_t uid[MIFARE_UID_MAX_LENGTH];
+    wait_for_card(uid, NULL);
+    if (_state.target_sel_res != NFC_SEL_RES_MIFARE_ULTRALIGHT)
+    {
+        return NFC_ERROR_WRONG_TAG;
+    }
+
+    uint8_t version[NTAG_VERSION_LENGTH];
+    int status = nfc_ntag_get_version(version);
+    if (status != PN532_ERROR_NONE)
+    {
+        return status;
+    }
+    size_t count = nfc_ntag_page_count(version);
+    if (count == 0)
+    {
+        console_printf("Unknown NTAG storage size 0x%02x!", version[6]);
+        return NFC_ERROR_WRONG_TAG;
+    }
+    if (count > response_length / NTAG_PAGE_LENGTH)
+    {
+        count = response_length / NTAG_PAGE_LENGTH;
+    }
+    status = nfc_ntag_read_pages(response, 0, count);
+    if (status == PN532_ERROR_NONE)
+    {
+        *pages = count;
+    }
+    return status;
 }
 
 /*---------------------- HELPER/TEST ----------------------*/
@@ -311,11 +2233,11 @@ int get_tag_info(uint8_t *response, size_t response_length)
 //     //helper fxn to run SamConfig and print conditions for mode configuration
 //     if (pn532_config_normal() == PN532_STATUS_OK)
 //     {
-//         printf("SamConfig successfully executed. HAT is now in normal mode.");
+//         console_printf("SamConfig successfully executed. HAT is now in normal mode.");
 //     }
 //     else
 //     {
-//         printf("Couldn't configure HAT");
+//         console_printf("Couldn't configure HAT");
 //         return;
 //     }
 // }
\ No newline at end of file
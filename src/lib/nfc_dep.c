@@ -0,0 +1,333 @@
+/**
+ * @file nfc_dep.c
+ * ---------------------
+ * @brief Implements nfc_dep.h
+ */
+
+#include <nfc_dep.h>
+#include <nfc.h>
+#include <console.h>
+
+// ATR_RES/ATR_REQ bytes after NFCID3: DID, BS (send rates), BR (receive rates), then TO/PP.
+#define ATR_RATE_212 (0x01)
+#define ATR_RATE_424 (0x02)
+// TgInitAsTarget mode byte: activated for NFC-DEP, bit rate in bits 6-4.
+#define TARGET_MODE_DEP (0x04)
+#define TARGET_MODE_BAUD(mode) (((mode) >> 4) & 0x07)
+
+// TgInitAsTarget parameters: DEP only; MIFARE parameters (SENS_RES, NFCID1t, SEL_RES with
+// the NFC-DEP bit) for passive 106 kbps activation; FeliCa parameters (NFCID2t, PAD,
+// system code) for passive 212/424 kbps; NFCID3t; no general or historical bytes.
+static const uint8_t TARGET_PARAMS[] = {
+    0x02,
+    0x04, 0x00, 0x12, 0x34, 0x56, 0x40,
+    0x01, 0xFE, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF,
+    0xAA, 0x99, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11,
+    0x00,
+    0x00,
+};
+
+/**
+ * @fn atr_max_baud
+ * ---------------------
+ * @returns highest bit rate set in both the send (bs) and receive (br) rates of an ATR.
+ */
+static uint8_t atr_max_baud(uint8_t bs, uint8_t br)
+{
+    uint8_t rates = bs & br;
+    return (rates & ATR_RATE_424) ? PN532_BAUD_424 : (rates & ATR_RATE_212) ? PN532_BAUD_212 : PN532_BAUD_106;
+}
+
+/**
+ * @fn dep_command
+ * ---------------------
+ * @description: Sends one PN532 command carrying a message chunk and accounts its time.
+ * The command is never resent once acknowledged: that would pass the chunk to the peer
+ * twice, or drop one already fetched. The status byte of the response (in buf[0]) keeps
+ * its MI bit.
+ * @returns number of data bytes after the status, or PN532_STATUS_ERROR.
+ */
+static int dep_command(nfc_dep_link_t *link, uint8_t command, uint8_t *params, size_t params_length, uint8_t *buf, size_t bufsize)
+{
+    unsigned int timestart = timer_get_ticks();
+    int received = pn532_send_receive_once(command, buf, bufsize, params, params_length, PN532_DEFAULT_TIMEOUT);
+    unsigned int elapsed = timer_get_ticks() - timestart;
+
+    link->stats.frames++;
+    link->stats.frame_us += elapsed;
+    if (elapsed > link->stats.max_frame_us)
+    {
+        link->stats.max_frame_us = elapsed;
+    }
+    if (received < 1)
+    {
+        console_printf("NFC-DEP exchange got no answer!");
+        return PN532_STATUS_ERROR;
+    }
+    // Bits 5-0 of the status are the error code.
+    if ((buf[0] & 0x3F) != PN532_ERROR_NONE)
+    {
+        console_printf("NFC-DEP exchange failed with 0x%02x!", buf[0] & 0x3F);
+        return PN532_STATUS_ERROR;
+    }
+    return received - 1;
+}
+
+int nfc_dep_initiate(nfc_dep_link_t *link, unsigned int timeout)
+{
+    // ActPass 1: active mode, which keeps the same framing at every bit rate. BR 106 kbps,
+    // no optional data.
+    uint8_t params[] = {0x01, PN532_BAUD_106, 0x00};
+    // Status, Tg, NFCID3t, DIDt, BSt, BRt, TO, PPt, general bytes.
+    uint8_t buf[64];
+
+    memset(link, 0, sizeof(*link));
+    int received = pn532_send_receive(PN532_COMMAND_INJUMPFORDEP, buf, sizeof(buf), params, sizeof(params), timeout);
+    // The peer takes Tg 1 from whatever card had it.
+    nfc_release_targets();
+    if (received == PN532_STATUS_ERROR)
+    {
+        pn532_abort();
+        return PN532_STATUS_ERROR;
+    }
+    if (buf[0] != PN532_ERROR_NONE)
+    {
+        return buf[0];
+    }
+    if (received < 2 + NFC_DEP_NFCID3_LENGTH + 5)
+    {
+        console_printf("ATR_RES too short!");
+        return PN532_STATUS_ERROR;
+    }
+    link->initiator = true;
+    link->tg = buf[1];
+    memcpy(link->nfcid3, buf + 2, NFC_DEP_NFCID3_LENGTH);
+    link->baud = PN532_BAUD_106;
+    link->max_baud = atr_max_baud(buf[13], buf[14]);
+
+    if (link->max_baud != PN532_BAUD_106)
+    {
+        uint8_t psl[] = {link->tg, link->max_baud, link->max_baud};
+        uint8_t status[1] = {0xFF};
+        if (pn532_send_receive(PN532_COMMAND_INPSL, status, sizeof(status), psl, sizeof(psl), PN532_DEFAULT_TIMEOUT) == PN532_STATUS_ERROR)
+        {
+            return PN532_STATUS_ERROR;
+        }
+        // A refused PSL_REQ leaves the link up at 106 kbps.
+        if (status[0] == PN532_ERROR_NONE)
+        {
+            link->baud = link->max_baud;
+        }
+    }
+    return PN532_ERROR_NONE;
+}
+
+int nfc_dep_listen(nfc_dep_link_t *link, unsigned int timeout)
+{
+    // Mode, then ATR_REQ: LEN, D4 00, NFCID3i, DIDi, BSi, BRi, PPi, general bytes.
+    uint8_t buf[80];
+
+    memset(link, 0, sizeof(*link));
+    nfc_release_targets();
+    if (pn532_send_command(PN532_COMMAND_TGINITASTARGET, (uint8_t *)TARGET_PARAMS, sizeof(TARGET_PARAMS),
+                           PN532_DEFAULT_TIMEOUT) == PN532_STATUS_ERROR)
+    {
+        return PN532_STATUS_ERROR;
+    }
+    int length = pn532_await_response(PN532_COMMAND_TGINITASTARGET, buf, sizeof(buf), timeout);
+    if (length == PN532_STATUS_ERROR)
+    {
+        // Still listening: stop it so the next command is not refused.
+        pn532_abort();
+        return PN532_STATUS_ERROR;
+    }
+    if (length < 2 + 2 + NFC_DEP_NFCID3_LENGTH + 4 || !(buf[0] & TARGET_MODE_DEP) || buf[2] != 0xD4 || buf[3] != 0x00)
+    {
+        console_printf("Activated by an initiator that is not NFC-DEP!");
+        return PN532_STATUS_ERROR;
+    }
+    // 847 kbps and above only exist in passive mode with cards; report them as 424.
+    link->baud = TARGET_MODE_BAUD(buf[0]) > PN532_BAUD_424 ? PN532_BAUD_424 : TARGET_MODE_BAUD(buf[0]);
+    memcpy(link->nfcid3, buf + 4, NFC_DEP_NFCID3_LENGTH);
+    link->max_baud = atr_max_baud(buf[15], buf[16]);
+    return PN532_STATUS_OK;
+}
+
+int nfc_dep_transceive(nfc_dep_link_t *link, const uint8_t *request, size_t request_length, uint8_t *response, size_t response_size)
+{
+    uint8_t params[1 + NFC_DEP_CHUNK];
+    uint8_t buf[1 + NFC_DEP_CHUNK];
+    size_t sent = 0, length = 0;
+    int received;
+
+    // Every request chunk but the last carries MI; the target takes those without data.
+    do
+    {
+        size_t chunk = request_length - sent < NFC_DEP_CHUNK ? request_length - sent : NFC_DEP_CHUNK;
+        bool more = sent + chunk < request_length;
+        params[0] = link->tg | (more ? NFC_DEP_MI : 0);
+        memcpy(params + 1, request + sent, chunk);
+        received = dep_command(link, PN532_COMMAND_INDATAEXCHANGE, params, 1 + chunk, buf, sizeof(buf));
+        if (received == PN532_STATUS_ERROR)
+        {
+            return PN532_STATUS_ERROR;
+        }
+        sent += chunk;
+    } while (sent < request_length);
+    link->stats.bytes_sent += sent;
+
+    // The reply comes back with the last chunk; while its status carries MI, an empty
+    // InDataExchange fetches the next.
+    while (1)
+    {
+        if (length + received > response_size)
+        {
+            console_printf("NFC-DEP reply longer than %d bytes!", (int)response_size);
+            return PN532_STATUS_ERROR;
+        }
+        memcpy(response + length, buf + 1, received);
+        length += received;
+        if (!(buf[0] & NFC_DEP_MI))
+        {
+            break;
+        }
+        params[0] = link->tg;
+        received = dep_command(link, PN532_COMMAND_INDATAEXCHANGE, params, 1, buf, sizeof(buf));
+        if (received == PN532_STATUS_ERROR)
+        {
+            return PN532_STATUS_ERROR;
+        }
+    }
+    link->stats.bytes_received += length;
+    link->stats.messages++;
+    return length;
+}
+
+int nfc_dep_receive(nfc_dep_link_t *link, uint8_t *data, size_t size)
+{
+    uint8_t buf[1 + NFC_DEP_CHUNK];
+    size_t length = 0;
+
+    do
+    {
+        int received = dep_command(link, PN532_COMMAND_TGGETDATA, NULL, 0, buf, sizeof(buf));
+        if (received == PN532_STATUS_ERROR)
+        {
+            return PN532_STATUS_ERROR;
+        }
+        if (length + received > size)
+        {
+            console_printf("NFC-DEP request longer than %d bytes!", (int)size);
+            return PN532_STATUS_ERROR;
+        }
+        memcpy(data + length, buf + 1, received);
+        length += received;
+    } while (buf[0] & NFC_DEP_MI);
+    link->stats.bytes_received += length;
+    link->stats.messages++;
+    return length;
+}
+
+int nfc_dep_reply(nfc_dep_link_t *link, const uint8_t *data, size_t length)
+{
+    uint8_t params[NFC_DEP_CHUNK];
+    uint8_t buf[1];
+    size_t sent = 0;
+
+    // TgSetMetaData sends a chunk with MI, TgSetData the last one.
+    do
+    {
+        size_t chunk = length - sent < NFC_DEP_CHUNK ? length - sent : NFC_DEP_CHUNK;
+        bool more = sent + chunk < length;
+        memcpy(params, data + sent, chunk);
+        if (dep_command(link, more ? PN532_COMMAND_TGSETMETADATA : PN532_COMMAND_TGSETDATA, params, chunk,
+                        buf, sizeof(buf)) == PN532_STATUS_ERROR)
+        {
+            return PN532_STATUS_ERROR;
+        }
+        sent += chunk;
+    } while (sent < length);
+    link->stats.bytes_sent += sent;
+    return PN532_ERROR_NONE;
+}
+
+int nfc_dep_release(nfc_dep_link_t *link)
+{
+    uint8_t params[] = {link->tg};
+    uint8_t response[1] = {0xFF};
+
+    if (pn532_send_receive(PN532_COMMAND_INRELEASE, response, sizeof(response), params, sizeof(params), PN532_DEFAULT_TIMEOUT) == PN532_STATUS_ERROR)
+    {
+        return PN532_STATUS_ERROR;
+    }
+    return response[0];
+}
+
+int nfc_dep_bench(nfc_dep_link_t *link, size_t total)
+{
+    static uint8_t message[NFC_DEP_BENCH_MESSAGE];
+    uint8_t reply[NFC_DEP_BENCH_REPLY];
+    size_t sent = 0;
+
+    for (size_t i = 0; i < sizeof(message); i++)
+    {
+        message[i] = i;
+    }
+    // The last message is the empty one that ends the run.
+    do
+    {
+        size_t length = total - sent < NFC_DEP_BENCH_MESSAGE ? total - sent : NFC_DEP_BENCH_MESSAGE;
+        int received = nfc_dep_transceive(link, message, length, reply, sizeof(reply));
+        uint32_t acknowledged = reply[0] | reply[1] << 8 | reply[2] << 16 | (uint32_t)reply[3] << 24;
+        if (received != NFC_DEP_BENCH_REPLY || acknowledged != length)
+        {
+            console_printf("p2p-bench: message at byte %d not acknowledged!", (int)sent);
+            return PN532_STATUS_ERROR;
+        }
+        if (length == 0)
+        {
+            return PN532_STATUS_OK;
+        }
+        sent += length;
+    } while (1);
+}
+
+int nfc_dep_bench_serve(nfc_dep_link_t *link)
+{
+    static uint8_t message[NFC_DEP_BENCH_MESSAGE];
+
+    while (1)
+    {
+        int length = nfc_dep_receive(link, message, sizeof(message));
+        if (length == PN532_STATUS_ERROR)
+        {
+            return PN532_STATUS_ERROR;
+        }
+        uint8_t reply[NFC_DEP_BENCH_REPLY] = {length & 0xFF, (length >> 8) & 0xFF, (length >> 16) & 0xFF, (length >> 24) & 0xFF};
+        if (nfc_dep_reply(link, reply, sizeof(reply)) != PN532_ERROR_NONE)
+        {
+            return PN532_STATUS_ERROR;
+        }
+        if (length == 0)
+        {
+            return PN532_STATUS_OK;
+        }
+    }
+}
+
+void nfc_dep_print_stats(const nfc_dep_link_t *link)
+{
+    static const int KBPS[] = {106, 212, 424};
+    const nfc_dep_stats_t *stats = &link->stats;
+    unsigned int bytes = stats->bytes_sent + stats->bytes_received;
+    unsigned int frames = stats->frames ? stats->frames : 1;
+    // Per second from milliseconds, so a long run does not overflow.
+    unsigned int ms = stats->frame_us / 1000 ? stats->frame_us / 1000 : 1;
+
+    console_printf("nfc-dep %s at %d kbps (peer up to %d kbps): %d messages, %d bytes sent, %d received\n",
+           link->initiator ? "initiator" : "target", KBPS[link->baud], KBPS[link->max_baud], stats->messages,
+           stats->bytes_sent, stats->bytes_received);
+    console_printf("%d frames: %d us average, %d us slowest; %d bytes/s\n", stats->frames, stats->frame_us / frames,
+           stats->max_frame_us, bytes * 1000 / ms);
+}
@@ -0,0 +1,91 @@
+/**
+ * @file nfc_dump.c
+ * ---------------------
+ * @brief Implements nfc_dump.h
+ */
+
+#include <nfc_dump.h>
+
+uint16_t nfc_dump_crc(const uint8_t *bytes, size_t length)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= (uint16_t)bytes[i] << 8;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+size_t nfc_dump_encode(const nfc_dump_record_t *record, uint8_t *out)
+{
+    size_t length = 0;
+
+    if (record->uid_length > NFC_DUMP_UID_MAX_LENGTH)
+    {
+        return 0;
+    }
+    out[length++] = NFC_DUMP_SYNC;
+    out[length++] = record->uid_length;
+    for (size_t i = 0; i < record->uid_length; i++)
+    {
+        out[length++] = record->uid[i];
+    }
+    out[length++] = record->block;
+    out[length++] = record->status;
+    for (size_t i = 0; i < NFC_DUMP_DATA_LENGTH; i++)
+    {
+        out[length++] = record->data[i];
+    }
+    uint16_t crc = nfc_dump_crc(out + 1, length - 1);
+    out[length++] = crc >> 8;
+    out[length++] = crc & 0xFF;
+    return length;
+}
+
+int nfc_dump_decode(const uint8_t *buf, size_t length, nfc_dump_record_t *record)
+{
+    if (length < 1)
+    {
+        return 0;
+    }
+    if (buf[0] != NFC_DUMP_SYNC)
+    {
+        return NFC_DUMP_BAD;
+    }
+    if (length < 2)
+    {
+        return 0;
+    }
+    size_t uid_length = buf[1];
+    if (uid_length > NFC_DUMP_UID_MAX_LENGTH)
+    {
+        return NFC_DUMP_BAD;
+    }
+    size_t record_length = 6 + uid_length + NFC_DUMP_DATA_LENGTH;
+    if (length < record_length)
+    {
+        return 0;
+    }
+    uint16_t crc = nfc_dump_crc(buf + 1, record_length - 3);
+    if (buf[record_length - 2] != crc >> 8 || buf[record_length - 1] != (crc & 0xFF))
+    {
+        return NFC_DUMP_BAD;
+    }
+
+    record->uid_length = uid_length;
+    for (size_t i = 0; i < uid_length; i++)
+    {
+        record->uid[i] = buf[2 + i];
+    }
+    record->block = buf[2 + uid_length];
+    record->status = buf[3 + uid_length];
+    for (size_t i = 0; i < NFC_DUMP_DATA_LENGTH; i++)
+    {
+        record->data[i] = buf[4 + uid_length + i];
+    }
+    return record_length;
+}
@@ -5,6 +5,9 @@
  */
 
 #include <pn532.h>
+#include <gpioextra.h>
+#include <gpio_interrupts.h>
+#include <console.h>
 
 #define HIGH 1
 #define LOW 0
@@ -16,16 +19,95 @@
 #define _SPI_READY (0x01)
 #define _SPI_CHANNEL (0)
 
+// Status polling cadence: first poll after 10 ms, then every 15 ms.
+#define POLL_FIRST_US (10000)
+#define POLL_RETRY_US (5000)
+// In IRQ mode, status is still polled this often in case an edge is missed.
+#define IRQ_FALLBACK_POLL_US (50000)
+// Waits that can idle for seconds (pn532_await_response) check status this rarely.
+#define IDLE_FALLBACK_POLL_US (1000000)
+#define IDLE_POLL_US (100000)
+// Leading 0x00 bytes tolerated before the start code of a received frame.
+#define DECODER_MAX_PREAMBLE (8)
+
+// Recovery ladder of an exchange that lost a frame on the wire: re-read a corrupted
+// response with NACK, then resend the command with a doubling backoff, then reset.
+#define ACK_TIMEOUT_MS (50) // the PN532 ACKs as soon as it has the frame
+#define NACK_RETRIES (3)
+#define COMMAND_RETRIES (3)
+#define RETRY_BACKOFF_US (1000)
+// Internal result of an exchange that lost a frame and is worth resending.
+#define LINK_LOST (-2)
+// Internal result of an exchange whose command was ACKed, and so run, but whose response
+// never came through intact. Resending runs the command again.
+#define RESPONSE_LOST (-3)
+static const uint8_t PN532_NACK[] = {0x00, 0x00, 0xFF, 0xFF, 0x00, 0x00};
+
 const uint8_t PN532_ACK[] = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
 const uint8_t PN532_FRAME_START[] = {0x00, 0x00, 0xFF};
 static unsigned int _RESET_PIN, _NSS_PIN;
 
+const pn532_timing_t PN532_TIMING_CONSERVATIVE = {
+    .nss_setup_us = 10,
+    .nss_hold_us = 10,
+    .frame_gap_us = 100,
+    .wakeup_us = 2000,
+};
+const pn532_timing_t PN532_TIMING_FAST = {
+    .nss_setup_us = 1,
+    .nss_hold_us = 1,
+    .frame_gap_us = 10,
+    .wakeup_us = 2000, // T_osc_start does not get shorter
+};
+static pn532_timing_t _TIMING;
+static unsigned int _last_nss_release;
+
+static unsigned int _IRQ_PIN;
+static bool _irq_enabled;
+static volatile bool _irq_ready;
+static pn532_stats_t _stats;
+// Why the last received frame was rejected.
+static const char *_frame_error = "";
+// Bumped whenever the chip may have lost its configuration: reset, wakeup, failed exchange.
+static unsigned int _link_generation;
+
+// One buffer carries every exchange, in both directions. Outgoing frames are built in
+// place behind FRAME_HEADROOM bytes of SPI op + header so the payload is copied once.
+// An extended frame fills the headroom; a normal one starts EXTENDED_HEADER_EXTRA in:
+//   extended: [0] SPI op  [1] preamble  [2-3] start code  [4-5] FF FF  [6] LENM  [7] LENL  [8] LCS
+//   normal:                                 [3] SPI op  [4] preamble  [5-6] start code  [7] LEN  [8] LCS
+//   then [9..] TFI, data  DCS  postamble
+#define FRAME_HEADROOM (9)
+#define EXTENDED_HEADER_EXTRA (3)
+#define FRAME_BUFFER_LENGTH (PN532_FRAME_MAX_LENGTH + 20)
+static uint8_t _frame[FRAME_BUFFER_LENGTH];
+
+// Constant command frames, built and bit-reversed once at init.
+static const uint8_t SAM_CONFIG_NORMAL[] = {0x01, 0x14, 0x01};
+static pn532_frame_t _sam_config_normal;
+
+// Fast bring-up: a short reset pulse, then GetFirmwareVersion until the PN532 answers.
+#define RESET_PULSE_US 100       // RSTPD_N low; the datasheet minimum is far shorter
+#define PROBE_TIMEOUT_MS 5       // ACK wait of one probe
+#define PROBE_BACKOFF_MIN_US 500 // pause after an unanswered probe, doubled each time
+#define PROBE_BACKOFF_MAX_US 16000
+#define PROBE_BUDGET_MS 500 // then the full-length sequence takes over
+static pn532_bring_up_t _bring_up;
+
 //-------------SUPPORTING FUNCTIONS START----------------
 
-void pn532_init(unsigned int reset_pin, unsigned int nss_pin) //initialize the HAT to send/receive over SPI
+void pn532_set_timing(const pn532_timing_t *timing)
+{
+    _TIMING = timing ? *timing : PN532_TIMING_CONSERVATIVE;
+}
+
+void pn532_init(unsigned int reset_pin, unsigned int nss_pin, const pn532_timing_t *timing) //initialize the HAT to send/receive over SPI
 {
     // Initialize pins 7-11 for spi
     spi_init(SPI_CE0, 1);
+    pn532_set_timing(timing);
+    pn532_frame_prebuild(&_sam_config_normal, PN532_COMMAND_SAMCONFIGURATION,
+                         SAM_CONFIG_NORMAL, sizeof(SAM_CONFIG_NORMAL));
 
     // Initialize reset and nss pins
     _RESET_PIN = reset_pin;
@@ -33,13 +115,98 @@ void pn532_init(unsigned int reset_pin, unsigned int nss_pin) //initialize the H
     gpio_set_output(_RESET_PIN);
     gpio_set_output(_NSS_PIN);
 
-    // Reset and wakeup module
-    pn532_reset();
-    pn532_wakeup();
+    pn532_bring_up(false);
+}
+
+/**
+ * @fn fast_reset
+ * ---------------------
+ * @description: Pulses reset for RESET_PULSE_US, then holds NSS low for T_osc_start so
+ * the PN532 leaves power down, without the fixed delays of pn532_reset and pn532_wakeup.
+ */
+static void fast_reset(void)
+{
+    _link_generation++;
+    gpio_write(_RESET_PIN, LOW);
+    timer_delay_us(RESET_PULSE_US);
+    gpio_write(_RESET_PIN, HIGH);
+    gpio_write(_NSS_PIN, LOW);
+    timer_delay_us(_TIMING.wakeup_us); // T_osc_start
+    gpio_write(_NSS_PIN, HIGH);
+}
+
+static int transmit(const pn532_frame_t *frame, uint8_t command, uint8_t *params, size_t params_length);
+static int finish_exchange(uint8_t command, uint8_t *response, size_t response_length, unsigned int timeout);
+
+/**
+ * @fn probe_ready
+ * ---------------------
+ * @description: Sends GetFirmwareVersion until the PN532 answers or budget_ms passes,
+ * backing off from PROBE_BACKOFF_MIN_US to PROBE_BACKOFF_MAX_US between attempts.
+ * @returns true once the PN532 answered.
+ */
+static bool probe_ready(unsigned int budget_ms)
+{
+    uint8_t version[4];
+    unsigned int backoff = PROBE_BACKOFF_MIN_US;
+    unsigned int timestart = timer_get_ticks();
+    while (timer_get_ticks() - timestart < 1000 * budget_ms)
+    {
+        // One attempt each, outside the recovery ladder, which would bring the chip up again.
+        _bring_up.probes++;
+        if (transmit(NULL, PN532_COMMAND_GETFIRMWAREVERSION, NULL, 0) == PN532_STATUS_OK &&
+            finish_exchange(PN532_COMMAND_GETFIRMWAREVERSION, version, sizeof(version), PROBE_TIMEOUT_MS) >= 0)
+        {
+            return true;
+        }
+        timer_delay_us(backoff);
+        backoff = backoff * 2 < PROBE_BACKOFF_MAX_US ? backoff * 2 : PROBE_BACKOFF_MAX_US;
+    }
+    return false;
+}
+
+int pn532_bring_up(bool full)
+{
+    unsigned int timestart = timer_get_ticks();
+    memset(&_bring_up, 0, sizeof(_bring_up));
+
+    if (!full)
+    {
+        fast_reset();
+        _bring_up.ready = probe_ready(PROBE_BUDGET_MS);
+    }
+    if (!_bring_up.ready)
+    {
+        // Slow module: the original reset and wakeup sequence.
+        _bring_up.full_reset = true;
+        pn532_reset();
+        pn532_wakeup();
+        _bring_up.ready = probe_ready(PROBE_BUDGET_MS);
+    }
+    _bring_up.ready_us = timer_get_ticks() - timestart;
+
+    if (!_bring_up.ready)
+    {
+        console_printf("PN532 did not answer after a full reset!");
+        return PN532_STATUS_ERROR;
+    }
+    return PN532_STATUS_OK;
+}
+
+const pn532_bring_up_t *pn532_get_bring_up(void)
+{
+    return &_bring_up;
+}
+
+void pn532_print_bring_up(void)
+{
+    console_printf("PN532 %s after %d ms, %d probes, %s reset\n", _bring_up.ready ? "ready" : "not answering",
+           _bring_up.ready_us / 1000, _bring_up.probes, _bring_up.full_reset ? "full" : "fast");
 }
 
 void pn532_reset()
 {
+    _link_generation++;
     gpio_write(_RESET_PIN, HIGH);
     timer_delay_ms(100);
     gpio_write(_RESET_PIN, LOW);
@@ -48,261 +215,904 @@ void pn532_reset()
     timer_delay_ms(100);
 }
 
+// BIT_REVERSE[b] is b with its bit order mirrored: the Pi shifts MSB first, the PN532 LSB first.
+#define R2(n) n, n + 2 * 64, n + 1 * 64, n + 3 * 64
+#define R4(n) R2(n), R2(n + 2 * 16), R2(n + 1 * 16), R2(n + 3 * 16)
+#define R6(n) R4(n), R4(n + 2 * 4), R4(n + 1 * 4), R4(n + 3 * 4)
+static const uint8_t BIT_REVERSE[256] = {R6(0), R6(2), R6(1), R6(3)};
+
 uint8_t reverse_byte(uint8_t byte)
 {
-    uint8_t result = 0;
-    for (char i = 0; i < 8; i++)
+    return BIT_REVERSE[byte];
+}
+
+/**
+ * @fn reverse_bytes
+ * ---------------------
+ * @description: Mirrors the bit order of every byte of data in place.
+ */
+static void reverse_bytes(uint8_t *data, size_t bufsize)
+{
+    for (size_t i = 0; i < bufsize; i++)
     {
-        result <<= 1;
-        result += (byte & 1);
-        byte >>= 1;
+        data[i] = BIT_REVERSE[data[i]];
     }
-    return result;
 }
 
 void pn532_wakeup()
 {
+    _link_generation++;
     // Send any special commands/data to wake up PN532
     uint8_t data[] = {0x00};
     timer_delay_ms(1000);
     gpio_write(_NSS_PIN, LOW);
-    timer_delay_ms(2); // T_osc_start
+    timer_delay_us(_TIMING.wakeup_us); // T_osc_start
     rpi_spi_rw(data, HIGH);
     timer_delay_ms(1000);
 }
 
-void rpi_spi_rw(uint8_t *data, size_t bufsize)
+/**
+ * @fn nss_select
+ * ---------------------
+ * @description: Pulls NSS low once the frame gap since the last transaction has passed.
+ */
+static void nss_select(void)
 {
+    while (timer_get_ticks() - _last_nss_release < _TIMING.frame_gap_us)
+        ;
     gpio_write(_NSS_PIN, LOW);
-    timer_delay_ms(1);
+    timer_delay_us(_TIMING.nss_setup_us);
+    _stats.spi_transactions++;
+}
+
+/**
+ * @fn nss_release
+ * ---------------------
+ * @description: Releases NSS after the hold time and starts the frame gap.
+ */
+static void nss_release(void)
+{
+    timer_delay_us(_TIMING.nss_hold_us);
+    gpio_write(_NSS_PIN, HIGH);
+    _last_nss_release = timer_get_ticks();
+}
+
+/**
+ * @fn spi_chunk
+ * ---------------------
+ * @description: Exchanges bufsize bytes in place within an open chip select, so one
+ * transaction can be read in several pieces.
+ */
+static void spi_chunk(uint8_t *data, size_t bufsize)
+{
+    // The controller reads each byte back into rx after sending it from tx, so one buffer
+    // serves both directions.
+    reverse_bytes(data, bufsize);
+    spi_transfer(data, data, bufsize);
+    reverse_bytes(data, bufsize);
+}
+
+void rpi_spi_rw(uint8_t *data, size_t bufsize)
+{
+    nss_select();
+    spi_chunk(data, bufsize);
+    nss_release();
+}
+
+/**
+ * @fn spi_write_wire
+ * ---------------------
+ * @description: Clocks out bytes that are already bit-reversed (see pn532_frame_prebuild),
+ * discarding what comes back.
+ */
+static void spi_write_wire(const uint8_t *wire, size_t bufsize)
+{
+    nss_select();
+    spi_transfer((uint8_t *)wire, _frame, bufsize);
+    nss_release();
+}
+
+/**
+ * @fn frame_read_raw
+ * ---------------------
+ * @description: Reads bufsize bytes from the PN532 into the frame buffer.
+ * @returns pointer to the bytes read (just past the SPI op byte).
+ */
+static uint8_t *frame_read_raw(size_t bufsize)
+{
+    memset(_frame, 0, bufsize + 1);
+    _frame[0] = _SPI_DATAREAD;
+
+    _irq_ready = false;
+    rpi_spi_rw(_frame, bufsize + 1);
+    return _frame + 1;
+}
 
-    for (int i = 0; i < bufsize; i++)
+void pn532_read_data(uint8_t *data, size_t bufsize)
+{
+    if (bufsize >= FRAME_BUFFER_LENGTH)
     {
-        data[i] = reverse_byte(data[i]);
+        return;
     }
 
-    uint8_t rx[bufsize];
-    spi_transfer(data, rx, bufsize);
+    // Read into the frame buffer after the read byte, then hand the bytes to the caller.
+    // The chip's next ready edge belongs to whatever comes after this frame.
+    uint8_t *frame = frame_read_raw(bufsize);
+    if (data != frame)
+    {
+        memcpy(data, frame, bufsize);
+    }
+}
 
-    for (int i = 0; i < bufsize; i++)
+void pn532_write_data(uint8_t *data, size_t bufsize)
+{
+    if (bufsize >= FRAME_BUFFER_LENGTH)
     {
-        data[i] = reverse_byte(rx[i]);
+        return;
     }
 
-    timer_delay_ms(1);
-    gpio_write(_NSS_PIN, HIGH);
+    // Place data after the write byte unless the caller built it there already
+    if (data != _frame + 1)
+    {
+        memcpy(_frame + 1, data, bufsize);
+    }
+    _frame[0] = _SPI_DATAWRITE;
+
+    // Write frame
+    _irq_ready = false;
+    rpi_spi_rw(_frame, bufsize + 1);
 }
 
-void pn532_read_data(uint8_t *data, size_t bufsize)
+/**
+ * @fn pn532_irq_handler
+ * ---------------------
+ * Handler for the falling edge of the PN532 IRQ line, which the chip pulls low when it
+ * has a frame ready to be read.
+ */
+static bool pn532_irq_handler(unsigned int pc)
 {
-    // Copy data into new frame with read byte as first byte
-    uint8_t frame[bufsize + 1];
-    memset(frame, 0, bufsize + 1);
-    frame[0] = _SPI_DATAREAD;
+    if (!gpio_check_and_clear_event(_IRQ_PIN))
+    {
+        return false;
+    }
+    _irq_ready = true;
+    return true;
+}
 
-    // Transmits frame bytes and copies response into data
-    timer_delay_ms(5);
-    rpi_spi_rw(frame, bufsize + 1);
-    memcpy(data, frame + 1, bufsize);
+void pn532_enable_irq(unsigned int irq_pin)
+{
+    _IRQ_PIN = irq_pin;
+    gpio_set_input(_IRQ_PIN);
+    gpio_set_pullup(_IRQ_PIN);
+
+    gpio_interrupts_enable();
+    gpio_enable_event_detection(_IRQ_PIN, GPIO_DETECT_ASYNC_FALLING_EDGE);
+    gpio_interrupts_register_handler(_IRQ_PIN, pn532_irq_handler);
+    _irq_ready = false;
+    _irq_enabled = true;
 }
 
-void pn532_write_data(uint8_t *data, size_t bufsize)
+void pn532_disable_irq(void)
 {
-    // Copy data into new frame with write byte as first byte
-    uint8_t frame[bufsize + 1];
-    memcpy(frame + 1, data, bufsize);
-    frame[0] = _SPI_DATAWRITE;
+    if (_irq_enabled)
+    {
+        // Undo pn532_enable_irq: nothing waits on the line any more.
+        gpio_disable_event_detection(_IRQ_PIN, GPIO_DETECT_ASYNC_FALLING_EDGE);
+        gpio_check_and_clear_event(_IRQ_PIN);
+    }
+    _irq_ready = false;
+    _irq_enabled = false;
+}
 
-    // Write frame
-    rpi_spi_rw(frame, bufsize + 1);
+/**
+ * @fn poll_latency
+ * ---------------------
+ * @returns how long status polling would have taken to notice a chip that became ready
+ * elapsed usecs into the wait.
+ */
+static unsigned int poll_latency(unsigned int elapsed)
+{
+    unsigned int latency = POLL_FIRST_US;
+    while (latency < elapsed)
+    {
+        latency += POLL_FIRST_US + POLL_RETRY_US;
+    }
+    return latency;
 }
 
-bool pn532_wait_ready(unsigned int timeout)
+/**
+ * @fn status_ready
+ * ---------------------
+ * @returns true if a _SPI_STATREAD reports the PN532 ready.
+ */
+static bool status_ready(void)
 {
     uint8_t status[] = {_SPI_STATREAD, 0x00};
+    rpi_spi_rw(status, sizeof(status));
+    _stats.status_polls++;
+    return status[1] == _SPI_READY;
+}
 
-    unsigned int timestart = timer_get_ticks();
-    unsigned int timenow;
+/**
+ * @fn wait_ready_irq
+ * ---------------------
+ * @returns true once the IRQ handler (or, as a fallback every fallback_us, a status read)
+ * reports ready. A timeout of 0 waits forever.
+ */
+static bool wait_ready_irq(unsigned int timestart, unsigned int timeout, unsigned int fallback_us)
+{
+    unsigned int last_poll = timestart;
+    while (timeout == 0 || timer_get_ticks() - timestart <= 1000 * timeout)
+    {
+        // The line is re-checked so an edge left over from an earlier frame is ignored.
+        if (_irq_ready && gpio_read(_IRQ_PIN) == LOW)
+        {
+            _irq_ready = false;
+            _stats.irq_wakeups++;
+            return true;
+        }
+        if (timer_get_ticks() - last_poll >= fallback_us)
+        {
+            last_poll = timer_get_ticks();
+            if (status_ready())
+                return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @fn wait_ready_poll
+ * ---------------------
+ * @returns true once a status read, first after first_us and then every
+ * first_us + retry_us, reports ready. A timeout of 0 waits forever.
+ */
+static bool wait_ready_poll(unsigned int timestart, unsigned int timeout, unsigned int first_us, unsigned int retry_us)
+{
     while (1)
     {
-        timer_delay_ms(10);
-        rpi_spi_rw(status, sizeof(status));
-        if (status[1] == _SPI_READY)
+        timer_delay_us(first_us);
+        if (status_ready())
         {
             return true;
         }
         else
         {
-            timer_delay_ms(5);
+            timer_delay_us(retry_us);
         }
-        timenow = timer_get_ticks();
-        if (1000 * (timenow - timestart) > timeout)
+        if (timeout != 0 && timer_get_ticks() - timestart > 1000 * timeout)
             break;
     }
     return false;
 }
 
+bool pn532_wait_ready(unsigned int timeout)
+{
+    unsigned int timestart = timer_get_ticks();
+    bool ready = _irq_enabled ? wait_ready_irq(timestart, timeout, IRQ_FALLBACK_POLL_US)
+                              : wait_ready_poll(timestart, timeout, POLL_FIRST_US, POLL_RETRY_US);
+
+    if (ready)
+    {
+        unsigned int elapsed = timer_get_ticks() - timestart;
+        _stats.ready_waits++;
+        _stats.ready_wait_us += elapsed;
+        if (_irq_enabled)
+            _stats.ready_saved_us += poll_latency(elapsed) - elapsed;
+    }
+    return ready;
+}
+
+/**
+ * @fn wait_ready_idle
+ * ---------------------
+ * @description: Like pn532_wait_ready for answers that may take seconds to come. Keeps
+ * the bus quiet meanwhile and stays out of the ready-wait statistics.
+ */
+static bool wait_ready_idle(unsigned int timeout)
+{
+    unsigned int timestart = timer_get_ticks();
+    return _irq_enabled ? wait_ready_irq(timestart, timeout, IDLE_FALLBACK_POLL_US)
+                        : wait_ready_poll(timestart, timeout, IDLE_POLL_US, 0);
+}
+
+unsigned int pn532_link_generation(void)
+{
+    return _link_generation;
+}
+
+/**
+ * @fn link_result
+ * ---------------------
+ * @description: Passes result through, starting a new link generation if a frame was
+ * lost (LINK_LOST or RESPONSE_LOST): nothing is known about the chip's state then. A
+ * response that did not come in time is not a lost link; it is how the PN532 reports
+ * that no target answered.
+ * @returns result, or PN532_STATUS_ERROR if the link was lost.
+ */
+static int link_result(int result)
+{
+    if (result == LINK_LOST || result == RESPONSE_LOST)
+    {
+        _link_generation++;
+        return PN532_STATUS_ERROR;
+    }
+    return result;
+}
+
+const pn532_stats_t *pn532_get_stats(void)
+{
+    return &_stats;
+}
+
+void pn532_reset_stats(void)
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+void pn532_print_stats(void)
+{
+    unsigned int commands = _stats.commands ? _stats.commands : 1;
+    unsigned int waits = _stats.ready_waits ? _stats.ready_waits : 1;
+
+    console_printf("commands: %d, ready mode: %s\n", _stats.commands, _irq_enabled ? "irq" : "poll");
+    console_printf("ready waits: %d, avg %d us, irq wakeups: %d, status polls: %d\n",
+           _stats.ready_waits, _stats.ready_wait_us / waits, _stats.irq_wakeups, _stats.status_polls);
+    console_printf("ready-wait saved vs polling: %d us per command\n", _stats.ready_saved_us / commands);
+    console_printf("spi transactions: %d\n", _stats.spi_transactions);
+    console_printf("recovery: %d bad frames, %d nacks, %d resends, %d link resets\n",
+           _stats.frame_errors, _stats.nacks, _stats.retries, _stats.link_resets);
+}
+
 //-------------SUPPORTING FUNCTIONS END------------------
 
 //-------------FRAME WRITING FUNCTIONS START ------------
 
+/**
+ * @fn frame_seal
+ * ---------------------
+ * @description: Completes a frame whose bufsize data bytes already sit at FRAME_HEADROOM
+ * in frame: writes the SPI op, preamble, start code, length, length checksum, data
+ * checksum (sum is the byte sum of the data) and postamble around them. Data longer than
+ * PN532_NORMAL_FRAME_MAX_LENGTH gets an extended frame header.
+ * @returns the frame's first byte, the SPI op; *length is the number of bytes to clock out.
+ */
+static uint8_t *frame_seal(uint8_t *frame, size_t bufsize, uint8_t sum, size_t *length)
+{
+    uint8_t *start = frame;
+    if (bufsize > PN532_NORMAL_FRAME_MAX_LENGTH)
+    {
+        frame[4] = 0xFF;
+        frame[5] = 0xFF;
+        frame[6] = bufsize >> 8;
+        frame[7] = bufsize & 0xFF;
+        frame[8] = (~(frame[6] + frame[7]) + 1) & 0xFF;
+    }
+    else
+    {
+        start += EXTENDED_HEADER_EXTRA;
+        frame[7] = bufsize & 0xFF;
+        frame[8] = (~bufsize + 1) & 0xFF;
+    }
+    start[0] = _SPI_DATAWRITE;
+    start[1] = PN532_PREAMBLE;
+    start[2] = PN532_STARTCODE1;
+    start[3] = PN532_STARTCODE2;
+    frame[FRAME_HEADROOM + bufsize] = (~sum + 1) & 0xFF;
+    frame[FRAME_HEADROOM + bufsize + 1] = PN532_POSTAMBLE;
+    *length = frame + FRAME_HEADROOM + bufsize + 2 - start;
+    return start;
+}
+
 int pn532_write_frame(uint8_t *data, size_t bufsize)
 {
     // Checks for valid bufsize
     if (bufsize > PN532_FRAME_MAX_LENGTH || bufsize < 1)
     {
-        return PN532_STATUS_ERROR; // Data must be array of 1 to 255 bytes.
+        return PN532_STATUS_ERROR; // Data must be array of 1 to 264 bytes.
     }
     // Build frame to send as:
     // - Preamble (0x00)
     // - Start code  (0x00, 0xFF)
-    // - Command length (1 byte)
+    // - Command length (1 byte, or FF FF and 2 bytes above 255 bytes)
     // - Command length checksum
     // - Command bytes
     // - Checksum
     // - Postamble (0x00)
-
-    uint8_t frame[PN532_FRAME_MAX_LENGTH + 7];
+    uint8_t *payload = _frame + FRAME_HEADROOM;
     uint8_t checksum = 0;
-    frame[0] = PN532_PREAMBLE;
-    frame[1] = PN532_STARTCODE1;
-    frame[2] = PN532_STARTCODE2;
-    for (uint8_t i = 0; i < 3; i++)
+    for (size_t i = 0; i < bufsize; i++)
     {
-        checksum += frame[i];
-    }
-    frame[3] = bufsize & 0xFF;
-    frame[4] = (~bufsize + 1) & 0xFF;
-    for (uint8_t i = 0; i < bufsize; i++)
-    {
-        frame[5 + i] = data[i];
+        payload[i] = data[i];
         checksum += data[i];
     }
-    frame[bufsize + 5] = ~checksum & 0xFF;
-    frame[bufsize + 6] = PN532_POSTAMBLE;
+    size_t length;
+    uint8_t *frame = frame_seal(_frame, bufsize, checksum, &length);
 
-    pn532_write_data(frame, bufsize + 7);
+    _irq_ready = false;
+    rpi_spi_rw(frame, length);
 
     return PN532_STATUS_OK;
 }
 
-int pn532_read_frame(uint8_t *response, size_t bufsize)
+//-------------FRAME DECODER START ------------
+
+void pn532_decoder_init(pn532_decoder_t *decoder, uint8_t *data, size_t capacity)
 {
-    uint8_t buf[PN532_FRAME_MAX_LENGTH + 7];
-    uint8_t checksum = 0;
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->state = PN532_DECODE_PREAMBLE;
+    decoder->data = data;
+    decoder->capacity = capacity;
+}
 
-    // Read frame with expected length of data.
-    pn532_read_data(buf, bufsize + 7);
+/**
+ * @fn decoder_fail
+ * ---------------------
+ * @description: Stops the decoder with error as the reason.
+ */
+static void decoder_fail(pn532_decoder_t *decoder, pn532_decode_error_t error)
+{
+    decoder->state = PN532_DECODE_ERROR;
+    decoder->error = error;
+}
+
+/**
+ * @fn decoder_start_data
+ * ---------------------
+ * @description: Moves on to the data of an information frame whose length checked out.
+ */
+static void decoder_start_data(pn532_decoder_t *decoder)
+{
+    if (decoder->length > decoder->capacity)
+    {
+        decoder_fail(decoder, PN532_DECODE_TOO_LONG);
+        return;
+    }
+    decoder->kind = PN532_FRAME_INFORMATION;
+    decoder->state = decoder->length ? PN532_DECODE_DATA : PN532_DECODE_DCS;
+}
 
-    // Swallow all the 0x00 values that preceed 0xFF.
-    uint8_t offset = 0;
-    while (buf[offset] == 0x00)
+size_t pn532_decoder_feed(pn532_decoder_t *decoder, const uint8_t *bytes, size_t count)
+{
+    size_t i = 0;
+    while (i < count && decoder->state != PN532_DECODE_DONE && decoder->state != PN532_DECODE_ERROR)
     {
-        offset += 1;
-        if (offset >= bufsize + 8)
+        uint8_t byte = bytes[i++];
+        switch (decoder->state)
         {
-            printf("\nResponse frame preamble does not contain 0x00FF!\n");
-            return PN532_STATUS_ERROR;
+        case PN532_DECODE_PREAMBLE:
+            // Any number of 0x00 (up to a limit), then 0xFF.
+            if (byte == 0xFF && decoder->zeros > 0)
+                decoder->state = PN532_DECODE_LEN;
+            else if (byte != 0x00 || ++decoder->zeros > DECODER_MAX_PREAMBLE)
+                decoder_fail(decoder, PN532_DECODE_BAD_START);
+            break;
+        case PN532_DECODE_LEN:
+            decoder->length = byte;
+            decoder->state = PN532_DECODE_LCS;
+            break;
+        case PN532_DECODE_LCS:
+            if (decoder->length == 0x00 && byte == 0xFF)
+            {
+                decoder->kind = PN532_FRAME_ACK;
+                decoder->state = PN532_DECODE_POSTAMBLE;
+            }
+            else if (decoder->length == 0xFF && byte == 0x00)
+            {
+                decoder->kind = PN532_FRAME_NACK;
+                decoder->length = 0;
+                decoder->state = PN532_DECODE_POSTAMBLE;
+            }
+            else if (decoder->length == 0xFF && byte == 0xFF)
+                decoder->state = PN532_DECODE_LENM; // extended frame
+            else if (((decoder->length + byte) & 0xFF) != 0)
+                decoder_fail(decoder, PN532_DECODE_BAD_LCS);
+            else
+                decoder_start_data(decoder);
+            break;
+        case PN532_DECODE_LENM:
+            decoder->length = byte << 8;
+            decoder->state = PN532_DECODE_LENL;
+            break;
+        case PN532_DECODE_LENL:
+            decoder->length |= byte;
+            decoder->state = PN532_DECODE_EXTENDED_LCS;
+            break;
+        case PN532_DECODE_EXTENDED_LCS:
+            if (((decoder->length + (decoder->length >> 8) + byte) & 0xFF) != 0)
+                decoder_fail(decoder, PN532_DECODE_BAD_LCS);
+            else
+                decoder_start_data(decoder);
+            break;
+        case PN532_DECODE_DATA:
+            decoder->data[decoder->received++] = byte;
+            decoder->checksum += byte;
+            if (decoder->received == decoder->length)
+                decoder->state = PN532_DECODE_DCS;
+            break;
+        case PN532_DECODE_DCS:
+            if (((decoder->checksum + byte) & 0xFF) != 0)
+                decoder_fail(decoder, PN532_DECODE_BAD_DCS);
+            else
+                decoder->state = PN532_DECODE_POSTAMBLE;
+            break;
+        case PN532_DECODE_POSTAMBLE:
+            // The postamble carries no information; any value is accepted.
+            decoder->state = PN532_DECODE_DONE;
+            break;
+        default:
+            break;
         }
     }
-    if (buf[offset] != 0xFF)
+    return i;
+}
+
+size_t pn532_decoder_need(const pn532_decoder_t *decoder)
+{
+    switch (decoder->state)
+    {
+    case PN532_DECODE_PREAMBLE:
+        return 1 + 3; // at least 0xFF, LEN and LCS
+    case PN532_DECODE_LEN:
+        return 2;
+    case PN532_DECODE_LCS:
+        return 1;
+    case PN532_DECODE_LENM:
+        return 3;
+    case PN532_DECODE_LENL:
+        return 2;
+    case PN532_DECODE_EXTENDED_LCS:
+        return 1;
+    case PN532_DECODE_DATA:
+        return decoder->length - decoder->received + 2;
+    case PN532_DECODE_DCS:
+        return 2;
+    case PN532_DECODE_POSTAMBLE:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @fn frame_read
+ * ---------------------
+ * @description: Reads one frame of at most capacity data bytes with a single chip select,
+ * clocking the 5-byte header first and then exactly as many bytes as its LEN announces.
+ * The data is decoded into the frame buffer behind the read position.
+ * @returns the decoder's state and results; *data points at the frame data.
+ */
+static pn532_frame_kind_t frame_read(size_t capacity, uint8_t **data, int *length)
+{
+    pn532_decoder_t decoder;
+    pn532_decoder_init(&decoder, _frame, capacity);
+
+    _irq_ready = false;
+    nss_select();
+
+    // SPI op, then preamble, start code, LEN and LCS, then whatever the decoder still needs.
+    _frame[0] = _SPI_DATAREAD;
+    spi_chunk(_frame, 1);
+    size_t position = 1;
+    size_t need = 5;
+    while (need > 0 && position + need <= FRAME_BUFFER_LENGTH)
     {
-        printf("\nResponse frame preamble does not contain 0x00FF!\n");
-        return PN532_STATUS_ERROR;
+        uint8_t *chunk = _frame + position;
+        memset(chunk, 0, need);
+        spi_chunk(chunk, need);
+        pn532_decoder_feed(&decoder, chunk, need);
+        position += need;
+        need = pn532_decoder_need(&decoder);
     }
-    offset += 1;
-    if (offset >= bufsize + 8)
+
+    nss_release();
+
+    *data = _frame;
+    *length = decoder.length;
+    if (decoder.state == PN532_DECODE_DONE)
     {
-        printf("\nResponse contains no data\n");
-        return PN532_STATUS_ERROR;
+        return decoder.kind;
     }
 
-    // Check length & length checksum match.
-    uint8_t frame_len = buf[offset];
-    if (((frame_len + buf[offset + 1]) & 0xFF) != 0)
+    static const char *reasons[] = {
+        [PN532_DECODE_BAD_START] = "preamble does not contain 0x00FF",
+        [PN532_DECODE_BAD_LCS] = "length checksum did not match length",
+        [PN532_DECODE_TOO_LONG] = "is longer than the receive buffer",
+        [PN532_DECODE_BAD_DCS] = "checksum did not match expected checksum",
+    };
+    _stats.frame_errors++;
+    _frame_error = decoder.state == PN532_DECODE_ERROR ? reasons[decoder.error] : "was cut short";
+    return PN532_FRAME_INVALID;
+}
+
+//-------------FRAME DECODER END ------------
+
+int pn532_read_frame(uint8_t *response, size_t bufsize)
+{
+    uint8_t *data;
+    int frame_len;
+    if (frame_read(bufsize, &data, &frame_len) != PN532_FRAME_INFORMATION)
     {
-        printf("\nResponse length checksum did not match length!\n");
+        console_printf("\nResponse frame %s!\n", _frame_error);
         return PN532_STATUS_ERROR;
     }
+    memcpy(response, data, frame_len);
+    return frame_len;
+}
 
-    // Check frame checksum value matches bytes.
-    for (uint8_t i = 0; i < frame_len + 1; i++)
+/**
+ * @fn wait_ack
+ * ---------------------
+ * @description: Waits up to timeout ms, and no longer than ACK_TIMEOUT_MS, for the ACK of
+ * a command frame that is on the wire.
+ * @returns PN532_STATUS_OK, or LINK_LOST if the ACK is missing or garbled.
+ */
+static int wait_ack(unsigned int timeout)
+{
+    // Grab status bytes
+    if (!pn532_wait_ready(timeout != 0 && timeout < ACK_TIMEOUT_MS ? timeout : ACK_TIMEOUT_MS))
+        return LINK_LOST;
+
+    // Verify ACK response
+    uint8_t *ack = frame_read_raw(sizeof(PN532_ACK));
+    if (memcmp(ack, PN532_ACK, sizeof(PN532_ACK)) != 0)
     {
-        checksum += buf[offset + 2 + i];
+        return LINK_LOST;
     }
-    checksum &= 0xFF;
-    if (checksum != 0)
+    return PN532_STATUS_OK;
+}
+
+/**
+ * @fn send_nack
+ * ---------------------
+ * @description: Asks the PN532 to send its last response again.
+ * @returns true once the repeated response is ready.
+ */
+static bool send_nack(void)
+{
+    _stats.nacks++;
+    _frame[0] = _SPI_DATAWRITE;
+    memcpy(_frame + 1, PN532_NACK, sizeof(PN532_NACK));
+    _irq_ready = false;
+    rpi_spi_rw(_frame, sizeof(PN532_NACK) + 1);
+    return pn532_wait_ready(ACK_TIMEOUT_MS);
+}
+
+/**
+ * @fn read_response
+ * ---------------------
+ * @description: Reads the response to command, which the PN532 reports ready, straight
+ * out of the frame buffer into response. A corrupted frame is asked for again with a
+ * NACK, up to NACK_RETRIES times.
+ * @returns number of response bytes, or LINK_LOST if no intact response came through.
+ */
+static int read_response(uint8_t command, uint8_t *response, size_t response_length)
+{
+    // Read response bytes. Any length the frame buffer holds is accepted; only
+    // response_length bytes are handed back.
+    uint8_t *data;
+    int frame_len;
+    int nacks = 0;
+    while (frame_read(PN532_FRAME_MAX_LENGTH, &data, &frame_len) != PN532_FRAME_INFORMATION)
     {
-        printf("\nResponse checksum did not match expected checksum\n");
-        return PN532_STATUS_ERROR;
+        if (nacks++ == NACK_RETRIES || !send_nack())
+        {
+            console_printf("\nResponse frame %s!\n", _frame_error);
+            return LINK_LOST;
+        }
+    }
+
+    // Check that response is for the called function.
+    if (frame_len < 2 || !((data[0] == PN532_PN532TOHOST) && (data[1] == (command + 1))))
+    {
+        console_printf("Received unexpected command response!");
+        return LINK_LOST;
     }
-    // Return frame data.
-    for (uint8_t i = 0; i < frame_len; i++)
+
+    // Return response data, then the number of bytes read
+    size_t length = frame_len - 2;
+    if (response_length > 0)
     {
-        response[i] = buf[offset + 2 + i];
+        memcpy(response, data + 2, response_length < length ? response_length : length);
     }
-    return frame_len;
+    return length;
 }
 
-int pn532_send_receive(uint8_t command, uint8_t *response, size_t response_length, uint8_t *params, size_t params_length, unsigned int timeout)
+/**
+ * @fn finish_exchange
+ * ---------------------
+ * @description: Second half of every command once its frame is on the wire: waits for and
+ * checks the ACK, then waits for and reads the response.
+ * @returns number of response bytes, PN532_STATUS_ERROR if the response did not come in
+ * timeout ms, LINK_LOST if the ACK did not come through, or RESPONSE_LOST if the response
+ * did not.
+ */
+static int finish_exchange(uint8_t command, uint8_t *response, size_t response_length, unsigned int timeout)
 {
-    // Build frame data with command and parameters.
-    uint8_t buf[PN532_FRAME_MAX_LENGTH];
-    buf[0] = PN532_HOSTTOPN532;
-    buf[1] = command & 0xFF;
-    memcpy(buf + 2, params, params_length);
-
-    // Send frame and wait for response.
-    if (pn532_write_frame(buf, params_length + 2) != PN532_STATUS_OK)
+    if (wait_ack(timeout) == LINK_LOST)
+    {
+        return LINK_LOST;
+    }
+    if (!pn532_wait_ready(timeout))
     {
-        pn532_wakeup();
-        printf("Trying to wakeup");
         return PN532_STATUS_ERROR;
     }
+    int length = read_response(command, response, response_length);
+    return length == LINK_LOST ? RESPONSE_LOST : length;
+}
 
-    // Grab status bytes
-    if (!pn532_wait_ready(timeout))
+/**
+ * @fn frame_build
+ * ---------------------
+ * @description: Builds the frame for command with params in place in the frame buffer.
+ * @returns the frame's first byte and in *length the number of bytes to clock out, or
+ * NULL if params do not fit in a frame.
+ */
+static uint8_t *frame_build(uint8_t command, uint8_t *params, size_t params_length, size_t *length)
+{
+    if (params_length + 2 > PN532_FRAME_MAX_LENGTH)
+    {
+        return NULL;
+    }
+
+    uint8_t *payload = _frame + FRAME_HEADROOM;
+    uint8_t checksum = PN532_HOSTTOPN532 + command;
+    payload[0] = PN532_HOSTTOPN532;
+    payload[1] = command & 0xFF;
+    for (size_t i = 0; i < params_length; i++)
+    {
+        payload[2 + i] = params[i];
+        checksum += params[i];
+    }
+    return frame_seal(_frame, params_length + 2, checksum, length);
+}
+
+/**
+ * @fn transmit
+ * ---------------------
+ * @description: Clocks out the prebuilt frame, or if frame is NULL, a frame built from
+ * command and params.
+ * @returns PN532_STATUS_OK, or PN532_STATUS_ERROR if params do not fit in a frame.
+ */
+static int transmit(const pn532_frame_t *frame, uint8_t command, uint8_t *params, size_t params_length)
+{
+    _irq_ready = false;
+    if (frame)
+    {
+        spi_write_wire(frame->wire, frame->length);
+        return PN532_STATUS_OK;
+    }
+
+    // Build frame data with command and parameters directly in the frame buffer.
+    size_t length;
+    uint8_t *built = frame_build(command, params, params_length, &length);
+    if (built == NULL)
+    {
+        console_printf("Parameters of command 0x%02x do not fit in a frame!", command);
         return PN532_STATUS_ERROR;
+    }
+    rpi_spi_rw(built, length);
+    return PN532_STATUS_OK;
+}
 
-    // Verify ACK response and wait to be ready for function response.
-    pn532_read_data(buf, sizeof(PN532_ACK));
-    for (int i = 0; i < sizeof(PN532_ACK); i++)
+/**
+ * @fn exchange
+ * ---------------------
+ * @description: Sends a command and waits for its ACK, and unless ack_only, its response.
+ * A lost or garbled frame climbs the recovery ladder: read_response re-reads a corrupted
+ * response with NACK, the command is resent up to COMMAND_RETRIES times with a doubling
+ * backoff, and last the PN532 is brought up again. A command is only resent after an
+ * unreadable response if resend_acked: the ACK means the PN532 ran it, so that is only
+ * safe for commands that give the same result when run twice, such as card reads and
+ * MIFARE value operations (they read the block, not the transfer buffer). NFC-DEP and
+ * target mode commands are not among them: they pass a chunk to or take one from the peer.
+ * @returns number of response bytes (PN532_STATUS_OK if ack_only), or PN532_STATUS_ERROR.
+ */
+static int exchange(const pn532_frame_t *frame, uint8_t command, uint8_t *params, size_t params_length,
+                    uint8_t *response, size_t response_length, bool ack_only, bool resend_acked, unsigned int timeout)
+{
+    _stats.commands++;
+    unsigned int backoff = RETRY_BACKOFF_US;
+    for (int attempt = 0; attempt <= COMMAND_RETRIES; attempt++)
     {
-        if (PN532_ACK[i] != buf[i])
+        if (attempt > 0)
+        {
+            // Cancel whatever the PN532 made of the last frame before sending it again.
+            _stats.retries++;
+            pn532_abort();
+            timer_delay_us(backoff);
+            backoff *= 2;
+        }
+        if (transmit(frame, command, params, params_length) == PN532_STATUS_ERROR)
         {
-            printf("Did not receive expected ACK from PN532!");
             return PN532_STATUS_ERROR;
         }
+        int result = ack_only ? wait_ack(timeout) : finish_exchange(command, response, response_length, timeout);
+        if (result == RESPONSE_LOST && !resend_acked)
+        {
+            console_printf("Response to command 0x%02x lost, not sending it again!", command);
+            return link_result(result);
+        }
+        if (result != LINK_LOST && result != RESPONSE_LOST)
+        {
+            return result;
+        }
     }
-    if (!pn532_wait_ready(timeout))
+
+    console_printf("PN532 link lost, bringing it up again!");
+    _stats.link_resets++;
+    pn532_bring_up(false);
+    return link_result(LINK_LOST);
+}
+
+int pn532_send_receive(uint8_t command, uint8_t *response, size_t response_length, uint8_t *params, size_t params_length, unsigned int timeout)
+{
+    return exchange(NULL, command, params, params_length, response, response_length, false, true, timeout);
+}
+
+int pn532_send_receive_once(uint8_t command, uint8_t *response, size_t response_length, uint8_t *params, size_t params_length, unsigned int timeout)
+{
+    return exchange(NULL, command, params, params_length, response, response_length, false, false, timeout);
+}
+
+int pn532_send_command(uint8_t command, uint8_t *params, size_t params_length, unsigned int timeout)
+{
+    return exchange(NULL, command, params, params_length, NULL, 0, true, true, timeout);
+}
+
+int pn532_await_response(uint8_t command, uint8_t *response, size_t response_length, unsigned int timeout)
+{
+    // Running out of time here only means no card turned up; the link itself is fine.
+    if (!wait_ready_idle(timeout))
     {
         return PN532_STATUS_ERROR;
     }
+    int length = read_response(command, response, response_length);
+    return link_result(length);
+}
 
-    // Read response bytes.
-    int frame_len = pn532_read_frame(buf, response_length + 2);
+void pn532_abort(void)
+{
+    _frame[0] = _SPI_DATAWRITE;
+    memcpy(_frame + 1, PN532_ACK, sizeof(PN532_ACK));
+    _irq_ready = false;
+    rpi_spi_rw(_frame, sizeof(PN532_ACK) + 1);
+}
 
-    // Check that response is for the called function.
-    if (!((buf[0] == PN532_PN532TOHOST) && (buf[1] == (command + 1))))
+int pn532_frame_prebuild(pn532_frame_t *frame, uint8_t command, const uint8_t *params, size_t params_length)
+{
+    if (FRAME_HEADROOM + params_length + 4 > sizeof(frame->wire) ||
+        params_length + 2 > PN532_NORMAL_FRAME_MAX_LENGTH)
     {
-        printf("Received unexpected command response!");
         return PN532_STATUS_ERROR;
     }
 
-    // Return response data.
-    for (int i = 0; i < response_length; i++)
+    uint8_t *payload = frame->wire + FRAME_HEADROOM;
+    uint8_t checksum = PN532_HOSTTOPN532 + command;
+    payload[0] = PN532_HOSTTOPN532;
+    payload[1] = command;
+    for (size_t i = 0; i < params_length; i++)
     {
-        response[i] = buf[i + 2];
+        payload[2 + i] = params[i];
+        checksum += params[i];
     }
-    // Then return the number of bytes read
-    return frame_len - 2;
+    frame->command = command;
+    uint8_t *start = frame_seal(frame->wire, params_length + 2, checksum, &frame->length);
+    memmove(frame->wire, start, frame->length);
+    reverse_bytes(frame->wire, frame->length);
+    return PN532_STATUS_OK;
+}
+
+int pn532_send_receive_frame(const pn532_frame_t *frame, uint8_t *response, size_t response_length, unsigned int timeout)
+{
+    return exchange(frame, frame->command, NULL, 0, response, response_length, false, true, timeout);
 }
 
 int pn532_get_firmware_version(uint8_t *version)
 {
     if (pn532_send_receive(PN532_COMMAND_GETFIRMWAREVERSION, version, 4, NULL, 0, 500) == PN532_STATUS_ERROR)
     {
-        printf("pn532_get_firmware_version failed to detect the PN532");
+        console_printf("pn532_get_firmware_version failed to detect the PN532");
         return PN532_STATUS_ERROR;
     }
     return PN532_STATUS_OK;
@@ -315,9 +1125,14 @@ int pn532_config_normal()
     // - 0x01, normal mode
     // - 0x14, timeout 50ms * 20 = 1 second
     // - 0x01, use IRQ pin
-    // Note that no other verification is necessary as call_function will
-    // check the command was executed as expected.
-    return pn532_sam_config(0x01, 0x14, 0x01);
+    // The frame is prebuilt in pn532_init from SAM_CONFIG_NORMAL. Note that no other
+    // verification is necessary as call_function will check the command was executed
+    // as expected.
+    if (pn532_send_receive_frame(&_sam_config_normal, NULL, 0, PN532_DEFAULT_TIMEOUT) == PN532_STATUS_ERROR)
+    {
+        return PN532_STATUS_ERROR;
+    }
+    return PN532_STATUS_OK;
 }
 
 int pn532_sam_config(uint8_t mode, uint8_t timeout, uint8_t use_irq_pin)
@@ -328,4 +1143,30 @@ int pn532_sam_config(uint8_t mode, uint8_t timeout, uint8_t use_irq_pin)
         return PN532_STATUS_ERROR;
     }
     return PN532_STATUS_OK;
-}
\ No newline at end of file
+}
+
+int pn532_rf_configuration(uint8_t item, const uint8_t *data, size_t length)
+{
+    uint8_t params[1 + 11]; // analog settings, the longest item, carry 11 bytes
+    if (length > sizeof(params) - 1)
+    {
+        return PN532_STATUS_ERROR;
+    }
+    params[0] = item;
+    memcpy(params + 1, data, length);
+    if (pn532_send_receive(PN532_COMMAND_RFCONFIGURATION, NULL, 0, params, 1 + length, PN532_DEFAULT_TIMEOUT) == PN532_STATUS_ERROR)
+    {
+        return PN532_STATUS_ERROR;
+    }
+    return PN532_STATUS_OK;
+}
+
+int pn532_set_parameters(uint8_t flags)
+{
+    uint8_t params[] = {flags};
+    if (pn532_send_receive(PN532_COMMAND_SETPARAMETERS, NULL, 0, params, sizeof(params), PN532_DEFAULT_TIMEOUT) == PN532_STATUS_ERROR)
+    {
+        return PN532_STATUS_ERROR;
+    }
+    return PN532_STATUS_OK;
+}
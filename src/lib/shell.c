@@ -8,10 +8,24 @@
 #include <printf.h>
 #include <nfc_shell_commands.h>
 #include "nfc.h"
+#include "nfc_dep.h"
+#include "nfc_dump.h"
+#include "console.h"
+#include "journal.h"
+#include "accounts.h"
+#include "denylist.h"
 
 #define LINE_LEN 80
+// provision ends once no new card has come for this long.
+#define PROVISION_IDLE_SECONDS 10
+// Checks deny bench times without a count.
+#define DENY_BENCH_DEFAULT 10000
+// Journal entries journal prints without a count.
+#define JOURNAL_PRINT_DEFAULT 10
 
 static formatted_fn_t shell_printf;
+// Whether pay and charge go to the local account table instead of the card.
+static bool _local_accounts;
 typedef unsigned char uint8_t;
 
 static const command_t commands[] = {
@@ -21,33 +35,26 @@ static const command_t commands[] = {
     {"peek", "[address] prints the contents of memory at address", cmd_peek},
     {"poke", "[address] [value] store value into memory at address", cmd_poke},
     {"charge", "[value] charges tag with value", cmd_charge_tag},
-    {"read", "[block number] prints block", cmd_read_tag},
+    {"read", "[block number] [count] prints count blocks (default 1) or the whole tag (Classic or NTAG)", cmd_read_tag},
     {"pay", "[value] pays tag with value", cmd_pay_tag},
     {"set", "[value] sets tag balance", cmd_set_tag_value},
     {"check", "checks tag balance", cmd_check_tag_balance},
+    {"stats", "[reset] prints or resets PN532 link, card detection and block cache statistics", cmd_stats},
+    {"detect", "[seconds] waits for a card and reports how long detection took", cmd_detect},
+    {"tune", "[default|fast-gate|robust] applies an RF tuning preset or prints the active one", cmd_tune},
+    {"p2p-bench", "[initiator|target] [kilobytes] measures NFC-DEP throughput to a second terminal", cmd_p2p_bench},
+    {"dump", "[--binary] reads a whole Classic card sector by sector, as a table or as binary records", cmd_dump},
+    {"journal", "[count|sync] prints the newest journal entries (default 10) or commits pending ones", cmd_journal},
+    {"account", "[list|add [balance]|check|set [balance]|local [on|off]|clear] manages the local account table", cmd_account},
+    {"deny", "[add uid...|tap|load|bench [count]|clear] revokes cards or prints the deny list statistics", cmd_deny},
+    {"provision", "[balance] [backup block] [key A] [access bits] [key B] initializes cards until none comes for 10 s", cmd_provision},
 };
 static const size_t COMMAND_SIZE = sizeof(commands) / sizeof(commands[0]);
 
-static void print_blocks(uint8_t *buf, size_t bufsize)
+// Rows are 16 bytes: one MIFARE Classic block (row_step 1) or four NTAG pages (row_step 4).
+static void print_blocks(uint8_t *buf, size_t bufsize, size_t first_block, size_t row_step)
 {
-    // Print vertical line numbers
-    shell_printf("\n     ");
-    int num_length = bufsize < 16 ? bufsize : 16;
-    for (int i = 0; i < num_length; i++)
-    {
-        if (i > 9)
-            shell_printf("%d ", i);
-        else
-            shell_printf(" %d ", i);
-    }
-
-    for (int i = 0; i < bufsize; i++)
-    {
-        if (i % 16 == 0)
-            shell_printf("\n%02d : ", i / 16);
-        shell_printf("%02x ", buf[i]);
-    }
-    shell_printf("\n");
+    console_print_table(buf, bufsize, first_block, row_step);
 }
 
 int cmd_check_tag_balance(int argc, const char *argv[])
@@ -60,16 +67,16 @@ int cmd_check_tag_balance(int argc, const char *argv[])
     }
 
     shell_printf("Please scan your card!\n");
-    int *balance = 0;
+    int balance = 0;
 
-    int error_code = get_balance(balance);
+    int error_code = get_balance(&balance);
     if (error_code != PN532_ERROR_NONE)
     {
         shell_printf("Error: 0x%02x\r\n", error_code);
         return 1;
     }
 
-    shell_printf("Current Balance: %d\n", *balance);
+    shell_printf("Current Balance: %d\n", balance);
     return 0;
 }
 
@@ -97,6 +104,30 @@ int cmd_set_tag_value(int argc, const char *argv[])
     return 0;
 }
 
+/**
+ * @fn run_balance_update
+ * ---------------------
+ * Adds delta to the scanned card's balance in one card transaction, or to its local
+ * account if pay and charge go to the account table, and reports it.
+ */
+static int run_balance_update(int delta)
+{
+    shell_printf("Please scan your card!\n");
+    int balance = 0;
+    unsigned int round_trips = 0;
+
+    int error_code = _local_accounts ? update_account_balance(delta, &balance, &round_trips)
+                                     : update_balance(delta, &balance, &round_trips);
+    if (error_code != PN532_ERROR_NONE)
+    {
+        shell_printf("Error: 0x%02x\r\n", error_code);
+        return 1;
+    }
+
+    shell_printf("New Balance: %d (%d round trips)\n", balance, round_trips);
+    return 0;
+}
+
 int cmd_pay_tag(int argc, const char *argv[])
 {
     if (argc != 2)
@@ -111,104 +142,610 @@ int cmd_pay_tag(int argc, const char *argv[])
         return 1;
     }
 
-    shell_printf("Please scan your card!\n");
-    int *balance = 0;
+    return run_balance_update(strtonum(argv[1], NULL));
+}
 
-    int error_code = get_balance(balance);
-    if (error_code != PN532_ERROR_NONE)
+int cmd_charge_tag(int argc, const char *argv[])
+{
+    if (argc != 2)
     {
-        shell_printf("Error: 0x%02x\r\n", error_code);
+        shell_printf("Error: charge takes 1 argument [value]\n");
         return 1;
     }
 
-    *balance += strtonum(argv[1], NULL);
+    if (strtonum(argv[1], NULL) == 0)
+    {
+        shell_printf("Error: charge takes an integer [value] & doesn't allow 0\n");
+        return 1;
+    }
+
+    return run_balance_update(-(int)strtonum(argv[1], NULL));
+}
 
-    error_code = set_balance(*balance);
+int cmd_read_tag(int argc, const char *argv[])
+{
+    uint8_t response[1024];
+    size_t start = 0, count = 64;
+
+    if (argc > 3)
+    {
+        shell_printf("Error: read takes [block number] [count] or no arguments\n");
+        return 1;
+    }
+    if (argc >= 2)
+    {
+        start = strtonum(argv[1], NULL);
+        count = argc == 3 ? strtonum(argv[2], NULL) : 1;
+    }
+    if (start > 63 || count == 0 || start + count > 64)
+    {
+        shell_printf("Error: blocks must be within 0-63\n");
+        return 1;
+    }
+
+    shell_printf("Please hold your card on the scanner until the scan is complete!\n");
+    if (argc == 1)
+    {
+        // A whole NTAG comes in a few FAST_READs; anything else is read as a Classic.
+        size_t pages;
+        int ntag_code = get_ntag_info(response, sizeof(response), &pages);
+        if (ntag_code == PN532_ERROR_NONE)
+        {
+            shell_printf("NTAG pages 0-%d:\n", pages - 1);
+            print_blocks(response, NTAG_PAGE_LENGTH * pages, 0, 4);
+            return 0;
+        }
+        if (ntag_code != NFC_ERROR_WRONG_TAG)
+        {
+            shell_printf("Error: 0x%02x\r\n", ntag_code);
+            return 1;
+        }
+    }
+    int error_code = get_blocks_info(response, start, count);
     if (error_code != PN532_ERROR_NONE)
     {
         shell_printf("Error: 0x%02x\r\n", error_code);
         return 1;
     }
 
-    shell_printf("New Balance: %d\n", *balance);
+    if (count == 1)
+        shell_printf("Reading block %d\n", start);
+    else
+        shell_printf("Blocks %d-%d:\n", start, start + count - 1);
+    print_blocks(response, MIFARE_BLOCK_LENGTH * count, start, 1);
     return 0;
 }
 
-int cmd_charge_tag(int argc, const char *argv[])
+int cmd_stats(int argc, const char *argv[])
 {
-    if (argc != 2)
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "reset") != 0))
     {
-        shell_printf("Error: charge takes 1 argument [value]\n");
+        shell_printf("Error: stats takes no arguments or [reset]\n");
         return 1;
     }
+    if (argc == 2)
+    {
+        pn532_reset_stats();
+        nfc_reset_detect_stats();
+        nfc_reset_cache_stats();
+        return 0;
+    }
+    pn532_print_stats();
+    nfc_print_detect_stats();
+    nfc_print_cache_stats();
+    nfc_print_reader_state();
+    return 0;
+}
 
-    if (strtonum(argv[1], NULL) == 0)
+int cmd_detect(int argc, const char *argv[])
+{
+    uint8_t uid[MIFARE_UID_MAX_LENGTH];
+    unsigned int seconds = 0;
+
+    if (argc > 2)
     {
-        shell_printf("Error: charge takes an integer [value] & doesn't allow 0\n");
+        shell_printf("Error: detect takes [seconds] or no arguments\n");
         return 1;
     }
+    if (argc == 2)
+        seconds = strtonum(argv[1], NULL);
 
     shell_printf("Please scan your card!\n");
-    int *balance = 0;
+    int uid_len = nfc_scan_card(uid, 1000 * seconds);
+    if (uid_len == PN532_STATUS_ERROR)
+    {
+        shell_printf("No card found\n");
+        nfc_print_detect_stats();
+        return 1;
+    }
 
-    int error_code = get_balance(balance);
-    if (error_code != PN532_ERROR_NONE)
+    shell_printf("UID:");
+    for (int i = 0; i < uid_len; i++)
+        shell_printf(" %02x", uid[i]);
+    shell_printf("\n");
+    nfc_print_detect_stats();
+    return 0;
+}
+
+int cmd_tune(int argc, const char *argv[])
+{
+    if (argc > 2)
     {
-        shell_printf("Error: 0x%02x\r\n", error_code);
+        shell_printf("Error: tune takes [preset] or no arguments\n");
         return 1;
     }
+    if (argc == 2)
+    {
+        const nfc_tuning_t *tuning = nfc_find_tuning(argv[1]);
+        if (tuning == NULL)
+        {
+            shell_printf("Error: presets are default, fast-gate and robust\n");
+            return 1;
+        }
+        if (nfc_apply_tuning(tuning) == PN532_STATUS_ERROR)
+        {
+            shell_printf("Error: PN532 did not accept the tuning\n");
+            return 1;
+        }
+    }
+    nfc_print_tuning();
+    return 0;
+}
+
+int cmd_p2p_bench(int argc, const char *argv[])
+{
+    nfc_dep_link_t link;
+    size_t kilobytes = 16;
+
+    if (argc < 2 || argc > 3 || (strcmp(argv[1], "initiator") != 0 && strcmp(argv[1], "target") != 0) ||
+        (argc == 3 && strcmp(argv[1], "initiator") != 0))
+    {
+        shell_printf("Error: p2p-bench takes initiator [kilobytes] or target\n");
+        return 1;
+    }
+    if (argc == 3)
+        kilobytes = strtonum(argv[2], NULL);
 
-    *balance -= strtonum(argv[1], NULL);
+    if (strcmp(argv[1], "target") == 0)
+    {
+        shell_printf("Waiting for the initiator...\n");
+        if (nfc_dep_listen(&link, 0) != PN532_STATUS_OK || nfc_dep_bench_serve(&link) != PN532_STATUS_OK)
+        {
+            shell_printf("Error: p2p-bench run failed\n");
+            return 1;
+        }
+        nfc_dep_print_stats(&link);
+        return 0;
+    }
 
-    error_code = set_balance(*balance);
+    shell_printf("Hold the terminals together!\n");
+    int error_code = nfc_dep_initiate(&link, PN532_DEFAULT_TIMEOUT);
     if (error_code != PN532_ERROR_NONE)
     {
-        shell_printf("Error: 0x%02x\r\n", error_code);
+        shell_printf("Error: no NFC-DEP target (0x%02x)\n", error_code);
+        return 1;
+    }
+    error_code = nfc_dep_bench(&link, 1024 * kilobytes);
+    nfc_dep_release(&link);
+    if (error_code != PN532_STATUS_OK)
+    {
+        shell_printf("Error: p2p-bench run failed\n");
+        return 1;
+    }
+    nfc_dep_print_stats(&link);
+    return 0;
+}
+
+/**
+ * @fn send_record
+ * ---------------------
+ * Queues one dump record for the UART as raw bytes, behind any text before it.
+ */
+static void send_record(const nfc_dump_record_t *record)
+{
+    uint8_t bytes[NFC_DUMP_RECORD_MAX_LENGTH];
+    console_write(bytes, nfc_dump_encode(record, bytes));
+}
+
+int cmd_dump(int argc, const char *argv[])
+{
+    static uint8_t response[MIFARE_BLOCK_LENGTH * 64];
+    nfc_dump_record_t record;
+
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "--binary") != 0))
+    {
+        shell_printf("Error: dump takes [--binary] or no arguments\n");
+        return 1;
+    }
+    bool binary = argc == 2;
+
+    shell_printf("Please hold your card on the scanner until the scan is complete!\n");
+    int uid_len = nfc_scan_card(record.uid, 0);
+    if (uid_len == PN532_STATUS_ERROR || uid_len > NFC_DUMP_UID_MAX_LENGTH)
+    {
+        shell_printf("Error: no card\n");
+        return 1;
+    }
+    record.uid_length = uid_len;
+    // An audit reads the card itself, not what the block cache remembers of it.
+    nfc_cache_invalidate(record.uid, uid_len);
+
+    // A sector the keys do not open is reported and the dump goes on.
+    int dump_status = PN532_ERROR_NONE;
+    for (size_t sector = 0; sector < MIFARE_1K_SECTORS; sector++)
+    {
+        uint8_t *blocks = response + MIFARE_BLOCK_LENGTH * 4 * sector;
+        int error_code = read_blocks(blocks, record.uid, uid_len, 4 * sector, 4, false);
+        if (error_code != PN532_ERROR_NONE)
+        {
+            memset(blocks, 0, MIFARE_BLOCK_LENGTH * 4);
+            dump_status = error_code;
+            if (!binary)
+                shell_printf("Sector %d: error 0x%02x\n", sector, error_code);
+        }
+        // Each block goes out as soon as its sector is read.
+        for (size_t i = 0; binary && i < 4; i++)
+        {
+            record.block = 4 * sector + i;
+            record.status = error_code;
+            memcpy(record.data, blocks + MIFARE_BLOCK_LENGTH * i, MIFARE_BLOCK_LENGTH);
+            send_record(&record);
+        }
+    }
+
+    if (binary)
+    {
+        record.block = NFC_DUMP_END_BLOCK;
+        record.status = dump_status;
+        memset(record.data, 0, MIFARE_BLOCK_LENGTH);
+        send_record(&record);
+        return dump_status != PN532_ERROR_NONE;
+    }
+    shell_printf("Blocks 0-63:\n");
+    print_blocks(response, sizeof(response), 0, 1);
+    return dump_status != PN532_ERROR_NONE;
+}
+
+int cmd_journal(int argc, const char *argv[])
+{
+    if (argc > 2)
+    {
+        shell_printf("Error: journal takes [count], [sync] or no arguments\n");
         return 1;
     }
+    if (argc == 2 && strcmp(argv[1], "sync") == 0)
+    {
+        int error_code = journal_commit();
+        shell_printf("%d entries pending\n", (int)journal_pending());
+        return error_code != 0;
+    }
 
-    shell_printf("New Balance: %d\n", *balance);
+    const char *end = NULL;
+    size_t count = argc == 2 ? strtonum(argv[1], &end) : JOURNAL_PRINT_DEFAULT;
+    if (argc == 2 && (*end != '\0' || count == 0))
+    {
+        shell_printf("Error: journal takes a positive integer [count]\n");
+        return 1;
+    }
+    journal_print(count);
     return 0;
 }
 
-int cmd_read_tag(int argc, const char *argv[])
+/**
+ * @fn scan_account
+ * ---------------------
+ * Waits for a card and finds its local account. Returns NULL, having said why, if the
+ * card has none; uid receives the UID either way.
+ */
+static account_t *scan_account(uint8_t *uid, int *uid_length)
 {
-    uint8_t response[1024];
-    size_t response_length = 0;
+    shell_printf("Please scan your card!\n");
+    *uid_length = nfc_scan_card(uid, 0);
+    if (*uid_length == PN532_STATUS_ERROR)
+    {
+        shell_printf("Error: no card\n");
+        return NULL;
+    }
+    account_t *account = accounts_find(uid, *uid_length);
+    if (!account)
+    {
+        char text[3 * MIFARE_UID_MAX_LENGTH + 1];
+        format_hex_bytes(text, uid, *uid_length);
+        shell_printf("Error: no account for UID %s\n", text);
+    }
+    return account;
+}
+
+int cmd_account(int argc, const char *argv[])
+{
+    uint8_t uid[MIFARE_UID_MAX_LENGTH];
+    char text[3 * MIFARE_UID_MAX_LENGTH + 1];
+    int uid_length;
+    const char *end = NULL;
+    const char *action = argc > 1 ? argv[1] : "";
 
     if (argc == 1)
     {
-        response_length = 1024;
-        printf("Please hold your card on the scanner until the scan is complete!\n");
-        int error_code = get_tag_info(response, response_length);
-        if (error_code != PN532_ERROR_NONE)
+        shell_printf("pay and charge go to the %s\n", _local_accounts ? "local account table" : "card");
+        accounts_print_stats();
+        return 0;
+    }
+    if (strcmp(action, "list") == 0 && argc == 2)
+    {
+        size_t position = 0;
+        for (const account_t *account = accounts_next(&position); account; account = accounts_next(&position))
+        {
+            format_hex_bytes(text, account->uid, account->uid_length);
+            shell_printf("%s: %d\n", text, (int)account->balance);
+        }
+        accounts_print_stats();
+        return 0;
+    }
+    if ((strcmp(action, "add") == 0 || strcmp(action, "set") == 0) && argc <= 3)
+    {
+        int balance = argc == 3 ? strtonum(argv[2], &end) : 0;
+        if (argc == 3 && *end != '\0')
         {
-            shell_printf("Error: 0x%02x\r\n", error_code);
+            shell_printf("Error: account %s takes an integer [balance]\n", action);
             return 1;
         }
-        shell_printf("Blocks 0-63:\n");
+        if (strcmp(action, "set") == 0)
+        {
+            int32_t old_balance;
+            if (!scan_account(uid, &uid_length) || !accounts_set(uid, uid_length, balance, &old_balance))
+            {
+                return 1;
+            }
+            journal_append(uid, uid_length, old_balance, balance, balance - old_balance, PN532_ERROR_NONE);
+        }
+        else
+        {
+            shell_printf("Please scan your card!\n");
+            uid_length = nfc_scan_card(uid, 0);
+            if (uid_length == PN532_STATUS_ERROR || !accounts_add(uid, uid_length, balance))
+            {
+                shell_printf("Error: no card, the card has an account already or the table is full\n");
+                return 1;
+            }
+        }
+        format_hex_bytes(text, uid, uid_length);
+        shell_printf("%s: %d\n", text, balance);
+        return 0;
     }
-    else if (argc == 2)
+    if (strcmp(action, "check") == 0 && argc == 2)
     {
-        response_length = 16;
-        printf("Please hold your card on the scanner until the scan is complete!\n");
-        int error_code = get_block_info(response, strtonum(argv[1], NULL));
+        account_t *account = scan_account(uid, &uid_length);
+        if (!account)
+        {
+            return 1;
+        }
+        shell_printf("Balance: %d\n", (int)account->balance);
+        return 0;
+    }
+    if (strcmp(action, "local") == 0 && argc <= 3)
+    {
+        if (argc == 3 && strcmp(argv[2], "on") != 0 && strcmp(argv[2], "off") != 0)
+        {
+            shell_printf("Error: account local takes [on|off]\n");
+            return 1;
+        }
+        if (argc == 3)
+        {
+            _local_accounts = strcmp(argv[2], "on") == 0;
+        }
+        shell_printf("pay and charge go to the %s\n", _local_accounts ? "local account table" : "card");
+        return 0;
+    }
+    if (strcmp(action, "clear") == 0 && argc == 2)
+    {
+        accounts_clear();
+        return 0;
+    }
 
-        if (error_code != PN532_ERROR_NONE)
+    shell_printf("Error: account takes list, add [balance], check, set [balance], local [on|off] or clear\n");
+    return 1;
+}
+
+/**
+ * @fn load_deny_list
+ * ---------------------
+ * Revokes UIDs sent over the serial console, one per line in hex, until an empty line
+ * or EOT. Nothing is echoed, so a list can be pasted or sent from a file.
+ */
+static void load_deny_list(void)
+{
+    char line[3 * DENYLIST_UID_MAX_LENGTH + 1];
+    size_t length = 0;
+    unsigned int added = 0, rejected = 0;
+    bool too_long = false;
+
+    shell_printf("Send UIDs in hex, one per line, then an empty line\n");
+    while (1)
+    {
+        int c = uart_getchar();
+        if (c == '\r')
+        {
+            continue;
+        }
+        if (c != '\n' && c != EOT)
         {
-            shell_printf("Error: 0x%02x\r\n", error_code);
+            if (length < sizeof(line) - 1)
+                line[length++] = c;
+            else
+                too_long = true;
+            continue;
+        }
+        if (length == 0 && !too_long)
+        {
+            break;
+        }
+
+        uint8_t uid[DENYLIST_UID_MAX_LENGTH];
+        size_t uid_length;
+        line[length] = '\0';
+        if (!too_long && denylist_parse_uid(line, uid, &uid_length) && denylist_add(uid, uid_length))
+            added++;
+        else
+            rejected++;
+        length = 0;
+        too_long = false;
+        if (c == EOT)
+        {
+            break;
+        }
+    }
+    shell_printf("%d UIDs revoked, %d lines rejected\n", added, rejected);
+}
+
+/**
+ * @fn bench_deny_list
+ * ---------------------
+ * Times count checks of made-up UIDs against the deny list as it is.
+ */
+static void bench_deny_list(unsigned int count)
+{
+    uint8_t uids[16][MIFARE_UID_DOUBLE_LENGTH];
+    uint32_t seed = timer_get_ticks();
+    unsigned int revoked = 0;
+
+    for (int i = 0; i < 16; i++)
+    {
+        for (int b = 0; b < MIFARE_UID_DOUBLE_LENGTH; b++)
+        {
+            seed = seed * 1103515245 + 12345;
+            uids[i][b] = seed >> 16;
+        }
+    }
+    unsigned int timestart = timer_get_ticks();
+    for (unsigned int i = 0; i < count; i++)
+    {
+        uids[i % 16][0] = i;
+        revoked += denylist_contains(uids[i % 16], MIFARE_UID_DOUBLE_LENGTH);
+    }
+    unsigned int elapsed = timer_get_ticks() - timestart;
+    shell_printf("%d checks against %d UIDs in %d us: %d ns each, %d revoked\n", count, (int)denylist_count(), elapsed,
+                 (int)(1000ULL * elapsed / count), revoked);
+}
+
+int cmd_deny(int argc, const char *argv[])
+{
+    uint8_t uid[MIFARE_UID_MAX_LENGTH];
+    size_t uid_length;
+    const char *end = NULL;
+    const char *action = argc > 1 ? argv[1] : "";
+
+    if (argc == 1)
+    {
+        denylist_print_stats();
+        return 0;
+    }
+    if (strcmp(action, "add") == 0 && argc > 2)
+    {
+        for (int i = 2; i < argc; i++)
+        {
+            if (!denylist_parse_uid(argv[i], uid, &uid_length) || !denylist_add(uid, uid_length))
+            {
+                shell_printf("Error: %s is not a 4, 7 or 10-byte UID in hex, or the list is full\n", argv[i]);
+                return 1;
+            }
+        }
+        return 0;
+    }
+    if (strcmp(action, "tap") == 0 && argc == 2)
+    {
+        shell_printf("Please scan the card to revoke!\n");
+        int uid_len = nfc_scan_card(uid, 0);
+        if (uid_len == PN532_STATUS_ERROR || !denylist_add(uid, uid_len))
+        {
+            shell_printf("Error: no card, or the list is full\n");
             return 1;
         }
-        shell_printf("Reading block %d\n", strtonum(argv[1], NULL));
+        char text[3 * MIFARE_UID_MAX_LENGTH + 1];
+        format_hex_bytes(text, uid, uid_len);
+        shell_printf("Revoked %s\n", text);
+        return 0;
     }
-    else
+    if (strcmp(action, "load") == 0 && argc == 2)
+    {
+        load_deny_list();
+        return 0;
+    }
+    if (strcmp(action, "bench") == 0 && argc <= 3)
     {
-        shell_printf("Error: charge takes either 1 [block number] or no arguments\n");
+        unsigned int count = argc == 3 ? strtonum(argv[2], &end) : DENY_BENCH_DEFAULT;
+        if ((argc == 3 && *end != '\0') || count == 0)
+        {
+            shell_printf("Error: deny bench takes a positive integer [count]\n");
+            return 1;
+        }
+        bench_deny_list(count);
+        return 0;
+    }
+    if (strcmp(action, "clear") == 0 && argc == 2)
+    {
+        denylist_clear();
+        return 0;
+    }
+
+    shell_printf("Error: deny takes add uid..., tap, load, bench [count] or clear\n");
+    return 1;
+}
+
+int cmd_provision(int argc, const char *argv[])
+{
+    nfc_provision_template_t tmpl = NFC_PROVISION_DEFAULT;
+    uint8_t uid[MIFARE_UID_MAX_LENGTH];
+
+    if (argc < 2 || argc == 4 || argc == 5 || argc > 6 ||
+        (argc == 6 && (parse_hex_bytes(argv[3], tmpl.key_a, MIFARE_KEY_LENGTH) != MIFARE_KEY_LENGTH ||
+                       parse_hex_bytes(argv[4], tmpl.access_bits, MIFARE_ACCESS_BITS_LENGTH) != MIFARE_ACCESS_BITS_LENGTH ||
+                       parse_hex_bytes(argv[5], tmpl.key_b, MIFARE_KEY_LENGTH) != MIFARE_KEY_LENGTH)))
+    {
+        shell_printf("Error: provision takes [balance] [backup block] [key A] [access bits] [key B],\n");
+        shell_printf("keys as 12 hex digits and access bits as 8\n");
         return 1;
     }
+    tmpl.balance = strtonum(argv[1], NULL);
+    if (argc >= 3)
+        tmpl.backup_block = strtonum(argv[2], NULL);
+    tmpl.set_trailers = argc == 6;
+
+    shell_printf("Present cards one at a time; provisioning ends after %d s without one.\n", PROVISION_IDLE_SECONDS);
+    unsigned int cards = 0, failures = 0;
+    unsigned int timestart = timer_get_ticks(), last_removal = timestart;
+    while (1)
+    {
+        int uid_len = nfc_scan_card(uid, 1000 * PROVISION_IDLE_SECONDS);
+        if (uid_len == PN532_STATUS_ERROR)
+            break;
 
-    print_blocks(response, response_length);
-    return 0;
+        unsigned int written = 0;
+        int error_code = nfc_provision_card(&tmpl, uid, uid_len, &written);
+        shell_printf("%d:", cards + failures + 1);
+        for (int i = 0; i < uid_len; i++)
+            shell_printf(" %02x", uid[i]);
+        if (error_code == PN532_ERROR_NONE)
+        {
+            cards++;
+            shell_printf(" ok, %d blocks written\n", written);
+        }
+        else
+        {
+            // The terminal bell tells the operator to set the card aside without looking up.
+            failures++;
+            shell_printf(" FAILED (0x%02x)\a\n", error_code);
+        }
+        nfc_wait_removal(uid, uid_len, 0);
+        last_removal = timer_get_ticks();
+    }
+
+    // The rate leaves out the idle wait that ended the batch.
+    unsigned int elapsed_ms = (last_removal - timestart) / 1000;
+    shell_printf("Provisioned %d cards, %d failures", cards, failures);
+    if (cards + failures > 0 && elapsed_ms > 0)
+        shell_printf(", %d cards per minute", (cards + failures) * 60000 / elapsed_ms);
+    shell_printf("\n");
+    return failures != 0;
 }
 
 /**
@@ -342,6 +879,7 @@ void shell_init(formatted_fn_t print_fn)
 
 int cmd_reboot(int argc, const char *argv[])
 {
+    console_flush();
     uart_send(EOT);
     pi_reboot();
     return 0;
@@ -349,7 +887,7 @@ int cmd_reboot(int argc, const char *argv[])
 
 void shell_bell(void)
 {
-    uart_putchar('\a');
+    console_write((const uint8_t *)"\a", 1);
 }
 
 static bool isalnum(char c)
@@ -388,9 +926,7 @@ void shell_readline(char buf[], size_t bufsize)
             else
             {
                 i--;
-                shell_printf("%c", '\b');
-                shell_printf("%c", ' ');
-                shell_printf("%c", '\b');
+                shell_printf("\b \b");
             }
         }
         else if (i < bufsize - 2 && canPrint(c))
@@ -484,6 +1020,8 @@ void shell_run(void)
     {
         char line[LINE_LEN];
 
+        // Whatever the last command journaled is committed while the shell waits for input.
+        journal_commit();
         shell_printf("Pi> ");
         shell_readline(line, sizeof(line));
         shell_evaluate(line);
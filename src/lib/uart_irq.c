@@ -0,0 +1,70 @@
+/**
+ * @file uart_irq.c
+ * ---------------------
+ * @brief Implements uart_irq.h on the BCM2835 mini UART.
+ */
+
+#include <uart_irq.h>
+
+struct mini_uart
+{
+    unsigned int io;
+    unsigned int ier;
+    unsigned int iir;
+    unsigned int lcr;
+    unsigned int mcr;
+    unsigned int lsr;
+    unsigned int msr;
+    unsigned int scratch;
+    unsigned int cntl;
+    unsigned int stat;
+    unsigned int baud;
+};
+
+#define AUX_IRQ ((volatile unsigned int *)0x20215000)
+#define AUX_IRQ_MINI_UART (1 << 0)
+static volatile struct mini_uart *const MU = (struct mini_uart *)0x20215040;
+
+// The datasheet swaps the RX and TX enable bits; bit 1 is TX. Bits 3-2, documented as
+// unused, must be set for the interrupt to fire at all.
+#define IER_TX_EMPTY ((1 << 1) | (3 << 2))
+#define LSR_TX_ROOM (1 << 5)
+
+static handler_fn_t _handler;
+
+/**
+ * @fn mini_uart_handler
+ * ---------------------
+ * @description: Claims the AUX interrupt if the mini UART raised it.
+ */
+static bool mini_uart_handler(unsigned int pc)
+{
+    if (!(*AUX_IRQ & AUX_IRQ_MINI_UART))
+    {
+        return false;
+    }
+    return _handler(pc);
+}
+
+void uart_irq_init(handler_fn_t handler)
+{
+    _handler = handler;
+    MU->ier = 0;
+    interrupts_register_handler(INTERRUPTS_AUX, mini_uart_handler);
+    interrupts_enable_source(INTERRUPTS_AUX);
+}
+
+bool uart_irq_tx_ready(void)
+{
+    return MU->lsr & LSR_TX_ROOM;
+}
+
+void uart_irq_tx_put(uint8_t byte)
+{
+    MU->io = byte;
+}
+
+void uart_irq_tx_enable(bool enable)
+{
+    MU->ier = enable ? IER_TX_EMPTY : 0;
+}
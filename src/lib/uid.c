@@ -0,0 +1,23 @@
+/**
+ * @file uid.c
+ * ---------------------
+ * @brief Implements uid.h
+ */
+
+#include <uid.h>
+
+uint32_t uid_hash(const uint8_t *uid, size_t uid_length)
+{
+    uint32_t hash = 2166136261u;
+    hash = (hash ^ uid_length) * 16777619u;
+    for (size_t i = 0; i < uid_length; i++)
+    {
+        hash = (hash ^ uid[i]) * 16777619u;
+    }
+    return hash;
+}
+
+bool uid_length_valid(size_t uid_length)
+{
+    return uid_length == 4 || uid_length == 7 || uid_length == 10;
+}
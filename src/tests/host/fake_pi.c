@@ -0,0 +1,300 @@
+/**
+ * @file fake_pi.c
+ * ---------------------
+ * @brief Implements fake_pi.h and the libpi stand-ins in host/include.
+ */
+
+#include <spi.h>
+#include <gpio.h>
+#include <timer.h>
+#include <gpioextra.h>
+#include <gpio_interrupts.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <uart_irq.h>
+#include "fake_pi.h"
+#include "fake_pn532.h"
+
+#define NUM_PINS (GPIO_PIN_LAST + 1)
+
+static unsigned int now_us;
+static unsigned int pin_levels[NUM_PINS];
+static bool falling_detect[NUM_PINS], events[NUM_PINS];
+static handler_fn_t handlers[NUM_PINS];
+static bool gpio_interrupts_on;
+
+static void uart_tick(void);
+
+unsigned int fake_pi_now(void)
+{
+    return now_us;
+}
+
+void fake_pi_advance(unsigned int usecs)
+{
+    now_us += usecs;
+    uart_tick();
+    fake_pn532_tick(now_us);
+}
+
+void fake_gpio_drive(unsigned int pin, unsigned int level)
+{
+    bool falling = pin_levels[pin] && !level;
+    pin_levels[pin] = level;
+    if (!falling || !falling_detect[pin])
+        return;
+
+    events[pin] = true;
+    if (gpio_interrupts_on && handlers[pin])
+        handlers[pin](0);
+}
+
+bool fake_gpio_detects_falling(unsigned int pin)
+{
+    return falling_detect[pin];
+}
+
+/*---------------------- timer ----------------------*/
+
+void timer_init(void)
+{
+}
+
+unsigned int timer_get_ticks(void)
+{
+    // A spinning reader still costs time.
+    fake_pi_advance(1);
+    return now_us;
+}
+
+void timer_delay_us(unsigned int usecs)
+{
+    fake_pi_advance(usecs);
+}
+
+void timer_delay_ms(unsigned int msecs)
+{
+    fake_pi_advance(1000 * msecs);
+}
+
+void timer_delay(unsigned int secs)
+{
+    fake_pi_advance(1000000 * secs);
+}
+
+/*---------------------- gpio ----------------------*/
+
+void gpio_init(void)
+{
+}
+
+void gpio_set_input(unsigned int pin)
+{
+}
+
+void gpio_set_output(unsigned int pin)
+{
+}
+
+void gpio_write(unsigned int pin, unsigned int val)
+{
+    pin_levels[pin] = val;
+    fake_pn532_gpio_write(pin, val);
+}
+
+unsigned int gpio_read(unsigned int pin)
+{
+    return pin_levels[pin];
+}
+
+void gpio_set_pullup(unsigned int pin)
+{
+}
+
+void gpio_set_pulldown(unsigned int pin)
+{
+}
+
+void gpio_enable_event_detection(unsigned int pin, gpio_event_t event)
+{
+    if (event == GPIO_DETECT_FALLING_EDGE || event == GPIO_DETECT_ASYNC_FALLING_EDGE)
+        falling_detect[pin] = true;
+}
+
+void gpio_disable_event_detection(unsigned int pin, gpio_event_t event)
+{
+    if (event == GPIO_DETECT_FALLING_EDGE || event == GPIO_DETECT_ASYNC_FALLING_EDGE)
+        falling_detect[pin] = false;
+}
+
+bool gpio_check_and_clear_event(unsigned int pin)
+{
+    bool event = events[pin];
+    events[pin] = false;
+    return event;
+}
+
+/*---------------------- interrupts ----------------------*/
+
+void interrupts_init(void)
+{
+}
+
+void interrupts_global_enable(void)
+{
+}
+
+void interrupts_global_disable(void)
+{
+}
+
+void gpio_interrupts_init(void)
+{
+    memset(handlers, 0, sizeof(handlers));
+    memset(falling_detect, 0, sizeof(falling_detect));
+    gpio_interrupts_on = false;
+}
+
+void gpio_interrupts_enable(void)
+{
+    gpio_interrupts_on = true;
+}
+
+void gpio_interrupts_disable(void)
+{
+    gpio_interrupts_on = false;
+}
+
+handler_fn_t gpio_interrupts_register_handler(unsigned int pin, handler_fn_t fn)
+{
+    handler_fn_t old = handlers[pin];
+    handlers[pin] = fn;
+    return old;
+}
+
+/*---------------------- spi ----------------------*/
+
+static uint8_t reverse(uint8_t b)
+{
+    uint8_t r = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        r = (r << 1) | (b & 1);
+        b >>= 1;
+    }
+    return r;
+}
+
+void spi_init(spi_chip_select_t chip_select, unsigned int polarity)
+{
+}
+
+void spi_transfer(unsigned char *tx, unsigned char *rx, unsigned int len)
+{
+    // The Pi shifts MSB first and the PN532 LSB first, so the chip sees every byte
+    // mirrored. Byte by byte, so rx may alias tx as with the real controller.
+    for (unsigned int i = 0; i < len; i++)
+    {
+        fake_pi_advance(FAKE_SPI_US_PER_BYTE);
+        rx[i] = reverse(fake_pn532_spi_byte(reverse(tx[i])));
+    }
+}
+
+/*---------------------- strings ----------------------*/
+
+unsigned int strtonum(const char *str, const char **endptr)
+{
+    char *end;
+    unsigned int result = (unsigned int)strtoul(str, &end, 0);
+    if (endptr)
+        *endptr = end;
+    return result;
+}
+
+/*---------------------- uart ----------------------*/
+
+#define UART_FIFO_DEPTH 8
+
+static struct
+{
+    handler_fn_t handler;
+    bool tx_irq, in_handler;
+    unsigned int us_per_byte; // 0: the line takes bytes as fast as they come
+    unsigned int fifo;        // bytes waiting in the TX FIFO
+    unsigned int next_out;    // when the oldest of them is on the line
+    char output[FAKE_UART_CAPTURE];
+    size_t output_len;
+} uart;
+
+/**
+ * @fn uart_raise
+ * ---------------------
+ * @description: Runs the handler while the TX interrupt is on and the FIFO empty, the
+ * condition the mini UART interrupts on.
+ */
+static void uart_raise(void)
+{
+    if (uart.tx_irq && uart.handler && !uart.in_handler && uart.fifo == 0)
+    {
+        uart.in_handler = true;
+        uart.handler(0);
+        uart.in_handler = false;
+    }
+}
+
+static void uart_tick(void)
+{
+    while (uart.fifo > 0 && (int)(now_us - uart.next_out) >= 0)
+    {
+        uart.fifo--;
+        uart.next_out += uart.us_per_byte;
+    }
+    uart_raise();
+}
+
+void uart_irq_init(handler_fn_t handler)
+{
+    uart.handler = handler;
+    uart.tx_irq = false;
+}
+
+bool uart_irq_tx_ready(void)
+{
+    return uart.us_per_byte == 0 || uart.fifo < UART_FIFO_DEPTH;
+}
+
+void uart_irq_tx_put(uint8_t byte)
+{
+    if (uart.output_len < FAKE_UART_CAPTURE)
+        uart.output[uart.output_len++] = byte;
+    if (byte != '\r')
+        putchar(byte);
+    if (uart.us_per_byte == 0)
+        return;
+    if (uart.fifo++ == 0)
+        uart.next_out = now_us + uart.us_per_byte;
+}
+
+void uart_irq_tx_enable(bool enable)
+{
+    uart.tx_irq = enable;
+    uart_raise();
+}
+
+void fake_uart_set_us_per_byte(unsigned int usecs)
+{
+    uart.us_per_byte = usecs;
+    uart.fifo = 0;
+}
+
+const char *fake_uart_output(size_t *length)
+{
+    *length = uart.output_len;
+    return uart.output;
+}
+
+void fake_uart_clear_output(void)
+{
+    uart.output_len = 0;
+}
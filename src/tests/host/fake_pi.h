@@ -0,0 +1,70 @@
+/**
+ * @file fake_pi.h
+ * ---------------------
+ * @brief Host-side replacements for the parts of libpi the nfc modules use. Time is a
+ * virtual microsecond counter so latencies measured against the fakes are exact and
+ * repeatable.
+ */
+#ifndef _FAKE_PI_H
+#define _FAKE_PI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define FAKE_SPI_US_PER_BYTE 8 // 1 MHz SCK
+#define FAKE_UART_CAPTURE 16384
+
+/**
+ * @fn fake_pi_now
+ * ---------------------
+ * @returns the virtual clock in microseconds without advancing it.
+ */
+unsigned int fake_pi_now(void);
+
+/**
+ * @fn fake_pi_advance
+ * ---------------------
+ * @description: Advances the virtual clock and lets simulated devices catch up.
+ */
+void fake_pi_advance(unsigned int usecs);
+
+/**
+ * @fn fake_gpio_drive
+ * ---------------------
+ * @description: Called by a simulated device to set the level of one of its output
+ * lines, as seen by gpio_read on the Pi side.
+ */
+void fake_gpio_drive(unsigned int pin, unsigned int level);
+
+/**
+ * @fn fake_gpio_detects_falling
+ * ---------------------
+ * @returns true if falling edges on pin are detected as events.
+ */
+bool fake_gpio_detects_falling(unsigned int pin);
+
+/**
+ * @fn fake_uart_set_us_per_byte
+ * ---------------------
+ * @description: Sets how long the simulated mini UART takes to put a byte on the line,
+ * draining its 8-byte TX FIFO on the virtual clock; 0, the default, sends at once.
+ */
+void fake_uart_set_us_per_byte(unsigned int usecs);
+
+/**
+ * @fn fake_uart_output
+ * ---------------------
+ * @returns the bytes sent through the mini UART since the last clear, up to
+ * FAKE_UART_CAPTURE of them. They are echoed to stdout as well, without the '\r's.
+ */
+const char *fake_uart_output(size_t *length);
+
+/**
+ * @fn fake_uart_clear_output
+ * ---------------------
+ * @description: Empties the captured output.
+ */
+void fake_uart_clear_output(void);
+
+#endif // _FAKE_PI_H
@@ -0,0 +1,1336 @@
+/**
+ * @file fake_pn532.c
+ * ---------------------
+ * @brief Implements fake_pn532.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "fake_pn532.h"
+#include "fake_pi.h"
+
+#define FRAME_MAX 300
+
+#define SPI_STATREAD (0x02)
+#define SPI_DATAWRITE (0x01)
+#define SPI_DATAREAD (0x03)
+
+#define ACK_US 200       // command frame received -> ACK ready
+#define CARD_RF_US 2000  // extra time for commands that talk to the card
+#define AUTOPOLL_PERIOD_US 150000
+// ISO14443-4 and FeliCa exchanges take a turnaround plus air time at the card's bit rate.
+#define RF_TURNAROUND_US 500
+#define ATS_TA1 (0x33) // DS and DR: 212 and 424 kbps
+
+#define ERR_TIMEOUT (0x01)
+#define ERR_MIFARE_AUTH (0x14)
+
+// NTAG215 layout: 135 pages, the configuration in the last four.
+#define NTAG_PAGES 135
+#define NTAG_AUTH0 (131 * 4 + 3)
+#define NTAG_PWD (133 * 4)
+#define NTAG_PACK (134 * 4)
+
+fake_pn532_counters_t fake_pn532_counters;
+
+static const uint8_t ACK_FRAME[] = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
+
+static struct
+{
+    unsigned int reset_pin, nss_pin, irq_pin;
+    unsigned int processing_us;
+    unsigned int now;
+
+    // Reset held low, and when the chip answers on SPI again after it was released.
+    bool in_reset;
+    unsigned int boot_us, boot_done;
+
+    // Current SPI transaction.
+    bool nss_low;
+    unsigned int index;
+    uint8_t op;
+    uint8_t in[FRAME_MAX];
+    size_t in_len;
+
+    // Frame queued for the host (ACK or response) and when it becomes readable.
+    uint8_t out[FRAME_MAX];
+    size_t out_len, out_pos;
+    bool out_pending, ready, out_is_response;
+    unsigned int ready_at;
+
+    // Line noise: command frames lost and responses garbled on their way to the host.
+    unsigned int drop_commands;
+    unsigned int corrupt_responses;
+    // Card writes carried out whose acknowledgement from the card is lost, and reads
+    // answered with a status but no data.
+    unsigned int lose_card_acks;
+    unsigned int short_reads;
+
+    // Response waiting behind the ACK.
+    uint8_t response[FRAME_MAX];
+    size_t response_len;
+    bool response_pending;
+    unsigned int response_us;
+
+    // Command waiting for a card to enter the field (InListPassiveTarget, InAutoPoll).
+    uint8_t listen_cmd;
+    unsigned int listen_next;   // time of the next poll
+    unsigned int listen_period; // 0 polls continuously
+    unsigned int listen_rounds; // polls left, 0 for no limit
+    uint8_t listen_type;        // InAutoPoll type that matches the card, 0xFF for none
+    uint8_t listen_params[16];  // InListPassiveTarget MaxTg, BrTy and initiator data
+    size_t listen_len;
+
+    // RFConfiguration and SetParameters settings.
+    uint8_t rf_field;
+    uint8_t max_retry_passive;
+    uint8_t parameter_flags;
+} chip;
+
+// Card that enters the field later.
+static struct
+{
+    bool pending;
+    unsigned int at;
+    uint8_t uid[10];
+    size_t uid_len;
+} arrival;
+
+typedef struct
+{
+    fake_card_type_t type;
+    bool present, selected;
+    uint8_t tg;   // logical number from the last listing
+    uint8_t baud; // 0: 106, 1: 212, 2: 424 kbps
+    bool iso_active; // ISO14443-4 activated with RATS
+    bool pwd_ok;     // NTAG PWD_AUTH passed since selection
+    uint8_t uid[10];
+    size_t uid_len;
+    int auth_sector;
+    uint8_t blocks[FAKE_PN532_BLOCKS][16];
+    // Value operation result waiting for TRANSFER.
+    bool transfer_pending;
+    int32_t transfer_value;
+    uint8_t transfer_address;
+} fake_card_t;
+
+static fake_card_t cards[FAKE_PN532_MAX_CARDS];
+static fake_card_t *card = &cards[0]; // card InDataExchange last talked to
+
+// Second terminal for NFC-DEP: a target the chip activates as Tg 1, or an initiator that
+// activates the chip as target. Messages are chained in DEP_CHUNK byte pieces.
+#define DEP_CHUNK 256
+static struct
+{
+    bool target, initiator; // role of the peer, if any
+    bool active;            // link up
+    bool echo;
+    uint8_t max_baud, baud;
+    uint8_t in[FAKE_PN532_DEP_MAX]; // message being received
+    size_t in_len;
+    uint8_t received[FAKE_PN532_DEP_MAX]; // last complete one
+    size_t received_len;
+    uint8_t out[FAKE_PN532_DEP_MAX]; // message being sent
+    size_t out_len, out_pos;
+    bool sending; // chunks of out left to give
+} peer;
+
+/*---------------------- card model ----------------------*/
+
+static bool is_trailer(size_t block)
+{
+    return block % 4 == 3;
+}
+
+void fake_pn532_add_card_of_type(fake_card_type_t type, const uint8_t *uid, size_t uid_len)
+{
+    static const uint8_t trailer[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x07,
+                                      0x80, 0x69, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    fake_card_t *c = cards;
+    while (c->present && c < cards + FAKE_PN532_MAX_CARDS - 1)
+        c++;
+    memset(c, 0, sizeof(*c));
+    c->type = type;
+    c->present = true;
+    c->auth_sector = -1;
+    c->uid_len = uid_len;
+    memcpy(c->uid, uid, uid_len);
+    if (type == FAKE_CARD_NTAG215)
+    {
+        // UID and check bytes, capability container, user pattern, configuration.
+        static const uint8_t config[] = {0x00, 0x00, 0x00, 0xBD, 0x04, 0x00, 0x00, 0xFF,
+                                         0x00, 0x05, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF,
+                                         0x00, 0x00, 0x00, 0x00};
+        static const uint8_t cc[] = {0xE1, 0x10, 0x3E, 0x00};
+        uint8_t *mem = &c->blocks[0][0];
+        for (size_t i = 16; i < 130 * 4; i++)
+            mem[i] = i * 7;
+        memcpy(mem, uid, 3);
+        mem[3] = 0x88 ^ uid[0] ^ uid[1] ^ uid[2];
+        memcpy(mem + 4, uid + 3, 4);
+        mem[8] = uid[3] ^ uid[4] ^ uid[5] ^ uid[6];
+        mem[9] = 0x48;
+        memcpy(mem + 12, cc, sizeof(cc));
+        memcpy(mem + 130 * 4, config, sizeof(config));
+        return;
+    }
+    if (type != FAKE_CARD_CLASSIC)
+    {
+        // ISO14443-4: one 1 KB binary file. FeliCa: 64 plain 16-byte blocks.
+        for (size_t i = 0; i < sizeof(c->blocks); i++)
+            c->blocks[i / 16][i % 16] = i * 7;
+        return;
+    }
+    memcpy(c->blocks[0], uid, uid_len);
+    for (size_t i = 3; i < FAKE_PN532_BLOCKS; i += 4)
+    {
+        memcpy(c->blocks[i], trailer, sizeof(trailer));
+    }
+}
+
+void fake_pn532_add_card(const uint8_t *uid, size_t uid_len)
+{
+    fake_pn532_add_card_of_type(FAKE_CARD_CLASSIC, uid, uid_len);
+}
+
+void fake_pn532_place_card(const uint8_t *uid, size_t uid_len)
+{
+    fake_pn532_remove_card();
+    fake_pn532_add_card(uid, uid_len);
+}
+
+void fake_pn532_place_card_after(const uint8_t *uid, size_t uid_len, unsigned int usecs)
+{
+    fake_pn532_remove_card();
+    arrival.pending = true;
+    arrival.at = chip.now + usecs;
+    arrival.uid_len = uid_len;
+    memcpy(arrival.uid, uid, uid_len);
+}
+
+void fake_pn532_remove_card(void)
+{
+    for (size_t i = 0; i < FAKE_PN532_MAX_CARDS; i++)
+    {
+        cards[i].present = false;
+        cards[i].selected = false;
+    }
+}
+
+uint8_t *fake_pn532_card_block(size_t block_number)
+{
+    return cards[0].blocks[block_number];
+}
+
+uint8_t *fake_pn532_card_block_of(size_t card_index, size_t block_number)
+{
+    return cards[card_index].blocks[block_number];
+}
+
+uint8_t *fake_pn532_card_page(size_t page)
+{
+    return &cards[0].blocks[0][0] + 4 * page;
+}
+
+void fake_pn532_add_dep_peer(uint8_t max_baud, bool echo)
+{
+    memset(&peer, 0, sizeof(peer));
+    peer.target = true;
+    peer.max_baud = max_baud;
+    peer.echo = echo;
+}
+
+void fake_pn532_dep_initiator_send(const uint8_t *message, size_t length)
+{
+    memset(&peer, 0, sizeof(peer));
+    peer.initiator = true;
+    memcpy(peer.out, message, length);
+    peer.out_len = length;
+    peer.sending = true;
+}
+
+const uint8_t *fake_pn532_dep_received(size_t *length)
+{
+    *length = peer.received_len;
+    return peer.received;
+}
+
+/**
+ * @fn parse_value
+ * ---------------------
+ * @returns true if block holds a well-formed value block, with its value and address.
+ */
+static bool parse_value(const uint8_t *b, int32_t *value, uint8_t *address)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        if (b[i] != b[8 + i] || b[i] != (uint8_t)~b[4 + i])
+            return false;
+    }
+    if (b[12] != b[14] || b[13] != b[15] || b[12] != (uint8_t)~b[13])
+        return false;
+    *value = (int32_t)(b[0] | b[1] << 8 | b[2] << 16 | (uint32_t)b[3] << 24);
+    *address = b[12];
+    return true;
+}
+
+/**
+ * @fn card_halt
+ * ---------------------
+ * @returns the status of a NAKed command, which halts a Classic card.
+ */
+static uint8_t card_halt(void)
+{
+    card->auth_sector = -1;
+    card->selected = false;
+    card->transfer_pending = false;
+    return ERR_MIFARE_AUTH;
+}
+
+/**
+ * @fn card_ack
+ * ---------------------
+ * @description: Status of a write the card has carried out: a timeout if its
+ * acknowledgement is to be lost.
+ */
+static uint8_t card_ack(void)
+{
+    if (chip.lose_card_acks > 0)
+    {
+        chip.lose_card_acks--;
+        return ERR_TIMEOUT;
+    }
+    return 0x00;
+}
+
+/**
+ * @fn card_exchange
+ * ---------------------
+ * @description: Runs one MIFARE Classic command against the card->
+ * @returns PN532 status byte, data is appended to out.
+ */
+static uint8_t card_exchange(const uint8_t *cmd, size_t len, uint8_t *out, size_t *out_len)
+{
+    if (!card->present || !card->selected || len < 2)
+        return ERR_TIMEOUT;
+
+    size_t block = cmd[1];
+    if (block >= FAKE_PN532_BLOCKS)
+        return ERR_MIFARE_AUTH;
+    int sector = block / 4;
+    uint8_t *trailer = card->blocks[sector * 4 + 3];
+
+    switch (cmd[0])
+    {
+    case 0x60: // AUTH_A
+    case 0x61: // AUTH_B
+    {
+        const uint8_t *key = cmd[0] == 0x60 ? trailer : trailer + 10;
+        if (len < 8 + card->uid_len || memcmp(cmd + 2, key, 6) != 0 ||
+            memcmp(cmd + 8, card->uid, card->uid_len) != 0)
+        {
+            // A failed authentication halts the card->
+            card->auth_sector = -1;
+            card->selected = false;
+            return ERR_MIFARE_AUTH;
+        }
+        card->auth_sector = sector;
+        return 0x00;
+    }
+    case 0x30: // READ
+        if (card->auth_sector != sector)
+            return ERR_MIFARE_AUTH;
+        if (chip.short_reads > 0)
+        {
+            chip.short_reads--;
+            return 0x00;
+        }
+        memcpy(out, card->blocks[block], 16);
+        if (is_trailer(block))
+            memset(out, 0, 6); // key A never reads back
+        *out_len = 16;
+        return 0x00;
+    case 0xA0: // WRITE
+        if (card->auth_sector != sector || len < 18 || block == 0)
+            return ERR_MIFARE_AUTH;
+        memcpy(card->blocks[block], cmd + 2, 16);
+        return card_ack();
+    case 0xC0: // DECREMENT
+    case 0xC1: // INCREMENT
+    case 0xC2: // RESTORE
+    {
+        int32_t value, operand;
+        if (card->auth_sector != sector || len < 6 || is_trailer(block) ||
+            !parse_value(card->blocks[block], &value, &card->transfer_address))
+            return card_halt();
+        operand = (int32_t)(cmd[2] | cmd[3] << 8 | cmd[4] << 16 | (uint32_t)cmd[5] << 24);
+        card->transfer_value = cmd[0] == 0xC1 ? value + operand : cmd[0] == 0xC0 ? value - operand : value;
+        card->transfer_pending = true;
+        return 0x00;
+    }
+    case 0xB0: // TRANSFER
+    {
+        if (card->auth_sector != sector || !card->transfer_pending || is_trailer(block) || block == 0)
+            return card_halt();
+        uint8_t *b = card->blocks[block];
+        for (int i = 0; i < 4; i++)
+        {
+            b[i] = b[8 + i] = (card->transfer_value >> (8 * i)) & 0xFF;
+            b[4 + i] = ~b[i];
+        }
+        b[12] = b[14] = card->transfer_address;
+        b[13] = b[15] = ~card->transfer_address;
+        card->transfer_pending = false;
+        return card_ack();
+    }
+    }
+    return ERR_MIFARE_AUTH;
+}
+
+/**
+ * @fn iso_exchange
+ * ---------------------
+ * @description: Runs one ISO7816 APDU against an ISO14443-4 card: READ BINARY
+ * (00 B0 offset Le) or UPDATE BINARY (00 D6 offset Lc data) of its 1 KB file.
+ * @returns PN532 status byte, response APDU is appended to out.
+ */
+static uint8_t iso_exchange(const uint8_t *apdu, size_t len, uint8_t *out, size_t *out_len)
+{
+    if (!card->present || !card->selected || !card->iso_active)
+        return ERR_TIMEOUT;
+
+    size_t offset = len >= 4 ? apdu[2] << 8 | apdu[3] : 0;
+    if (len >= 5 && apdu[0] == 0x00 && apdu[1] == 0xD6)
+    {
+        size_t lc = apdu[4];
+        bool ok = lc > 0 && len == 5 + lc && offset + lc <= sizeof(card->blocks);
+        if (ok)
+            memcpy(&card->blocks[0][0] + offset, apdu + 5, lc);
+        out[0] = ok ? 0x90 : 0x6A;
+        out[1] = ok ? 0x00 : 0x86;
+        *out_len = 2;
+        return 0x00;
+    }
+    size_t le = len >= 5 ? (apdu[4] ? apdu[4] : 256) : 0;
+    if (len != 5 || apdu[0] != 0x00 || apdu[1] != 0xB0 || offset + le > sizeof(card->blocks))
+    {
+        out[0] = 0x6A;
+        out[1] = 0x86; // incorrect P1-P2
+        *out_len = 2;
+        return 0x00;
+    }
+    memcpy(out, &card->blocks[0][0] + offset, le);
+    out[le] = 0x90;
+    out[le + 1] = 0x00;
+    *out_len = le + 2;
+    return 0x00;
+}
+
+/**
+ * @fn ntag_exchange
+ * ---------------------
+ * @description: Runs one NTAG215 command: READ (4 pages, wrapping at the end), WRITE
+ * (one page), GET_VERSION, FAST_READ (a page range) and PWD_AUTH. Pages from AUTH0 on
+ * take no write before PWD_AUTH; PWD and PACK read back as zeros.
+ * @returns PN532 status byte, the card's response is appended to out.
+ */
+static uint8_t ntag_exchange(const uint8_t *cmd, size_t len, uint8_t *out, size_t *out_len)
+{
+    static const uint8_t version[] = {0x00, 0x04, 0x04, 0x02, 0x01, 0x00, 0x11, 0x03};
+    if (!card->present || !card->selected || len < 1)
+        return ERR_TIMEOUT;
+
+    uint8_t *mem = &card->blocks[0][0];
+    size_t first = len >= 2 ? cmd[1] : 0, last = first;
+    switch (cmd[0])
+    {
+    case 0x60: // GET_VERSION
+        memcpy(out, version, sizeof(version));
+        *out_len = sizeof(version);
+        return 0x00;
+    case 0x30: // READ
+        if (len != 2 || first >= NTAG_PAGES)
+            return card_halt();
+        last = first + 3;
+        break;
+    case 0x3A: // FAST_READ
+        last = len == 3 ? cmd[2] : 0;
+        if (len != 3 || first > last || last >= NTAG_PAGES)
+            return card_halt();
+        break;
+    case 0xA2: // WRITE
+        if (len != 6 || first < 2 || first >= NTAG_PAGES || (first >= mem[NTAG_AUTH0] && !card->pwd_ok))
+            return card_halt();
+        memcpy(mem + 4 * first, cmd + 2, 4);
+        return 0x00;
+    case 0x1B: // PWD_AUTH
+        if (len != 5 || memcmp(cmd + 1, mem + NTAG_PWD, 4) != 0)
+            return card_halt();
+        card->pwd_ok = true;
+        memcpy(out, mem + NTAG_PACK, 2);
+        *out_len = 2;
+        return 0x00;
+    default:
+        return card_halt();
+    }
+    for (size_t page = first; page <= last; page++)
+    {
+        uint8_t *o = out + 4 * (page - first);
+        size_t p = page % NTAG_PAGES;
+        memcpy(o, mem + 4 * p, 4);
+        if (p == NTAG_PWD / 4 || p == NTAG_PACK / 4)
+            memset(o, 0, 4);
+    }
+    *out_len = 4 * (last - first + 1);
+    return 0x00;
+}
+
+/**
+ * @fn felica_exchange
+ * ---------------------
+ * @description: Runs one FeliCa command (length byte first) against a FeliCa card. Only
+ * Read Without Encryption of one service with 2-byte block list elements is supported.
+ * @returns PN532 status byte, the card's response frame is appended to out.
+ */
+static uint8_t felica_exchange(const uint8_t *cmd, size_t len, uint8_t *out, size_t *out_len)
+{
+    if (!card->present || !card->selected || len < 14 || cmd[0] != len || cmd[1] != 0x06 ||
+        memcmp(cmd + 2, card->uid, 8) != 0 || cmd[10] != 1)
+        return ERR_TIMEOUT;
+
+    size_t count = cmd[13];
+    if (len != 14 + 2 * count)
+        return ERR_TIMEOUT;
+    out[1] = 0x07;
+    memcpy(out + 2, card->uid, 8);
+    out[10] = out[11] = 0x00;
+    out[12] = count;
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t block = cmd[15 + 2 * i];
+        if (cmd[14 + 2 * i] != 0x80 || block >= FAKE_PN532_BLOCKS)
+        {
+            out[10] = 0xFF; // status flags: error
+            out[11] = 0xA8; // illegal block number
+            count = 0;
+            break;
+        }
+        memcpy(out + 13 + 16 * i, card->blocks[block], 16);
+    }
+    out[0] = 13 + (out[10] ? 0 : 16 * count);
+    if (out[10])
+        out[12] = 0;
+    *out_len = out[0];
+    return 0x00;
+}
+
+/**
+ * @fn dep_us
+ * ---------------------
+ * @returns air time of an NFC-DEP frame of bytes data bytes at the link's bit rate, with
+ * its 5-byte header.
+ */
+static unsigned int dep_us(size_t bytes)
+{
+    return RF_TURNAROUND_US + (bytes + 5) * 9 * 1000 / (106u << peer.baud);
+}
+
+/**
+ * @fn dep_take
+ * ---------------------
+ * @description: Adds a chunk to the message the peer is receiving; the last one (more
+ * false) completes it.
+ */
+static void dep_take(const uint8_t *chunk, size_t len, bool more)
+{
+    if (peer.in_len + len <= sizeof(peer.in))
+    {
+        memcpy(peer.in + peer.in_len, chunk, len);
+        peer.in_len += len;
+    }
+    if (!more)
+    {
+        memcpy(peer.received, peer.in, peer.in_len);
+        peer.received_len = peer.in_len;
+        peer.in_len = 0;
+    }
+}
+
+/**
+ * @fn dep_give
+ * ---------------------
+ * @description: Writes the next chunk of the message the peer is sending to out.
+ * @returns status byte: MI if more chunks follow.
+ */
+static uint8_t dep_give(uint8_t *out, size_t *out_len)
+{
+    size_t n = peer.out_len - peer.out_pos < DEP_CHUNK ? peer.out_len - peer.out_pos : DEP_CHUNK;
+    memcpy(out, peer.out + peer.out_pos, n);
+    peer.out_pos += n;
+    peer.sending = peer.out_pos < peer.out_len;
+    *out_len = n;
+    return peer.sending ? 0x40 : 0x00;
+}
+
+/**
+ * @fn dep_exchange
+ * ---------------------
+ * @description: InDataExchange to the peer target: a chunk with MI is taken without
+ * data, the last one completes the request and returns the first chunk of the reply, and
+ * an empty exchange while the reply has chunks left fetches the next.
+ * @returns status byte, reply data is appended to out.
+ */
+static uint8_t dep_exchange(bool more, const uint8_t *chunk, size_t len, uint8_t *out, size_t *out_len)
+{
+    *out_len = 0;
+    if (!more && len == 0 && peer.sending)
+        return dep_give(out, out_len);
+    dep_take(chunk, len, more);
+    if (more)
+        return 0x00;
+    if (peer.echo)
+    {
+        memcpy(peer.out, peer.received, peer.received_len);
+        peer.out_len = peer.received_len;
+    }
+    else
+    {
+        for (int i = 0; i < 4; i++)
+            peer.out[i] = (peer.received_len >> (8 * i)) & 0xFF;
+        peer.out_len = 4;
+    }
+    peer.out_pos = 0;
+    return dep_give(out, out_len);
+}
+
+/**
+ * @fn rf_us
+ * ---------------------
+ * @returns air time of an exchange of bytes bytes with the card at its bit rate, at 9 bits
+ * (8 data bits and parity) per byte.
+ */
+static unsigned int rf_us(const fake_card_t *c, size_t bytes)
+{
+    return RF_TURNAROUND_US + bytes * 9 * 1000 / (106u << c->baud);
+}
+
+/*---------------------- command handlers ----------------------*/
+
+static void build_response(uint8_t cmd, const uint8_t *data, size_t data_len);
+static void queue_out(const uint8_t *frame, size_t len, unsigned int delay);
+
+/**
+ * @fn target_data
+ * ---------------------
+ * @description: Selects card c as target tg and writes its ISO14443A target data (Tg,
+ * SENS_RES, SEL_RES, UID length, UID) to data.
+ * @returns number of bytes written.
+ */
+static size_t target_data(fake_card_t *c, uint8_t tg, uint8_t *data)
+{
+    static const uint8_t PMM[] = {0x01, 0x20, 0x22, 0x04, 0x27, 0x67, 0x4E, 0xFF};
+    c->selected = true;
+    c->tg = tg;
+    c->auth_sector = -1;
+    c->pwd_ok = false;
+    c->baud = 0;
+    data[0] = tg;
+    if (c->type == FAKE_CARD_FELICA)
+    {
+        // POL_RES: length, response code, IDm, PMm
+        data[1] = 18;
+        data[2] = 0x01;
+        memcpy(data + 3, c->uid, 8);
+        memcpy(data + 11, PMM, 8);
+        return 19;
+    }
+    data[1] = 0x00;
+    data[2] = c->type == FAKE_CARD_ISO14443_4 || c->type == FAKE_CARD_NTAG215 ? 0x44 : 0x04;
+    data[3] = c->type == FAKE_CARD_ISO14443_4 ? 0x20 : c->type == FAKE_CARD_NTAG215 ? 0x00 : 0x08;
+    data[4] = c->uid_len;
+    memcpy(data + 5, c->uid, c->uid_len);
+    size_t len = 5 + c->uid_len;
+
+    // With automatic RATS the PN532 activates ISO14443-4 and appends the ATS.
+    c->iso_active = c->type == FAKE_CARD_ISO14443_4 && (chip.parameter_flags & 0x10);
+    if (c->iso_active)
+    {
+        static const uint8_t ats[] = {0x05, 0x78, ATS_TA1, 0x80, 0x02};
+        memcpy(data + len, ats, sizeof(ats));
+        len += sizeof(ats);
+    }
+    return len;
+}
+
+/**
+ * @fn uid_matches
+ * ---------------------
+ * @returns true if InListPassiveTarget initiator data (a UID with cascade tags in front of
+ * its first cascade levels) names card c, or there is none.
+ */
+static bool uid_matches(const fake_card_t *c, const uint8_t *init, size_t init_len)
+{
+    uint8_t uid[10];
+    size_t uid_len = 0;
+    if (init_len == 0)
+        return true;
+    for (size_t i = 0; i < init_len; i++)
+    {
+        // A cascade tag starts every 4-byte level but the last.
+        if (init[i] == 0x88 && i % 4 == 0 && init_len - i > 4)
+            continue;
+        uid[uid_len++] = init[i];
+    }
+    return uid_len == c->uid_len && memcmp(uid, c->uid, uid_len) == 0;
+}
+
+/**
+ * @fn list_cards
+ * ---------------------
+ * @description: InListPassiveTarget: deselects every card, then selects up to max_tg
+ * present cards of baud rate type brty (0: ISO14443A, 1/2: FeliCa 212/424) matching the
+ * initiator data (a UID, or a FeliCa polling request), and writes NbTg and their target
+ * data to data.
+ * @returns number of bytes written.
+ */
+static size_t list_cards(uint8_t max_tg, uint8_t brty, const uint8_t *init, size_t init_len, uint8_t *data)
+{
+    size_t len = 1;
+    data[0] = 0;
+    if (!(chip.rf_field & 0x01))
+        max_tg = 0; // nothing answers with the field off
+    for (size_t i = 0; i < FAKE_PN532_MAX_CARDS; i++)
+    {
+        cards[i].selected = false;
+        cards[i].tg = 0;
+    }
+    for (size_t i = 0; i < FAKE_PN532_MAX_CARDS && data[0] < max_tg; i++)
+    {
+        fake_card_t *c = &cards[i];
+        bool match = brty == 0 ? c->type != FAKE_CARD_FELICA && uid_matches(c, init, init_len)
+                               : c->type == FAKE_CARD_FELICA && init_len == 5 && init[0] == 0x00;
+        if (c->present && match)
+        {
+            data[0]++;
+            len += target_data(c, data[0], data + len);
+            c->baud = brty;
+        }
+    }
+    return len;
+}
+
+/**
+ * @fn first_card
+ * ---------------------
+ * @returns the first ISO14443A card in the field, or NULL.
+ */
+static fake_card_t *first_card(void)
+{
+    for (size_t i = 0; i < FAKE_PN532_MAX_CARDS; i++)
+    {
+        if (cards[i].present && cards[i].type != FAKE_CARD_FELICA)
+            return &cards[i];
+    }
+    return NULL;
+}
+
+/**
+ * @fn listen_poll
+ * ---------------------
+ * @description: One poll of a listening command. Queues its response once the card is
+ * found, or for InAutoPoll, an empty one when its rounds run out.
+ */
+static void listen_poll(void)
+{
+    uint8_t data[FRAME_MAX];
+    size_t data_len = 0;
+    fake_card_t *found = NULL;
+
+    if (chip.listen_cmd == 0x4A)
+    {
+        data_len = list_cards(chip.listen_params[0], chip.listen_params[1], chip.listen_params + 2,
+                              chip.listen_len - 2, data);
+        if (data[0] == 0 && (chip.listen_rounds == 0 || --chip.listen_rounds > 0))
+        {
+            chip.listen_next += chip.listen_period;
+            return; // listens until a card shows up or activation retries run out
+        }
+    }
+    else
+    {
+        found = chip.listen_type != 0xFF && (chip.rf_field & 0x01) ? first_card() : NULL;
+        if (!found && (chip.listen_rounds == 0 || --chip.listen_rounds > 0))
+        {
+            chip.listen_next += chip.listen_period;
+            return;
+        }
+        data[0] = found ? 0x01 : 0x00;
+        data_len = 1;
+        if (found)
+        {
+            list_cards(0, 0, NULL, 0, data + 3); // deselect the rest
+            data[0] = 0x01;
+            data[1] = chip.listen_type;
+            data[2] = target_data(found, 1, data + 3);
+            data_len = 3 + data[2];
+        }
+    }
+    build_response(chip.listen_cmd, data, data_len);
+    queue_out(chip.response, chip.response_len, CARD_RF_US);
+    chip.listen_cmd = 0;
+}
+
+/**
+ * @fn execute
+ * ---------------------
+ * @description: Runs command cmd with its params and fills data with the response
+ * payload (after D5 cmd+1).
+ * @returns false if the chip stays busy without answering (e.g. no card in field).
+ */
+static bool execute(uint8_t cmd, const uint8_t *params, size_t len, uint8_t *data, size_t *data_len)
+{
+    *data_len = 0;
+    chip.response_us = chip.processing_us;
+    chip.listen_cmd = 0;
+
+    switch (cmd)
+    {
+    case 0x02: // GetFirmwareVersion
+        data[0] = 0x32;
+        data[1] = 0x01;
+        data[2] = 0x06;
+        data[3] = 0x07;
+        *data_len = 4;
+        return true;
+    case 0x14: // SAMConfiguration
+        return true;
+    case 0x4E: // InPSL
+    {
+        fake_card_t *target = NULL;
+        for (size_t i = 0; i < FAKE_PN532_MAX_CARDS; i++)
+        {
+            if (len == 3 && cards[i].tg != 0 && cards[i].tg == params[0])
+                target = &cards[i];
+        }
+        if (len == 3 && peer.active && params[0] == 1)
+        {
+            // PSL_REQ: the peer takes any rate it announced in its ATR_RES.
+            bool ok = params[1] == params[2] && params[1] <= peer.max_baud;
+            if (ok)
+                peer.baud = params[1];
+            chip.response_us += CARD_RF_US;
+            data[0] = ok ? 0x00 : 0x27;
+            *data_len = 1;
+            return true;
+        }
+        // Only an activated ISO14443-4 card that announced the rate in TA(1) takes a PPS.
+        uint8_t rate = len == 3 && params[1] <= 2 ? (1 << params[1]) >> 1 : 0xFF;
+        bool ok = target && target->iso_active && params[1] == params[2] &&
+                  (rate == 0 || ((ATS_TA1 & rate) && (ATS_TA1 >> 4 & rate)));
+        if (ok)
+            target->baud = params[1];
+        chip.response_us += CARD_RF_US;
+        data[0] = ok ? 0x00 : 0x27; // improper command for this target
+        *data_len = 1;
+        return true;
+    }
+    case 0x12: // SetParameters
+        if (len < 1)
+            return false;
+        chip.parameter_flags = params[0];
+        return true;
+    case 0x32: // RFConfiguration
+        if (len == 2 && params[0] == 0x01)
+            chip.rf_field = params[1];
+        else if (len == 4 && params[0] == 0x05)
+            chip.max_retry_passive = params[3];
+        else if (!(len == 4 && params[0] == 0x02) && !(len == 2 && params[0] == 0x04))
+            return false;
+        return true;
+    case 0x4A: // InListPassiveTarget
+        if (len < 2 || len > sizeof(chip.listen_params) || params[0] == 0 || params[0] > 2 ||
+            params[1] > 0x02)
+            return false;
+        *data_len = list_cards(params[0], params[1], params + 2, len - 2, data);
+        if (data[0] == 0)
+        {
+            // Retry activation every CARD_RF_US, forever by default, until a card shows up.
+            chip.listen_cmd = cmd;
+            chip.listen_next = chip.now + CARD_RF_US;
+            chip.listen_period = CARD_RF_US;
+            chip.listen_rounds = chip.max_retry_passive == 0xFF ? 0 : chip.max_retry_passive + 1;
+            memcpy(chip.listen_params, params, len);
+            chip.listen_len = len;
+            return false;
+        }
+        chip.response_us += CARD_RF_US;
+        return true;
+    case 0x60: // InAutoPoll
+        if (len < 3 || params[0] == 0x00 || params[1] == 0x00 || params[1] > 0x0F)
+            return false;
+        chip.listen_cmd = cmd;
+        chip.listen_next = chip.now;
+        chip.listen_period = params[1] * AUTOPOLL_PERIOD_US;
+        chip.listen_rounds = params[0] == 0xFF ? 0 : params[0];
+        chip.listen_type = 0xFF;
+        for (size_t i = 2; i < len && chip.listen_type == 0xFF; i++)
+        {
+            if (params[i] == 0x00 || params[i] == 0x10) // generic 106 kbps or MIFARE
+                chip.listen_type = params[i];
+        }
+        return false;
+    case 0x40: // InDataExchange
+    {
+        size_t n = 0;
+        if (len >= 1 && peer.active && peer.target && (params[0] & 0x3F) == 1)
+        {
+            data[0] = dep_exchange(params[0] & 0x40, params + 1, len - 1, data + 1, &n);
+            chip.response_us += dep_us(len - 1) + (n ? dep_us(n) : 0);
+            *data_len = 1 + n;
+            return true;
+        }
+        fake_card_t *target = NULL;
+        for (size_t i = 0; i < FAKE_PN532_MAX_CARDS; i++)
+        {
+            if (len >= 1 && cards[i].tg != 0 && cards[i].tg == params[0])
+                target = &cards[i];
+        }
+        if (target && target != card)
+        {
+            // Switching targets halts the previous card and wakes this one.
+            card->auth_sector = -1;
+            card->transfer_pending = false;
+            target->auth_sector = -1;
+            card = target;
+        }
+        if (!target)
+            data[0] = ERR_TIMEOUT;
+        else if (card->type == FAKE_CARD_ISO14443_4)
+            data[0] = iso_exchange(params + 1, len - 1, data + 1, &n);
+        else if (card->type == FAKE_CARD_FELICA)
+            data[0] = felica_exchange(params + 1, len - 1, data + 1, &n);
+        else if (card->type == FAKE_CARD_NTAG215)
+            data[0] = ntag_exchange(params + 1, len - 1, data + 1, &n);
+        else
+            data[0] = card_exchange(params + 1, len - 1, data + 1, &n);
+        chip.response_us += target && card->type != FAKE_CARD_CLASSIC ? rf_us(card, len - 1 + n) : CARD_RF_US;
+        *data_len = 1 + n;
+        return true;
+    }
+    case 0x56: // InJumpForDEP: ActPass, BR, Next
+    {
+        // ATR_RES: Tg, NFCID3t, DIDt, BSt, BRt, TO, PPt
+        static const uint8_t nfcid3[] = {0xAA, 0x99, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11};
+        if (len < 3 || params[1] > 2)
+            return false;
+        chip.response_us += CARD_RF_US;
+        for (size_t i = 0; i < FAKE_PN532_MAX_CARDS; i++)
+        {
+            cards[i].selected = false;
+            cards[i].tg = 0;
+        }
+        if (!peer.target || !(chip.rf_field & 0x01) || params[1] > peer.max_baud)
+        {
+            data[0] = ERR_TIMEOUT;
+            *data_len = 1;
+            return true;
+        }
+        peer.active = true;
+        peer.baud = params[1];
+        peer.in_len = peer.out_len = peer.out_pos = 0;
+        peer.sending = false;
+        data[0] = 0x00;
+        data[1] = 1;
+        memcpy(data + 2, nfcid3, sizeof(nfcid3));
+        data[12] = 0x00;
+        data[13] = data[14] = peer.max_baud == 2 ? 0x03 : peer.max_baud == 1 ? 0x01 : 0x00;
+        data[15] = 0x0E;
+        data[16] = 0x32;
+        *data_len = 17;
+        return true;
+    }
+    case 0x52: // InRelease
+        if (len < 1)
+            return false;
+        if (params[0] == 0 || params[0] == 1)
+            peer.active = peer.active && !peer.target;
+        for (size_t i = 0; i < FAKE_PN532_MAX_CARDS; i++)
+        {
+            if (params[0] == 0 || cards[i].tg == params[0])
+                cards[i].selected = false;
+        }
+        data[0] = 0x00;
+        *data_len = 1;
+        return true;
+    case 0x8C: // TgInitAsTarget: answers once the peer initiator activates the chip
+    {
+        // Mode (DEP at 106 kbps), then ATR_REQ: LEN, D4 00, NFCID3i, DIDi, BSi, BRi, PPi.
+        static const uint8_t atr_req[] = {0x11, 0xD4, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+                                          0x07, 0x08, 0x09, 0x0A, 0x00, 0x03, 0x03, 0x32};
+        if (len < 37 || !peer.initiator)
+            return false;
+        peer.active = true;
+        peer.baud = 0;
+        peer.in_len = 0;
+        chip.response_us += CARD_RF_US;
+        data[0] = 0x04;
+        memcpy(data + 1, atr_req, sizeof(atr_req));
+        *data_len = 1 + sizeof(atr_req);
+        return true;
+    }
+    case 0x86: // TgGetData
+    {
+        size_t n = 0;
+        if (!peer.active || !peer.initiator || !peer.sending)
+        {
+            data[0] = 0x29; // released by the initiator
+            *data_len = 1;
+            return true;
+        }
+        data[0] = dep_give(data + 1, &n);
+        chip.response_us += dep_us(n);
+        *data_len = 1 + n;
+        return true;
+    }
+    case 0x8E: // TgSetData
+    case 0x94: // TgSetMetaData
+        if (!peer.active || !peer.initiator)
+        {
+            data[0] = 0x29;
+            *data_len = 1;
+            return true;
+        }
+        dep_take(params, len, cmd == 0x94);
+        chip.response_us += dep_us(len);
+        data[0] = 0x00;
+        *data_len = 1;
+        return true;
+    case 0x42: // InCommunicateThru: raw command to the selected card
+    {
+        size_t n = 0;
+        for (size_t i = 0; i < FAKE_PN532_MAX_CARDS && !card->selected; i++)
+        {
+            if (cards[i].selected)
+                card = &cards[i];
+        }
+        bool ntag = card->present && card->selected && card->type == FAKE_CARD_NTAG215;
+        data[0] = ntag ? ntag_exchange(params, len, data + 1, &n) : ERR_TIMEOUT;
+        chip.response_us += rf_us(card, len + n);
+        *data_len = 1 + n;
+        return true;
+    }
+    }
+    return false;
+}
+
+/*---------------------- frame layer ----------------------*/
+
+static void queue_out(const uint8_t *frame, size_t len, unsigned int delay)
+{
+    memcpy(chip.out, frame, len);
+    chip.out_is_response = frame == chip.response;
+    chip.out_len = len;
+    chip.out_pos = 0;
+    chip.out_pending = true;
+    chip.ready = false;
+    chip.ready_at = chip.now + delay;
+    fake_gpio_drive(chip.irq_pin, 1);
+}
+
+static void build_response(uint8_t cmd, const uint8_t *data, size_t data_len)
+{
+    uint8_t *f = chip.response;
+    size_t len = data_len + 2;
+    uint8_t sum = 0xD5 + cmd + 1;
+
+    f[0] = 0x00;
+    f[1] = 0x00;
+    f[2] = 0xFF;
+    size_t header = 5;
+    if (len > 255)
+    {
+        // Extended frame: FF FF, then LENM LENL and their checksum.
+        f[3] = 0xFF;
+        f[4] = 0xFF;
+        f[5] = len >> 8;
+        f[6] = len & 0xFF;
+        f[7] = -(f[5] + f[6]);
+        header = 8;
+    }
+    else
+    {
+        f[3] = len;
+        f[4] = -len;
+    }
+    f[header] = 0xD5;
+    f[header + 1] = cmd + 1;
+    for (size_t i = 0; i < data_len; i++)
+    {
+        f[header + 2 + i] = data[i];
+        sum += data[i];
+    }
+    f[header + 2 + data_len] = -sum;
+    f[header + 3 + data_len] = 0x00;
+    chip.response_len = header + data_len + 4;
+}
+
+static void receive_frame(const uint8_t *f, size_t n)
+{
+    size_t i = 0;
+    while (i < n && f[i] == 0x00)
+        i++;
+    if (i == 0 || i + 2 >= n || f[i] != 0xFF)
+        return;
+    i++;
+
+    uint8_t len = f[i], lcs = f[i + 1];
+    if (len == 0x00 && lcs == 0xFF)
+    {
+        // ACK from host aborts the running command.
+        fake_pn532_counters.aborts++;
+        chip.out_pending = chip.ready = chip.response_pending = false;
+        chip.listen_cmd = 0;
+        fake_gpio_drive(chip.irq_pin, 1);
+        return;
+    }
+    if (len == 0xFF && lcs == 0x00)
+    {
+        // NACK: send the last response again.
+        fake_pn532_counters.nacks++;
+        if (chip.response_len > 0)
+            queue_out(chip.response, chip.response_len, ACK_US);
+        return;
+    }
+    size_t length = len;
+    const uint8_t *d = f + i + 2;
+    if (len == 0xFF && lcs == 0xFF)
+    {
+        // Extended frame: FF FF, then LENM LENL and their checksum.
+        if (i + 5 >= n || (uint8_t)(f[i + 2] + f[i + 3] + f[i + 4]) != 0)
+            return;
+        length = f[i + 2] << 8 | f[i + 3];
+        d = f + i + 5;
+    }
+    else if ((uint8_t)(len + lcs) != 0)
+        return;
+    if (d + length + 1 > f + n || length < 2)
+        return;
+    if (chip.drop_commands > 0)
+    {
+        chip.drop_commands--;
+        return;
+    }
+
+    uint8_t sum = 0;
+    for (size_t k = 0; k <= length; k++)
+        sum += d[k];
+    if (sum != 0 || d[0] != 0xD4)
+        return;
+
+    uint8_t cmd = d[1];
+    fake_pn532_counters.commands++;
+    fake_pn532_counters.command_counts[cmd]++;
+
+    uint8_t data[FRAME_MAX];
+    size_t data_len;
+    chip.response_pending = execute(cmd, d + 2, length - 2, data, &data_len);
+    if (chip.response_pending)
+        build_response(cmd, data, data_len);
+    queue_out(ACK_FRAME, sizeof(ACK_FRAME), ACK_US);
+}
+
+/**
+ * @fn chip_power_down
+ * ---------------------
+ * @description: Reset asserted: drops the running command, the cards lose their
+ * selection with the field and every setting returns to its power-on value.
+ */
+static void chip_power_down(void)
+{
+    chip.out_pending = chip.ready = chip.response_pending = false;
+    chip.listen_cmd = 0;
+    chip.rf_field = 0x03;
+    chip.max_retry_passive = 0xFF;
+    chip.parameter_flags = 0x14;
+    for (size_t i = 0; i < FAKE_PN532_MAX_CARDS; i++)
+    {
+        cards[i].selected = cards[i].iso_active = false;
+        cards[i].tg = cards[i].baud = 0;
+    }
+    peer.active = false;
+    fake_gpio_drive(chip.irq_pin, 1);
+}
+
+/**
+ * @fn booting
+ * ---------------------
+ * @returns true while reset is held or the chip has not finished starting up.
+ */
+static bool booting(void)
+{
+    return chip.in_reset || (int)(chip.now - chip.boot_done) < 0;
+}
+
+/*---------------------- hooks ----------------------*/
+
+void fake_pn532_gpio_write(unsigned int pin, unsigned int val)
+{
+    if (pin == chip.reset_pin && chip.in_reset == !val)
+    {
+        chip.in_reset = !val;
+        if (chip.in_reset)
+            chip_power_down();
+        else
+            chip.boot_done = chip.now + chip.boot_us;
+        return;
+    }
+    if (pin != chip.nss_pin || chip.nss_low == !val)
+        return;
+
+    if (!val)
+    {
+        chip.nss_low = true;
+        chip.index = 0;
+        chip.in_len = 0;
+        fake_pn532_counters.spi_transactions++;
+        return;
+    }
+
+    chip.nss_low = false;
+    if (chip.op == SPI_DATAWRITE)
+    {
+        receive_frame(chip.in, chip.in_len);
+    }
+    else if (chip.op == SPI_DATAREAD && chip.ready && chip.out_pos >= chip.out_len)
+    {
+        // Frame fully read: move on to the response behind an ACK, if any.
+        if (chip.out_is_response && chip.corrupt_responses > 0)
+            chip.corrupt_responses--;
+        chip.ready = chip.out_pending = false;
+        fake_gpio_drive(chip.irq_pin, 1);
+        if (chip.response_pending)
+        {
+            chip.response_pending = false;
+            queue_out(chip.response, chip.response_len, chip.response_us);
+        }
+    }
+    chip.op = 0;
+}
+
+uint8_t fake_pn532_spi_byte(uint8_t mosi)
+{
+    fake_pn532_counters.spi_bytes++;
+    if (!chip.nss_low)
+        return 0xFF;
+    if (booting())
+        return 0x00; // deaf until started: frames are lost and status reads "not ready"
+
+    if (chip.index++ == 0)
+    {
+        chip.op = mosi;
+        if (mosi == SPI_STATREAD)
+            fake_pn532_counters.status_reads++;
+        if (mosi == SPI_DATAREAD)
+            chip.out_pos = 0;
+        return 0x00;
+    }
+
+    switch (chip.op)
+    {
+    case SPI_STATREAD:
+        return chip.ready ? 0x01 : 0x00;
+    case SPI_DATAWRITE:
+        if (chip.in_len < FRAME_MAX)
+            chip.in[chip.in_len++] = mosi;
+        return 0x00;
+    case SPI_DATAREAD:
+        if (chip.ready && chip.out_pos < chip.out_len)
+        {
+            uint8_t byte = chip.out[chip.out_pos++];
+            // A flipped bit in the command code byte breaks the data checksum.
+            if (chip.out_is_response && chip.corrupt_responses > 0 && chip.out_pos == 7)
+                byte ^= 0x01;
+            return byte;
+        }
+        return 0x00;
+    }
+    return 0x00;
+}
+
+void fake_pn532_tick(unsigned int now)
+{
+    chip.now = now;
+    if (arrival.pending && (int)(now - arrival.at) >= 0)
+    {
+        arrival.pending = false;
+        fake_pn532_place_card(arrival.uid, arrival.uid_len);
+    }
+    // Polls run once the ACK has been read.
+    if (chip.listen_cmd && !chip.out_pending && (int)(now - chip.listen_next) >= 0)
+    {
+        listen_poll();
+    }
+    if (chip.out_pending && !chip.ready && (int)(now - chip.ready_at) >= 0)
+    {
+        chip.ready = true;
+        fake_gpio_drive(chip.irq_pin, 0);
+    }
+}
+
+/*---------------------- setup ----------------------*/
+
+void fake_pn532_set_processing_us(unsigned int usecs)
+{
+    chip.processing_us = usecs;
+}
+
+void fake_pn532_drop_commands(unsigned int count)
+{
+    chip.drop_commands = count;
+}
+
+void fake_pn532_corrupt_responses(unsigned int count)
+{
+    chip.corrupt_responses = count;
+}
+
+void fake_pn532_lose_card_acks(unsigned int count)
+{
+    chip.lose_card_acks = count;
+}
+
+void fake_pn532_short_reads(unsigned int count)
+{
+    chip.short_reads = count;
+}
+
+void fake_pn532_set_boot_us(unsigned int usecs)
+{
+    chip.boot_us = usecs;
+}
+
+void fake_pn532_reset_counters(void)
+{
+    memset(&fake_pn532_counters, 0, sizeof(fake_pn532_counters));
+}
+
+void fake_pn532_init(unsigned int reset_pin, unsigned int nss_pin, unsigned int irq_pin)
+{
+    static const uint8_t uid[] = {0xDE, 0xAD, 0xBE, 0xEF};
+
+    memset(&chip, 0, sizeof(chip));
+    memset(&arrival, 0, sizeof(arrival));
+    memset(cards, 0, sizeof(cards));
+    memset(&peer, 0, sizeof(peer));
+    card = &cards[0];
+    chip.reset_pin = reset_pin;
+    chip.nss_pin = nss_pin;
+    chip.irq_pin = irq_pin;
+    chip.processing_us = 500;
+    chip.boot_us = 5000;
+    chip.now = fake_pi_now();
+    chip.boot_done = chip.now;
+    chip_power_down();
+    fake_pn532_place_card(uid, sizeof(uid));
+    fake_pn532_reset_counters();
+}
@@ -0,0 +1,194 @@
+/**
+ * @file fake_pn532.h
+ * ---------------------
+ * @brief Host-side simulation of a PN532 on the SPI bus with a MIFARE Classic 1K card
+ * in its field. The simulated chip speaks the real frame protocol (status read, data
+ * write/read, ACK, information frames) so the unmodified pn532.c/nfc.c run against it.
+ */
+#ifndef _FAKE_PN532_H
+#define _FAKE_PN532_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define FAKE_PN532_BLOCKS 64
+#define FAKE_PN532_MAX_CARDS 2
+#define FAKE_PN532_DEP_MAX 4096 // longest NFC-DEP message the peer takes
+
+typedef enum
+{
+    FAKE_CARD_CLASSIC,   // MIFARE Classic 1K
+    FAKE_CARD_ISO14443_4, // ISO14443-4A card with a 1 KB file for READ BINARY, up to 424 kbps
+    FAKE_CARD_FELICA,    // FeliCa card with 64 blocks readable without encryption
+    FAKE_CARD_NTAG215,   // NTAG215: 135 pages, PWD FF FF FF FF, no page protected (AUTH0 FF)
+} fake_card_type_t;
+
+typedef struct
+{
+    unsigned int spi_transactions; // NSS low..high windows
+    unsigned int spi_bytes;        // bytes clocked in either direction
+    unsigned int status_reads;     // _SPI_STATREAD transactions
+    unsigned int commands;         // information frames accepted (and ACKed)
+    unsigned int nacks;            // NACK frames asking for a response again
+    unsigned int aborts;           // ACK frames cancelling the running command
+    unsigned int command_counts[256];
+} fake_pn532_counters_t;
+
+extern fake_pn532_counters_t fake_pn532_counters;
+
+/**
+ * @fn fake_pn532_init
+ * ---------------------
+ * @description: Powers up the simulated chip on the given pins with a default card
+ * (UID de ad be ef, all keys FF..FF) in the field and clears all counters.
+ */
+void fake_pn532_init(unsigned int reset_pin, unsigned int nss_pin, unsigned int irq_pin);
+
+/**
+ * @fn fake_pn532_set_processing_us
+ * ---------------------
+ * @description: Sets how long the simulated chip takes to execute a command after
+ * its ACK has been read. RF commands take this plus the card's own response time.
+ * InListPassiveTarget with no card, and InAutoPoll, answer only once a poll finds a card
+ * (or InAutoPoll runs out of rounds); InAutoPoll polls every Period x 150 ms.
+ */
+void fake_pn532_set_processing_us(unsigned int usecs);
+
+/**
+ * @fn fake_pn532_drop_commands
+ * ---------------------
+ * @description: Loses the next count command frames on the wire: they get no ACK.
+ */
+void fake_pn532_drop_commands(unsigned int count);
+
+/**
+ * @fn fake_pn532_corrupt_responses
+ * ---------------------
+ * @description: Garbles the next count response frames the host reads, repeats after a
+ * NACK included. The chip keeps an intact copy to send again.
+ */
+void fake_pn532_corrupt_responses(unsigned int count);
+
+/**
+ * @fn fake_pn532_lose_card_acks
+ * ---------------------
+ * @description: The next count MIFARE WRITE or TRANSFER commands are carried out by the
+ * card but its acknowledgement is lost: the PN532 reports a timeout.
+ */
+void fake_pn532_lose_card_acks(unsigned int count);
+
+/**
+ * @fn fake_pn532_short_reads
+ * ---------------------
+ * @description: The next count MIFARE READ commands are answered with a success status
+ * and no block data.
+ */
+void fake_pn532_short_reads(unsigned int count);
+
+/**
+ * @fn fake_pn532_set_boot_us
+ * ---------------------
+ * @description: Sets how long the simulated chip stays deaf on SPI after reset is
+ * released. Commands sent earlier are lost and status reads report "not ready".
+ */
+void fake_pn532_set_boot_us(unsigned int usecs);
+
+/**
+ * @fn fake_pn532_place_card
+ * ---------------------
+ * @description: Empties the field and puts a fresh MIFARE Classic 1K card with the given
+ * UID in it.
+ */
+void fake_pn532_place_card(const uint8_t *uid, size_t uid_len);
+
+/**
+ * @fn fake_pn532_add_card
+ * ---------------------
+ * @description: Puts another fresh card in the field next to those already there, up to
+ * FAKE_PN532_MAX_CARDS. Listings return the cards in the order they were added.
+ */
+void fake_pn532_add_card(const uint8_t *uid, size_t uid_len);
+
+/**
+ * @fn fake_pn532_add_card_of_type
+ * ---------------------
+ * @description: Like fake_pn532_add_card for any card type. A FeliCa card's uid is its
+ * 8-byte IDm. The data of ISO14443-4 and FeliCa cards is filled with a fixed pattern.
+ */
+void fake_pn532_add_card_of_type(fake_card_type_t type, const uint8_t *uid, size_t uid_len);
+
+/**
+ * @fn fake_pn532_place_card_after
+ * ---------------------
+ * @description: Empties the field and puts a fresh card with the given UID in it usecs
+ * from now.
+ */
+void fake_pn532_place_card_after(const uint8_t *uid, size_t uid_len, unsigned int usecs);
+
+/**
+ * @fn fake_pn532_remove_card
+ * ---------------------
+ * @description: Takes the card out of the field.
+ */
+void fake_pn532_remove_card(void);
+
+/**
+ * @fn fake_pn532_card_block
+ * ---------------------
+ * @returns pointer to the 16 bytes of the given block of the card in the field.
+ */
+uint8_t *fake_pn532_card_block(size_t block_number);
+
+/**
+ * @fn fake_pn532_card_block_of
+ * ---------------------
+ * @returns pointer to the 16 bytes of the given block of the card_index-th card added.
+ */
+uint8_t *fake_pn532_card_block_of(size_t card_index, size_t block_number);
+
+/**
+ * @fn fake_pn532_card_page
+ * ---------------------
+ * @returns pointer to the 4 bytes of the given page of the NTAG card in the field.
+ */
+uint8_t *fake_pn532_card_page(size_t page);
+
+/**
+ * @fn fake_pn532_add_dep_peer
+ * ---------------------
+ * @description: Puts a second terminal listening as an NFC-DEP target in the field. It
+ * announces bit rates up to max_baud (PN532_BAUD_*) in its ATR_RES and answers each
+ * message with its 4-byte little-endian length, as p2p-bench does, or echoes it back.
+ */
+void fake_pn532_add_dep_peer(uint8_t max_baud, bool echo);
+
+/**
+ * @fn fake_pn532_dep_initiator_send
+ * ---------------------
+ * @description: Has a second terminal activate the simulated chip as NFC-DEP initiator
+ * at 106 kbps once it listens with TgInitAsTarget, then send it message.
+ */
+void fake_pn532_dep_initiator_send(const uint8_t *message, size_t length);
+
+/**
+ * @fn fake_pn532_dep_received
+ * ---------------------
+ * @returns the last complete message the peer received (a request as target, a reply as
+ * initiator) and its length in *length.
+ */
+const uint8_t *fake_pn532_dep_received(size_t *length);
+
+/**
+ * @fn fake_pn532_reset_counters
+ * ---------------------
+ * @description: Zeroes fake_pn532_counters.
+ */
+void fake_pn532_reset_counters(void);
+
+/* Hooks used by fake_pi.c */
+void fake_pn532_gpio_write(unsigned int pin, unsigned int val);
+uint8_t fake_pn532_spi_byte(uint8_t mosi);
+void fake_pn532_tick(unsigned int now);
+
+#endif // _FAKE_PN532_H
@@ -0,0 +1,29 @@
+/**
+ * @file gpio.h
+ * ---------------------
+ * @brief Host stand-in for the libpi gpio module.
+ */
+#ifndef _HOST_GPIO_H
+#define _HOST_GPIO_H
+
+enum
+{
+    GPIO_PIN_FIRST = 0,
+    GPIO_PIN4 = 4,
+    GPIO_PIN5 = 5,
+    GPIO_PIN6 = 6,
+    GPIO_PIN12 = 12,
+    GPIO_PIN16 = 16,
+    GPIO_PIN20 = 20,
+    GPIO_PIN21 = 21,
+    GPIO_PIN25 = 25,
+    GPIO_PIN_LAST = 53,
+};
+
+void gpio_init(void);
+void gpio_set_input(unsigned int pin);
+void gpio_set_output(unsigned int pin);
+void gpio_write(unsigned int pin, unsigned int val);
+unsigned int gpio_read(unsigned int pin);
+
+#endif // _HOST_GPIO_H
@@ -0,0 +1,17 @@
+/**
+ * @file gpio_interrupts.h
+ * ---------------------
+ * @brief Host stand-in for the libpi gpio_interrupts module. Registered handlers run
+ * synchronously when a simulated device drives an enabled edge.
+ */
+#ifndef _HOST_GPIO_INTERRUPTS_H
+#define _HOST_GPIO_INTERRUPTS_H
+
+#include "interrupts.h"
+
+void gpio_interrupts_init(void);
+void gpio_interrupts_enable(void);
+void gpio_interrupts_disable(void);
+handler_fn_t gpio_interrupts_register_handler(unsigned int pin, handler_fn_t fn);
+
+#endif // _HOST_GPIO_INTERRUPTS_H
@@ -0,0 +1,27 @@
+/**
+ * @file gpioextra.h
+ * ---------------------
+ * @brief Host stand-in for the libpi gpioextra module.
+ */
+#ifndef _HOST_GPIOEXTRA_H
+#define _HOST_GPIOEXTRA_H
+
+#include <stdbool.h>
+
+typedef enum
+{
+    GPIO_DETECT_RISING_EDGE = 0,
+    GPIO_DETECT_FALLING_EDGE,
+    GPIO_DETECT_HIGH_LEVEL,
+    GPIO_DETECT_LOW_LEVEL,
+    GPIO_DETECT_ASYNC_RISING_EDGE,
+    GPIO_DETECT_ASYNC_FALLING_EDGE,
+} gpio_event_t;
+
+void gpio_set_pullup(unsigned int pin);
+void gpio_set_pulldown(unsigned int pin);
+void gpio_enable_event_detection(unsigned int pin, gpio_event_t event);
+void gpio_disable_event_detection(unsigned int pin, gpio_event_t event);
+bool gpio_check_and_clear_event(unsigned int pin);
+
+#endif // _HOST_GPIOEXTRA_H
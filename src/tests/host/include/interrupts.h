@@ -0,0 +1,17 @@
+/**
+ * @file interrupts.h
+ * ---------------------
+ * @brief Host stand-in for the libpi interrupts module.
+ */
+#ifndef _HOST_INTERRUPTS_H
+#define _HOST_INTERRUPTS_H
+
+#include <stdbool.h>
+
+typedef bool (*handler_fn_t)(unsigned int);
+
+void interrupts_init(void);
+void interrupts_global_enable(void);
+void interrupts_global_disable(void);
+
+#endif // _HOST_INTERRUPTS_H
@@ -0,0 +1,11 @@
+/**
+ * @file printf.h
+ * ---------------------
+ * @brief Host stand-in for the libpi printf module.
+ */
+#ifndef _HOST_PRINTF_H
+#define _HOST_PRINTF_H
+
+#include <stdio.h>
+
+#endif // _HOST_PRINTF_H
@@ -0,0 +1,19 @@
+/**
+ * @file spi.h
+ * ---------------------
+ * @brief Host stand-in for the libpi SPI module. Transfers are routed to the
+ * simulated PN532 in fake_pn532.c.
+ */
+#ifndef _HOST_SPI_H
+#define _HOST_SPI_H
+
+typedef enum
+{
+    SPI_CE0 = 0,
+    SPI_CE1 = 1,
+} spi_chip_select_t;
+
+void spi_init(spi_chip_select_t chip_select, unsigned int polarity);
+void spi_transfer(unsigned char *tx, unsigned char *rx, unsigned int len);
+
+#endif // _HOST_SPI_H
@@ -0,0 +1,14 @@
+/**
+ * @file strings.h
+ * ---------------------
+ * @brief Host stand-in for the libpi strings module.
+ */
+#ifndef _HOST_STRINGS_H
+#define _HOST_STRINGS_H
+
+#include_next <strings.h>
+#include <string.h>
+
+unsigned int strtonum(const char *str, const char **endptr);
+
+#endif // _HOST_STRINGS_H
@@ -0,0 +1,16 @@
+/**
+ * @file timer.h
+ * ---------------------
+ * @brief Host stand-in for the libpi timer module. Time is virtual: delays
+ * advance the clock instantly and every tick read advances it by 1 usec.
+ */
+#ifndef _HOST_TIMER_H
+#define _HOST_TIMER_H
+
+void timer_init(void);
+unsigned int timer_get_ticks(void);
+void timer_delay_us(unsigned int usecs);
+void timer_delay_ms(unsigned int msecs);
+void timer_delay(unsigned int secs);
+
+#endif // _HOST_TIMER_H
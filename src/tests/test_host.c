@@ -0,0 +1,1476 @@
+/**
+ * @file test_host.c
+ * ---------------------
+ * @brief Host-side tests of the pn532 and nfc modules against the simulated PN532 in
+ * src/tests/host. Build and run with `make host-test`; no Pi or reader needed.
+ */
+
+#include <assert.h>
+#include <pn532.h>
+#include <nfc.h>
+#include <nfc_dep.h>
+#include <nfc_dump.h>
+#include <console.h>
+#include <journal_file.h>
+#include <accounts.h>
+#include <denylist.h>
+#include <time.h>
+#include <gpio_interrupts.h>
+#include "host/fake_pi.h"
+#include "host/fake_pn532.h"
+
+static const unsigned int RESET_PIN = GPIO_PIN20;
+static const unsigned int NSS_PIN = GPIO_PIN4;
+static const unsigned int IRQ_PIN = GPIO_PIN25;
+
+// The millisecond sleeps the transport used before timing profiles existed.
+static const pn532_timing_t TIMING_LEGACY = {
+    .nss_setup_us = 1000,
+    .nss_hold_us = 1000,
+    .frame_gap_us = 5000,
+    .wakeup_us = 2000,
+};
+
+/**
+ * @fn setup
+ * ---------------------
+ * @description: Powers up a fresh simulated reader and brings the driver up on it.
+ */
+static void setup(const pn532_timing_t *timing)
+{
+    fake_pn532_init(RESET_PIN, NSS_PIN, IRQ_PIN);
+    gpio_interrupts_init();
+    pn532_disable_irq();
+    nfc_init(RESET_PIN, NSS_PIN, timing);
+    fake_pn532_reset_counters();
+    pn532_reset_stats();
+}
+
+/**
+ * @fn test_bring_up
+ * ---------------------
+ * @description: the probed bring-up against the full-length sequence, and the fallback
+ * when a slow module is still deaf after the probing budget
+ */
+static void test_bring_up(void)
+{
+    setup(&PN532_TIMING_FAST);
+    const pn532_bring_up_t *bring_up = pn532_get_bring_up();
+    assert(bring_up->ready && !bring_up->full_reset);
+    unsigned int fast = bring_up->ready_us;
+    pn532_print_bring_up();
+
+    assert(pn532_bring_up(true) == PN532_STATUS_OK);
+    assert(bring_up->full_reset);
+    unsigned int full = bring_up->ready_us;
+
+    fake_pn532_set_boot_us(800 * 1000);
+    assert(pn532_bring_up(false) == PN532_STATUS_OK);
+    assert(bring_up->ready && bring_up->full_reset);
+    pn532_print_bring_up();
+
+    printf("time to ready: probed %u us, full sequence %u us\n", fast, full);
+    assert(fast < 50 * 1000 && full > 2 * 1000 * 1000);
+}
+
+/**
+ * @fn command_latency
+ * ---------------------
+ * @returns virtual microseconds one GetFirmwareVersion exchange takes.
+ */
+static unsigned int command_latency(const pn532_timing_t *timing)
+{
+    uint8_t version[4];
+
+    setup(timing);
+    unsigned int start = fake_pi_now();
+    assert(pn532_get_firmware_version(version) == PN532_STATUS_OK);
+    unsigned int elapsed = fake_pi_now() - start;
+
+    assert(version[1] == 1 && version[2] == 6);
+    return elapsed;
+}
+
+/**
+ * @fn test_timing_profiles
+ * ---------------------
+ * @description: per-command latency of each SPI timing profile
+ */
+static void test_timing_profiles(void)
+{
+    unsigned int legacy = command_latency(&TIMING_LEGACY);
+    unsigned int conservative = command_latency(&PN532_TIMING_CONSERVATIVE);
+    unsigned int fast = command_latency(&PN532_TIMING_FAST);
+
+    printf("GetFirmwareVersion: legacy %u us, conservative %u us, fast %u us\n",
+           legacy, conservative, fast);
+    assert(conservative < legacy);
+    assert(fast <= conservative);
+}
+
+/**
+ * @fn test_irq_ready
+ * ---------------------
+ * @description: IRQ ready notification versus status polling, and the polling fallback
+ * when the IRQ line never moves
+ */
+static void test_irq_ready(void)
+{
+    uint8_t version[4];
+
+    setup(&PN532_TIMING_FAST);
+    unsigned int start = fake_pi_now();
+    assert(pn532_get_firmware_version(version) == PN532_STATUS_OK);
+    unsigned int polled = fake_pi_now() - start;
+
+    pn532_enable_irq(IRQ_PIN);
+    pn532_reset_stats();
+    start = fake_pi_now();
+    assert(pn532_get_firmware_version(version) == PN532_STATUS_OK);
+    unsigned int irq = fake_pi_now() - start;
+
+    printf("GetFirmwareVersion: polled %u us, irq %u us\n", polled, irq);
+    pn532_print_stats();
+    assert(irq < polled / 4);
+    assert(pn532_get_stats()->irq_wakeups == 2);
+    assert(pn532_get_stats()->ready_saved_us > 0);
+
+    // Nothing drives this pin, so only the fallback status poll can see the chip.
+    pn532_enable_irq(GPIO_PIN21);
+    assert(pn532_get_firmware_version(version) == PN532_STATUS_OK);
+    assert(version[1] == 1);
+
+    // Back to polling, the IRQ line no longer latches events.
+    pn532_enable_irq(IRQ_PIN);
+    pn532_disable_irq();
+    pn532_reset_stats();
+    assert(pn532_get_firmware_version(version) == PN532_STATUS_OK);
+    assert(pn532_get_stats()->irq_wakeups == 0 && !fake_gpio_detects_falling(IRQ_PIN));
+}
+
+/**
+ * @fn test_prebuilt_frames
+ * ---------------------
+ * @description: a prebuilt frame gets the same answer as one built per call, and frames
+ * that do not fit are refused
+ */
+static void test_prebuilt_frames(void)
+{
+    uint8_t built[4], prebuilt[4], params[PN532_PREBUILT_MAX_LENGTH] = {0};
+    pn532_frame_t frame;
+
+    setup(&PN532_TIMING_FAST);
+    assert(pn532_send_receive(PN532_COMMAND_GETFIRMWAREVERSION, built, 4, NULL, 0, 500) == 4);
+    assert(pn532_frame_prebuild(&frame, PN532_COMMAND_GETFIRMWAREVERSION, NULL, 0) == PN532_STATUS_OK);
+    assert(pn532_send_receive_frame(&frame, prebuilt, 4, 500) == 4);
+    assert(memcmp(built, prebuilt, 4) == 0);
+    assert(pn532_config_normal() == PN532_STATUS_OK);
+
+    assert(pn532_frame_prebuild(&frame, PN532_COMMAND_INDATAEXCHANGE, params, sizeof(params)) == PN532_STATUS_ERROR);
+}
+
+/**
+ * @fn decode
+ * ---------------------
+ * @returns final decoder state after feeding frame one byte at a time into a capacity
+ * byte buffer that is followed by guard bytes which must stay untouched.
+ */
+static pn532_decode_state_t decode(const uint8_t *frame, size_t len, size_t capacity, pn532_decoder_t *decoder)
+{
+    uint8_t data[32];
+    memset(data, 0xAA, sizeof(data));
+    pn532_decoder_init(decoder, data, capacity);
+    for (size_t i = 0; i < len && pn532_decoder_need(decoder) > 0; i++)
+    {
+        assert(pn532_decoder_feed(decoder, frame + i, 1) == 1);
+    }
+    for (size_t i = capacity; i < sizeof(data); i++)
+    {
+        assert(data[i] == 0xAA);
+    }
+    return decoder->state;
+}
+
+/**
+ * @fn test_frame_decoder
+ * ---------------------
+ * @description: streaming decoder on good, ACK/NACK and malformed frames, and the number
+ * of bytes clocked for a response
+ */
+static void test_frame_decoder(void)
+{
+    const uint8_t good[] = {0x00, 0x00, 0xFF, 0x03, 0xFD, 0xD5, 0x15, 0x01, 0x15, 0x00};
+    const uint8_t extra_zeros[] = {0x00, 0x00, 0x00, 0x00, 0xFF, 0x03, 0xFD, 0xD5, 0x15, 0x01, 0x15, 0x00};
+    const uint8_t ack[] = {0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00};
+    const uint8_t nack[] = {0x00, 0x00, 0xFF, 0xFF, 0x00, 0x00};
+    const uint8_t bad_lcs[] = {0x00, 0x00, 0xFF, 0x03, 0xFE, 0xD5, 0x15, 0x01, 0x15, 0x00};
+    const uint8_t bad_dcs[] = {0x00, 0x00, 0xFF, 0x03, 0xFD, 0xD5, 0x15, 0x01, 0x16, 0x00};
+    const uint8_t long_len[] = {0x00, 0x00, 0xFF, 0x40, 0xC0, 0xD5};
+    const uint8_t no_start[] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    const uint8_t extended_bad_lcs[] = {0x00, 0x00, 0xFF, 0xFF, 0xFF, 0x01, 0x04, 0xFC};
+    static uint8_t extended[8 + 260 + 2], data[264];
+    pn532_decoder_t decoder;
+
+    // Extended frame of 260 bytes: 00 00 FF FF FF 01 04 FB, D5 41, data, DCS, 00.
+    memcpy(extended, (const uint8_t[]){0x00, 0x00, 0xFF, 0xFF, 0xFF, 0x01, 0x04, 0xFB, 0xD5, 0x41}, 10);
+    uint8_t sum = (uint8_t)(0xD5 + 0x41);
+    for (size_t i = 10; i < 8 + 260; i++)
+        sum += extended[i] = i;
+    extended[8 + 260] = -sum;
+
+    assert(decode(good, sizeof(good), 8, &decoder) == PN532_DECODE_DONE);
+    assert(decoder.kind == PN532_FRAME_INFORMATION && decoder.length == 3);
+    assert(decode(extra_zeros, sizeof(extra_zeros), 8, &decoder) == PN532_DECODE_DONE);
+    assert(decode(ack, sizeof(ack), 8, &decoder) == PN532_DECODE_DONE && decoder.kind == PN532_FRAME_ACK);
+    assert(decode(nack, sizeof(nack), 8, &decoder) == PN532_DECODE_DONE && decoder.kind == PN532_FRAME_NACK);
+    assert(decode(bad_lcs, sizeof(bad_lcs), 8, &decoder) == PN532_DECODE_ERROR && decoder.error == PN532_DECODE_BAD_LCS);
+    assert(decode(bad_dcs, sizeof(bad_dcs), 8, &decoder) == PN532_DECODE_ERROR && decoder.error == PN532_DECODE_BAD_DCS);
+    assert(decode(long_len, sizeof(long_len), 8, &decoder) == PN532_DECODE_ERROR && decoder.error == PN532_DECODE_TOO_LONG);
+    assert(decode(no_start, sizeof(no_start), 8, &decoder) == PN532_DECODE_ERROR && decoder.error == PN532_DECODE_BAD_START);
+    assert(decode(good, 6, 8, &decoder) == PN532_DECODE_DATA && pn532_decoder_need(&decoder) == 4);
+    pn532_decoder_init(&decoder, data, sizeof(data));
+    assert(pn532_decoder_feed(&decoder, extended, 5) == 5 && pn532_decoder_need(&decoder) == 3);
+    pn532_decoder_feed(&decoder, extended + 5, sizeof(extended) - 5);
+    assert(decoder.state == PN532_DECODE_DONE && decoder.length == 260 && data[259] == (uint8_t)267);
+    assert(decode(extended, sizeof(extended), 8, &decoder) == PN532_DECODE_ERROR && decoder.error == PN532_DECODE_TOO_LONG);
+    assert(decode(extended_bad_lcs, sizeof(extended_bad_lcs), 8, &decoder) == PN532_DECODE_ERROR && decoder.error == PN532_DECODE_BAD_LCS);
+
+    // IRQ mode, so no status reads: write 12 + ACK 7 + exact response 1 + 5 + 12 + 2.
+    uint8_t uid[MIFARE_UID_MAX_LENGTH];
+    setup(&PN532_TIMING_FAST);
+    pn532_enable_irq(IRQ_PIN);
+    fake_pn532_reset_counters();
+    assert(pn532_read_passive_target(uid, PN532_MIFARE_ISO14443A, 1000) == 4);
+    printf("InListPassiveTarget: %u bytes clocked\n", fake_pn532_counters.spi_bytes);
+    assert(fake_pn532_counters.spi_bytes == 12 + 7 + 20);
+}
+
+/**
+ * @fn test_bulk_blocks
+ * ---------------------
+ * @description: full-card dump with per-sector authentication against the old per-block
+ * authentication, and a write_blocks/read_blocks round trip that skips trailers
+ */
+static void test_bulk_blocks(void)
+{
+    static uint8_t before[1024], after[1024];
+    uint8_t key[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    uint8_t uid[MIFARE_UID_MAX_LENGTH];
+
+    setup(&PN532_TIMING_FAST);
+    pn532_enable_irq(IRQ_PIN);
+    for (size_t i = 0; i < 64; i++)
+    {
+        if (i % 4 != 3 && i != 0)
+            memset(fake_pn532_card_block(i), i, 16);
+    }
+
+    // What get_tag_info used to do: authenticate before every block.
+    fake_pn532_reset_counters();
+    unsigned int start = fake_pi_now();
+    assert(pn532_config_normal() == PN532_STATUS_OK);
+    int uid_len = pn532_read_passive_target(uid, PN532_MIFARE_ISO14443A, 1000);
+    for (size_t block = 0; block < 64; block++)
+    {
+        assert(pn532_authenticate_block(uid, uid_len, block, MIFARE_CMD_AUTH_A, key) == PN532_ERROR_NONE);
+        assert(pn532_read_block(before + 16 * block, block) == PN532_ERROR_NONE);
+    }
+    unsigned int per_block_us = fake_pi_now() - start;
+    unsigned int per_block_exchanges = fake_pn532_counters.command_counts[PN532_COMMAND_INDATAEXCHANGE];
+
+    fake_pn532_reset_counters();
+    start = fake_pi_now();
+    assert(get_tag_info(after, sizeof(after)) == PN532_ERROR_NONE);
+    unsigned int per_sector_us = fake_pi_now() - start;
+    unsigned int per_sector_exchanges = fake_pn532_counters.command_counts[PN532_COMMAND_INDATAEXCHANGE];
+
+    printf("1K dump: per-block auth %u exchanges %u us, per-sector auth %u exchanges %u us\n",
+           per_block_exchanges, per_block_us, per_sector_exchanges, per_sector_us);
+    assert(memcmp(before, after, sizeof(after)) == 0);
+    assert(per_block_exchanges == 128 && per_sector_exchanges == 81);
+
+    // Blocks 4-11 span two sectors and one trailer, which must survive.
+    uint8_t data[8 * 16], readback[8 * 16], trailer[16];
+    memset(data, 0x5A, sizeof(data));
+    memcpy(trailer, fake_pn532_card_block(7), 16);
+    assert(write_blocks(data, uid, uid_len, 4, 8, true) == PN532_ERROR_NONE);
+    assert(memcmp(fake_pn532_card_block(7), trailer, 16) == 0);
+    memset(readback, 0x5A, sizeof(readback));
+    assert(read_blocks(readback, uid, uid_len, 4, 8, true) == PN532_ERROR_NONE);
+    assert(memcmp(readback, data, sizeof(data)) == 0);
+    assert(read_blocks(readback, uid, uid_len, 60, 8, true) == PN532_STATUS_ERROR);
+}
+
+/**
+ * @fn idle_minute
+ * ---------------------
+ * @returns SPI transactions spent waiting a minute for a card that never comes.
+ */
+static unsigned int idle_minute(void)
+{
+    uint8_t uid[MIFARE_UID_MAX_LENGTH];
+
+    fake_pn532_remove_card();
+    fake_pn532_reset_counters();
+    assert(nfc_detect_card(uid, 60000) == PN532_STATUS_ERROR);
+    return fake_pn532_counters.spi_transactions;
+}
+
+/**
+ * @fn detection_latency
+ * ---------------------
+ * @returns microseconds from a card entering the field to nfc_detect_card returning it.
+ */
+static unsigned int detection_latency(unsigned int arrival_us)
+{
+    static const uint8_t uid[] = {0x04, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66};
+    uint8_t found[MIFARE_UID_MAX_LENGTH];
+
+    fake_pn532_remove_card();
+    fake_pn532_place_card_after(uid, sizeof(uid), arrival_us);
+    unsigned int start = fake_pi_now();
+    assert(nfc_detect_card(found, 10000) == sizeof(uid));
+    assert(memcmp(found, uid, sizeof(uid)) == 0);
+    return fake_pi_now() - start - arrival_us;
+}
+
+/**
+ * @fn test_autopoll_detection
+ * ---------------------
+ * @description: Card detection with InAutoPoll against re-listing with InListPassiveTarget:
+ * bus traffic while no card is present, and how soon an arriving card is reported.
+ */
+static void test_autopoll_detection(void)
+{
+    uint8_t uid[MIFARE_UID_MAX_LENGTH];
+
+    setup(&PN532_TIMING_FAST);
+    pn532_enable_irq(IRQ_PIN);
+    unsigned int autopoll_idle = idle_minute();
+    unsigned int autopoll_latency = detection_latency(2345678);
+    assert(nfc_get_detect_stats()->detections == 1 && nfc_get_detect_stats()->timeouts == 1);
+    nfc_print_detect_stats();
+
+    nfc_set_autopoll(NULL);
+    unsigned int relist_idle = idle_minute();
+    unsigned int relist_latency = detection_latency(2345678);
+
+    pn532_disable_irq();
+    nfc_set_autopoll(&NFC_AUTOPOLL_DEFAULT);
+    unsigned int polled_idle = idle_minute();
+
+    printf("idle minute: autopoll %u spi transactions (status polled %u), re-listing %u\n",
+           autopoll_idle, polled_idle, relist_idle);
+    printf("detection latency: autopoll %u us, re-listing %u us\n", autopoll_latency, relist_latency);
+    assert(autopoll_idle * 10 < relist_idle && polled_idle < relist_idle);
+    assert(autopoll_latency <= PN532_AUTOPOLL_PERIOD_MS * 1000 + 10000);
+
+    // A round limit that runs out restarts polling until the caller's timeout.
+    nfc_autopoll_t twice = NFC_AUTOPOLL_DEFAULT;
+    twice.poll_count = 2;
+    nfc_set_autopoll(&twice);
+    pn532_enable_irq(IRQ_PIN);
+    idle_minute();
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_INAUTOPOLL] >= 60000 / 300);
+    fake_pn532_place_card(uid, MIFARE_UID_SINGLE_LENGTH);
+    assert(nfc_detect_card(uid, 1000) == MIFARE_UID_SINGLE_LENGTH);
+}
+
+/**
+ * @fn test_multi_target
+ * ---------------------
+ * @description: Two cards in the field listed at once, card commands routed to each by Tg,
+ * and a known triple-size UID selected directly with initiator data.
+ */
+static void test_multi_target(void)
+{
+    static const uint8_t first[] = {0x11, 0x22, 0x33, 0x44};
+    static const uint8_t second[] = {0x04, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09};
+    uint8_t data[MIFARE_BLOCK_LENGTH] = {0xA1}, block[MIFARE_BLOCK_LENGTH];
+    nfc_target_t targets[PN532_MAX_TARGETS];
+    nfc_transaction_t a, b;
+
+    setup(&PN532_TIMING_FAST);
+    fake_pn532_place_card(first, sizeof(first));
+    fake_pn532_add_card(second, sizeof(second));
+    assert(pn532_list_passive_targets(targets, PN532_MAX_TARGETS, NULL, 0, 1000) == 2);
+    assert(targets[0].tg == 1 && targets[0].uid_length == sizeof(first));
+    assert(targets[1].tg == 2 && targets[1].uid_length == sizeof(second));
+    assert(memcmp(targets[1].uid, second, sizeof(second)) == 0);
+
+    // Both cards in one field session, interleaved.
+    assert(nfc_transaction_begin_target(&a, &targets[0]) == PN532_ERROR_NONE);
+    assert(nfc_transaction_begin_target(&b, &targets[1]) == PN532_ERROR_NONE);
+    assert(nfc_transaction_write(&a, data, 4) == PN532_ERROR_NONE);
+    data[0] = 0xB2;
+    assert(nfc_transaction_write(&b, data, 4) == PN532_ERROR_NONE);
+    assert(nfc_transaction_read(&a, block, 4) == PN532_ERROR_NONE && block[0] == 0xA1);
+    assert(nfc_transaction_read(&b, block, 5) == PN532_ERROR_NONE);
+    nfc_transaction_end(&a);
+    nfc_transaction_end(&b);
+    assert(fake_pn532_card_block_of(0, 4)[0] == 0xA1 && fake_pn532_card_block_of(1, 4)[0] == 0xB2);
+
+    // Straight to the second card by its UID, with the first still in the field.
+    assert(nfc_reselect(second, sizeof(second), 1000) == 1);
+    assert(nfc_current_target() == 1);
+    assert(pn532_authenticate_block((uint8_t *)second, sizeof(second), 4, MIFARE_CMD_AUTH_A,
+                                    (uint8_t[]){0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}) == PN532_ERROR_NONE);
+    assert(pn532_read_block(block, 4) == PN532_ERROR_NONE && block[0] == 0xB2);
+}
+
+/**
+ * @fn listing_miss
+ * ---------------------
+ * @returns microseconds pn532_read_passive_target takes to give up on an empty field.
+ */
+static unsigned int listing_miss(void)
+{
+    uint8_t uid[MIFARE_UID_MAX_LENGTH];
+
+    fake_pn532_remove_card();
+    unsigned int start = fake_pi_now();
+    assert(pn532_read_passive_target(uid, PN532_MIFARE_ISO14443A, 1000) == PN532_STATUS_ERROR);
+    return fake_pi_now() - start;
+}
+
+/**
+ * @fn test_rf_tuning
+ * ---------------------
+ * @description: Tuning presets reach the PN532 in one call and change how long an empty
+ * listing takes; the active tuning reads back.
+ */
+static void test_rf_tuning(void)
+{
+    uint8_t uid[MIFARE_UID_MAX_LENGTH];
+
+    setup(&PN532_TIMING_FAST);
+    pn532_enable_irq(IRQ_PIN);
+    assert(strcmp(nfc_get_tuning()->name, "default") == 0);
+    unsigned int default_miss = listing_miss();
+
+    fake_pn532_reset_counters();
+    assert(nfc_apply_tuning(nfc_find_tuning("fast-gate")) == PN532_STATUS_OK);
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_RFCONFIGURATION] == 4);
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_SETPARAMETERS] == 1);
+    assert(nfc_get_tuning()->max_retry_passive == NFC_TUNING_FAST_GATE.max_retry_passive);
+    unsigned int fast_miss = listing_miss();
+    nfc_print_tuning();
+    printf("empty listing: default %u us, fast-gate %u us\n", default_miss, fast_miss);
+    assert(default_miss > 1000000 && fast_miss < 20000);
+
+    fake_pn532_place_card(uid, MIFARE_UID_SINGLE_LENGTH);
+    assert(pn532_read_passive_target(uid, PN532_MIFARE_ISO14443A, 1000) == MIFARE_UID_SINGLE_LENGTH);
+
+    nfc_tuning_t field_off = NFC_TUNING_FAST_GATE;
+    field_off.name = "field-off";
+    field_off.field = 0;
+    assert(nfc_apply_tuning(&field_off) == PN532_STATUS_OK);
+    assert(pn532_read_passive_target(uid, PN532_MIFARE_ISO14443A, 1000) == PN532_STATUS_ERROR);
+    assert(nfc_find_tuning("robust") == &NFC_TUNING_ROBUST && nfc_find_tuning("turbo") == NULL);
+}
+
+/**
+ * @fn test_bit_rates
+ * ---------------------
+ * @description: FeliCa listing at 212 and 424 kbps, an ISO14443-4 card switched to 424 kbps
+ * with InPSL, and the bulk read rate of each against the same read at 106 kbps.
+ */
+static void test_bit_rates(void)
+{
+    static const uint8_t iso_uid[] = {0x04, 0x52, 0x61, 0x7A, 0x12, 0x34, 0x80};
+    static const uint8_t idm[] = {0x01, 0x2E, 0x4C, 0xD3, 0x12, 0x34, 0x56, 0x78};
+    uint8_t data[1024], uid[MIFARE_UID_MAX_LENGTH];
+    nfc_target_t target;
+    unsigned int start, read_106, read_424, felica_212, felica_424;
+
+    setup(&PN532_TIMING_FAST);
+    pn532_enable_irq(IRQ_PIN);
+
+    // ISO14443-4: 1 KB with READ BINARY before and after the PPS.
+    fake_pn532_remove_card();
+    fake_pn532_add_card_of_type(FAKE_CARD_ISO14443_4, iso_uid, sizeof(iso_uid));
+    assert(pn532_list_passive_targets(&target, 1, NULL, 0, 1000) == 1);
+    assert(target.sel_res == NFC_SEL_RES_ISO14443_4 && target.baud == PN532_BAUD_106);
+    assert(target.max_baud == PN532_BAUD_424);
+    start = fake_pi_now();
+    assert(nfc_read_binary(data, 0, sizeof(data)) == PN532_ERROR_NONE);
+    read_106 = fake_pi_now() - start;
+    assert(nfc_set_target_baud(&target, target.max_baud) == PN532_ERROR_NONE);
+    assert(target.baud == PN532_BAUD_424);
+    start = fake_pi_now();
+    assert(nfc_read_binary(data, 0, sizeof(data)) == PN532_ERROR_NONE);
+    read_424 = fake_pi_now() - start;
+    assert(memcmp(data, fake_pn532_card_block(0), sizeof(data)) == 0);
+
+    // FeliCa: the same 1 KB as 64 blocks.
+    fake_pn532_remove_card();
+    fake_pn532_add_card_of_type(FAKE_CARD_FELICA, idm, sizeof(idm));
+    assert(pn532_read_passive_target(uid, PN532_FELICA_424, 1000) == FELICA_IDM_LENGTH);
+    assert(memcmp(uid, idm, sizeof(idm)) == 0);
+    assert(pn532_list_felica_targets(&target, 1, PN532_FELICA_212, FELICA_SYSTEM_CODE_ANY, 1000) == 1);
+    assert(target.baud == PN532_BAUD_212 && memcmp(target.uid, idm, sizeof(idm)) == 0);
+    start = fake_pi_now();
+    assert(nfc_felica_read_blocks(&target, 0x000B, 0, 64, data) == PN532_ERROR_NONE);
+    felica_212 = fake_pi_now() - start;
+    assert(pn532_list_felica_targets(&target, 1, PN532_FELICA_424, FELICA_SYSTEM_CODE_ANY, 1000) == 1);
+    start = fake_pi_now();
+    assert(nfc_felica_read_blocks(&target, 0x000B, 0, 64, data) == PN532_ERROR_NONE);
+    felica_424 = fake_pi_now() - start;
+    assert(memcmp(data, fake_pn532_card_block(0), sizeof(data)) == 0);
+    assert(nfc_set_target_baud(&target, PN532_BAUD_424) == PN532_STATUS_ERROR);
+
+    printf("1 KB read: iso14443-4 106 kbps %u us, 424 kbps %u us; felica 212 kbps %u us, 424 kbps %u us\n",
+           read_106, read_424, felica_212, felica_424);
+    assert(read_106 >= 2 * read_424);
+}
+
+/**
+ * @fn test_link_recovery
+ * ---------------------
+ * @description: a garbled response is read again with NACK, a lost command is resent,
+ * and a link that stays broken is brought up again
+ */
+static void test_link_recovery(void)
+{
+    uint8_t version[4];
+
+    unsigned int clean = command_latency(&PN532_TIMING_FAST);
+    fake_pn532_reset_counters();
+    pn532_reset_stats();
+
+    fake_pn532_corrupt_responses(1);
+    unsigned int start = fake_pi_now();
+    assert(pn532_get_firmware_version(version) == PN532_STATUS_OK);
+    unsigned int nack = fake_pi_now() - start;
+    assert(version[1] == 1 && version[2] == 6);
+    assert(pn532_get_stats()->nacks == 1 && fake_pn532_counters.nacks == 1);
+    assert(pn532_get_stats()->retries == 0);
+
+    fake_pn532_drop_commands(1);
+    start = fake_pi_now();
+    assert(pn532_get_firmware_version(version) == PN532_STATUS_OK);
+    unsigned int resend = fake_pi_now() - start;
+    assert(pn532_get_stats()->retries == 1 && fake_pn532_counters.commands == 2);
+
+    // Every read of every attempt garbled: NACKs and resends run out.
+    fake_pn532_corrupt_responses(4 * 4);
+    assert(pn532_get_firmware_version(version) == PN532_STATUS_ERROR);
+    assert(pn532_get_stats()->retries == 1 + 3 && pn532_get_stats()->link_resets == 1);
+    assert(pn532_get_firmware_version(version) == PN532_STATUS_OK);
+    pn532_print_stats();
+
+    printf("GetFirmwareVersion: clean %u us, one nack %u us, one resend %u us\n", clean, nack, resend);
+    assert(nack < 2 * clean && resend < 5 * clean);
+}
+
+/**
+ * @fn test_reader_state
+ * ---------------------
+ * @description: commands that would change nothing are skipped, and a lost link or a
+ * reset makes the driver send them again; a listing that finds no card does not
+ */
+static void test_reader_state(void)
+{
+    const uint8_t card[] = {0x04, 0x11, 0x22, 0x33};
+    uint8_t uid[MIFARE_UID_MAX_LENGTH];
+    uint8_t version[4], cached[4];
+
+    setup(&PN532_TIMING_FAST);
+    fake_pn532_place_card(card, sizeof(card));
+    assert(!nfc_get_reader_state()->sam_normal && nfc_get_reader_state()->tuning_known);
+
+    assert(nfc_config_normal() == PN532_STATUS_OK);
+    assert(nfc_config_normal() == PN532_STATUS_OK);
+    assert(nfc_get_firmware_version(version) == PN532_STATUS_OK);
+    assert(nfc_get_firmware_version(cached) == PN532_STATUS_OK);
+    assert(memcmp(version, cached, sizeof(version)) == 0);
+    assert(nfc_apply_tuning(&NFC_TUNING_DEFAULT) == PN532_STATUS_OK);
+    assert(pn532_get_stats()->commands == 2);
+
+    assert(nfc_apply_tuning(&NFC_TUNING_FAST_GATE) == PN532_STATUS_OK);
+    assert(nfc_apply_tuning(&NFC_TUNING_FAST_GATE) == PN532_STATUS_OK);
+    assert(pn532_get_stats()->commands == 7);
+
+    assert(nfc_detect_card(uid, 1000) == sizeof(card));
+    unsigned int commands = pn532_get_stats()->commands;
+    assert(nfc_reselect(card, sizeof(card), 1000) == 1);
+    assert(pn532_get_stats()->commands == commands);
+    nfc_print_reader_state();
+
+    // A listing that runs out of time without a card is no news about the chip.
+    nfc_target_t target;
+    assert(nfc_apply_tuning(&NFC_TUNING_DEFAULT) == PN532_STATUS_OK);
+    fake_pn532_remove_card();
+    fake_pn532_reset_counters();
+    assert(pn532_list_passive_targets(&target, 1, NULL, 0, 100) == PN532_STATUS_ERROR);
+    assert(pn532_read_passive_target(uid, PN532_MIFARE_ISO14443A, 100) == PN532_STATUS_ERROR);
+    assert(fake_pn532_counters.aborts == 2);
+    assert(nfc_config_normal() == PN532_STATUS_OK);
+    assert(nfc_get_firmware_version(cached) == PN532_STATUS_OK);
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_SAMCONFIGURATION] == 0);
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_GETFIRMWAREVERSION] == 0);
+    assert(nfc_get_reader_state()->tuning_known);
+
+    // A chip that stops answering may have lost everything.
+    fake_pn532_drop_commands(1 + 3);
+    assert(pn532_get_firmware_version(version) == PN532_STATUS_ERROR);
+    const nfc_reader_state_t *state = nfc_get_reader_state();
+    assert(!state->sam_normal && !state->firmware_known && !state->tuning_known);
+    assert(state->target_uid_length == 0 && strcmp(nfc_get_tuning()->name, "unknown") == 0);
+    commands = pn532_get_stats()->commands;
+    assert(nfc_config_normal() == PN532_STATUS_OK);
+    assert(nfc_apply_tuning(&NFC_TUNING_FAST_GATE) == PN532_STATUS_OK);
+    assert(pn532_get_stats()->commands == commands + 6);
+
+    pn532_reset();
+    assert(!nfc_get_reader_state()->sam_normal);
+    assert(nfc_config_normal() == PN532_STATUS_OK);
+    assert(pn532_get_stats()->commands == commands + 7);
+
+    // Waiting for a tap puts the reader back in normal mode first.
+    pn532_reset();
+    fake_pn532_place_card(card, sizeof(card));
+    fake_pn532_reset_counters();
+    assert(nfc_scan_card(uid, 1000) == sizeof(card));
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_SAMCONFIGURATION] == 1);
+}
+
+/**
+ * @fn test_extended_frames
+ * ---------------------
+ * @description: READ BINARY and UPDATE BINARY of full short APDUs, whose frames are
+ * longer than 255 bytes, each in a single exchange
+ */
+static void test_extended_frames(void)
+{
+    static const uint8_t iso_uid[] = {0x04, 0x52, 0x61, 0x7A, 0x12, 0x34, 0x80};
+    static uint8_t written[1024], data[1024];
+    nfc_target_t target;
+
+    setup(&PN532_TIMING_FAST);
+    pn532_enable_irq(IRQ_PIN);
+    fake_pn532_remove_card();
+    fake_pn532_add_card_of_type(FAKE_CARD_ISO14443_4, iso_uid, sizeof(iso_uid));
+    assert(pn532_list_passive_targets(&target, 1, NULL, 0, 1000) == 1);
+    for (size_t i = 0; i < sizeof(written); i++)
+        written[i] = i * 7;
+
+    fake_pn532_reset_counters();
+    assert(nfc_update_binary(written, 0, sizeof(written)) == PN532_ERROR_NONE);
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_INDATAEXCHANGE] == 5);
+    assert(memcmp(fake_pn532_card_block(0), written, sizeof(written)) == 0);
+
+    fake_pn532_reset_counters();
+    unsigned int start = fake_pi_now();
+    assert(nfc_read_binary(data, 0, sizeof(data)) == PN532_ERROR_NONE);
+    unsigned int read = fake_pi_now() - start;
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_INDATAEXCHANGE] == 4);
+    assert(memcmp(data, written, sizeof(data)) == 0);
+    assert(pn532_get_stats()->frame_errors == 0);
+    printf("1 KB: update binary 5 exchanges, read binary 4 exchanges in %u us\n", read);
+}
+
+/**
+ * @fn test_ntag
+ * ---------------------
+ * @description: an NTAG215 dumped with GET_VERSION and three FAST_READs, page writes, and
+ * writes behind AUTH0 refused until PWD_AUTH
+ */
+static void test_ntag(void)
+{
+    static const uint8_t ntag_uid[] = {0x04, 0x91, 0x3C, 0x5A, 0x2B, 0x68, 0x80};
+    static const uint8_t pwd[] = {0xFF, 0xFF, 0xFF, 0xFF}, wrong[] = {0x12, 0x34, 0x56, 0x78};
+    static const uint8_t page[] = {0xCA, 0xFE, 0xF0, 0x0D};
+    static uint8_t data[1024];
+    uint8_t pack[NTAG_PACK_LENGTH], read[NTAG_PAGE_LENGTH];
+    nfc_target_t target;
+    size_t pages = 0;
+
+    setup(&PN532_TIMING_FAST);
+    pn532_enable_irq(IRQ_PIN);
+    fake_pn532_remove_card();
+    fake_pn532_add_card_of_type(FAKE_CARD_NTAG215, ntag_uid, sizeof(ntag_uid));
+
+    unsigned int start = fake_pi_now();
+    assert(get_ntag_info(data, sizeof(data), &pages) == PN532_ERROR_NONE);
+    unsigned int dump = fake_pi_now() - start;
+    assert(pages == 135);
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_INCOMMUNICATETHRU] == 4);
+    assert(memcmp(data, fake_pn532_card_page(0), 133 * NTAG_PAGE_LENGTH) == 0);
+    printf("NTAG215: %u commands (4 InCommunicateThru) in %u us, READ would take 34\n",
+           fake_pn532_counters.commands, dump);
+
+    assert(nfc_ntag_write_page(page, 10) == PN532_ERROR_NONE);
+    assert(nfc_ntag_read_page(read, 10) == PN532_ERROR_NONE);
+    assert(memcmp(read, page, sizeof(page)) == 0 && memcmp(fake_pn532_card_page(10), page, sizeof(page)) == 0);
+
+    // Protect pages 16 on: a write is refused, and so is a wrong password.
+    fake_pn532_card_page(131)[3] = 16;
+    fake_pn532_card_page(134)[0] = 0x80;
+    assert(nfc_ntag_write_page(page, 20) != PN532_ERROR_NONE);
+    assert(pn532_list_passive_targets(&target, 1, NULL, 0, 1000) == 1);
+    assert(nfc_ntag_pwd_auth(wrong, pack) != PN532_ERROR_NONE);
+    assert(nfc_get_reader_state()->target_uid_length == 0);
+    assert(pn532_list_passive_targets(&target, 1, NULL, 0, 1000) == 1);
+    assert(nfc_ntag_pwd_auth(pwd, pack) == PN532_ERROR_NONE && pack[0] == 0x80);
+    assert(nfc_ntag_write_page(page, 20) == PN532_ERROR_NONE);
+    assert(memcmp(fake_pn532_card_page(20), page, sizeof(page)) == 0);
+
+    // A MIFARE Classic is left to the block reader.
+    fake_pn532_remove_card();
+    fake_pn532_add_card(ntag_uid, 4);
+    assert(get_ntag_info(data, sizeof(data), &pages) == NFC_ERROR_WRONG_TAG && pages == 0);
+}
+
+/**
+ * @fn dep_bench_rate
+ * ---------------------
+ * @returns bytes per second of a 16 KB p2p-bench run against a peer target announcing
+ * bit rates up to max_baud, after checking the link came up at that rate.
+ */
+static unsigned int dep_bench_rate(uint8_t max_baud)
+{
+    nfc_dep_link_t link;
+
+    fake_pn532_add_dep_peer(max_baud, false);
+    assert(nfc_dep_initiate(&link, 1000) == PN532_ERROR_NONE);
+    assert(link.baud == max_baud && link.max_baud == max_baud);
+    assert(nfc_dep_bench(&link, 16 * 1024) == PN532_STATUS_OK);
+    assert(nfc_dep_release(&link) == PN532_ERROR_NONE);
+    assert(link.stats.messages == 17 && link.stats.bytes_sent == 16 * 1024);
+    nfc_dep_print_stats(&link);
+    return (link.stats.bytes_sent + link.stats.bytes_received) * 1000 / (link.stats.frame_us / 1000);
+}
+
+/**
+ * @fn test_nfc_dep
+ * ---------------------
+ * @description: chained NFC-DEP messages both ways as initiator and as target, the bit
+ * rate raised to the peer's highest, and p2p-bench throughput at 106 and 424 kbps
+ */
+static void test_nfc_dep(void)
+{
+    static uint8_t message[1000], reply[1000];
+    nfc_dep_link_t link;
+    size_t received_len;
+
+    setup(&PN532_TIMING_FAST);
+    pn532_enable_irq(IRQ_PIN);
+    for (size_t i = 0; i < sizeof(message); i++)
+        message[i] = i * 13;
+
+    // Nobody listening.
+    assert(nfc_dep_initiate(&link, 1000) != PN532_ERROR_NONE);
+
+    // 1000 bytes are 4 chunks out and, echoed, 3 more fetched.
+    fake_pn532_add_dep_peer(PN532_BAUD_424, true);
+    assert(nfc_dep_initiate(&link, 1000) == PN532_ERROR_NONE && link.baud == PN532_BAUD_424);
+    fake_pn532_reset_counters();
+    assert(nfc_dep_transceive(&link, message, sizeof(message), reply, sizeof(reply)) == sizeof(message));
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_INDATAEXCHANGE] == 7);
+    assert(memcmp(reply, message, sizeof(message)) == 0);
+    assert(memcmp(fake_pn532_dep_received(&received_len), message, sizeof(message)) == 0);
+    assert(received_len == sizeof(message));
+    assert(nfc_dep_transceive(&link, message, sizeof(message), reply, 100) == PN532_STATUS_ERROR);
+
+    // A reply still garbled after every NACK (1 + 3 reads) fails the exchange; resending
+    // it would hand the peer the chunk a second time.
+    fake_pn532_reset_counters();
+    fake_pn532_corrupt_responses(4);
+    assert(nfc_dep_transceive(&link, message, 100, reply, sizeof(reply)) == PN532_STATUS_ERROR);
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_INDATAEXCHANGE] == 1);
+    assert(memcmp(fake_pn532_dep_received(&received_len), message, 100) == 0 && received_len == 100);
+
+    unsigned int slow = dep_bench_rate(PN532_BAUD_106);
+    unsigned int fast = dep_bench_rate(PN532_BAUD_424);
+    printf("p2p-bench 16 KB: %u bytes/s at 106 kbps, %u bytes/s at 424 kbps\n", slow, fast);
+    assert(fast > 2 * slow);
+
+    // As target: a 1000-byte request in, a 600-byte reply out.
+    fake_pn532_dep_initiator_send(message, sizeof(message));
+    assert(nfc_dep_listen(&link, 1000) == PN532_STATUS_OK && !link.initiator);
+    assert(link.baud == PN532_BAUD_106 && link.max_baud == PN532_BAUD_424);
+    fake_pn532_reset_counters();
+    assert(nfc_dep_receive(&link, reply, sizeof(reply)) == sizeof(message));
+    assert(memcmp(reply, message, sizeof(message)) == 0);
+    assert(nfc_dep_reply(&link, message, 600) == PN532_ERROR_NONE);
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_TGGETDATA] == 4);
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_TGSETMETADATA] == 2);
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_TGSETDATA] == 1);
+    assert(memcmp(fake_pn532_dep_received(&received_len), message, 600) == 0 && received_len == 600);
+
+    // Nor is TgGetData sent again after a garbled answer: the chunk is already fetched.
+    fake_pn532_dep_initiator_send(message, 100);
+    assert(nfc_dep_listen(&link, 1000) == PN532_STATUS_OK);
+    fake_pn532_reset_counters();
+    fake_pn532_corrupt_responses(4);
+    assert(nfc_dep_receive(&link, reply, sizeof(reply)) == PN532_STATUS_ERROR);
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_TGGETDATA] == 1);
+}
+
+/**
+ * @fn test_balance_transaction
+ * ---------------------
+ * @description: a payment as one transaction of on-card value arithmetic against the old
+ * get_balance + set_balance, migration of a raw balance block, a lost TRANSFER ACK that
+ * must not charge twice, and value block backup
+ */
+static void test_balance_transaction(void)
+{
+    const uint8_t legacy[16] = {0x00, 0x00, 0x01, 0x2C}; // 300, big-endian
+    int balance = 0;
+    int32_t value;
+    unsigned int round_trips = 0, reported = 0;
+
+    setup(&PN532_TIMING_FAST);
+    assert(set_balance(100) == PN532_ERROR_NONE);
+    assert(mifare_parse_value_block(fake_pn532_card_block(6), &value) && value == 100);
+
+    pn532_reset_stats();
+    assert(get_balance(&balance) == PN532_ERROR_NONE);
+    assert(set_balance(balance + 25) == PN532_ERROR_NONE);
+    unsigned int two_step = pn532_get_stats()->commands;
+
+    assert(update_balance(-40, NULL, &round_trips) == PN532_ERROR_NONE);
+    assert(update_balance(10, &balance, &reported) == PN532_ERROR_NONE);
+    printf("payment: get+set %u round trips, value ops %u, value ops + read back %u\n",
+           two_step, round_trips, reported);
+    assert(balance == 95);
+    assert(two_step == 7 && round_trips == 6 && reported == 6);
+
+    // A card still holding a raw balance is converted on its first payment.
+    memcpy(fake_pn532_card_block(6), legacy, 16);
+    assert(update_balance(-50, &balance, NULL) == PN532_ERROR_NONE && balance == 250);
+    journal_entry_t entry;
+    assert(journal_get(0, &entry) && entry.old_balance == 300 && entry.new_balance == 250);
+    assert(mifare_parse_value_block(fake_pn532_card_block(6), &value) && value == 250);
+
+    // A TRANSFER the card carried out but whose ACK was lost is reported, not re-applied.
+    fake_pn532_lose_card_acks(1);
+    assert(update_balance(-20, &balance, NULL) == 0x01);
+    assert(mifare_parse_value_block(fake_pn532_card_block(6), &value) && value == 230);
+    fake_pn532_lose_card_acks(0);
+
+    nfc_transaction_t txn;
+    assert(nfc_transaction_begin(&txn) == PN532_ERROR_NONE);
+    assert(nfc_transaction_backup_value(&txn, 6, 5) == PN532_ERROR_NONE);
+    assert(nfc_transaction_backup_value(&txn, 6, 9) == PN532_STATUS_ERROR);
+    nfc_transaction_end(&txn);
+    assert(mifare_parse_value_block(fake_pn532_card_block(5), &value) && value == 230);
+}
+
+/**
+ * @fn test_block_cache
+ * ---------------------
+ * @description: repeat reads of a card still in the field served from its cached image,
+ * unchanged writes skipped, the least recently used card evicted, and a card changed
+ * elsewhere read afresh when it is tapped again
+ */
+static void test_block_cache(void)
+{
+    uint8_t uid[MIFARE_UID_MAX_LENGTH], other[] = {0x10, 0x20, 0x30, 0x40};
+    int balance = 0;
+    int32_t value;
+
+    setup(&PN532_TIMING_FAST);
+    assert(set_balance(70) == PN532_ERROR_NONE);
+
+    // While the card stays in the field, a repeat read, or a write of what the card
+    // holds, costs no RF traffic.
+    uint8_t data[3 * 16];
+    int uid_len = nfc_detect_card(uid, 1000);
+    nfc_reset_cache_stats();
+    assert(read_blocks(data, uid, uid_len, 4, 3, false) == PN532_ERROR_NONE);
+    fake_pn532_reset_counters();
+    assert(read_blocks(data, uid, uid_len, 4, 3, false) == PN532_ERROR_NONE);
+    assert(write_blocks(data, uid, uid_len, 4, 3, false) == PN532_ERROR_NONE);
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_INDATAEXCHANGE] == 0);
+    assert(nfc_get_cache_stats()->hits == 3 && nfc_get_cache_stats()->misses == 3);
+    assert(nfc_get_cache_stats()->clean_writes == 3 && nfc_get_cache_stats()->write_backs == 0);
+
+    // Only the changed block of a write goes out.
+    data[16] ^= 0xFF;
+    fake_pn532_reset_counters();
+    assert(write_blocks(data, uid, uid_len, 4, 3, false) == PN532_ERROR_NONE);
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_INDATAEXCHANGE] == 2);
+    assert(memcmp(fake_pn532_card_block(5), data + 16, 16) == 0);
+
+    // Four more cards evict the first; brought back, it is read from the card again.
+    for (uint8_t i = 0; i < NFC_CACHE_TAGS; i++)
+    {
+        other[0] = i;
+        fake_pn532_place_card(other, sizeof(other));
+        assert(set_balance(i) == PN532_ERROR_NONE);
+    }
+    assert(nfc_get_cache_stats()->evictions == 1);
+    fake_pn532_place_card(uid, uid_len);
+    mifare_value_block(fake_pn532_card_block(6), 42, 6);
+    assert(get_balance(&balance) == PN532_ERROR_NONE && balance == 42);
+
+    // A read answered without its block is an error, and nothing of it is cached.
+    mifare_value_block(fake_pn532_card_block(6), 43, 6);
+    nfc_cache_invalidate(uid, uid_len);
+    fake_pn532_short_reads(8);
+    assert(get_balance(&balance) != PN532_ERROR_NONE);
+    fake_pn532_short_reads(0);
+    fake_pn532_reset_counters();
+    assert(get_balance(&balance) == PN532_ERROR_NONE && balance == 43);
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_INDATAEXCHANGE] > 0);
+
+    // The card leaves the field with 70 cached and comes back charged elsewhere to 50.
+    journal_entry_t entry;
+    assert(set_balance(70) == PN532_ERROR_NONE);
+    fake_pn532_place_card(uid, uid_len);
+    mifare_value_block(fake_pn532_card_block(6), 50, 6);
+    assert(get_balance(&balance) == PN532_ERROR_NONE && balance == 50);
+    assert(set_balance(70) == PN532_ERROR_NONE);
+    fake_pn532_place_card(uid, uid_len);
+    mifare_value_block(fake_pn532_card_block(6), 50, 6);
+    assert(set_balance(70) == PN532_ERROR_NONE);
+    assert(mifare_parse_value_block(fake_pn532_card_block(6), &value) && value == 70);
+    fake_pn532_place_card(uid, uid_len);
+    mifare_value_block(fake_pn532_card_block(6), 50, 6);
+    assert(update_balance(-10, &balance, NULL) == PN532_ERROR_NONE && balance == 40);
+    assert(mifare_parse_value_block(fake_pn532_card_block(6), &value) && value == 40);
+    assert(journal_get(0, &entry) && entry.old_balance == 50 && entry.new_balance == 40);
+    nfc_print_cache_stats();
+}
+
+/**
+ * @fn test_sector_keys
+ * ---------------------
+ * @description: sectors locked with keys from the key table: the first authentication
+ * tries keys and re-selects the card after each refusal, later ones go straight to the
+ * key that worked
+ */
+static void test_sector_keys(void)
+{
+    const uint8_t key_a[] = {0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5};
+    const uint8_t key_b[] = {0xB0, 0xB1, 0xB2, 0xB3, 0xB4, 0xB5};
+    uint8_t uid[MIFARE_UID_MAX_LENGTH], data[3 * 16];
+    int balance = 0;
+
+    setup(&PN532_TIMING_FAST);
+    assert(set_balance(80) == PN532_ERROR_NONE);
+    memcpy(fake_pn532_card_block(7), key_a, 6);
+    memcpy(fake_pn532_card_block(11), key_a, 6);
+    memcpy(fake_pn532_card_block(11) + 10, key_b, 6);
+    nfc_cache_invalidate(NULL, 0);
+
+    // Only the transport key: the card refuses it and stays usable.
+    assert(get_balance(&balance) == 0x14); // authentication error
+    assert(nfc_add_key(MIFARE_CMD_AUTH_A, key_a, 1 << 1) == PN532_STATUS_OK);
+    assert(nfc_add_key(MIFARE_CMD_AUTH_B, key_b, 1 << 2) == PN532_STATUS_OK);
+    assert(nfc_add_key(0x30, key_b, NFC_KEY_ALL_SECTORS) == PN532_STATUS_ERROR);
+
+    nfc_reset_cache_stats();
+    fake_pn532_reset_counters();
+    assert(get_balance(&balance) == PN532_ERROR_NONE && balance == 80);
+    int uid_len = nfc_detect_card(uid, 1000);
+    assert(read_blocks(data, uid, uid_len, 8, 3, false) == PN532_ERROR_NONE);
+    unsigned int first = fake_pn532_counters.command_counts[PN532_COMMAND_INDATAEXCHANGE];
+    assert(nfc_get_cache_stats()->key_misses == 2 && nfc_get_cache_stats()->key_hits == 0);
+
+    nfc_cache_invalidate(uid, uid_len);
+    fake_pn532_reset_counters();
+    assert(get_balance(&balance) == PN532_ERROR_NONE && balance == 80);
+    assert(read_blocks(data, uid, uid_len, 8, 3, false) == PN532_ERROR_NONE);
+    unsigned int again = fake_pn532_counters.command_counts[PN532_COMMAND_INDATAEXCHANGE];
+    printf("locked sectors: %u exchanges with key trials, %u with remembered keys\n", first, again);
+    assert(nfc_get_cache_stats()->key_misses == 2 && nfc_get_cache_stats()->key_hits == 2);
+    assert(again == first - 2 && again == 6);
+
+    // A key changed on the card is found again from the table.
+    memcpy(fake_pn532_card_block(7), (const uint8_t[]){0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}, 6);
+    nfc_cache_invalidate(uid, uid_len);
+    assert(get_balance(&balance) == PN532_ERROR_NONE && balance == 80);
+    assert(nfc_get_cache_stats()->key_misses == 3);
+    nfc_print_cache_stats();
+}
+
+/**
+ * @fn test_provision
+ * ---------------------
+ * @description: provisioning a fresh card to a template, a card that already matches it,
+ * and noticing the card leave the field
+ */
+static void test_provision(void)
+{
+    nfc_provision_template_t tmpl = NFC_PROVISION_DEFAULT;
+    const uint8_t key_a[] = {0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5};
+    const uint8_t access_bits[] = {0x08, 0x77, 0x8F, 0x00};
+    uint8_t uid[MIFARE_UID_MAX_LENGTH];
+    unsigned int written = 0;
+    int32_t value;
+
+    setup(&PN532_TIMING_FAST);
+    tmpl.balance = 500;
+    tmpl.backup_block = 5;
+    tmpl.set_trailers = true;
+    memcpy(tmpl.key_a, key_a, sizeof(key_a));
+    memcpy(tmpl.access_bits, access_bits, sizeof(access_bits));
+
+    int uid_len = nfc_detect_card(uid, 1000);
+    unsigned int start = fake_pi_now();
+    assert(nfc_provision_card(&tmpl, uid, uid_len, &written) == PN532_ERROR_NONE && written == 3);
+    unsigned int fresh_us = fake_pi_now() - start;
+    assert(mifare_parse_value_block(fake_pn532_card_block(6), &value) && value == 500);
+    assert(memcmp(fake_pn532_card_block(5), fake_pn532_card_block(6), 16) == 0);
+    assert(memcmp(fake_pn532_card_block(7), key_a, 6) == 0);
+    assert(memcmp(fake_pn532_card_block(7) + 6, access_bits, 4) == 0);
+
+    // Provisioned already: nothing to write, and the new key A opens the sector first time.
+    nfc_cache_invalidate(uid, uid_len);
+    nfc_reset_cache_stats();
+    start = fake_pi_now();
+    assert(nfc_provision_card(&tmpl, uid, uid_len, &written) == PN532_ERROR_NONE && written == 0);
+    unsigned int again_us = fake_pi_now() - start;
+    assert(nfc_get_cache_stats()->key_misses == 0 && nfc_get_cache_stats()->write_backs == 0);
+    printf("provision: fresh card %u us, provisioned card %u us\n", fresh_us, again_us);
+
+    // The card stays, then leaves.
+    assert(nfc_wait_removal(uid, uid_len, 100) == PN532_STATUS_ERROR);
+    fake_pn532_remove_card();
+    start = fake_pi_now();
+    assert(nfc_wait_removal(uid, uid_len, 0) == PN532_STATUS_OK);
+    printf("removal noticed after %u us\n", fake_pi_now() - start);
+    assert(fake_pi_now() - start <= 3000 * NFC_PRESENCE_TIMEOUT);
+
+    tmpl.backup_block = 7;
+    assert(nfc_provision_card(&tmpl, uid, uid_len, NULL) == PN532_STATUS_ERROR);
+}
+
+/**
+ * @fn test_dump_records
+ * ---------------------
+ * @description: a card streamed as dump records and decoded back, with console text in
+ * front and a damaged record skipped
+ */
+static void test_dump_records(void)
+{
+    static uint8_t stream[64 + 65 * NFC_DUMP_RECORD_MAX_LENGTH];
+    static uint8_t blocks[64 * 16];
+    const char *text = "Please hold your card on the scanner until the scan is complete!\n";
+    nfc_dump_record_t record;
+    uint8_t uid[MIFARE_UID_MAX_LENGTH];
+
+    setup(&PN532_TIMING_FAST);
+    int uid_len = nfc_detect_card(record.uid, 1000);
+    memcpy(uid, record.uid, uid_len);
+    record.uid_length = uid_len;
+    size_t length = strlen(text);
+    memcpy(stream, text, length);
+    for (size_t sector = 0; sector < 16; sector++)
+    {
+        record.status = read_blocks(blocks + 64 * sector, uid, uid_len, 4 * sector, 4, false);
+        for (size_t i = 0; i < 4; i++)
+        {
+            record.block = 4 * sector + i;
+            memcpy(record.data, blocks + 64 * sector + 16 * i, 16);
+            length += nfc_dump_encode(&record, stream + length);
+        }
+    }
+    record.block = NFC_DUMP_END_BLOCK;
+    length += nfc_dump_encode(&record, stream + length);
+    size_t record_length = 6 + uid_len + 16;
+    assert(length == strlen(text) + 65 * record_length);
+    printf("dump stream: %u bytes for a 1K card\n", (unsigned int)(length - strlen(text)));
+
+    // Block 9's record is damaged; the rest decode.
+    stream[strlen(text) + 9 * record_length + 10] ^= 0x01;
+    uint8_t decoded[64 * 16];
+    size_t position = 0, records = 0, skipped = 0;
+    memset(decoded, 0, sizeof(decoded));
+    while (position < length)
+    {
+        int taken = nfc_dump_decode(stream + position, length - position, &record);
+        assert(taken != 0);
+        if (taken == NFC_DUMP_BAD)
+        {
+            position++;
+            skipped++;
+            continue;
+        }
+        position += taken;
+        records++;
+        assert(record.uid_length == uid_len && memcmp(record.uid, uid, uid_len) == 0);
+        if (record.block != NFC_DUMP_END_BLOCK)
+            memcpy(decoded + 16 * record.block, record.data, 16);
+    }
+    assert(records == 64 && skipped == strlen(text) + record_length);
+    memcpy(decoded + 16 * 9, blocks + 16 * 9, 16);
+    assert(memcmp(decoded, blocks, sizeof(blocks)) == 0);
+    assert(nfc_dump_decode(stream + strlen(text), record_length - 1, &record) == 0);
+}
+
+/**
+ * @fn test_console
+ * ---------------------
+ * @description: a whole card printed as a table through the interrupt-drained ring
+ * buffer at 115200 baud: queued at once, then sent byte for byte as the old per-byte
+ * printing would have, and a write larger than the buffer waiting for room
+ */
+static void test_console(void)
+{
+    static uint8_t card[64 * 16];
+    static char expected[8192];
+    static uint8_t big[CONSOLE_TX_BUFFER_SIZE + 1000];
+    size_t length = 0, captured;
+
+    for (size_t i = 0; i < sizeof(card); i++)
+        card[i] = i * 7;
+    // What print_blocks sent with a printf per byte, with the UART's "\r\n".
+    length += sprintf(expected + length, "\r\n     ");
+    for (int i = 0; i < 16; i++)
+        length += sprintf(expected + length, i > 9 ? "%d " : " %d ", i);
+    for (int i = 0; i < sizeof(card); i++)
+    {
+        if (i % 16 == 0)
+            length += sprintf(expected + length, "\r\n%02d : ", i / 16);
+        length += sprintf(expected + length, "%02x ", card[i]);
+    }
+    length += sprintf(expected + length, "\r\n");
+
+    fake_uart_set_us_per_byte(CONSOLE_BYTE_US);
+    console_init();
+    fake_uart_clear_output();
+    unsigned int start = fake_pi_now();
+    console_print_table(card, sizeof(card), 0, 1);
+    unsigned int queued_us = fake_pi_now() - start;
+    assert(console_pending() > 0);
+    console_flush();
+    unsigned int sent_us = fake_pi_now() - start;
+    printf("\n1K table: %u bytes queued in %u us, on the line for %u us\n", (unsigned int)length, queued_us, sent_us);
+    const char *output = fake_uart_output(&captured);
+    assert(captured == length && memcmp(output, expected, length) == 0);
+    assert(queued_us < 1000 && sent_us >= (length - 8) * CONSOLE_BYTE_US);
+
+    fake_uart_clear_output();
+    for (size_t i = 0; i < sizeof(big); i++)
+        big[i] = 'a' + i % 26;
+    console_write(big, sizeof(big));
+    console_printf("%s %d\n", "done", 42);
+    console_flush();
+    output = fake_uart_output(&captured);
+    assert(captured == sizeof(big) + 9);
+    assert(memcmp(output, big, sizeof(big)) == 0 && memcmp(output + sizeof(big), "done 42\r\n", 9) == 0);
+
+    char line[32];
+    assert(format_decimal(line, 7, 3, '0') == 3 && strcmp(line, "007") == 0);
+    assert(format_decimal(line, 12345, 2, ' ') == 5 && strcmp(line, "12345") == 0);
+    assert(format_hex_bytes(line, (const uint8_t[]){0x0A, 0xFF}, 2) == 6 && strcmp(line, "0a ff ") == 0);
+    uint8_t parsed[3];
+    assert(parse_hex_bytes("0a FF", parsed, 3) == 2 && parsed[0] == 0x0A && parsed[1] == 0xFF);
+    assert(parse_hex_bytes("0a:ff:01", parsed, 3) == 3 && parsed[2] == 0x01);
+    assert(parse_hex_bytes("0aff010", parsed, 3) < 0 && parse_hex_bytes("0aff0102", parsed, 3) < 0);
+    fake_uart_set_us_per_byte(0);
+}
+
+/**
+ * @fn test_journal
+ * ---------------------
+ * @description: taps append to the RAM journal without touching the device or adding a
+ * round trip; one commit writes them a block at a time into a file-backed device that
+ * wraps around, and a journal reattached to the file carries on after its newest record
+ */
+static void test_journal(void)
+{
+    const char *path = "build/host/journal.bin";
+    const uint8_t uid[] = {0xDE, 0xAD, 0xBE, 0xEF};
+    const size_t per_block = 512 / JOURNAL_RECORD_LENGTH;
+    uint8_t block[512];
+    journal_file_t file;
+    journal_entry_t entry;
+    int balance = 0;
+    unsigned int round_trips = 0;
+
+    setup(&PN532_TIMING_FAST);
+    assert(set_balance(100) == PN532_ERROR_NONE);
+    journal_reset();
+    remove(path);
+    assert(journal_file_open(&file, path, 512, 2) == 0);
+    assert(journal_attach(&file.device) == 0);
+
+    // 30 taps overrun the 2-block device, so its first block ends up rewritten.
+    unsigned int start = fake_pi_now();
+    for (int i = 0; i < 30; i++)
+    {
+        assert(update_balance(i % 2 ? 5 : -3, &balance, &round_trips) == PN532_ERROR_NONE);
+        assert(round_trips == 6);
+    }
+    printf("30 taps in %u us, %d entries pending\n", fake_pi_now() - start, (int)journal_pending());
+    assert(journal_pending() == 30 && journal_get_stats()->block_writes == 0);
+    assert(journal_get(0, &entry) && entry.sequence == 29 && entry.new_balance == balance);
+    assert(entry.old_balance == balance - 5 && entry.amount == 5 && memcmp(entry.uid, uid, 4) == 0);
+
+    assert(journal_commit() == 0);
+    assert(journal_pending() == 0 && journal_get_stats()->block_writes == 3 && journal_get_stats()->committed == 30);
+    FILE *f = fopen(path, "rb");
+    assert(f && fread(block, 1, sizeof(block), f) == sizeof(block));
+    for (size_t slot = 0; slot < per_block; slot++)
+    {
+        bool valid = journal_decode(block + slot * JOURNAL_RECORD_LENGTH, &entry);
+        assert(valid == (slot < 6));
+        assert(!valid || (entry.sequence == 24 + slot && entry.new_balance - entry.old_balance == entry.amount));
+    }
+    assert(fread(block, 1, sizeof(block), f) == sizeof(block));
+    assert(journal_decode(block, &entry) && entry.sequence == 12 && entry.uid_length == 4);
+    fclose(f);
+
+    // Balances are journaled as read from the card, whether or not the caller wants one.
+    int32_t value;
+    assert(update_balance(-1, NULL, NULL) == PN532_ERROR_NONE);
+    assert(mifare_parse_value_block(fake_pn532_card_block(6), &value) && value == balance - 1);
+    assert(journal_get(0, &entry) && entry.old_balance == balance && entry.new_balance == value && entry.amount == -1);
+    balance = value;
+    assert(journal_commit() == 0 && journal_get_stats()->block_writes == 4);
+
+    // After a restart the log goes on from the newest record on the device.
+    journal_attach(NULL);
+    journal_file_close(&file);
+    journal_reset();
+    assert(journal_file_open(&file, path, 512, 2) == 0);
+    assert(journal_attach(&file.device) == 0);
+    assert(update_balance(2, &balance, NULL) == PN532_ERROR_NONE);
+    assert(journal_commit() == 0);
+    f = fopen(path, "rb");
+    assert(f && fread(block, 1, sizeof(block), f) == sizeof(block));
+    fclose(f);
+    assert(journal_decode(block + 7 * JOURNAL_RECORD_LENGTH, &entry) && entry.sequence == 31 && entry.new_balance == balance);
+    journal_print(3);
+
+    journal_attach(NULL);
+    journal_file_close(&file);
+    journal_reset();
+    remove(path);
+}
+
+/**
+ * @fn test_accounts
+ * ---------------------
+ * @description: a full table of UIDs of all three lengths found in a couple of probes,
+ * iterated in full and refusing duplicates and overflow; pay against a local account
+ * reads only the UID and leaves the card's blocks alone
+ */
+static void test_accounts(void)
+{
+    const uint8_t card_uid[] = {0xDE, 0xAD, 0xBE, 0xEF};
+    uint8_t uid[ACCOUNTS_UID_MAX_LENGTH], block[16];
+    const size_t lengths[] = {4, 7, 10};
+    uint32_t seed = 1;
+    int balance = 0;
+    int32_t value;
+    unsigned int round_trips = 0;
+
+    accounts_clear();
+    for (int i = 0; i < ACCOUNTS_MAX; i++)
+    {
+        // Distinct UIDs: the index in the first bytes, pseudo-random bytes after it.
+        uid[0] = i;
+        uid[1] = i >> 8;
+        for (size_t b = 2; b < sizeof(uid); b++)
+        {
+            seed = seed * 1103515245 + 12345;
+            uid[b] = seed >> 16;
+        }
+        assert(accounts_add(uid, lengths[i % 3], i) != NULL);
+    }
+    assert(accounts_count() == ACCOUNTS_MAX && accounts_add(card_uid, 4, 0) == NULL);
+
+    size_t position = 0, seen = 0;
+    int64_t total = 0;
+    for (const account_t *account = accounts_next(&position); account; account = accounts_next(&position))
+    {
+        assert(accounts_find(account->uid, account->uid_length) == account);
+        seen++;
+        total += account->balance;
+    }
+    assert(seen == ACCOUNTS_MAX && total == (int64_t)ACCOUNTS_MAX * (ACCOUNTS_MAX - 1) / 2);
+    // The last UID went in with 7 bytes; its 4-byte prefix is another card.
+    assert(accounts_find(uid, 7) != NULL && accounts_find(uid, 4) == NULL);
+    assert(accounts_add(uid, 10, 0) == NULL && accounts_add(uid, 5, 0) == NULL);
+    const accounts_stats_t *stats = accounts_get_stats();
+    printf("%d accounts: %u.%02u probes per lookup, at most %u\n", ACCOUNTS_MAX, stats->probes / stats->lookups,
+           100 * (stats->probes % stats->lookups) / stats->lookups, stats->max_displacement + 1);
+    assert(stats->probes < 2 * stats->lookups && stats->max_displacement < 64);
+    assert(accounts_update(uid, 7, -5, &value) && value == ACCOUNTS_MAX - 1 - 5);
+    assert(accounts_set(uid, 7, 12, &value) && value == ACCOUNTS_MAX - 1 - 5);
+    assert(accounts_find(uid, 7)->balance == 12 && !accounts_set(uid, 4, 12, &value));
+
+    setup(&PN532_TIMING_FAST);
+    assert(set_balance(100) == PN532_ERROR_NONE);
+    memcpy(block, fake_pn532_card_block(6), sizeof(block));
+    accounts_clear();
+    assert(update_account_balance(-30, &balance, NULL) == NFC_ERROR_NO_ACCOUNT);
+    assert(accounts_add(card_uid, 4, 500) != NULL);
+    unsigned int exchanges = fake_pn532_counters.command_counts[PN532_COMMAND_INDATAEXCHANGE];
+    assert(update_account_balance(-30, &balance, &round_trips) == PN532_ERROR_NONE && balance == 470);
+    assert(update_account_balance(5, &balance, NULL) == PN532_ERROR_NONE && balance == 475);
+    printf("local pay: %u round trips\n", round_trips);
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_INDATAEXCHANGE] == exchanges);
+    assert(memcmp(block, fake_pn532_card_block(6), sizeof(block)) == 0);
+    accounts_clear();
+}
+
+/**
+ * @fn make_uid
+ * ---------------------
+ * @description: the index-th of a set of distinct 7-byte UIDs: the index in the first
+ * bytes, the set number and pseudo-random bytes after it
+ */
+static void make_uid(uint8_t *uid, uint32_t index, uint8_t set)
+{
+    uint32_t seed = index * 2654435761u + set;
+    uid[0] = index;
+    uid[1] = index >> 8;
+    uid[2] = index >> 16;
+    uid[3] = set;
+    for (int b = 4; b < 7; b++)
+    {
+        seed = seed * 1103515245 + 12345;
+        uid[b] = seed >> 16;
+    }
+}
+
+/**
+ * @fn test_deny_list
+ * ---------------------
+ * @description: 100k revoked UIDs all found and 100k others let through, about 1% of
+ * them needing the exact set, each check taking well under a microsecond of host time;
+ * a revoked card is refused before any block is read, and journaled
+ */
+static void test_deny_list(void)
+{
+    const int revoked = 100000;
+    const uint8_t card_uid[] = {0xDE, 0xAD, 0xBE, 0xEF};
+    uint8_t uid[DENYLIST_UID_MAX_LENGTH];
+    size_t uid_length;
+    int balance = 0;
+    journal_entry_t entry;
+
+    denylist_clear();
+    for (int i = 0; i < revoked; i++)
+    {
+        make_uid(uid, i, 0);
+        assert(denylist_add(uid, 7));
+    }
+    assert(denylist_add(uid, 7) && denylist_count() == revoked);
+
+    clock_t start = clock();
+    int found = 0;
+    for (int i = 0; i < revoked; i++)
+    {
+        make_uid(uid, i, 0);
+        found += denylist_contains(uid, 7);
+        make_uid(uid, i, 1);
+        found += denylist_contains(uid, 7);
+    }
+    double ns = 1e9 * (clock() - start) / CLOCKS_PER_SEC / (2 * revoked);
+    const denylist_stats_t *stats = denylist_get_stats();
+    unsigned int false_passes = stats->filter_passes - revoked;
+    printf("%d checks against %d UIDs: %.0f ns each, %u false filter passes (%.2f%%)\n", 2 * revoked, revoked, ns,
+           false_passes, 100.0 * false_passes / revoked);
+    assert(found == revoked && stats->hits == revoked);
+    assert(false_passes < revoked / 50 && ns < 2000);
+
+    assert(denylist_parse_uid("de:ad:be:ef", uid, &uid_length) && uid_length == 4 && memcmp(uid, card_uid, 4) == 0);
+    assert(denylist_parse_uid("04 A2 2B 6A 3C 5D 80", uid, &uid_length) && uid_length == 7 && uid[6] == 0x80);
+    assert(!denylist_parse_uid("deadbee", uid, &uid_length) && !denylist_parse_uid("deadbeefxx", uid, &uid_length));
+    assert(!denylist_parse_uid("0102030405", uid, &uid_length) && !denylist_add(uid, 5));
+
+    // A revoked card is refused on the card and in the account table.
+    setup(&PN532_TIMING_FAST);
+    assert(set_balance(100) == PN532_ERROR_NONE);
+    journal_reset();
+    accounts_clear();
+    assert(accounts_add(card_uid, 4, 100) != NULL);
+    assert(denylist_add(card_uid, 4));
+    nfc_cache_invalidate(NULL, 0);
+    unsigned int exchanges = fake_pn532_counters.command_counts[PN532_COMMAND_INDATAEXCHANGE];
+    assert(update_balance(-30, &balance, NULL) == NFC_ERROR_REVOKED);
+    assert(get_balance(&balance) == NFC_ERROR_REVOKED);
+    assert(update_account_balance(-30, &balance, NULL) == NFC_ERROR_REVOKED);
+    assert(fake_pn532_counters.command_counts[PN532_COMMAND_INDATAEXCHANGE] == exchanges);
+    assert(accounts_find(card_uid, 4)->balance == 100);
+    assert(journal_get(0, &entry) && entry.status == NFC_ERROR_REVOKED && entry.amount == -30);
+    assert(journal_get(1, &entry) && entry.status == NFC_ERROR_REVOKED && journal_get_stats()->appended == 2);
+
+    denylist_clear();
+    assert(update_balance(-30, &balance, NULL) == PN532_ERROR_NONE);
+    assert(get_balance(&balance) == PN532_ERROR_NONE && balance == 70);
+    accounts_clear();
+    journal_reset();
+}
+
+/**
+ * @fn test_balance_roundtrip
+ * ---------------------
+ * @description: set_balance followed by get_balance against the simulated card
+ */
+static void test_balance_roundtrip(void)
+{
+    int balance = 0;
+
+    setup(&PN532_TIMING_FAST);
+    assert(set_balance(1234) == PN532_ERROR_NONE);
+    assert(get_balance(&balance) == PN532_ERROR_NONE);
+    assert(balance == 1234);
+    assert(fake_pn532_card_block(6)[0] == (1234 & 0xFF));
+}
+
+int main(void)
+{
+    printf("--------------- Bring-up ------------------------\n");
+    test_bring_up();
+    printf("------------- Timing Profile Test ---------------\n");
+    test_timing_profiles();
+    printf("--------------- IRQ Ready Wait ------------------\n");
+    test_irq_ready();
+    printf("--------------- Prebuilt Frames -----------------\n");
+    test_prebuilt_frames();
+    printf("--------------- Frame Decoder -------------------\n");
+    test_frame_decoder();
+    printf("--------------- Bulk Block I/O ------------------\n");
+    test_bulk_blocks();
+    printf("--------------- Autopoll Detection --------------\n");
+    test_autopoll_detection();
+    printf("--------------- Multiple Targets ----------------\n");
+    test_multi_target();
+    printf("--------------- RF Tuning -----------------------\n");
+    test_rf_tuning();
+    printf("--------------- Bit Rates -----------------------\n");
+    test_bit_rates();
+    printf("--------------- Extended Frames -----------------\n");
+    test_extended_frames();
+    printf("--------------- NTAG ----------------------------\n");
+    test_ntag();
+    printf("--------------- NFC-DEP -------------------------\n");
+    test_nfc_dep();
+    printf("--------------- Link Recovery -------------------\n");
+    test_link_recovery();
+    printf("--------------- Reader State --------------------\n");
+    test_reader_state();
+    printf("--------------- Balance Transaction -------------\n");
+    test_balance_transaction();
+    printf("--------------- Block Cache ---------------------\n");
+    test_block_cache();
+    printf("--------------- Sector Keys ---------------------\n");
+    test_sector_keys();
+    printf("--------------- Provisioning --------------------\n");
+    test_provision();
+    printf("--------------- Dump Records --------------------\n");
+    test_dump_records();
+    printf("--------------- Console Output ------------------\n");
+    test_console();
+    printf("--------------- Transaction Journal -------------\n");
+    test_journal();
+    printf("--------------- Local Accounts ------------------\n");
+    test_accounts();
+    printf("--------------- Deny List -----------------------\n");
+    test_deny_list();
+    printf("--------------- Balance Round Trip --------------\n");
+    test_balance_roundtrip();
+    printf("-------------------------------------------------\n");
+    printf("All host tests passed.\n");
+    return 0;
+}
@@ -244,7 +244,7 @@ static int test_rw_mifare(void)
  */
 static void test_card_balance(void)
 {
-    int *value = 0;
+    int value = 0;
 
     printf("Begin by placing fob on the scanner until balance is set.\n");
     gpio_write(16, 1);
@@ -255,9 +255,9 @@ static void test_card_balance(void)
     timer_delay(3);
     printf("\nScan fob to show balance\n");
     gpio_write(16, 1);
-    assert(get_balance(value) == PN532_ERROR_NONE);
+    assert(get_balance(&value) == PN532_ERROR_NONE);
     gpio_write(16, 0);
-    printf("Current Balance: %d\n", *value);
+    printf("Current Balance: %d\n", value);
 
     timer_delay(3);
     printf("\nNow scan once more to deduct 25\n");
@@ -270,15 +270,15 @@ static void test_card_balance(void)
     timer_delay(3);
     printf("\nScan fob to show balance\n");
     gpio_write(16, 1);
-    assert(get_balance(value) == PN532_ERROR_NONE);
+    assert(get_balance(&value) == PN532_ERROR_NONE);
     gpio_write(16, 0);
-    printf("Current Balance: %d\n", *value);
+    printf("Current Balance: %d\n", value);
     printf("test_card_balance complete.\n");
 }
 
 void main(void)
 {
-    nfc_init(RESET_PIN, NSS_PIN);
+    nfc_init(RESET_PIN, NSS_PIN, &PN532_TIMING_CONSERVATIVE);
 
     gpio_init();
     gpio_set_output(16);
@@ -0,0 +1,166 @@
+/**
+ * @file dump_decode.c
+ * ---------------------
+ * @brief Host-side decoder of `dump --binary` streams (see nfc_dump.h). Reads the stream
+ * from a file or stdin, e.g. `build/host/dump_decode < /dev/ttyUSB0`, and prints each
+ * card as the table `read` prints. With -o it appends each card's 1024-byte image to a
+ * file instead. Console text around the records is skipped. Build with
+ * `make dump-decode`.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <nfc_dump.h>
+
+#define CARD_BLOCKS 64
+
+typedef struct
+{
+    uint8_t uid[NFC_DUMP_UID_MAX_LENGTH];
+    uint8_t uid_length;
+    uint8_t blocks[CARD_BLOCKS][NFC_DUMP_DATA_LENGTH];
+    uint8_t status[CARD_BLOCKS];
+    unsigned int received;
+} card_t;
+
+/**
+ * @fn print_card
+ * ---------------------
+ * @description: Prints a card as the shell's print_blocks does, then the blocks that did
+ * not read.
+ */
+static void print_card(const card_t *card)
+{
+    printf("UID:");
+    for (int i = 0; i < card->uid_length; i++)
+        printf(" %02x", card->uid[i]);
+    printf("\nBlocks 0-%d:\n", CARD_BLOCKS - 1);
+
+    printf("\n     ");
+    for (int i = 0; i < NFC_DUMP_DATA_LENGTH; i++)
+    {
+        if (i > 9)
+            printf("%d ", i);
+        else
+            printf(" %d ", i);
+    }
+    for (int block = 0; block < CARD_BLOCKS; block++)
+    {
+        printf("\n%02d : ", block);
+        for (int i = 0; i < NFC_DUMP_DATA_LENGTH; i++)
+            printf("%02x ", card->blocks[block][i]);
+    }
+    printf("\n");
+
+    for (int block = 0; block < CARD_BLOCKS; block++)
+    {
+        if (card->status[block] != 0)
+            printf("block %d: error 0x%02x\n", block, card->status[block]);
+    }
+}
+
+/**
+ * @fn take_record
+ * ---------------------
+ * @description: Adds a decoded record to the card being received. A record of another
+ * UID starts a new card; the end record hands the card on to print or save.
+ * @returns 1 if the card is complete, else 0.
+ */
+static int take_record(card_t *card, const nfc_dump_record_t *record)
+{
+    if (card->uid_length != record->uid_length || memcmp(card->uid, record->uid, record->uid_length) != 0)
+    {
+        memset(card, 0, sizeof(*card));
+        card->uid_length = record->uid_length;
+        memcpy(card->uid, record->uid, record->uid_length);
+    }
+    if (record->block == NFC_DUMP_END_BLOCK)
+        return 1;
+    if (record->block < CARD_BLOCKS)
+    {
+        memcpy(card->blocks[record->block], record->data, NFC_DUMP_DATA_LENGTH);
+        card->status[record->block] = record->status;
+        card->received++;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static uint8_t buf[4096];
+    static card_t card;
+    FILE *in = stdin, *image = NULL;
+    size_t length = 0;
+    unsigned int cards = 0, skipped = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            image = fopen(argv[++i], "ab");
+            if (!image)
+            {
+                perror(argv[i]);
+                return 1;
+            }
+        }
+        else if (in == stdin && argv[i][0] != '-')
+        {
+            in = fopen(argv[i], "rb");
+            if (!in)
+            {
+                perror(argv[i]);
+                return 1;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-o image-file] [stream-file]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    size_t got;
+    while ((got = fread(buf + length, 1, sizeof(buf) - length, in)) > 0)
+    {
+        length += got;
+        size_t position = 0;
+        while (position < length)
+        {
+            nfc_dump_record_t record;
+            int taken = nfc_dump_decode(buf + position, length - position, &record);
+            if (taken == 0)
+                break;
+            if (taken == NFC_DUMP_BAD)
+            {
+                position++;
+                skipped++;
+                continue;
+            }
+            position += taken;
+            if (!take_record(&card, &record))
+                continue;
+
+            cards++;
+            if (card.received != CARD_BLOCKS)
+                fprintf(stderr, "card %u: %u of %d blocks received\n", cards, card.received, CARD_BLOCKS);
+            if (image)
+            {
+                fwrite(card.blocks, 1, sizeof(card.blocks), image);
+                printf("card %u: saved, status 0x%02x\n", cards, record.status);
+            }
+            else
+            {
+                print_card(&card);
+            }
+            memset(&card, 0, sizeof(card));
+        }
+        memmove(buf, buf + position, length - position);
+        length -= position;
+    }
+
+    fprintf(stderr, "%u cards, %u bytes of console text or damaged records skipped\n", cards, skipped);
+    if (image)
+        fclose(image);
+    return 0;
+}
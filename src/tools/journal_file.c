@@ -0,0 +1,65 @@
+/**
+ * @file journal_file.c
+ * ---------------------
+ * @brief Implements journal_file.h
+ */
+
+#include <journal_file.h>
+
+static int file_read(void *context, size_t block, uint8_t *buf)
+{
+    journal_file_t *journal = context;
+    size_t size = journal->device.block_size;
+    if (fseek(journal->file, (long)(block * size), SEEK_SET) != 0 || fread(buf, 1, size, journal->file) != size)
+        return -1;
+    return 0;
+}
+
+static int file_write(void *context, size_t block, const uint8_t *buf)
+{
+    journal_file_t *journal = context;
+    size_t size = journal->device.block_size;
+    // Flushed at once: a committed block must not wait in the stdio buffer.
+    if (fseek(journal->file, (long)(block * size), SEEK_SET) != 0 || fwrite(buf, 1, size, journal->file) != size ||
+        fflush(journal->file) != 0)
+        return -1;
+    return 0;
+}
+
+int journal_file_open(journal_file_t *journal, const char *path, size_t block_size, size_t block_count)
+{
+    journal->file = fopen(path, "r+b");
+    if (!journal->file)
+        journal->file = fopen(path, "w+b");
+    if (!journal->file)
+    {
+        perror(path);
+        return -1;
+    }
+
+    if (fseek(journal->file, 0, SEEK_END) != 0)
+        return -1;
+    for (long length = ftell(journal->file); length < (long)(block_size * block_count); length++)
+    {
+        if (fputc(0, journal->file) == EOF)
+        {
+            perror(path);
+            return -1;
+        }
+    }
+    fflush(journal->file);
+
+    journal->device.block_size = block_size;
+    journal->device.block_count = block_count;
+    journal->device.read = file_read;
+    journal->device.write = file_write;
+    journal->device.context = journal;
+    return 0;
+}
+
+void journal_file_close(journal_file_t *journal)
+{
+    if (journal->file)
+        fclose(journal->file);
+    journal->file = NULL;
+}